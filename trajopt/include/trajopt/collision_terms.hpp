@@ -5,9 +5,27 @@
 #include <trajopt/common.hpp>
 #include <trajopt_sco/modeling.hpp>
 #include <trajopt_sco/sco_fwd.hpp>
+#include <unordered_map>
 
 namespace trajopt
 {
+/**
+ * @brief The information needed to evaluate the exact collision penalty of a contact pair.
+ *
+ * Unlike tesseract::ContactResult it carries no nearest points, normals or continuous
+ * collision data, only the signed distance and the pair's [dist_pen, coeff].
+ */
+struct ContactDistance
+{
+  double distance;
+  double safety_margin;
+  double coeff;
+};
+typedef std::vector<ContactDistance> ContactDistanceVector;
+
+/** @brief Indices of the joints moving each link of a manipulator, in increasing order */
+typedef std::unordered_map<std::string, std::vector<int>> LinkJointIndices;
+
 struct CollisionEvaluator
 {
   EIGEN_MAKE_ALIGNED_OPERATOR_NEW
@@ -22,20 +40,42 @@ struct CollisionEvaluator
   virtual void CalcDistExpressions(const DblVec& x, sco::AffExprVector& exprs) = 0;
   virtual void CalcDists(const DblVec& x, DblVec& exprs) = 0;
   virtual void CalcCollisions(const DblVec& x, tesseract::ContactResultVector& dist_results) = 0;
+  /**
+   * @brief Distance only collision query used when evaluating the exact merit.
+   *
+   * The contacts are found like in CalcCollisions, so the distances match the distance expressions at x, but the
+   * query threshold is the largest safety margin without the linearization padding. Pairs farther apart than their
+   * own safety margin are dropped, since they do not contribute to the penalty.
+   */
+  virtual void CalcContactDistances(const DblVec& x, ContactDistanceVector& dists) = 0;
   void GetCollisionsCached(const DblVec& x, tesseract::ContactResultVector&);
+  /** @brief The contact distances at x, reduced from the cached collisions when x was already convexified */
+  void GetContactDistancesCached(const DblVec& x, ContactDistanceVector& dists);
   virtual void Plot(const tesseract::BasicPlottingPtr plotter, const DblVec& x) = 0;
   virtual sco::VarVector GetVars() = 0;
 
   const SafetyMarginDataConstPtr getSafetyMarginData() const { return safety_margin_data_; }
+  /**
+   * @brief The joints moving each link of the manipulator, found on the first call
+   *
+   * The Jacobian columns of the other joints are structurally zero, so they are left out of the distance expressions.
+   */
+  const LinkJointIndices& GetLinkJointIndices();
   Cache<size_t, tesseract::ContactResultVector, 10> m_cache;
+  Cache<size_t, ContactDistanceVector, 10> m_dist_cache;
 
 protected:
+  /** @brief Keep the contacts within their pair's safety margin, dropping the linearization data */
+  void ContactResultsToDistances(const tesseract::ContactResultVector& dist_results,
+                                 ContactDistanceVector& dists) const;
+
   tesseract::BasicEnvConstPtr env_;
   tesseract::BasicKinConstPtr manip_;
   SafetyMarginDataConstPtr safety_margin_data_;
 
 private:
   CollisionEvaluator() {}
+  LinkJointIndices link_joint_indices_;
 };
 
 typedef std::shared_ptr<CollisionEvaluator> CollisionEvaluatorPtr;
@@ -60,11 +100,19 @@ public:
    */
   void CalcDists(const DblVec& x, DblVec& exprs) override;
   void CalcCollisions(const DblVec& x, tesseract::ContactResultVector& dist_results) override;
+  void CalcContactDistances(const DblVec& x, ContactDistanceVector& dists) override;
   void Plot(const tesseract::BasicPlottingPtr plotter, const DblVec& x) override;
   sco::VarVector GetVars() override { return m_vars; }
 private:
+  /** @brief Move the links to the state at x and return all contacts within the threshold of the manager */
+  void DiscreteContactTest(tesseract::DiscreteContactManagerBase& manager,
+                           const DblVec& x,
+                           tesseract::ContactResultVector& dist_results) const;
+
   sco::VarVector m_vars;
   tesseract::DiscreteContactManagerBasePtr contact_manager_;
+  /** @brief Contact manager used for distance only queries, its threshold is not padded */
+  tesseract::DiscreteContactManagerBasePtr dist_contact_manager_;
 };
 
 struct CastCollisionEvaluator : public CollisionEvaluator
@@ -74,16 +122,41 @@ public:
                          tesseract::BasicEnvConstPtr env,
                          SafetyMarginDataConstPtr safety_margin_data,
                          const sco::VarVector& vars0,
-                         const sco::VarVector& vars1);
+                         const sco::VarVector& vars1,
+                         double max_segment_length = 0);
   void CalcDistExpressions(const DblVec& x, sco::AffExprVector& exprs) override;
   void CalcDists(const DblVec& x, DblVec& exprs) override;
   void CalcCollisions(const DblVec& x, tesseract::ContactResultVector& dist_results) override;
+  void CalcContactDistances(const DblVec& x, ContactDistanceVector& dists) override;
   void Plot(const tesseract::BasicPlottingPtr plotter, const DblVec& x) override;
   sco::VarVector GetVars() override { return concat(m_vars0, m_vars1); }
+  /** @brief Number of sub-segments the segment at x is cast as */
+  int NumSegments(const DblVec& x) const;
+
 private:
+  /**
+   * @brief Cast the links from the state at vars0 to the state at vars1
+   *
+   * If the segment is subdivided every sub-segment is cast separately and the cc_time of the contacts is mapped back
+   * onto the whole segment. Each link pair then keeps only the contacts of the sub-segment where it is closest.
+   */
+  void CastContactTest(tesseract::ContinuousContactManagerBase& manager,
+                       const DblVec& x,
+                       tesseract::ContactResultVector& dist_results) const;
+
   sco::VarVector m_vars0;
   sco::VarVector m_vars1;
+  /**
+   * @brief Largest joint motion cast as a single hull, larger segments are split into equal sub-segments.
+   *
+   * This is a joint-space length: the largest change of any single joint value over the segment, in the joint units
+   * (radians or meters), not a cartesian distance. The hull of the start and end poses overestimates the swept volume
+   * of large motions. Zero disables subdivision.
+   */
+  double max_segment_length_;
   tesseract::ContinuousContactManagerBasePtr contact_manager_;
+  /** @brief Contact manager used for distance only queries, its threshold is not padded */
+  tesseract::ContinuousContactManagerBasePtr dist_contact_manager_;
 };
 
 class TRAJOPT_API CollisionCost : public sco::Cost, public Plotter
@@ -99,7 +172,8 @@ public:
                 tesseract::BasicEnvConstPtr env,
                 SafetyMarginDataConstPtr safety_margin_data,
                 const sco::VarVector& vars0,
-                const sco::VarVector& vars1);
+                const sco::VarVector& vars1,
+                double max_segment_length = 0);
   virtual sco::ConvexObjectivePtr convex(const DblVec& x, sco::Model* model) override;
   virtual double value(const DblVec&) override;
   void Plot(const tesseract::BasicPlottingPtr& plotter, const DblVec& x) override;
@@ -121,7 +195,8 @@ public:
                       tesseract::BasicEnvConstPtr env,
                       SafetyMarginDataConstPtr safety_margin_data,
                       const sco::VarVector& vars0,
-                      const sco::VarVector& vars1);
+                      const sco::VarVector& vars1,
+                      double max_segment_length = 0);
   virtual sco::ConvexConstraintsPtr convex(const DblVec& x, sco::Model* model) override;
   virtual DblVec value(const DblVec&) override;
   void Plot(const DblVec& x);
@@ -14,62 +14,112 @@ TRAJOPT_IGNORE_WARNINGS_POP
 namespace trajopt
 {
 /**
- * @brief Used to calculate the error for CartPoseTermInfo
- * This is converted to a cost or constraint using TrajOptCostFromErrFunc or TrajOptConstraintFromErrFunc
+ * @brief Common part of the Cartesian pose error calculators
+ *
+ * The error of a single state is computed by calcError into fixed size storage, so CartPoseJacCalculatorT can
+ * difference it without allocating.
  */
-struct DynamicCartPoseErrCalculator : public TrajOptVectorOfVector
+struct CartPoseErrCalculatorBase : public TrajOptVectorOfVector
 {
   EIGEN_MAKE_ALIGNED_OPERATOR_NEW
-  std::string target_;
+  typedef Eigen::Matrix<double, 6, 1> Vector6d;
   tesseract::BasicKinConstPtr manip_;
   tesseract::BasicEnvConstPtr env_;
   std::string link_;
   Eigen::Isometry3d tcp_;
+  CartPoseErrCalculatorBase(tesseract::BasicKinConstPtr manip,
+                            tesseract::BasicEnvConstPtr env,
+                            std::string link,
+                            Eigen::Isometry3d tcp)
+    : manip_(manip), env_(env), link_(link), tcp_(tcp)
+  {
+  }
+
+  /** @brief Pose error at dof_vals, rotation then position. change_base is the base link pose in state. */
+  virtual Vector6d calcError(const Eigen::Ref<const Eigen::VectorXd>& dof_vals,
+                             const tesseract::EnvState& state,
+                             const Eigen::Isometry3d& change_base) const = 0;
+
+  Eigen::VectorXd operator()(const Eigen::VectorXd& dof_vals) const override;
+  void evaluate(const Eigen::VectorXd& dof_vals, Eigen::VectorXd& out) const override;
+};
+typedef std::shared_ptr<const CartPoseErrCalculatorBase> CartPoseErrCalculatorBaseConstPtr;
+
+/**
+ * @brief Used to calculate the error for DynamicCartPoseTermInfo
+ * This is converted to a cost or constraint using TrajOptCostFromErrFunc or TrajOptConstraintFromErrFunc
+ */
+struct DynamicCartPoseErrCalculator : public CartPoseErrCalculatorBase
+{
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  std::string target_;
   DynamicCartPoseErrCalculator(const std::string& target,
                                tesseract::BasicKinConstPtr manip,
                                tesseract::BasicEnvConstPtr env,
                                std::string link,
                                Eigen::Isometry3d tcp = Eigen::Isometry3d::Identity())
-    : target_(target), manip_(manip), env_(env), link_(link), tcp_(tcp)
+    : CartPoseErrCalculatorBase(manip, env, link, tcp), target_(target)
   {
   }
 
   void Plot(const tesseract::BasicPlottingPtr& plotter, const Eigen::VectorXd& dof_vals) override;
 
-  Eigen::VectorXd operator()(const Eigen::VectorXd& dof_vals) const override;
+  Vector6d calcError(const Eigen::Ref<const Eigen::VectorXd>& dof_vals,
+                     const tesseract::EnvState& state,
+                     const Eigen::Isometry3d& change_base) const override;
 };
 
 /**
  * @brief Used to calculate the error for StaticCartPoseTermInfo
  * This is converted to a cost or constraint using TrajOptCostFromErrFunc or TrajOptConstraintFromErrFunc
  */
-struct CartPoseErrCalculator : public TrajOptVectorOfVector
+struct CartPoseErrCalculator : public CartPoseErrCalculatorBase
 {
   EIGEN_MAKE_ALIGNED_OPERATOR_NEW
   Eigen::Isometry3d pose_inv_;
-  tesseract::BasicKinConstPtr manip_;
-  tesseract::BasicEnvConstPtr env_;
-  std::string link_;
-  Eigen::Isometry3d tcp_;
   CartPoseErrCalculator(const Eigen::Isometry3d& pose,
                         tesseract::BasicKinConstPtr manip,
                         tesseract::BasicEnvConstPtr env,
                         std::string link,
                         Eigen::Isometry3d tcp = Eigen::Isometry3d::Identity())
-    : pose_inv_(pose.inverse()), manip_(manip), env_(env), link_(link), tcp_(tcp)
+    : CartPoseErrCalculatorBase(manip, env, link, tcp), pose_inv_(pose.inverse())
   {
   }
 
   void Plot(const tesseract::BasicPlottingPtr& plotter, const Eigen::VectorXd& dof_vals) override;
 
-  Eigen::VectorXd operator()(const Eigen::VectorXd& dof_vals) const override;
+  Vector6d calcError(const Eigen::Ref<const Eigen::VectorXd>& dof_vals,
+                     const tesseract::EnvState& state,
+                     const Eigen::Isometry3d& change_base) const override;
+};
+
+/**
+ * @brief Forward difference jacobian of a Cartesian pose error, for CartPoseTermInfo and DynamicCartPoseTermInfo
+ *
+ * Gives the same jacobian as the numerical one of CostFromErrFunc, but looks up the environment state once per call
+ * and keeps the perturbed joints and the 6xN jacobian in fixed size storage. N is the number of joints, or
+ * Eigen::Dynamic when it is not known at compile time.
+ */
+template <int N = Eigen::Dynamic>
+struct CartPoseJacCalculatorT : sco::MatrixOfVector
+{
+  CartPoseErrCalculatorBaseConstPtr f_;
+  double epsilon_;
+  CartPoseJacCalculatorT(CartPoseErrCalculatorBaseConstPtr f, double epsilon = 1e-5) : f_(f), epsilon_(epsilon) {}
+
+  Eigen::MatrixXd operator()(const Eigen::VectorXd& dof_vals) const override;
+  void evaluate(const Eigen::VectorXd& dof_vals, Eigen::MatrixXd& out) const override;
 };
+typedef CartPoseJacCalculatorT<> CartPoseJacCalculator;
 
 /**
  * @brief Used to calculate the jacobian for CartVelTermInfo
  *
+ * N is the number of joints. When it is known at compile time the per-waypoint jacobians are fixed size, otherwise
+ * use Eigen::Dynamic.
  */
-struct CartVelJacCalculator : sco::MatrixOfVector
+template <int N = Eigen::Dynamic>
+struct CartVelJacCalculatorT : sco::MatrixOfVector
 {
   EIGEN_MAKE_ALIGNED_OPERATOR_NEW
   tesseract::BasicKinConstPtr manip_;
@@ -77,23 +127,28 @@ struct CartVelJacCalculator : sco::MatrixOfVector
   std::string link_;
   double limit_;
   Eigen::Isometry3d tcp_;
-  CartVelJacCalculator(tesseract::BasicKinConstPtr manip,
-                       tesseract::BasicEnvConstPtr env,
-                       std::string link,
-                       double limit,
-                       Eigen::Isometry3d tcp = Eigen::Isometry3d::Identity())
+  CartVelJacCalculatorT(tesseract::BasicKinConstPtr manip,
+                        tesseract::BasicEnvConstPtr env,
+                        std::string link,
+                        double limit,
+                        Eigen::Isometry3d tcp = Eigen::Isometry3d::Identity())
     : manip_(manip), env_(env), link_(link), limit_(limit), tcp_(tcp)
   {
   }
 
   Eigen::MatrixXd operator()(const Eigen::VectorXd& dof_vals) const override;
+  void evaluate(const Eigen::VectorXd& dof_vals, Eigen::MatrixXd& out) const override;
 };
+typedef CartVelJacCalculatorT<> CartVelJacCalculator;
 
 /**
  * @brief  Used to calculate the error for CartVelTermInfo
  * This is converted to a cost or constraint using TrajOptCostFromErrFunc or TrajOptConstraintFromErrFunc
+ *
+ * N is the number of joints, see CartVelJacCalculatorT
  */
-struct CartVelErrCalculator : sco::VectorOfVector
+template <int N = Eigen::Dynamic>
+struct CartVelErrCalculatorT : sco::VectorOfVector
 {
   EIGEN_MAKE_ALIGNED_OPERATOR_NEW
   tesseract::BasicKinConstPtr manip_;
@@ -101,17 +156,55 @@ struct CartVelErrCalculator : sco::VectorOfVector
   std::string link_;
   double limit_;
   Eigen::Isometry3d tcp_;
-  CartVelErrCalculator(tesseract::BasicKinConstPtr manip,
-                       tesseract::BasicEnvConstPtr env,
-                       std::string link,
-                       double limit,
-                       Eigen::Isometry3d tcp = Eigen::Isometry3d::Identity())
+  CartVelErrCalculatorT(tesseract::BasicKinConstPtr manip,
+                        tesseract::BasicEnvConstPtr env,
+                        std::string link,
+                        double limit,
+                        Eigen::Isometry3d tcp = Eigen::Isometry3d::Identity())
     : manip_(manip), env_(env), link_(link), limit_(limit), tcp_(tcp)
   {
   }
 
   Eigen::VectorXd operator()(const Eigen::VectorXd& dof_vals) const override;
+  void evaluate(const Eigen::VectorXd& dof_vals, Eigen::VectorXd& out) const override;
 };
+typedef CartVelErrCalculatorT<> CartVelErrCalculator;
+
+// Specializations for the common robot sizes are compiled in kinematic_terms.cpp
+extern template struct CartPoseJacCalculatorT<6>;
+extern template struct CartPoseJacCalculatorT<7>;
+extern template struct CartPoseJacCalculatorT<8>;
+extern template struct CartPoseJacCalculatorT<Eigen::Dynamic>;
+extern template struct CartVelJacCalculatorT<6>;
+extern template struct CartVelJacCalculatorT<7>;
+extern template struct CartVelJacCalculatorT<8>;
+extern template struct CartVelJacCalculatorT<Eigen::Dynamic>;
+extern template struct CartVelErrCalculatorT<6>;
+extern template struct CartVelErrCalculatorT<7>;
+extern template struct CartVelErrCalculatorT<8>;
+extern template struct CartVelErrCalculatorT<Eigen::Dynamic>;
+
+/**
+ * @brief Create a calculator specialized for the number of joints
+ *
+ * Dispatches to the fixed size specializations compiled in kinematic_terms.cpp and falls back to Eigen::Dynamic for
+ * any other size.
+ */
+template <typename Base, template <int> class Calculator, typename... Args>
+std::shared_ptr<Base> createFixedDofCalculator(long n_dof, Args&&... args)
+{
+  switch (n_dof)
+  {
+    case 6:
+      return std::shared_ptr<Base>(new Calculator<6>(std::forward<Args>(args)...));
+    case 7:
+      return std::shared_ptr<Base>(new Calculator<7>(std::forward<Args>(args)...));
+    case 8:
+      return std::shared_ptr<Base>(new Calculator<8>(std::forward<Args>(args)...));
+    default:
+      return std::shared_ptr<Base>(new Calculator<Eigen::Dynamic>(std::forward<Args>(args)...));
+  }
+}
 
 struct JointVelErrCalculator : sco::VectorOfVector
 {
@@ -181,4 +274,88 @@ struct TimeCostJacCalculator : sco::MatrixOfVector
   Eigen::MatrixXd operator()(const Eigen::VectorXd& var_vals) const;
 };
 
+/**
+ * @brief Evaluates the pose errors of a whole tool path in one pass
+ *
+ * Each waypoint error is ordered like CartPoseErrCalculator (rotation then position) and weighted by the coefficients.
+ * Errors within the per-axis tolerances are zero. Rotation tolerances are angles in radians, converted to the
+ * sin(angle / 2) units of the quaternion vector error. Jacobians are computed analytically from the manipulator
+ * jacobian, so each waypoint takes one forward kinematics and one jacobian call.
+ */
+class CartesianPathEvaluator
+{
+public:
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  CartesianPathEvaluator(const tesseract::VectorIsometry3d& poses,
+                         const std::vector<sco::VarVector>& vars,
+                         const Eigen::Vector3d& pos_coeffs,
+                         const Eigen::Vector3d& rot_coeffs,
+                         const Eigen::Vector3d& pos_tolerances,
+                         const Eigen::Vector3d& rot_tolerances,
+                         tesseract::BasicKinConstPtr manip,
+                         tesseract::BasicEnvConstPtr env,
+                         std::string link,
+                         Eigen::Isometry3d tcp = Eigen::Isometry3d::Identity());
+
+  /** @brief Weighted errors of all waypoints, 6 per waypoint */
+  Eigen::VectorXd calcErrors(const DblVec& x) const;
+
+  /** @brief Weighted errors linearized at x. Rows with a zero coefficient are skipped. */
+  std::vector<sco::AffExpr> calcLinearizedErrors(const DblVec& x) const;
+
+  sco::VarVector getVars() const;
+
+private:
+  typedef Eigen::Matrix<double, 6, 1> Vector6d;
+  typedef Eigen::Matrix<double, 6, Eigen::Dynamic> Jacobian;
+
+  /** @brief Weighted, dead banded error of waypoint i, and its jacobian if jac is not null */
+  void calcWaypointError(size_t i,
+                         const Eigen::VectorXd& dof_vals,
+                         const tesseract::EnvState& state,
+                         const Eigen::Isometry3d& change_base,
+                         Vector6d& err,
+                         Jacobian* jac) const;
+
+  tesseract::VectorIsometry3d pose_invs_;
+  std::vector<sco::VarVector> vars_;
+  Vector6d coeffs_;
+  Vector6d tolerances_;
+  tesseract::BasicKinConstPtr manip_;
+  tesseract::BasicEnvConstPtr env_;
+  std::string link_;
+  Eigen::Isometry3d tcp_;
+};
+typedef std::shared_ptr<CartesianPathEvaluator> CartesianPathEvaluatorPtr;
+
+/** @brief Absolute value penalty on the pose errors of a whole tool path */
+class CartesianPathCost : public sco::Cost
+{
+public:
+  CartesianPathCost(CartesianPathEvaluatorPtr evaluator, const std::string& name)
+    : Cost(name), evaluator_(evaluator)
+  {
+  }
+  double value(const DblVec& x) override;
+  sco::ConvexObjectivePtr convex(const DblVec& x, sco::Model* model) override;
+  sco::VarVector getVars() override { return evaluator_->getVars(); }
+private:
+  CartesianPathEvaluatorPtr evaluator_;
+};
+
+/** @brief Equality constraint on the pose errors of a whole tool path */
+class CartesianPathConstraint : public sco::EqConstraint
+{
+public:
+  CartesianPathConstraint(CartesianPathEvaluatorPtr evaluator, const std::string& name)
+    : EqConstraint(name), evaluator_(evaluator)
+  {
+  }
+  DblVec value(const DblVec& x) override;
+  sco::ConvexConstraintsPtr convex(const DblVec& x, sco::Model* model) override;
+  sco::VarVector getVars() override { return evaluator_->getVars(); }
+private:
+  CartesianPathEvaluatorPtr evaluator_;
+};
+
 }  // namespace trajopt
@@ -119,6 +119,8 @@ struct InitInfo
     pci.env->getCurrentJointValues)
     JOINT_INTERPOLATED: Linearly interpolates between initial value and the joint position specified in InitInfo.data
     GIVEN_TRAJ: Initializes the matrix to a given trajectory
+    CARTESIAN_IK: Solves inverse kinematics for the target of every CartPoseTermInfo, each seeded from the previous
+    solution, and linearly interpolates the remaining timesteps
 
     In all cases the dt column (if present) is appended the selected method is defined.
  */
@@ -127,6 +129,7 @@ struct InitInfo
     STATIONARY,
     JOINT_INTERPOLATED,
     GIVEN_TRAJ,
+    CARTESIAN_IK,
   };
   /** @brief Specifies the type of initialization to use */
   Type type;
@@ -254,6 +257,44 @@ struct CartPoseTermInfo : public TermInfo
   DEFINE_CREATE(CartPoseTermInfo)
 };
 
+/**
+ \brief Applies cost/constraint to the pose of a link along a whole tool path
+
+ Target i applies to timestep first_step + i. All waypoints are evaluated in one pass with analytic jacobians and
+ convexified together, instead of one CartPoseTermInfo per waypoint.
+ */
+struct CartesianPathTermInfo : public TermInfo
+{
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  /** @brief Timestep of the first target */
+  int first_step;
+  /** @brief Target poses, one per timestep starting at first_step */
+  tesseract::VectorIsometry3d poses;
+  /** @brief coefficients for position and rotation */
+  Eigen::Vector3d pos_coeffs, rot_coeffs;
+  /**
+   * @brief Per-axis tolerances within which the position and rotation errors are zero
+   *
+   * Position tolerances are distances along the target axes. Rotation tolerances are angles in radians about the target
+   * axes; the rotation error is the vector part of the error quaternion (sin(angle / 2) * axis), so a rotation of up to
+   * rot_tolerances(i) about axis i alone has zero error.
+   */
+  Eigen::Vector3d pos_tolerances, rot_tolerances;
+  /** @brief Link which should follow the path */
+  std::string link;
+  /** @brief Static transform applied to the link */
+  Eigen::Isometry3d tcp;
+
+  CartesianPathTermInfo();
+
+  /** @brief Used to add term to pci from json */
+  void fromJson(ProblemConstructionInfo& pci, const Json::Value& v) override;
+  /** @brief Converts term info into cost/constraint and adds it to trajopt problem */
+  void hatch(TrajOptProb& prob) override;
+  DEFINE_CREATE(CartesianPathTermInfo)
+};
+
 /**
  \brief Applies cost/constraint to the cartesian velocity of a link
 
@@ -475,6 +516,11 @@ struct CollisionTermInfo : public TermInfo
   /** @brief (gap=1 by default) */
   int gap;
 
+  /** @brief for continuous-time penalty, split segments whose largest joint motion exceeds this into equal casts */
+  /** @brief This is a joint-space length (largest change of a single joint, in radians or meters), */
+  /** @brief not a cartesian distance. JSON: "max_segment_length" (0, the default, disables subdivision) */
+  double max_segment_length = 0;
+
   /** @brief Contains distance penalization data: Safety Margin, Coeff used during */
   /** @brief optimization, etc. */
   std::vector<SafetyMarginDataPtr> info;
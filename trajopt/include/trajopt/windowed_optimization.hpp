@@ -0,0 +1,60 @@
+#pragma once
+#include <trajopt_utils/macros.h>
+TRAJOPT_IGNORE_WARNINGS_PUSH
+#include <functional>
+TRAJOPT_IGNORE_WARNINGS_POP
+
+#include <trajopt/problem_description.hpp>
+#include <trajopt_sco/optimizers.hpp>
+
+namespace trajopt
+{
+/**
+ * @brief Creates the sub-problem for the timesteps [first_step, last_step] of the full trajectory
+ *
+ * The returned problem must have last_step - first_step + 1 steps, with its step 0 corresponding to first_step. Every
+ * call must return a new problem. The factory is always called from the calling thread, but when num_threads > 1 the
+ * windows are solved concurrently, so each problem must then be built against its own environment and kinematics
+ * (e.g. a separate KDLEnv per window); tesseract environments and kinematics are not safe to use from several threads.
+ */
+typedef std::function<TrajOptProbPtr(int first_step, int last_step)> WindowProblemFactory;
+
+struct TRAJOPT_API WindowedOptimizationParameters
+{
+  int window_size;        // number of timesteps in each window
+  int window_overlap;     // number of timesteps shared by consecutive windows
+  int max_admm_iter;      // maximum number of consensus iterations
+  double rho;             // weight of the consensus penalty on the shared waypoints
+  double consensus_tol;   // converged when the shared waypoints of all windows agree within this tolerance
+  int num_threads;        // number of windows optimized concurrently (default 1), 0 uses the hardware concurrency.
+                          // Above 1 the windows must not share an environment or kinematics.
+  sco::BasicTrustRegionSQPParameters sqp_params;  // parameters of the SQP solving each window
+
+  WindowedOptimizationParameters();
+};
+
+struct TRAJOPT_API WindowedOptimizationResult
+{
+  TrajArray traj;                                // consensus joint trajectory (n_steps x n_dof)
+  std::vector<TrajOptResultPtr> window_results;  // result of the last solve of each window
+  int admm_iter;                                 // number of consensus iterations performed
+  double primal_residual;                        // max disagreement of a window with the consensus
+  bool converged;
+};
+typedef std::shared_ptr<WindowedOptimizationResult> WindowedOptimizationResultPtr;
+
+/**
+ * @brief Optimize a long trajectory as overlapping windows reconciled by consensus ADMM
+ *
+ * The trajectory of n_steps is split into windows of window_size steps overlapping by window_overlap steps. Each window
+ * is solved with BasicTrustRegionSQP concurrently, with a quadratic penalty pulling its shared waypoints towards the
+ * consensus. After every round the consensus is set to the average of the windows and the scaled dual variables are
+ * updated, until the shared waypoints agree.
+ *
+ * With num_threads > 1 the window problems are evaluated on separate threads, so their terms must not share mutable
+ * state. Windows sharing an environment or kinematics object are rejected in that case.
+ */
+WindowedOptimizationResultPtr TRAJOPT_API OptimizeWindowed(int n_steps,
+                                                           const WindowProblemFactory& factory,
+                                                           const WindowedOptimizationParameters& params);
+}  // namespace trajopt
@@ -1,6 +1,9 @@
 #include <trajopt_utils/macros.h>
 TRAJOPT_IGNORE_WARNINGS_PUSH
+#include <algorithm>
 #include <boost/functional/hash.hpp>
+#include <cmath>
+#include <map>
 TRAJOPT_IGNORE_WARNINGS_POP
 
 #include <trajopt/collision_terms.hpp>
@@ -15,14 +18,6 @@ TRAJOPT_IGNORE_WARNINGS_POP
 
 namespace trajopt
 {
-void CollisionsToDistances(const tesseract::ContactResultVector& dist_results, DblVec& dists)
-{
-  dists.clear();
-  dists.reserve(dist_results.size());
-  for (auto i = 0u; i < dist_results.size(); ++i)
-    dists.push_back(dist_results[i].distance);
-}
-
 void DebugPrintInfo(const tesseract::ContactResult& res,
                     const Eigen::VectorXd& dist_grad_A,
                     const Eigen::VectorXd& dist_grad_B,
@@ -155,16 +150,91 @@ void DebugPrintInfo(const tesseract::ContactResult& res,
   std::printf("\n");
 }
 
+/**
+ * @brief Gradients of the contact distance with respect to the joint values, one per link of the contact
+ *
+ * A gradient is left empty if its link does not belong to the manipulator.
+ * @return False if neither link of the contact belongs to the manipulator
+ */
+bool CalcDistanceGradients(const tesseract::ContactResult& res,
+                           const tesseract::BasicKinConstPtr manip,
+                           const tesseract::EnvState& state,
+                           const Eigen::Isometry3d& change_base,
+                           const Eigen::VectorXd& dofvals,
+                           bool isTimestep1,
+                           Eigen::VectorXd& dist_grad_a,
+                           Eigen::VectorXd& dist_grad_b)
+{
+  const std::vector<std::string>& link_names = manip->getLinkNames();
+
+  std::vector<std::string>::const_iterator itA = std::find(link_names.begin(), link_names.end(), res.link_names[0]);
+  if (itA != link_names.end())
+  {
+    Eigen::MatrixXd jac;
+    jac.resize(6, manip->numJoints());
+    manip->calcJacobian(jac, change_base, dofvals, res.link_names[0], state, res.nearest_points[0]);
+    dist_grad_a = -res.normal.transpose() * jac.topRows(3);
+  }
+
+  std::vector<std::string>::const_iterator itB = std::find(link_names.begin(), link_names.end(), res.link_names[1]);
+  if (itB != link_names.end())
+  {
+    Eigen::MatrixXd jac;
+    jac.resize(6, manip->numJoints());
+    manip->calcJacobian(jac,
+                        change_base,
+                        dofvals,
+                        res.link_names[1],
+                        state,
+                        (isTimestep1 && (res.cc_type == tesseract::ContinouseCollisionType::CCType_Between)) ?
+                            res.cc_nearest_points[1] :
+                            res.nearest_points[1]);
+    dist_grad_b = res.normal.transpose() * jac.topRows(3);
+  }
+
+  return itA != link_names.end() || itB != link_names.end();
+}
+
+/** @brief The joints moving either link of the contact, in increasing order */
+std::vector<int> ContactJoints(const tesseract::ContactResult& res, const LinkJointIndices& link_joints)
+{
+  std::vector<int> joints;
+  for (const std::string& link_name : res.link_names)
+  {
+    auto it = link_joints.find(link_name);
+    if (it != link_joints.end())
+      joints.insert(joints.end(), it->second.begin(), it->second.end());
+  }
+  std::sort(joints.begin(), joints.end());
+  joints.erase(std::unique(joints.begin(), joints.end()), joints.end());
+  return joints;
+}
+
+/** @brief Add grad * (vars - dofvals) to expr, over the given joints only */
+void AddGradientExpr(sco::AffExpr& expr,
+                     const Eigen::VectorXd& grad,
+                     const sco::VarVector& vars,
+                     const Eigen::VectorXd& dofvals,
+                     const std::vector<int>& joints)
+{
+  for (int j : joints)
+  {
+    expr.coeffs.push_back(grad(j));
+    expr.vars.push_back(vars[static_cast<size_t>(j)]);
+    expr.constant -= grad(j) * dofvals(j);
+  }
+}
+
 void CollisionsToDistanceExpressions(const tesseract::ContactResultVector& dist_results,
                                      const tesseract::BasicEnvConstPtr env,
                                      const tesseract::BasicKinConstPtr manip,
+                                     const LinkJointIndices& link_joints,
                                      const sco::VarVector& vars,
                                      const DblVec& x,
                                      sco::AffExprVector& exprs,
                                      bool isTimestep1)
 {
   Eigen::VectorXd dofvals = sco::getVec(x, vars);
-  const std::vector<std::string>& link_names = manip->getLinkNames();
 
   // All collision data is in world corrdinate system. This provides the
   // transfrom for converting data between world frame and manipulator
@@ -182,37 +252,17 @@ void CollisionsToDistanceExpressions(const tesseract::ContactResultVector& dist_
     sco::AffExpr dist(res.distance);
 
     Eigen::VectorXd dist_grad_a, dist_grad_b;
-    std::vector<std::string>::const_iterator itA = std::find(link_names.begin(), link_names.end(), res.link_names[0]);
-    if (itA != link_names.end())
-    {
-      Eigen::MatrixXd jac;
-      jac.resize(6, manip->numJoints());
-      manip->calcJacobian(jac, change_base, dofvals, res.link_names[0], *state, res.nearest_points[0]);
-      dist_grad_a = -res.normal.transpose() * jac.topRows(3);
-      sco::exprInc(dist, sco::varDot(dist_grad_a, vars));
-      sco::exprInc(dist, -dist_grad_a.dot(dofvals));
-    }
-
-    std::vector<std::string>::const_iterator itB = std::find(link_names.begin(), link_names.end(), res.link_names[1]);
-    if (itB != link_names.end())
-    {
-      Eigen::MatrixXd jac;
-      jac.resize(6, manip->numJoints());
-      manip->calcJacobian(jac,
-                          change_base,
-                          dofvals,
-                          res.link_names[1],
-                          *state,
-                          (isTimestep1 && (res.cc_type == tesseract::ContinouseCollisionType::CCType_Between)) ?
-                              res.cc_nearest_points[1] :
-                              res.nearest_points[1]);
-      dist_grad_b = res.normal.transpose() * jac.topRows(3);
-      sco::exprInc(dist, sco::varDot(dist_grad_b, vars));
-      sco::exprInc(dist, -dist_grad_b.dot(dofvals));
-    }
+    bool found =
+        CalcDistanceGradients(res, manip, *state, change_base, dofvals, isTimestep1, dist_grad_a, dist_grad_b);
+    Eigen::VectorXd dist_grad = Eigen::VectorXd::Zero(dofvals.size());
+    if (dist_grad_a.size() > 0)
+      dist_grad += dist_grad_a;
+    if (dist_grad_b.size() > 0)
+      dist_grad += dist_grad_b;
+    AddGradientExpr(dist, dist_grad, vars, dofvals, ContactJoints(res, link_joints));
     // DebugPrintInfo(res, dist_grad_a, dist_grad_b, dofvals, i == 0);
 
-    if (itA != link_names.end() || itB != link_names.end())
+    if (found)
     {
       exprs.push_back(dist);
     }
@@ -222,14 +272,15 @@ void CollisionsToDistanceExpressions(const tesseract::ContactResultVector& dist_
 void CollisionsToDistanceExpressions(const tesseract::ContactResultVector& dist_results,
                                      const tesseract::BasicEnvConstPtr env,
                                      const tesseract::BasicKinConstPtr manip,
+                                     const LinkJointIndices& link_joints,
                                      const sco::VarVector& vars0,
                                      const sco::VarVector& vars1,
                                      const DblVec& x,
                                      sco::AffExprVector& exprs)
 {
   sco::AffExprVector exprs0, exprs1;
-  CollisionsToDistanceExpressions(dist_results, env, manip, vars0, x, exprs0, false);
-  CollisionsToDistanceExpressions(dist_results, env, manip, vars1, x, exprs1, true);
+  CollisionsToDistanceExpressions(dist_results, env, manip, link_joints, vars0, x, exprs0, false);
+  CollisionsToDistanceExpressions(dist_results, env, manip, link_joints, vars1, x, exprs1, true);
 
   exprs.resize(exprs0.size());
   for (std::size_t i = 0; i < exprs0.size(); ++i)
@@ -244,6 +295,109 @@ void CollisionsToDistanceExpressions(const tesseract::ContactResultVector& dist_
   }
 }
 
+/**
+ * @brief Linearize the contacts of a segment that was cast as n_segments equal sub-segments
+ *
+ * The cc_time of every contact is relative to the whole segment. The contact is linearized about the end points
+ * q_a, q_b of its sub-segment, which are interpolated from the segment end points, so each gradient is split between
+ * vars0 and vars1 by the interpolation weights.
+ */
+void CollisionsToDistanceExpressions(const tesseract::ContactResultVector& dist_results,
+                                     const tesseract::BasicEnvConstPtr env,
+                                     const tesseract::BasicKinConstPtr manip,
+                                     const LinkJointIndices& link_joints,
+                                     const sco::VarVector& vars0,
+                                     const sco::VarVector& vars1,
+                                     const DblVec& x,
+                                     int n_segments,
+                                     sco::AffExprVector& exprs)
+{
+  if (n_segments <= 1)
+  {
+    CollisionsToDistanceExpressions(dist_results, env, manip, link_joints, vars0, vars1, x, exprs);
+    return;
+  }
+
+  Eigen::VectorXd dofvals0 = sco::getVec(x, vars0);
+  Eigen::VectorXd dofvals1 = sco::getVec(x, vars1);
+  tesseract::EnvStateConstPtr state = env->getState();
+  Eigen::Isometry3d change_base = state->transforms.at(manip->getBaseLinkName());
+
+  exprs.clear();
+  exprs.reserve(dist_results.size());
+  for (const auto& res : dist_results)
+  {
+    assert(res.cc_time >= 0.0 && res.cc_time <= 1.0);
+    double segment_time = res.cc_time * n_segments;
+    int k = std::min(static_cast<int>(segment_time), n_segments - 1);
+    double t = segment_time - k;
+    double s0 = static_cast<double>(k) / n_segments;
+    double s1 = static_cast<double>(k + 1) / n_segments;
+
+    Eigen::VectorXd grad_a = Eigen::VectorXd::Zero(dofvals0.size());
+    Eigen::VectorXd grad_b = Eigen::VectorXd::Zero(dofvals0.size());
+    Eigen::VectorXd dist_grad_a, dist_grad_b;
+    Eigen::VectorXd qa = dofvals0 + s0 * (dofvals1 - dofvals0);
+    if (!CalcDistanceGradients(res, manip, *state, change_base, qa, false, dist_grad_a, dist_grad_b))
+      continue;
+    if (dist_grad_a.size() > 0)
+      grad_a += dist_grad_a;
+    if (dist_grad_b.size() > 0)
+      grad_a += dist_grad_b;
+
+    dist_grad_a.resize(0);
+    dist_grad_b.resize(0);
+    Eigen::VectorXd qb = dofvals0 + s1 * (dofvals1 - dofvals0);
+    CalcDistanceGradients(res, manip, *state, change_base, qb, true, dist_grad_a, dist_grad_b);
+    if (dist_grad_a.size() > 0)
+      grad_b += dist_grad_a;
+    if (dist_grad_b.size() > 0)
+      grad_b += dist_grad_b;
+
+    // dist + (1 - t) * grad_a * (q_a(vars) - q_a) + t * grad_b * (q_b(vars) - q_b),
+    // with q_s(vars) = (1 - s) * vars0 + s * vars1
+    Eigen::VectorXd grad0 = (1 - t) * (1 - s0) * grad_a + t * (1 - s1) * grad_b;
+    Eigen::VectorXd grad1 = (1 - t) * s0 * grad_a + t * s1 * grad_b;
+
+    std::vector<int> joints = ContactJoints(res, link_joints);
+    sco::AffExpr dist(res.distance);
+    AddGradientExpr(dist, grad0, vars0, dofvals0, joints);
+    AddGradientExpr(dist, grad1, vars1, dofvals1, joints);
+    exprs.push_back(dist);
+  }
+}
+
+const LinkJointIndices& CollisionEvaluator::GetLinkJointIndices()
+{
+  if (!link_joint_indices_.empty())
+    return link_joint_indices_;
+
+  tesseract::EnvStateConstPtr state = env_->getState();
+  Eigen::Isometry3d change_base = state->transforms.at(manip_->getBaseLinkName());
+  const Eigen::MatrixX2d& limits = manip_->getLimits();
+  Eigen::VectorXd q0 = Eigen::VectorXd::Zero(limits.rows());
+  for (Eigen::Index j = 0; j < limits.rows(); ++j)
+    if (std::isfinite(limits(j, 0)) && std::isfinite(limits(j, 1)))
+      q0(j) = (limits(j, 0) + limits(j, 1)) / 2;
+
+  // A joint which does not move a link leaves its pose bit for bit unchanged, any other joint changes it
+  for (const std::string& link_name : manip_->getLinkNames())
+  {
+    std::vector<int>& joints = link_joint_indices_[link_name];
+    Eigen::Isometry3d pose0;
+    bool known = manip_->calcFwdKin(pose0, change_base, q0, link_name, *state);
+    for (int j = 0; j < static_cast<int>(q0.size()); ++j)
+    {
+      Eigen::VectorXd q = q0;
+      q(j) += 0.1;
+      Eigen::Isometry3d pose;
+      if (!known || !manip_->calcFwdKin(pose, change_base, q, link_name, *state) || pose.matrix() != pose0.matrix())
+        joints.push_back(j);
+    }
+  }
+  return link_joint_indices_;
+}
+
 inline size_t hash(const DblVec& x) { return boost::hash_range(x.begin(), x.end()); }
 void CollisionEvaluator::GetCollisionsCached(const DblVec& x, tesseract::ContactResultVector& dist_results)
 {
@@ -262,6 +416,45 @@ void CollisionEvaluator::GetCollisionsCached(const DblVec& x, tesseract::Contact
   }
 }
 
+void CollisionEvaluator::GetContactDistancesCached(const DblVec& x, ContactDistanceVector& dists)
+{
+  size_t key = hash(sco::getDblVec(x, GetVars()));
+  ContactDistanceVector* it = m_dist_cache.get(key);
+  if (it != nullptr)
+  {
+    LOG_DEBUG("using cached distance check\n");
+    dists = *it;
+    return;
+  }
+
+  // A full collision check at this point already has everything needed
+  tesseract::ContactResultVector* full_it = m_cache.get(key);
+  if (full_it != nullptr)
+  {
+    LOG_DEBUG("using cached collision check for distance check\n");
+    ContactResultsToDistances(*full_it, dists);
+  }
+  else
+  {
+    LOG_DEBUG("not using cached distance check\n");
+    CalcContactDistances(x, dists);
+  }
+  m_dist_cache.put(key, dists);
+}
+
+void CollisionEvaluator::ContactResultsToDistances(const tesseract::ContactResultVector& dist_results,
+                                                   ContactDistanceVector& dists) const
+{
+  dists.clear();
+  dists.reserve(dist_results.size());
+  for (const auto& res : dist_results)
+  {
+    const Eigen::Vector2d& data = safety_margin_data_->getPairSafetyMarginData(res.link_names[0], res.link_names[1]);
+    if (res.distance < data[0])
+      dists.push_back({ res.distance, data[0], data[1] });
+  }
+}
+
 SingleTimestepCollisionEvaluator::SingleTimestepCollisionEvaluator(tesseract::BasicKinConstPtr manip,
                                                                    tesseract::BasicEnvConstPtr env,
                                                                    SafetyMarginDataConstPtr safety_margin_data,
@@ -272,32 +465,54 @@ SingleTimestepCollisionEvaluator::SingleTimestepCollisionEvaluator(tesseract::Ba
   contact_manager_->setActiveCollisionObjects(manip_->getLinkNames());
   contact_manager_->setContactDistanceThreshold(safety_margin_data_->getMaxSafetyMargin() +
                                                 0.04);  // The original implementation added a margin of 0.04;
+
+  dist_contact_manager_ = env_->getDiscreteContactManager();
+  dist_contact_manager_->setActiveCollisionObjects(manip_->getLinkNames());
+  dist_contact_manager_->setContactDistanceThreshold(safety_margin_data_->getMaxSafetyMargin());
 }
 
-void SingleTimestepCollisionEvaluator::CalcCollisions(const DblVec& x, tesseract::ContactResultVector& dist_results)
+void SingleTimestepCollisionEvaluator::DiscreteContactTest(tesseract::DiscreteContactManagerBase& manager,
+                                                           const DblVec& x,
+                                                           tesseract::ContactResultVector& dist_results) const
 {
   tesseract::ContactResultMap contacts;
   tesseract::EnvStatePtr state = env_->getState(manip_->getJointNames(), sco::getVec(x, m_vars));
 
   for (const auto& link_name : manip_->getLinkNames())
-    contact_manager_->setCollisionObjectsTransform(link_name, state->transforms[link_name]);
+    manager.setCollisionObjectsTransform(link_name, state->transforms[link_name]);
 
-  contact_manager_->contactTest(contacts, tesseract::ContactTestTypes::ALL);
+  manager.contactTest(contacts, tesseract::ContactTestTypes::ALL);
   tesseract::moveContactResultsMapToContactResultsVector(contacts, dist_results);
 }
 
-void SingleTimestepCollisionEvaluator::CalcDists(const DblVec& x, DblVec& dists)
+void SingleTimestepCollisionEvaluator::CalcCollisions(const DblVec& x, tesseract::ContactResultVector& dist_results)
 {
+  DiscreteContactTest(*contact_manager_, x, dist_results);
+}
+
+void SingleTimestepCollisionEvaluator::CalcContactDistances(const DblVec& x, ContactDistanceVector& dists)
+{
+  // Every contact is kept, as in CalcCollisions, since the distance expressions linearize each of them
   tesseract::ContactResultVector dist_results;
-  GetCollisionsCached(x, dist_results);
-  CollisionsToDistances(dist_results, dists);
+  DiscreteContactTest(*dist_contact_manager_, x, dist_results);
+  ContactResultsToDistances(dist_results, dists);
+}
+
+void SingleTimestepCollisionEvaluator::CalcDists(const DblVec& x, DblVec& dists)
+{
+  ContactDistanceVector contact_dists;
+  GetContactDistancesCached(x, contact_dists);
+  dists.clear();
+  dists.reserve(contact_dists.size());
+  for (const auto& d : contact_dists)
+    dists.push_back(d.distance);
 }
 
 void SingleTimestepCollisionEvaluator::CalcDistExpressions(const DblVec& x, sco::AffExprVector& exprs)
 {
   tesseract::ContactResultVector dist_results;
   GetCollisionsCached(x, dist_results);
-  CollisionsToDistanceExpressions(dist_results, env_, manip_, m_vars, x, exprs, false);
+  CollisionsToDistanceExpressions(dist_results, env_, manip_, GetLinkJointIndices(), m_vars, x, exprs, false);
 
   LOG_DEBUG("%ld distance expressions\n", exprs.size());
 }
@@ -344,38 +559,115 @@ CastCollisionEvaluator::CastCollisionEvaluator(tesseract::BasicKinConstPtr manip
                                                tesseract::BasicEnvConstPtr env,
                                                SafetyMarginDataConstPtr safety_margin_data,
                                                const sco::VarVector& vars0,
-                                               const sco::VarVector& vars1)
-  : CollisionEvaluator(manip, env, safety_margin_data), m_vars0(vars0), m_vars1(vars1)
+                                               const sco::VarVector& vars1,
+                                               double max_segment_length)
+  : CollisionEvaluator(manip, env, safety_margin_data)
+  , m_vars0(vars0)
+  , m_vars1(vars1)
+  , max_segment_length_(max_segment_length)
 {
   contact_manager_ = env_->getContinuousContactManager();
   contact_manager_->setActiveCollisionObjects(manip_->getLinkNames());
   contact_manager_->setContactDistanceThreshold(safety_margin_data_->getMaxSafetyMargin() +
                                                 0.04);  // The original implementation added a margin of 0.04;
+
+  dist_contact_manager_ = env_->getContinuousContactManager();
+  dist_contact_manager_->setActiveCollisionObjects(manip_->getLinkNames());
+  dist_contact_manager_->setContactDistanceThreshold(safety_margin_data_->getMaxSafetyMargin());
+}
+
+int CastCollisionEvaluator::NumSegments(const DblVec& x) const
+{
+  if (max_segment_length_ <= 0)
+    return 1;
+
+  double motion = (sco::getVec(x, m_vars1) - sco::getVec(x, m_vars0)).cwiseAbs().maxCoeff();
+  return std::max(1, static_cast<int>(std::ceil(motion / max_segment_length_)));
+}
+
+void CastCollisionEvaluator::CastContactTest(tesseract::ContinuousContactManagerBase& manager,
+                                             const DblVec& x,
+                                             tesseract::ContactResultVector& dist_results) const
+{
+  Eigen::VectorXd dofvals0 = sco::getVec(x, m_vars0);
+  Eigen::VectorXd dofvals1 = sco::getVec(x, m_vars1);
+  int n_segments = NumSegments(x);
+
+  dist_results.clear();
+  tesseract::ContactResultMap closest_contacts;
+  std::map<std::pair<std::string, std::string>, double> closest_distance;
+  for (int k = 0; k < n_segments; ++k)
+  {
+    double s0 = static_cast<double>(k) / n_segments;
+    double s1 = static_cast<double>(k + 1) / n_segments;
+    tesseract::EnvStatePtr state0 = env_->getState(manip_->getJointNames(), dofvals0 + s0 * (dofvals1 - dofvals0));
+    tesseract::EnvStatePtr state1 = env_->getState(manip_->getJointNames(), dofvals0 + s1 * (dofvals1 - dofvals0));
+    for (const auto& link_name : manip_->getLinkNames())
+      manager.setCollisionObjectsTransform(link_name, state0->transforms[link_name], state1->transforms[link_name]);
+
+    tesseract::ContactResultMap contacts;
+    manager.contactTest(contacts, tesseract::ContactTestTypes::ALL);
+
+    if (n_segments == 1)
+    {
+      tesseract::moveContactResultsMapToContactResultsVector(contacts, dist_results);
+      return;
+    }
+
+    // Neighbouring sub-segments see the same contact, so every pair keeps the contacts of the sub-segment where it is
+    // closest. Otherwise a pair would be penalized once per sub-segment.
+    for (auto& pair : contacts)
+    {
+      if (pair.second.empty())
+        continue;
+
+      double distance = INFINITY;
+      for (auto& res : pair.second)
+      {
+        // Report the contact time relative to the whole segment
+        res.cc_time = s0 + res.cc_time * (s1 - s0);
+        distance = std::min(distance, res.distance);
+      }
+
+      auto it = closest_distance.find(pair.first);
+      if (it == closest_distance.end() || distance < it->second)
+      {
+        closest_distance[pair.first] = distance;
+        closest_contacts[pair.first] = std::move(pair.second);
+      }
+    }
+  }
+  tesseract::moveContactResultsMapToContactResultsVector(closest_contacts, dist_results);
 }
 
 void CastCollisionEvaluator::CalcCollisions(const DblVec& x, tesseract::ContactResultVector& dist_results)
 {
-  tesseract::ContactResultMap contacts;
-  tesseract::EnvStatePtr state0 = env_->getState(manip_->getJointNames(), sco::getVec(x, m_vars0));
-  tesseract::EnvStatePtr state1 = env_->getState(manip_->getJointNames(), sco::getVec(x, m_vars1));
-  for (const auto& link_name : manip_->getLinkNames())
-    contact_manager_->setCollisionObjectsTransform(
-        link_name, state0->transforms[link_name], state1->transforms[link_name]);
+  CastContactTest(*contact_manager_, x, dist_results);
+}
 
-  contact_manager_->contactTest(contacts, tesseract::ContactTestTypes::ALL);
-  tesseract::moveContactResultsMapToContactResultsVector(contacts, dist_results);
+void CastCollisionEvaluator::CalcContactDistances(const DblVec& x, ContactDistanceVector& dists)
+{
+  // A pair within its margin is closest in the same sub-segment for both thresholds, so the same contacts are kept
+  tesseract::ContactResultVector dist_results;
+  CastContactTest(*dist_contact_manager_, x, dist_results);
+  ContactResultsToDistances(dist_results, dists);
 }
+
 void CastCollisionEvaluator::CalcDistExpressions(const DblVec& x, sco::AffExprVector& exprs)
 {
   tesseract::ContactResultVector dist_results;
   GetCollisionsCached(x, dist_results);
-  CollisionsToDistanceExpressions(dist_results, env_, manip_, m_vars0, m_vars1, x, exprs);
+  CollisionsToDistanceExpressions(
+      dist_results, env_, manip_, GetLinkJointIndices(), m_vars0, m_vars1, x, NumSegments(x), exprs);
 }
 void CastCollisionEvaluator::CalcDists(const DblVec& x, DblVec& dists)
 {
-  tesseract::ContactResultVector dist_results;
-  GetCollisionsCached(x, dist_results);
-  CollisionsToDistances(dist_results, dists);
+  ContactDistanceVector contact_dists;
+  GetContactDistancesCached(x, contact_dists);
+  dists.clear();
+  dists.reserve(contact_dists.size());
+  for (const auto& d : contact_dists)
+    dists.push_back(d.distance);
 }
 
 void CastCollisionEvaluator::Plot(const tesseract::BasicPlottingPtr plotter, const DblVec& x)
@@ -429,8 +721,10 @@ CollisionCost::CollisionCost(tesseract::BasicKinConstPtr manip,
                              tesseract::BasicEnvConstPtr env,
                              SafetyMarginDataConstPtr safety_margin_data,
                              const sco::VarVector& vars0,
-                             const sco::VarVector& vars1)
-  : Cost("cast_collision"), m_calc(new CastCollisionEvaluator(manip, env, safety_margin_data, vars0, vars1))
+                             const sco::VarVector& vars1,
+                             double max_segment_length)
+  : Cost("cast_collision")
+  , m_calc(new CastCollisionEvaluator(manip, env, safety_margin_data, vars0, vars1, max_segment_length))
 {
 }
 
@@ -455,18 +749,13 @@ sco::ConvexObjectivePtr CollisionCost::convex(const sco::DblVec& x, sco::Model*
 
 double CollisionCost::value(const sco::DblVec& x)
 {
-  DblVec dists;
-  m_calc->CalcDists(x, dists);
+  ContactDistanceVector dists;
+  m_calc->GetContactDistancesCached(x, dists);
 
-  tesseract::ContactResultVector dist_results;
-  m_calc->GetCollisionsCached(x, dist_results);
   double out = 0;
-  for (std::size_t i = 0; i < dists.size(); ++i)
-  {
-    const Eigen::Vector2d& data = m_calc->getSafetyMarginData()->getPairSafetyMarginData(dist_results[i].link_names[0],
-                                                                                         dist_results[i].link_names[1]);
-    out += sco::pospart(data[0] - dists[i]) * data[1];
-  }
+  for (const auto& d : dists)
+    out += sco::pospart(d.safety_margin - d.distance) * d.coeff;
+
   return out;
 }
 
@@ -486,8 +775,9 @@ CollisionConstraint::CollisionConstraint(tesseract::BasicKinConstPtr manip,
                                          tesseract::BasicEnvConstPtr env,
                                          SafetyMarginDataConstPtr safety_margin_data,
                                          const sco::VarVector& vars0,
-                                         const sco::VarVector& vars1)
-  : m_calc(new CastCollisionEvaluator(manip, env, safety_margin_data, vars0, vars1))
+                                         const sco::VarVector& vars1,
+                                         double max_segment_length)
+  : m_calc(new CastCollisionEvaluator(manip, env, safety_margin_data, vars0, vars1, max_segment_length))
 {
   name_ = "collision";
 }
@@ -513,19 +803,13 @@ sco::ConvexConstraintsPtr CollisionConstraint::convex(const sco::DblVec& x, sco:
 
 DblVec CollisionConstraint::value(const sco::DblVec& x)
 {
-  DblVec dists;
-  m_calc->CalcDists(x, dists);
+  ContactDistanceVector dists;
+  m_calc->GetContactDistancesCached(x, dists);
 
-  tesseract::ContactResultVector dist_results;
-  m_calc->GetCollisionsCached(x, dist_results);
   DblVec out(dists.size());
   for (std::size_t i = 0; i < dists.size(); ++i)
-  {
-    const Eigen::Vector2d& data = m_calc->getSafetyMarginData()->getPairSafetyMarginData(dist_results[i].link_names[0],
-                                                                                         dist_results[i].link_names[1]);
+    out[i] = sco::pospart(dists[i].safety_margin - dists[i].distance) * dists[i].coeff;
 
-    out[i] = sco::pospart(data[0] - dists[i]) * data[1];
-  }
   return out;
 }
 }
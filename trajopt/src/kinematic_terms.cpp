@@ -49,19 +49,34 @@ vector<T> concat(const vector<T>& a, const vector<T>& b) {
 
 namespace trajopt
 {
-VectorXd DynamicCartPoseErrCalculator::operator()(const VectorXd& dof_vals) const
+VectorXd CartPoseErrCalculatorBase::operator()(const VectorXd& dof_vals) const
+{
+  VectorXd out;
+  evaluate(dof_vals, out);
+  return out;
+}
+
+void CartPoseErrCalculatorBase::evaluate(const VectorXd& dof_vals, VectorXd& out) const
 {
-  Isometry3d new_pose, target_pose, change_base;
   tesseract::EnvStateConstPtr state = env_->getState();
-  change_base = state->transforms.at(manip_->getBaseLinkName());
+  Isometry3d change_base = state->transforms.at(manip_->getBaseLinkName());
   assert(change_base.isApprox(
       env_->getState(manip_->getJointNames(), dof_vals)->transforms.at(manip_->getBaseLinkName())));
-  manip_->calcFwdKin(new_pose, change_base, dof_vals, link_, *state);
-  manip_->calcFwdKin(target_pose, change_base, dof_vals, target_, *state);
+  out = calcError(dof_vals, *state, change_base);
+}
+
+CartPoseErrCalculatorBase::Vector6d DynamicCartPoseErrCalculator::calcError(const Ref<const VectorXd>& dof_vals,
+                                                                            const tesseract::EnvState& state,
+                                                                            const Isometry3d& change_base) const
+{
+  Isometry3d new_pose, target_pose;
+  manip_->calcFwdKin(new_pose, change_base, dof_vals, link_, state);
+  manip_->calcFwdKin(target_pose, change_base, dof_vals, target_, state);
 
   Isometry3d pose_err = target_pose.inverse() * (new_pose * tcp_);
   Quaterniond q(pose_err.rotation());
-  VectorXd err = concat(Vector3d(q.x(), q.y(), q.z()), pose_err.translation());
+  Vector6d err;
+  err << q.x(), q.y(), q.z(), pose_err.translation();
   return err;
 }
 
@@ -81,18 +96,17 @@ void DynamicCartPoseErrCalculator::Plot(const tesseract::BasicPlottingPtr& plott
   plotter->plotArrow(cur_pose.translation(), target_pose.translation(), Eigen::Vector4d(1, 0, 1, 1), 0.005);
 }
 
-VectorXd CartPoseErrCalculator::operator()(const VectorXd& dof_vals) const
+CartPoseErrCalculatorBase::Vector6d CartPoseErrCalculator::calcError(const Ref<const VectorXd>& dof_vals,
+                                                                     const tesseract::EnvState& state,
+                                                                     const Isometry3d& change_base) const
 {
-  Isometry3d new_pose, change_base;
-  tesseract::EnvStateConstPtr state = env_->getState();
-  change_base = state->transforms.at(manip_->getBaseLinkName());
-  assert(change_base.isApprox(
-      env_->getState(manip_->getJointNames(), dof_vals)->transforms.at(manip_->getBaseLinkName())));
-  manip_->calcFwdKin(new_pose, change_base, dof_vals, link_, *state);
+  Isometry3d new_pose;
+  manip_->calcFwdKin(new_pose, change_base, dof_vals, link_, state);
 
   Isometry3d pose_err = pose_inv_ * (new_pose * tcp_);
   Quaterniond q(pose_err.rotation());
-  VectorXd err = concat(Vector3d(q.x(), q.y(), q.z()), pose_err.translation());
+  Vector6d err;
+  err << q.x(), q.y(), q.z(), pose_err.translation();
   return err;
 }
 
@@ -113,64 +127,135 @@ void CartPoseErrCalculator::Plot(const tesseract::BasicPlottingPtr& plotter, con
   plotter->plotArrow(cur_pose.translation(), target.translation(), Eigen::Vector4d(1, 0, 1, 1), 0.005);
 }
 
-MatrixXd CartVelJacCalculator::operator()(const VectorXd& dof_vals) const
+template <int N>
+MatrixXd CartPoseJacCalculatorT<N>::operator()(const VectorXd& dof_vals) const
+{
+  MatrixXd out;
+  evaluate(dof_vals, out);
+  return out;
+}
+
+template <int N>
+void CartPoseJacCalculatorT<N>::evaluate(const VectorXd& dof_vals, MatrixXd& out) const
+{
+  typedef Matrix<double, N, 1> JointsN;
+
+  assert(N == Dynamic || N == dof_vals.size());
+  tesseract::EnvStateConstPtr state = f_->env_->getState();
+  Isometry3d change_base = state->transforms.at(f_->manip_->getBaseLinkName());
+
+  // Forward differences, like calcForwardNumJac
+  JointsN xpert = dof_vals;
+  CartPoseErrCalculatorBase::Vector6d y = f_->calcError(xpert, *state, change_base);
+  Matrix<double, 6, N> jac(6, dof_vals.size());
+  for (int i = 0; i < dof_vals.size(); ++i)
+  {
+    xpert(i) = dof_vals(i) + epsilon_;
+    jac.col(i) = (f_->calcError(xpert, *state, change_base) - y) / epsilon_;
+    xpert(i) = dof_vals(i);
+  }
+  out = jac;
+}
+
+template <int N>
+MatrixXd CartVelJacCalculatorT<N>::operator()(const VectorXd& dof_vals) const
 {
+  MatrixXd out;
+  evaluate(dof_vals, out);
+  return out;
+}
+
+template <int N>
+void CartVelJacCalculatorT<N>::evaluate(const VectorXd& dof_vals, MatrixXd& out) const
+{
+  // Two stacked waypoints, so the stencil has 2 * N columns
+  typedef Matrix<double, 6, N> JacobianN;
+  typedef Matrix<double, 6, (N == Dynamic) ? Dynamic : 2 * N> StencilJacobian;
+  typedef Matrix<double, N, 1> JointsN;
+
   int n_dof = static_cast<int>(manip_->numJoints());
-  MatrixXd out(6, 2 * n_dof);
+  assert(N == Dynamic || N == n_dof);
+  JointsN dof_vals0 = dof_vals.topRows(n_dof);
+  JointsN dof_vals1 = dof_vals.bottomRows(n_dof);
 
   tesseract::EnvStateConstPtr state = env_->getState();
   Isometry3d change_base = state->transforms.at(manip_->getBaseLinkName());
   assert(change_base.isApprox(
-      env_->getState(manip_->getJointNames(), dof_vals.topRows(n_dof))->transforms.at(manip_->getBaseLinkName())));
+      env_->getState(manip_->getJointNames(), dof_vals0)->transforms.at(manip_->getBaseLinkName())));
   assert(change_base.isApprox(
-      env_->getState(manip_->getJointNames(), dof_vals.bottomRows(n_dof))->transforms.at(manip_->getBaseLinkName())));
-
-  MatrixXd jac0, jac1;
-  jac0.resize(6, manip_->numJoints());
-  jac1.resize(6, manip_->numJoints());
+      env_->getState(manip_->getJointNames(), dof_vals1)->transforms.at(manip_->getBaseLinkName())));
 
+  JacobianN jac0(6, n_dof), jac1(6, n_dof);
   if (tcp_.translation().isZero())
   {
-    manip_->calcJacobian(jac0, change_base, dof_vals.topRows(n_dof), link_, *state);
-    manip_->calcJacobian(jac1, change_base, dof_vals.bottomRows(n_dof), link_, *state);
+    manip_->calcJacobian(jac0, change_base, dof_vals0, link_, *state);
+    manip_->calcJacobian(jac1, change_base, dof_vals1, link_, *state);
   }
   else
   {
-    manip_->calcJacobian(jac0, change_base, dof_vals.topRows(n_dof), link_, *state, tcp_.translation());
-    manip_->calcJacobian(jac1, change_base, dof_vals.bottomRows(n_dof), link_, *state, tcp_.translation());
+    manip_->calcJacobian(jac0, change_base, dof_vals0, link_, *state, tcp_.translation());
+    manip_->calcJacobian(jac1, change_base, dof_vals1, link_, *state, tcp_.translation());
   }
 
-  out.block(0, 0, 3, n_dof) = -jac0.topRows(3);
-  out.block(0, n_dof, 3, n_dof) = jac1.topRows(3);
-  out.block(3, 0, 3, n_dof) = jac0.topRows(3);
-  out.block(3, n_dof, 3, n_dof) = -jac1.topRows(3);
+  StencilJacobian stencil(6, 2 * n_dof);
+  stencil.block(0, 0, 3, n_dof) = -jac0.template topRows<3>();
+  stencil.block(0, n_dof, 3, n_dof) = jac1.template topRows<3>();
+  stencil.block(3, 0, 3, n_dof) = jac0.template topRows<3>();
+  stencil.block(3, n_dof, 3, n_dof) = -jac1.template topRows<3>();
+  out = stencil;
+}
+
+template <int N>
+VectorXd CartVelErrCalculatorT<N>::operator()(const VectorXd& dof_vals) const
+{
+  VectorXd out;
+  evaluate(dof_vals, out);
   return out;
 }
 
-VectorXd CartVelErrCalculator::operator()(const VectorXd& dof_vals) const
+template <int N>
+void CartVelErrCalculatorT<N>::evaluate(const VectorXd& dof_vals, VectorXd& out) const
 {
+  typedef Matrix<double, N, 1> JointsN;
+
   int n_dof = static_cast<int>(manip_->numJoints());
+  assert(N == Dynamic || N == n_dof);
+  JointsN dof_vals0 = dof_vals.topRows(n_dof);
+  JointsN dof_vals1 = dof_vals.bottomRows(n_dof);
   Isometry3d pose0, pose1, change_base;
 
   tesseract::EnvStateConstPtr state = env_->getState();
   change_base = state->transforms.at(manip_->getBaseLinkName());
   assert(change_base.isApprox(
-      env_->getState(manip_->getJointNames(), dof_vals.topRows(n_dof))->transforms.at(manip_->getBaseLinkName())));
+      env_->getState(manip_->getJointNames(), dof_vals0)->transforms.at(manip_->getBaseLinkName())));
   assert(change_base.isApprox(
-      env_->getState(manip_->getJointNames(), dof_vals.bottomRows(n_dof))->transforms.at(manip_->getBaseLinkName())));
+      env_->getState(manip_->getJointNames(), dof_vals1)->transforms.at(manip_->getBaseLinkName())));
 
-  manip_->calcFwdKin(pose0, change_base, dof_vals.topRows(n_dof), link_, *state);
-  manip_->calcFwdKin(pose1, change_base, dof_vals.bottomRows(n_dof), link_, *state);
+  manip_->calcFwdKin(pose0, change_base, dof_vals0, link_, *state);
+  manip_->calcFwdKin(pose1, change_base, dof_vals1, link_, *state);
 
   pose0 = pose0 * tcp_;
   pose1 = pose1 * tcp_;
 
-  VectorXd out(6);
-  out.topRows(3) = (pose1.translation() - pose0.translation() - Vector3d(limit_, limit_, limit_));
-  out.bottomRows(3) = (pose0.translation() - pose1.translation() - Vector3d(limit_, limit_, limit_));
-  return out;
+  Matrix<double, 6, 1> err;
+  err.topRows<3>() = (pose1.translation() - pose0.translation() - Vector3d(limit_, limit_, limit_));
+  err.bottomRows<3>() = (pose0.translation() - pose1.translation() - Vector3d(limit_, limit_, limit_));
+  out = err;
 }
 
+template struct CartPoseJacCalculatorT<6>;
+template struct CartPoseJacCalculatorT<7>;
+template struct CartPoseJacCalculatorT<8>;
+template struct CartPoseJacCalculatorT<Dynamic>;
+template struct CartVelJacCalculatorT<6>;
+template struct CartVelJacCalculatorT<7>;
+template struct CartVelJacCalculatorT<8>;
+template struct CartVelJacCalculatorT<Dynamic>;
+template struct CartVelErrCalculatorT<6>;
+template struct CartVelErrCalculatorT<7>;
+template struct CartVelErrCalculatorT<8>;
+template struct CartVelErrCalculatorT<Dynamic>;
+
 Eigen::VectorXd JointVelErrCalculator::operator()(const VectorXd& var_vals) const
 {
   assert(var_vals.rows() % 2 == 0);
@@ -330,4 +415,144 @@ MatrixXd TimeCostJacCalculator::operator()(const VectorXd& time_vals) const
   return jac;
 }
 
+CartesianPathEvaluator::CartesianPathEvaluator(const tesseract::VectorIsometry3d& poses,
+                                               const std::vector<sco::VarVector>& vars,
+                                               const Vector3d& pos_coeffs,
+                                               const Vector3d& rot_coeffs,
+                                               const Vector3d& pos_tolerances,
+                                               const Vector3d& rot_tolerances,
+                                               tesseract::BasicKinConstPtr manip,
+                                               tesseract::BasicEnvConstPtr env,
+                                               std::string link,
+                                               Isometry3d tcp)
+  : vars_(vars), manip_(manip), env_(env), link_(link), tcp_(tcp)
+{
+  assert(poses.size() == vars.size());
+  pose_invs_.reserve(poses.size());
+  for (const Isometry3d& pose : poses)
+    pose_invs_.push_back(pose.inverse());
+
+  // The rotation error is the quaternion vector part, which is sin(angle / 2) for a rotation about a single axis
+  coeffs_ << rot_coeffs, pos_coeffs;
+  tolerances_ << (0.5 * rot_tolerances.array().min(M_PI)).sin().matrix(), pos_tolerances;
+}
+
+void CartesianPathEvaluator::calcWaypointError(size_t i,
+                                               const VectorXd& dof_vals,
+                                               const tesseract::EnvState& state,
+                                               const Isometry3d& change_base,
+                                               Vector6d& err,
+                                               Jacobian* jac) const
+{
+  Isometry3d pose;
+  manip_->calcFwdKin(pose, change_base, dof_vals, link_, state);
+
+  const Isometry3d& pose_inv = pose_invs_[i];
+  Isometry3d pose_err = pose_inv * (pose * tcp_);
+  Quaterniond q(pose_err.rotation());
+  err << q.vec(), pose_err.translation();
+
+  if (jac)
+  {
+    jac->resize(6, dof_vals.size());
+    if (tcp_.translation().isZero())
+      manip_->calcJacobian(*jac, change_base, dof_vals, link_, state);
+    else
+      manip_->calcJacobian(*jac, change_base, dof_vals, link_, state, tcp_.translation());
+
+    // Rows 0-2 are the linear and rows 3-5 the angular velocity. The quaternion vector part of the error changes as
+    // 0.5 * (w * I - [v]x) * w_target, where w_target is the angular velocity in the target frame.
+    Matrix3d q_vec_skew;
+    q_vec_skew << 0, -q.z(), q.y(), q.z(), 0, -q.x(), -q.y(), q.x(), 0;
+    Matrix3d q_rate = 0.5 * (q.w() * Matrix3d::Identity() - q_vec_skew);
+    Jacobian world_jac = *jac;
+    jac->topRows<3>() = q_rate * pose_inv.linear() * world_jac.bottomRows<3>();
+    jac->bottomRows<3>() = pose_inv.linear() * world_jac.topRows<3>();
+  }
+
+  // Dead band within the tolerances, then weight by the coefficients
+  for (int r = 0; r < 6; ++r)
+  {
+    if (std::abs(err(r)) <= tolerances_(r))
+    {
+      err(r) = 0;
+      if (jac)
+        jac->row(r).setZero();
+    }
+    else
+    {
+      err(r) -= std::copysign(tolerances_(r), err(r));
+    }
+  }
+  err = coeffs_.cwiseProduct(err);
+  if (jac)
+    *jac = coeffs_.asDiagonal() * (*jac);
+}
+
+VectorXd CartesianPathEvaluator::calcErrors(const DblVec& x) const
+{
+  tesseract::EnvStateConstPtr state = env_->getState();
+  Isometry3d change_base = state->transforms.at(manip_->getBaseLinkName());
+
+  VectorXd out(6 * static_cast<long>(vars_.size()));
+  Vector6d err;
+  for (size_t i = 0; i < vars_.size(); ++i)
+  {
+    calcWaypointError(i, getVec(x, vars_[i]), *state, change_base, err, nullptr);
+    out.segment<6>(6 * static_cast<long>(i)) = err;
+  }
+  return out;
+}
+
+std::vector<AffExpr> CartesianPathEvaluator::calcLinearizedErrors(const DblVec& x) const
+{
+  tesseract::EnvStateConstPtr state = env_->getState();
+  Isometry3d change_base = state->transforms.at(manip_->getBaseLinkName());
+
+  std::vector<AffExpr> out;
+  out.reserve(6 * vars_.size());
+  Vector6d err;
+  Jacobian jac;
+  for (size_t i = 0; i < vars_.size(); ++i)
+  {
+    VectorXd dof_vals = getVec(x, vars_[i]);
+    calcWaypointError(i, dof_vals, *state, change_base, err, &jac);
+    for (int r = 0; r < 6; ++r)
+    {
+      if (coeffs_(r) == 0)
+        continue;
+      out.push_back(affFromValGrad(err(r), dof_vals, jac.row(r).transpose(), vars_[i]));
+    }
+  }
+  return out;
+}
+
+VarVector CartesianPathEvaluator::getVars() const
+{
+  VarVector out;
+  for (const VarVector& vars : vars_)
+    out.insert(out.end(), vars.begin(), vars.end());
+  return out;
+}
+
+double CartesianPathCost::value(const DblVec& x) { return evaluator_->calcErrors(x).lpNorm<1>(); }
+
+ConvexObjectivePtr CartesianPathCost::convex(const DblVec& x, Model* model)
+{
+  ConvexObjectivePtr out(new ConvexObjective(model));
+  for (const AffExpr& expr : evaluator_->calcLinearizedErrors(x))
+    out->addAbs(expr, 1);
+  return out;
+}
+
+DblVec CartesianPathConstraint::value(const DblVec& x) { return toDblVec(evaluator_->calcErrors(x)); }
+
+ConvexConstraintsPtr CartesianPathConstraint::convex(const DblVec& x, Model* model)
+{
+  ConvexConstraintsPtr out(new ConvexConstraints(model));
+  for (const AffExpr& expr : evaluator_->calcLinearizedErrors(x))
+    out->addEqCnt(expr);
+  return out;
+}
+
 }  // namespace trajopt
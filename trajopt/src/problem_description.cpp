@@ -1,6 +1,8 @@
 ﻿#include <trajopt_utils/macros.h>
 TRAJOPT_IGNORE_WARNINGS_PUSH
 #include <boost/algorithm/string.hpp>
+#include <iterator>
+#include <map>
 #include <ros/ros.h>
 #include <tesseract_core/basic_kin.h>
 TRAJOPT_IGNORE_WARNINGS_POP
@@ -47,6 +49,7 @@ void RegisterMakers()
 {
   trajopt::TermInfo::RegisterMaker("dynamic_cart_pose", &trajopt::DynamicCartPoseTermInfo::create);
   trajopt::TermInfo::RegisterMaker("cart_pose", &trajopt::CartPoseTermInfo::create);
+  trajopt::TermInfo::RegisterMaker("cartesian_path", &trajopt::CartesianPathTermInfo::create);
   trajopt::TermInfo::RegisterMaker("cart_vel", &trajopt::CartVelTermInfo::create);
   trajopt::TermInfo::RegisterMaker("joint_pos", &trajopt::JointPosTermInfo::create);
   trajopt::TermInfo::RegisterMaker("joint_vel", &trajopt::JointVelTermInfo::create);
@@ -146,6 +149,14 @@ void ProblemConstructionInfo::readOptInfo(const Json::Value& v)
   json_marshal::childFromJson(v, opt_info.max_time, "max_time", opt_info.max_time);
   json_marshal::childFromJson(v, opt_info.merit_error_coeff, "merit_error_coeff", opt_info.merit_error_coeff);
   json_marshal::childFromJson(v, opt_info.trust_box_size, "trust_box_size", opt_info.trust_box_size);
+  json_marshal::childFromJson(
+      v, opt_info.lazy_merit_evaluation, "lazy_merit_evaluation", opt_info.lazy_merit_evaluation);
+  json_marshal::childFromJson(
+      v, opt_info.per_block_trust_region, "per_block_trust_region", opt_info.per_block_trust_region);
+  json_marshal::childFromJson(v, opt_info.inexact_qp_solves, "inexact_qp_solves", opt_info.inexact_qp_solves);
+  json_marshal::childFromJson(v, opt_info.max_qp_tolerance, "max_qp_tolerance", opt_info.max_qp_tolerance);
+  json_marshal::childFromJson(v, opt_info.min_qp_tolerance, "min_qp_tolerance", opt_info.min_qp_tolerance);
+  json_marshal::childFromJson(v, opt_info.speculative_trials, "speculative_trials", opt_info.speculative_trials);
 }
 
 void ProblemConstructionInfo::readCosts(const Json::Value& v)
@@ -249,10 +260,14 @@ void ProblemConstructionInfo::readInitInfo(const Json::Value& v)
     }
     init_info.data = util::toVectorXd(endpoint);
   }
+  else if (boost::iequals(type_str, "cartesian_ik"))
+  {
+    init_info.type = InitInfo::CARTESIAN_IK;
+  }
   else
   {
     PRINT_AND_THROW("init_info did not have a valid type from Json. Valid types are "
-                    "stationary, joint_interpolated, or given_traj");
+                    "stationary, joint_interpolated, given_traj, or cartesian_ik");
   }
 }
 
@@ -293,6 +308,115 @@ void ProblemConstructionInfo::fromJson(const Json::Value& v)
   }
 }
 
+/**
+ * @brief Damped least squares inverse kinematics for a single link pose
+ *
+ * Rows of the pose error are weighted by the term coefficients in the target frame, matching CartPoseTermInfo, so a
+ * zero rot_coeffs only constrains the position and a zero coefficient leaves the corresponding target axis free.
+ * The solution is clamped to the joint limits after every step. Returns true if the weighted error converged.
+ */
+bool solveDampedLeastSquaresIK(Eigen::VectorXd& joint_values,
+                               const tesseract::BasicKin& kin,
+                               const tesseract::EnvState& state,
+                               const Eigen::Isometry3d& change_base,
+                               const CartPoseTermInfo& target)
+{
+  const int max_iter = 100;
+  const double tolerance = 1e-5;
+  const double damping = 1e-2;
+
+  Eigen::Isometry3d target_pose;
+  target_pose.linear() = Eigen::Quaterniond(target.wxyz(0), target.wxyz(1), target.wxyz(2), target.wxyz(3)).matrix();
+  target_pose.translation() = target.xyz;
+
+  Eigen::Matrix<double, 6, 1> weights;
+  weights << (target.pos_coeffs.array() > 0).cast<double>(), (target.rot_coeffs.array() > 0).cast<double>();
+
+  // Rotates the base frame error and jacobian rows into the target frame before they are weighted
+  Eigen::Matrix<double, 6, 6> to_target = Eigen::Matrix<double, 6, 6>::Zero();
+  to_target.topLeftCorner<3, 3>() = target_pose.linear().transpose();
+  to_target.bottomRightCorner<3, 3>() = target_pose.linear().transpose();
+  Eigen::Matrix<double, 6, 6> mask = weights.asDiagonal() * to_target;
+
+  const Eigen::MatrixX2d& limits = kin.getLimits();
+  Eigen::MatrixXd jac(6, joint_values.size());
+  for (int iter = 0; iter < max_iter; ++iter)
+  {
+    Eigen::Isometry3d pose;
+    kin.calcFwdKin(pose, change_base, joint_values, target.link, state);
+    pose = pose * target.tcp;
+
+    // Position and rotation error in the base frame, matching the row order of the jacobian
+    Eigen::AngleAxisd rot_err(target_pose.linear() * pose.linear().transpose());
+    Eigen::Matrix<double, 6, 1> err;
+    err << target_pose.translation() - pose.translation(), rot_err.angle() * rot_err.axis();
+    err = mask * err;
+    if (err.norm() < tolerance)
+      return true;
+
+    kin.calcJacobian(jac, change_base, joint_values, target.link, state, target.tcp.translation());
+    jac = mask * jac;
+
+    Eigen::Matrix<double, 6, 6> jjt = jac * jac.transpose();
+    jjt.diagonal().array() += damping * damping;
+    joint_values += jac.transpose() * jjt.ldlt().solve(err);
+    joint_values = joint_values.cwiseMax(limits.col(0)).cwiseMin(limits.col(1));
+  }
+  return false;
+}
+
+/** @brief Seed the trajectory with IK solutions for the CartPoseTermInfo targets, interpolating between them */
+void generateCartesianIKTraj(TrajArray& init_traj, const ProblemConstructionInfo& pci)
+{
+  int n_steps = pci.basic_info.n_steps;
+  Eigen::VectorXd start_pos = pci.env->getCurrentJointValues(pci.kin->getName());
+
+  // Constraints take precedence over costs when both target the same timestep
+  std::map<int, std::shared_ptr<const CartPoseTermInfo>> targets;
+  for (const std::vector<TermInfoPtr>* infos : { &pci.cost_infos, &pci.cnt_infos })
+  {
+    for (const TermInfoPtr& info : *infos)
+    {
+      auto cart_info = std::dynamic_pointer_cast<const CartPoseTermInfo>(info);
+      if (cart_info && cart_info->timestep >= 0 && cart_info->timestep < n_steps)
+        targets[cart_info->timestep] = cart_info;
+    }
+  }
+
+  if (targets.empty())
+    ROS_WARN("cartesian_ik initialization has no cartesian pose targets, using a stationary trajectory");
+
+  tesseract::EnvStateConstPtr state = pci.env->getState();
+  Eigen::Isometry3d change_base = state->transforms.at(pci.kin->getBaseLinkName());
+
+  // Solve the targets in order, seeding each from the previous solution so consecutive waypoints stay continuous
+  std::map<int, Eigen::VectorXd> anchors;
+  if (targets.empty() || targets.begin()->first != 0)
+    anchors[0] = start_pos;
+
+  Eigen::VectorXd seed = start_pos;
+  for (const auto& target : targets)
+  {
+    if (!solveDampedLeastSquaresIK(seed, *pci.kin, *state, change_base, *target.second))
+      ROS_WARN("cartesian_ik initialization did not converge for timestep %i", target.first);
+    anchors[target.first] = seed;
+  }
+
+  init_traj.resize(n_steps, start_pos.size());
+  auto prev = anchors.begin();
+  for (auto next = std::next(prev); next != anchors.end(); prev = next++)
+  {
+    int len = next->first - prev->first + 1;
+    for (int idof = 0; idof < start_pos.size(); ++idof)
+      init_traj.block(prev->first, idof, len, 1) =
+          Eigen::VectorXd::LinSpaced(len, prev->second(idof), next->second(idof));
+  }
+
+  // Hold the last solution after the final target
+  for (int i = prev->first; i < n_steps; ++i)
+    init_traj.row(i) = prev->second.transpose();
+}
+
 void generateInitTraj(TrajArray& init_traj, const ProblemConstructionInfo& pci)
 {
   // TODO: Change this so that it can intelligently handle when time is enabled and dt values are/are not given
@@ -318,10 +442,14 @@ void generateInitTraj(TrajArray& init_traj, const ProblemConstructionInfo& pci)
   {
     init_traj = init_info.data;
   }
+  else if (init_info.type == InitInfo::CARTESIAN_IK)
+  {
+    generateCartesianIKTraj(init_traj, pci);
+  }
   else
   {
     PRINT_AND_THROW("Init Info did not have a valid type. Valid types are "
-                    "STATIONARY, JOINT_INTERPOLATED, or GIVEN_TRAJ");
+                    "STATIONARY, JOINT_INTERPOLATED, GIVEN_TRAJ, or CARTESIAN_IK");
   }
 
   // Currently all trajectories are generated without time then appended here
@@ -519,6 +647,17 @@ TrajOptProb::TrajOptProb(int n_steps, const ProblemConstructionInfo& pci)
   }
   sco::VarVector trajvarvec = createVariables(names, vlower, vupper);
   m_traj_vars = VarArray(n_steps, n_dof + (pci.basic_info.use_time ? 1 : 0), trajvarvec.data());
+
+  // One trust region block for the joints of each timestep and, since it is scaled differently, one
+  // for each dt
+  IntVec blocks;
+  for (int i = 0; i < n_steps; ++i)
+  {
+    blocks.insert(blocks.end(), static_cast<size_t>(n_dof), i);
+    if (pci.basic_info.use_time == true)
+      blocks.push_back(n_steps + i);
+  }
+  setTrustRegionBlocks(blocks);
 }
 
 TrajOptProb::TrajOptProb() {}
@@ -568,17 +707,19 @@ void DynamicCartPoseTermInfo::hatch(TrajOptProb& prob)
   }
   else
   {
-    sco::VectorOfVectorPtr f(new DynamicCartPoseErrCalculator(target, prob.GetKin(), prob.GetEnv(), link, tcp));
+    std::shared_ptr<DynamicCartPoseErrCalculator> f(
+        new DynamicCartPoseErrCalculator(target, prob.GetKin(), prob.GetEnv(), link, tcp));
+    sco::MatrixOfVectorPtr dfdx = createFixedDofCalculator<sco::MatrixOfVector, CartPoseJacCalculatorT>(n_dof, f);
     // Apply error calculator as either cost or constraint
     if (term_type & TT_COST)
     {
       prob.addCost(sco::CostPtr(new TrajOptCostFromErrFunc(
-          f, prob.GetVarRow(timestep, 0, n_dof), concat(rot_coeffs, pos_coeffs), sco::ABS, name)));
+          f, dfdx, prob.GetVarRow(timestep, 0, n_dof), concat(rot_coeffs, pos_coeffs), sco::ABS, name)));
     }
     else if (term_type & TT_CNT)
     {
       prob.addConstraint(sco::ConstraintPtr(new TrajOptConstraintFromErrFunc(
-          f, prob.GetVarRow(timestep, 0, n_dof), concat(rot_coeffs, pos_coeffs), sco::EQ, name)));
+          f, dfdx, prob.GetVarRow(timestep, 0, n_dof), concat(rot_coeffs, pos_coeffs), sco::EQ, name)));
     }
     else
     {
@@ -643,15 +784,19 @@ void CartPoseTermInfo::hatch(TrajOptProb& prob)
   }
   else if ((term_type & TT_COST) && ~(term_type | ~TT_USE_TIME))
   {
-    sco::VectorOfVectorPtr f(new CartPoseErrCalculator(input_pose, prob.GetKin(), prob.GetEnv(), link, tcp));
+    std::shared_ptr<CartPoseErrCalculator> f(
+        new CartPoseErrCalculator(input_pose, prob.GetKin(), prob.GetEnv(), link, tcp));
+    sco::MatrixOfVectorPtr dfdx = createFixedDofCalculator<sco::MatrixOfVector, CartPoseJacCalculatorT>(n_dof, f);
     prob.addCost(sco::CostPtr(new TrajOptCostFromErrFunc(
-        f, prob.GetVarRow(timestep, 0, n_dof), concat(rot_coeffs, pos_coeffs), sco::ABS, name)));
+        f, dfdx, prob.GetVarRow(timestep, 0, n_dof), concat(rot_coeffs, pos_coeffs), sco::ABS, name)));
   }
   else if ((term_type & TT_CNT) && ~(term_type | ~TT_USE_TIME))
   {
-    sco::VectorOfVectorPtr f(new CartPoseErrCalculator(input_pose, prob.GetKin(), prob.GetEnv(), link, tcp));
+    std::shared_ptr<CartPoseErrCalculator> f(
+        new CartPoseErrCalculator(input_pose, prob.GetKin(), prob.GetEnv(), link, tcp));
+    sco::MatrixOfVectorPtr dfdx = createFixedDofCalculator<sco::MatrixOfVector, CartPoseJacCalculatorT>(n_dof, f);
     prob.addConstraint(sco::ConstraintPtr(new TrajOptConstraintFromErrFunc(
-        f, prob.GetVarRow(timestep, 0, n_dof), concat(rot_coeffs, pos_coeffs), sco::EQ, name)));
+        f, dfdx, prob.GetVarRow(timestep, 0, n_dof), concat(rot_coeffs, pos_coeffs), sco::EQ, name)));
   }
   else
   {
@@ -659,6 +804,111 @@ void CartPoseTermInfo::hatch(TrajOptProb& prob)
   }
 }
 
+CartesianPathTermInfo::CartesianPathTermInfo() : TermInfo(TT_COST | TT_CNT)
+{
+  first_step = 0;
+  pos_coeffs = Eigen::Vector3d::Ones();
+  rot_coeffs = Eigen::Vector3d::Ones();
+  pos_tolerances = Eigen::Vector3d::Zero();
+  rot_tolerances = Eigen::Vector3d::Zero();
+  tcp.setIdentity();
+}
+
+void CartesianPathTermInfo::fromJson(ProblemConstructionInfo& pci, const Json::Value& v)
+{
+  FAIL_IF_FALSE(v.isMember("params"));
+  Eigen::Vector3d tcp_xyz = Eigen::Vector3d::Zero();
+  Eigen::Vector4d tcp_wxyz = Eigen::Vector4d(1, 0, 0, 0);
+  std::vector<DblVec> xyzs, wxyzs;
+
+  const Json::Value& params = v["params"];
+  json_marshal::childFromJson(params, first_step, "first_step", 0);
+  json_marshal::childFromJson(params, xyzs, "xyzs");
+  json_marshal::childFromJson(params, wxyzs, "wxyzs");
+  json_marshal::childFromJson(params, pos_coeffs, "pos_coeffs", Eigen::Vector3d(1, 1, 1));
+  json_marshal::childFromJson(params, rot_coeffs, "rot_coeffs", Eigen::Vector3d(1, 1, 1));
+  json_marshal::childFromJson(params, pos_tolerances, "pos_tolerances", Eigen::Vector3d(0, 0, 0));
+  json_marshal::childFromJson(params, rot_tolerances, "rot_tolerances", Eigen::Vector3d(0, 0, 0));
+  json_marshal::childFromJson(params, link, "link");
+  json_marshal::childFromJson(params, tcp_xyz, "tcp_xyz", Eigen::Vector3d(0, 0, 0));
+  json_marshal::childFromJson(params, tcp_wxyz, "tcp_wxyz", Eigen::Vector4d(1, 0, 0, 0));
+
+  if (xyzs.size() != wxyzs.size())
+    PRINT_AND_THROW("cartesian_path xyzs and wxyzs must have the same length");
+
+  poses.clear();
+  for (size_t i = 0; i < xyzs.size(); ++i)
+  {
+    if (xyzs[i].size() != 3 || wxyzs[i].size() != 4)
+      PRINT_AND_THROW(boost::format("cartesian_path pose %i must have 3 xyz and 4 wxyz values") % i);
+
+    Eigen::Isometry3d pose;
+    pose.linear() = Eigen::Quaterniond(wxyzs[i][0], wxyzs[i][1], wxyzs[i][2], wxyzs[i][3]).matrix();
+    pose.translation() = Eigen::Vector3d(xyzs[i][0], xyzs[i][1], xyzs[i][2]);
+    poses.push_back(pose);
+  }
+
+  Eigen::Quaterniond q(tcp_wxyz(0), tcp_wxyz(1), tcp_wxyz(2), tcp_wxyz(3));
+  tcp.linear() = q.matrix();
+  tcp.translation() = tcp_xyz;
+
+  const std::vector<std::string>& link_names = pci.kin->getLinkNames();
+  if (std::find(link_names.begin(), link_names.end(), link) == link_names.end())
+  {
+    PRINT_AND_THROW(boost::format("invalid link name: %s") % link);
+  }
+
+  const char* all_fields[] = { "first_step",     "xyzs",           "wxyzs", "pos_coeffs", "rot_coeffs",
+                               "pos_tolerances", "rot_tolerances", "link",  "tcp_xyz",    "tcp_wxyz" };
+  ensure_only_members(params, all_fields, sizeof(all_fields) / sizeof(char*));
+}
+
+void CartesianPathTermInfo::hatch(TrajOptProb& prob)
+{
+  int n_dof = static_cast<int>(prob.GetKin()->numJoints());
+  int n_poses = static_cast<int>(poses.size());
+  if (first_step < 0 || first_step + n_poses > prob.GetNumSteps())
+    PRINT_AND_THROW(boost::format("cartesian_path with %i poses starting at timestep %i does not fit in %i steps") %
+                    n_poses % first_step % prob.GetNumSteps());
+
+  std::vector<sco::VarVector> vars;
+  vars.reserve(poses.size());
+  for (int i = 0; i < n_poses; ++i)
+    vars.push_back(prob.GetVarRow(first_step + i, 0, n_dof));
+
+  CartesianPathEvaluatorPtr evaluator(new CartesianPathEvaluator(poses,
+                                                                 vars,
+                                                                 pos_coeffs,
+                                                                 rot_coeffs,
+                                                                 pos_tolerances,
+                                                                 rot_tolerances,
+                                                                 prob.GetKin(),
+                                                                 prob.GetEnv(),
+                                                                 link,
+                                                                 tcp));
+
+  if (term_type == (TT_COST | TT_USE_TIME))
+  {
+    ROS_ERROR("Use time version of this term has not been defined.");
+  }
+  else if (term_type == (TT_CNT | TT_USE_TIME))
+  {
+    ROS_ERROR("Use time version of this term has not been defined.");
+  }
+  else if ((term_type & TT_COST) && ~(term_type | ~TT_USE_TIME))
+  {
+    prob.addCost(sco::CostPtr(new CartesianPathCost(evaluator, name)));
+  }
+  else if ((term_type & TT_CNT) && ~(term_type | ~TT_USE_TIME))
+  {
+    prob.addConstraint(sco::ConstraintPtr(new CartesianPathConstraint(evaluator, name)));
+  }
+  else
+  {
+    ROS_WARN("CartesianPathTermInfo does not have a valid term_type defined. No cost/constraint applied");
+  }
+}
+
 void CartVelTermInfo::fromJson(ProblemConstructionInfo& pci, const Json::Value& v)
 {
   FAIL_IF_FALSE(v.isMember("params"));
@@ -698,8 +948,10 @@ void CartVelTermInfo::hatch(TrajOptProb& prob)
     for (int iStep = first_step; iStep < last_step; ++iStep)
     {
       prob.addCost(sco::CostPtr(new TrajOptCostFromErrFunc(
-          sco::VectorOfVectorPtr(new CartVelErrCalculator(prob.GetKin(), prob.GetEnv(), link, max_displacement)),
-          sco::MatrixOfVectorPtr(new CartVelJacCalculator(prob.GetKin(), prob.GetEnv(), link, max_displacement)),
+          createFixedDofCalculator<sco::VectorOfVector, CartVelErrCalculatorT>(
+              n_dof, prob.GetKin(), prob.GetEnv(), link, max_displacement),
+          createFixedDofCalculator<sco::MatrixOfVector, CartVelJacCalculatorT>(
+              n_dof, prob.GetKin(), prob.GetEnv(), link, max_displacement),
           concat(prob.GetVarRow(iStep, 0, n_dof), prob.GetVarRow(iStep + 1, 0, n_dof)),
           Eigen::VectorXd::Ones(0),
           sco::ABS,
@@ -711,8 +963,10 @@ void CartVelTermInfo::hatch(TrajOptProb& prob)
     for (int iStep = first_step; iStep < last_step; ++iStep)
     {
       prob.addConstraint(sco::ConstraintPtr(new TrajOptConstraintFromErrFunc(
-          sco::VectorOfVectorPtr(new CartVelErrCalculator(prob.GetKin(), prob.GetEnv(), link, max_displacement)),
-          sco::MatrixOfVectorPtr(new CartVelJacCalculator(prob.GetKin(), prob.GetEnv(), link, max_displacement)),
+          createFixedDofCalculator<sco::VectorOfVector, CartVelErrCalculatorT>(
+              n_dof, prob.GetKin(), prob.GetEnv(), link, max_displacement),
+          createFixedDofCalculator<sco::MatrixOfVector, CartVelJacCalculatorT>(
+              n_dof, prob.GetKin(), prob.GetEnv(), link, max_displacement),
           concat(prob.GetVarRow(iStep, 0, n_dof), prob.GetVarRow(iStep + 1, 0, n_dof)),
           Eigen::VectorXd::Ones(0),
           sco::INEQ,
@@ -1283,6 +1537,8 @@ void CollisionTermInfo::fromJson(ProblemConstructionInfo& pci, const Json::Value
   json_marshal::childFromJson(params, last_step, "last_step", n_steps - 1);
   json_marshal::childFromJson(params, gap, "gap", 1);
   FAIL_IF_FALSE(gap >= 0);
+  json_marshal::childFromJson(params, max_segment_length, "max_segment_length", 0.0);
+  FAIL_IF_FALSE(max_segment_length >= 0);
   FAIL_IF_FALSE((first_step >= 0) && (first_step < n_steps));
   FAIL_IF_FALSE((last_step >= first_step) && (last_step < n_steps));
 
@@ -1365,7 +1621,8 @@ void CollisionTermInfo::fromJson(ProblemConstructionInfo& pci, const Json::Value
     }
   }
 
-  const char* all_fields[] = { "continuous", "first_step", "last_step", "gap", "coeffs", "dist_pen", "pairs" };
+  const char* all_fields[] = { "continuous", "first_step", "last_step", "gap", "max_segment_length", "coeffs",
+                               "dist_pen",   "pairs" };
   ensure_only_members(params, all_fields, sizeof(all_fields) / sizeof(char*));
 }
 
@@ -1383,7 +1640,8 @@ void CollisionTermInfo::hatch(TrajOptProb& prob)
                                                     prob.GetEnv(),
                                                     info[static_cast<size_t>(i - first_step)],
                                                     prob.GetVarRow(i, 0, n_dof),
-                                                    prob.GetVarRow(i + gap, 0, n_dof))));
+                                                    prob.GetVarRow(i + gap, 0, n_dof),
+                                                    max_segment_length)));
         prob.getCosts().back()->setName((boost::format("%s_%i") % name.c_str() % i).str());
       }
     }
@@ -1407,7 +1665,8 @@ void CollisionTermInfo::hatch(TrajOptProb& prob)
                                                                           prob.GetEnv(),
                                                                           info[static_cast<size_t>(i - first_step)],
                                                                           prob.GetVarRow(i, 0, n_dof),
-                                                                          prob.GetVarRow(i + 1, 0, n_dof))));
+                                                                          prob.GetVarRow(i + 1, 0, n_dof),
+                                                                          max_segment_length)));
         prob.getIneqConstraints().back()->setName((boost::format("%s_%i") % name.c_str() % i).str());
       }
     }
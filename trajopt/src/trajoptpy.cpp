@@ -1,104 +1,199 @@
 #include <trajopt_utils/macros.h>
 TRAJOPT_IGNORE_WARNINGS_PUSH
-#include <boost/python.hpp>
+#include <jsoncpp/json/json.h>
+#include <pybind11/eigen.h>
+#include <pybind11/numpy.h>
+#include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
+#include <srdfdom/model.h>
+#include <urdf_parser/urdf_parser.h>
 TRAJOPT_IGNORE_WARNINGS_POP
 
-#include <trajopt_ros/sco/modeling_utils.hpp>
-#include <trajopt_ros/trajopt/collision_checker.hpp>
-#include <trajopt_ros/trajopt/numpy_utils.hpp>
-#include <trajopt_ros/trajopt/problem_description.hpp>
-#include <trajopt_ros/utils/macros.h>
+#include <tesseract_ros/kdl/kdl_env.h>
+#include <trajopt/problem_description.hpp>
+#include <trajopt_sco/modeling_utils.hpp>
+#include <trajopt_sco/num_diff.hpp>
+#include <trajopt_utils/logging.hpp>
+
 using namespace trajopt;
-using namespace Eigen;
-using namespace OpenRAVE;
-using std::vector;
+using namespace sco;
+
+namespace py = pybind11;
 
-namespace py = boost::python;
+namespace
+{
+typedef py::array_t<double, py::array::c_style | py::array::forcecast> DoubleArray;
 
-bool gInteractive = false;
-py::object openravepy;
+const double BATCH_EPSILON = 1e-5;
 
-EnvironmentBasePtr GetCppEnv(py::object py_env)
+/**
+ * @brief Wrap a buffer owned by owner in a read-only NumPy array without copying it
+ *
+ * NumPy keeps owner alive as long as the array, so the view stays valid.
+ */
+py::array readOnlyView(const double* data, std::vector<py::ssize_t> shape, py::handle owner)
 {
-  py::object openravepy = py::import("openravepy");
-  int id = py::extract<int>(openravepy.attr("RaveGetEnvironmentId")(py_env));
-  EnvironmentBasePtr cpp_env = RaveGetEnvironment(id);
-  return cpp_env;
+  std::vector<py::ssize_t> strides(shape.size(), static_cast<py::ssize_t>(sizeof(double)));
+  for (long i = static_cast<long>(shape.size()) - 2; i >= 0; --i)
+    strides[static_cast<size_t>(i)] = strides[static_cast<size_t>(i + 1)] * shape[static_cast<size_t>(i + 1)];
+
+  py::array out(py::dtype::of<double>(), shape, strides, data, owner);
+  py::detail::array_proxy(out.ptr())->flags &= ~py::detail::npy_api::NPY_ARRAY_WRITEABLE_;
+  return out;
 }
-KinBodyPtr GetCppKinBody(py::object py_kb, EnvironmentBasePtr env)
+
+/**
+ * @brief Copy a callback argument into a new NumPy array
+ *
+ * The solver reuses its buffers after the call returns, so a view would dangle if the callback kept the array.
+ */
+py::array argumentArray(const double* data, std::vector<py::ssize_t> shape)
 {
-  int id = py::extract<int>(py_kb.attr("GetEnvironmentId")());
-  return env->GetBodyFromEnvironmentId(id);
+  return py::array_t<double>(shape, data);
 }
-KinBody::LinkPtr GetCppLink(py::object py_link, EnvironmentBasePtr env)
+
+/** @brief Read a callback result without copying when it is already a contiguous float64 array */
+DoubleArray toDoubleArray(const py::object& obj, const std::string& what)
 {
-  KinBodyPtr parent = GetCppKinBody(py_link.attr("GetParent")(), env);
-  int idx = py::extract<int>(py_link.attr("GetIndex")());
-  return parent->GetLinks()[idx];
+  DoubleArray out = DoubleArray::ensure(obj);
+  if (!out)
+    throw py::type_error(what + " must return an array of floats");
+  return out;
 }
 
-class PyTrajOptProb
+struct ScalarFuncFromPy : public ScalarOfVector
 {
-public:
-  TrajOptProbPtr m_prob;
-  PyTrajOptProb(TrajOptProbPtr prob) : m_prob(prob) {}
-  py::list GetDOFIndices()
+  py::object m_pyfunc;
+  ScalarFuncFromPy(py::object pyfunc) : m_pyfunc(pyfunc) {}
+  double operator()(const Eigen::VectorXd& x) const override
   {
-    RobotAndDOFPtr rad = boost::dynamic_pointer_cast<RobotAndDOF>(m_prob->GetRAD());
-    if (!rad)
-      PRINT_AND_THROW("can only call GetDOFIndices on a robot");
-    vector<int> inds = rad->GetJointIndices();
-    return toPyList(inds);
+    py::gil_scoped_acquire gil;
+    return m_pyfunc(argumentArray(x.data(), { x.size() })).cast<double>();
   }
-  void SetRobotActiveDOFs()
+};
+
+struct VectorFuncFromPy : public VectorOfVector
+{
+  py::object m_pyfunc;
+  VectorFuncFromPy(py::object pyfunc) : m_pyfunc(pyfunc) {}
+  Eigen::VectorXd operator()(const Eigen::VectorXd& x) const override
   {
-    RobotAndDOFPtr rad = boost::dynamic_pointer_cast<RobotAndDOF>(m_prob->GetRAD());
-    if (!rad)
-      PRINT_AND_THROW("can only call SetRobotActiveDOFs on a robot");
-    rad->SetRobotActiveDOFs();
+    py::gil_scoped_acquire gil;
+    DoubleArray out = toDoubleArray(m_pyfunc(argumentArray(x.data(), { x.size() })), "error function");
+    return Eigen::Map<const Eigen::VectorXd>(out.data(), out.size());
   }
-  void AddConstraint1(py::object f, py::list ijs, const string& typestr, const string& name);
-  void AddConstraint2(py::object f, py::object dfdx, py::list ijs, const string& typestr, const string& name);
-  void AddCost1(py::object f, py::list ijs, const string& name);
-  void AddErrCost1(py::object f, py::list ijs, const string& typestr, const string& name);
-  void AddErrCost2(py::object f, py::object dfdx, py::list ijs, const string& typestr, const string& name);
 };
 
-struct ScalarFuncFromPy : public ScalarOfVector
+struct MatrixFuncFromPy : public MatrixOfVector
 {
   py::object m_pyfunc;
-  ScalarFuncFromPy(py::object pyfunc) : m_pyfunc(pyfunc) {}
-  double operator()(const VectorXd& x) const
+  MatrixFuncFromPy(py::object pyfunc) : m_pyfunc(pyfunc) {}
+  Eigen::MatrixXd operator()(const Eigen::VectorXd& x) const override
   {
-    return py::extract<double>(m_pyfunc(toNdarray1<double>(x.data(), x.size())));
+    py::gil_scoped_acquire gil;
+    DoubleArray out = toDoubleArray(m_pyfunc(argumentArray(x.data(), { x.size() })), "jacobian function");
+    if (out.ndim() != 2)
+      throw py::value_error("jacobian function must return a 2d array");
+    typedef Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> RowMajorMatrix;
+    return Eigen::Map<const RowMajorMatrix>(out.data(), out.shape(0), out.shape(1));
   }
 };
-struct VectorFuncFromPy : public VectorOfVector
+
+/**
+ * @brief Error function evaluated over a block of waypoints with a single Python call
+ *
+ * The variables are laid out waypoint-major (n_waypoints x n_dof). The Python function receives an
+ * (n_waypoints, n_dof) array and returns an (n_waypoints, n_err) array, where row i only depends on waypoint i.
+ */
+struct BatchedVectorFuncFromPy : public VectorOfVector
 {
   py::object m_pyfunc;
-  VectorFuncFromPy(py::object pyfunc) : m_pyfunc(pyfunc) {}
-  VectorXd operator()(const VectorXd& x) const
+  py::ssize_t m_n_waypoints;
+  py::ssize_t m_n_dof;
+  BatchedVectorFuncFromPy(py::object pyfunc, py::ssize_t n_waypoints, py::ssize_t n_dof)
+    : m_pyfunc(pyfunc), m_n_waypoints(n_waypoints), m_n_dof(n_dof)
   {
-    py::object outarr = np_mod.attr("array")(m_pyfunc(toNdarray1<double>(x.data(), x.size())), "float64");
-    VectorXd out = Map<const VectorXd>(getPointer<double>(outarr), py::extract<int>(outarr.attr("size")));
+  }
+
+  /** @brief Evaluate the Python function, the GIL must be held */
+  DoubleArray evaluate(const Eigen::VectorXd& x) const
+  {
+    DoubleArray out = toDoubleArray(m_pyfunc(argumentArray(x.data(), { m_n_waypoints, m_n_dof })), "error function");
+    if (out.ndim() != 2 || out.shape(0) != m_n_waypoints)
+      throw py::value_error("batched error function must return an array of shape (n_waypoints, n_err)");
     return out;
   }
+
+  Eigen::VectorXd operator()(const Eigen::VectorXd& x) const override
+  {
+    py::gil_scoped_acquire gil;
+    DoubleArray out = evaluate(x);
+    return Eigen::Map<const Eigen::VectorXd>(out.data(), out.size());
+  }
 };
-struct MatrixFuncFromPy : public MatrixOfVector
+
+/**
+ * @brief Block diagonal jacobian of a batched error function
+ *
+ * If a Python jacobian is supplied it receives the (n_waypoints, n_dof) array and returns an
+ * (n_waypoints, n_err, n_dof) array. Otherwise the jacobian is computed by forward differences, perturbing the same
+ * dof of every waypoint at once since the waypoints are independent. This takes n_dof + 1 Python calls instead of one
+ * call per variable.
+ */
+struct BatchedMatrixFuncFromPy : public MatrixOfVector
 {
-  py::object m_pyfunc;
-  MatrixFuncFromPy(py::object pyfunc) : m_pyfunc(pyfunc) {}
-  MatrixXd operator()(const VectorXd& x) const
+  std::shared_ptr<BatchedVectorFuncFromPy> m_f;
+  py::object m_pydfdx;
+  BatchedMatrixFuncFromPy(std::shared_ptr<BatchedVectorFuncFromPy> f, py::object pydfdx) : m_f(f), m_pydfdx(pydfdx) {}
+  Eigen::MatrixXd operator()(const Eigen::VectorXd& x) const override
   {
-    py::object outarr = np_mod.attr("array")(m_pyfunc(toNdarray1<double>(x.data(), x.size())), "float64");
-    py::object shape = outarr.attr("shape");
-    MatrixXd out =
-        Map<const MatrixXd>(getPointer<double>(outarr), py::extract<int>(shape[0]), py::extract<int>(shape[1]));
+    py::gil_scoped_acquire gil;
+    py::ssize_t n_waypoints = m_f->m_n_waypoints;
+    py::ssize_t n_dof = m_f->m_n_dof;
+
+    if (!m_pydfdx.is_none())
+    {
+      DoubleArray jac =
+          toDoubleArray(m_pydfdx(argumentArray(x.data(), { n_waypoints, n_dof })), "batched jacobian function");
+      if (jac.ndim() != 3 || jac.shape(0) != n_waypoints || jac.shape(2) != n_dof)
+        throw py::value_error("batched jacobian function must return an array of shape (n_waypoints, n_err, n_dof)");
+
+      py::ssize_t n_err = jac.shape(1);
+      Eigen::MatrixXd out = Eigen::MatrixXd::Zero(n_waypoints * n_err, x.size());
+      auto j = jac.unchecked<3>();
+      for (py::ssize_t i = 0; i < n_waypoints; ++i)
+        for (py::ssize_t r = 0; r < n_err; ++r)
+          for (py::ssize_t c = 0; c < n_dof; ++c)
+            out(i * n_err + r, i * n_dof + c) = j(i, r, c);
+      return out;
+    }
+
+    DoubleArray y0 = m_f->evaluate(x);
+    py::ssize_t n_err = y0.shape(1);
+    auto e0 = y0.unchecked<2>();
+    Eigen::MatrixXd out = Eigen::MatrixXd::Zero(n_waypoints * n_err, x.size());
+    Eigen::VectorXd xp = x;
+    for (py::ssize_t c = 0; c < n_dof; ++c)
+    {
+      for (py::ssize_t i = 0; i < n_waypoints; ++i)
+        xp(i * n_dof + c) += BATCH_EPSILON;
+
+      DoubleArray y = m_f->evaluate(xp);
+      if (y.shape(1) != n_err)
+        throw py::value_error("batched error function must return the same number of errors at every point");
+      auto e = y.unchecked<2>();
+      for (py::ssize_t i = 0; i < n_waypoints; ++i)
+        for (py::ssize_t r = 0; r < n_err; ++r)
+          out(i * n_err + r, i * n_dof + c) = (e(i, r) - e0(i, r)) / BATCH_EPSILON;
+
+      for (py::ssize_t i = 0; i < n_waypoints; ++i)
+        xp(i * n_dof + c) = x(i * n_dof + c);
+    }
     return out;
   }
 };
 
-ConstraintType _GetConstraintType(const string& typestr)
+ConstraintType GetConstraintType(const std::string& typestr)
 {
   if (typestr == "EQ")
     return EQ;
@@ -107,7 +202,8 @@ ConstraintType _GetConstraintType(const string& typestr)
   else
     PRINT_AND_THROW("type must be \"EQ\" or \"INEQ\"");
 }
-PenaltyType _GetPenaltyType(const string& typestr)
+
+PenaltyType GetPenaltyType(const std::string& typestr)
 {
   if (typestr == "SQUARED")
     return SQUARED;
@@ -116,337 +212,233 @@ PenaltyType _GetPenaltyType(const string& typestr)
   else if (typestr == "HINGE")
     return HINGE;
   else
-    PRINT_AND_THROW("type must be \"SQUARED\" or \"ABS\" or \"HINGE\"r");
+    PRINT_AND_THROW("type must be \"SQUARED\" or \"ABS\" or \"HINGE\"");
 }
-VarVector _GetVars(py::list ijs, const VarArray& vars)
+
+VarVector GetVars(const std::vector<std::pair<int, int>>& ijs, const VarArray& vars)
 {
   VarVector out;
-  int n = py::len(ijs);
-  for (int k = 0; k < n; ++k)
-  {
-    int i = py::extract<int>(ijs[k][0]);
-    int j = py::extract<int>(ijs[k][1]);
-    out.push_back(vars(i, j));
-  }
+  out.reserve(ijs.size());
+  for (const auto& ij : ijs)
+    out.push_back(vars(ij.first, ij.second));
   return out;
 }
 
-void PyTrajOptProb::AddConstraint1(py::object f, py::list ijs, const string& typestr, const string& name)
+/** @brief All variables of the timesteps in [first_step, last_step], waypoint-major */
+VarVector GetStepVars(TrajOptProb& prob, int first_step, int last_step)
 {
-  ConstraintType type = _GetConstraintType(typestr);
-  VarVector vars = _GetVars(ijs, m_prob->GetVars());
-  ConstraintPtr c(
-      new ConstraintFromFunc(VectorOfVectorPtr(new VectorFuncFromPy(f)), vars, VectorXd::Ones(0), type, name));
-  m_prob->addConstraint(c);
-}
-void PyTrajOptProb::AddConstraint2(py::object f,
-                                   py::object dfdx,
-                                   py::list ijs,
-                                   const string& typestr,
-                                   const string& name)
-{
-  ConstraintType type = _GetConstraintType(typestr);
-  VarVector vars = _GetVars(ijs, m_prob->GetVars());
-  ConstraintPtr c(new ConstraintFromFunc(VectorOfVectorPtr(new VectorFuncFromPy(f)),
-                                         MatrixOfVectorPtr(new MatrixFuncFromPy(dfdx)),
-                                         vars,
-                                         VectorXd::Ones(0),
-                                         type,
-                                         name));
-  m_prob->addConstraint(c);
-}
-void PyTrajOptProb::AddCost1(py::object f, py::list ijs, const string& name)
-{
-  VarVector vars = _GetVars(ijs, m_prob->GetVars());
-  CostPtr c(new CostFromFunc(ScalarOfVectorPtr(new ScalarFuncFromPy(f)), vars, "f"));
-  m_prob->addCost(c);
-}
-void PyTrajOptProb::AddErrCost1(py::object f, py::list ijs, const string& typestr, const string& name)
-{
-  PenaltyType type = _GetPenaltyType(typestr);
-  VarVector vars = _GetVars(ijs, m_prob->GetVars());
-  CostPtr c(new CostFromErrFunc(VectorOfVectorPtr(new VectorFuncFromPy(f)), vars, VectorXd(), type, name));
-  m_prob->addCost(c);
-}
-void PyTrajOptProb::AddErrCost2(py::object f, py::object dfdx, py::list ijs, const string& typestr, const string& name)
-{
-  PenaltyType type = _GetPenaltyType(typestr);
-  VarVector vars = _GetVars(ijs, m_prob->GetVars());
-  CostPtr c(new CostFromErrFunc(VectorOfVectorPtr(new VectorFuncFromPy(f)),
-                                MatrixOfVectorPtr(new MatrixFuncFromPy(dfdx)),
-                                vars,
-                                VectorXd(),
-                                type,
-                                name));
-  m_prob->addCost(c);
+  if (first_step < 0 || last_step >= prob.GetNumSteps() || first_step > last_step)
+    PRINT_AND_THROW("invalid timestep range");
+
+  VarVector out;
+  for (int i = first_step; i <= last_step; ++i)
+    for (int j = 0; j < prob.GetNumDOF(); ++j)
+      out.push_back(prob.GetVars()(i, j));
+  return out;
 }
 
-Json::Value readJsonFile(const std::string& doc)
+Json::Value ParseJson(const std::string& doc)
 {
   Json::Value root;
   Json::Reader reader;
-  bool success = reader.parse(doc, root);
-  if (!success)
-    throw openrave_exception("couldn't parse string as json");
+  if (!reader.parse(doc, root))
+    PRINT_AND_THROW("couldn't parse string as json");
   return root;
 }
 
-PyTrajOptProb PyConstructProblem(const std::string& json_string, py::object py_env)
+tesseract::BasicEnvPtr LoadEnvironment(const std::string& urdf_xml_string, const std::string& srdf_xml_string)
 {
-  EnvironmentBasePtr cpp_env = GetCppEnv(py_env);
-  Json::Value json_root = readJsonFile(json_string);
-  TrajOptProbPtr cpp_prob = ConstructProblem(json_root, cpp_env);
-  return PyTrajOptProb(cpp_prob);
-}
+  urdf::ModelInterfaceSharedPtr urdf_model = urdf::parseURDF(urdf_xml_string);
+  if (urdf_model == nullptr)
+    PRINT_AND_THROW("failed to parse urdf");
 
-void SetInteractive(py::object b) { gInteractive = py::extract<bool>(b); }
-class PyTrajOptResult
-{
-public:
-  PyTrajOptResult(TrajOptResultPtr result) : m_result(result) {}
-  TrajOptResultPtr m_result;
-  py::object GetCosts()
-  {
-    py::list out;
-    int n_costs = m_result->cost_names.size();
-    for (int i = 0; i < n_costs; ++i)
-    {
-      out.append(py::make_tuple(m_result->cost_names[i], m_result->cost_vals[i]));
-    }
-    return out;
-  }
-  py::object GetConstraints()
-  {
-    py::list out;
-    int n_cnts = m_result->cnt_names.size();
-    for (int i = 0; i < n_cnts; ++i)
-    {
-      out.append(py::make_tuple(m_result->cnt_names[i], m_result->cnt_viols[i]));
-    }
-    return out;
-  }
-  py::object GetTraj()
-  {
-    TrajArray& traj = m_result->traj;
-    py::object out = np_mod.attr("empty")(py::make_tuple(traj.rows(), traj.cols()));
-    for (int i = 0; i < traj.rows(); ++i)
-    {
-      for (int j = 0; j < traj.cols(); ++j)
-      {
-        out[i][j] = traj(i, j);
-      }
-    }
-    return out;
-  }
-  py::object __str__() { return GetCosts().attr("__str__")() + GetConstraints().attr("__str__")(); }
-};
+  srdf::ModelSharedPtr srdf_model(new srdf::Model);
+  if (!srdf_model->initString(*urdf_model, srdf_xml_string))
+    PRINT_AND_THROW("failed to parse srdf");
 
-PyTrajOptResult PyOptimizeProblem(PyTrajOptProb& prob) { return OptimizeProblem(prob.m_prob, gInteractive); }
-class PyCollision
-{
-public:
-  Collision m_c;
-  PyCollision(const Collision& c) : m_c(c) {}
-  float GetDistance() { return m_c.distance; }
-};
+  tesseract_ros::KDLEnvPtr env(new tesseract_ros::KDLEnv);
+  if (!env->init(urdf_model, srdf_model))
+    PRINT_AND_THROW("failed to initialize environment");
 
-py::list toPyList(const vector<Collision>& collisions)
-{
-  py::list out;
-  BOOST_FOREACH (const Collision& c, collisions)
-  {
-    out.append(PyCollision(c));
-  }
-  return out;
+  return env;
 }
 
-class PyGraphHandle
+void AddCost(TrajOptProb& prob, py::object f, const std::vector<std::pair<int, int>>& ijs, const std::string& name)
 {
-  vector<GraphHandlePtr> m_handles;
-
-public:
-  PyGraphHandle(const vector<GraphHandlePtr>& handles) : m_handles(handles) {}
-  PyGraphHandle(GraphHandlePtr handle) : m_handles(1, handle) {}
-  void SetTransparency1(float alpha)
-  {
-    BOOST_FOREACH (GraphHandlePtr& handle, m_handles)
-    {
-      SetTransparency(handle, alpha);
-    }
-  }
-};
+  ScalarOfVectorPtr func(new ScalarFuncFromPy(f));
+  prob.addCost(CostPtr(new CostFromFunc(func, GetVars(ijs, prob.GetVars()), name)));
+}
 
-class PyCollisionChecker
+void AddErrorCost(TrajOptProb& prob,
+                  py::object f,
+                  py::object dfdx,
+                  const std::vector<std::pair<int, int>>& ijs,
+                  const std::string& typestr,
+                  const std::string& name)
 {
-public:
-  py::object AllVsAll()
-  {
-    vector<Collision> collisions;
-    m_cc->AllVsAll(collisions);
-    return toPyList(collisions);
-  }
-  py::object BodyVsAll(py::object py_kb)
-  {
-    KinBodyPtr cpp_kb = boost::const_pointer_cast<EnvironmentBase>(m_cc->GetEnv())
-                            ->GetBodyFromEnvironmentId(py::extract<int>(py_kb.attr("GetEnvironmentId")()));
-    if (!cpp_kb)
-    {
-      throw openrave_exception("body isn't part of environment!");
-    }
-    vector<Collision> collisions;
-    m_cc->BodyVsAll(*cpp_kb, collisions);
-    return toPyList(collisions);
-  }
-  PyGraphHandle PlotCollisionGeometry()
-  {
-    vector<GraphHandlePtr> handles;
-    m_cc->PlotCollisionGeometry(handles);
-    return PyGraphHandle(handles);
-  }
-  void ExcludeCollisionPair(py::object link0, py::object link1)
-  {
-    EnvironmentBasePtr env = boost::const_pointer_cast<EnvironmentBase>(m_cc->GetEnv());
-    m_cc->ExcludeCollisionPair(*GetCppLink(link0, env), *GetCppLink(link1, env));
-  }
-  void IncludeCollisionPair(py::object link0, py::object link1)
-  {
-    EnvironmentBasePtr env = boost::const_pointer_cast<EnvironmentBase>(m_cc->GetEnv());
-    m_cc->IncludeCollisionPair(*GetCppLink(link0, env), *GetCppLink(link1, env));
-  }
-  PyCollisionChecker(CollisionCheckerPtr cc) : m_cc(cc) {}
-private:
-  PyCollisionChecker();
-  CollisionCheckerPtr m_cc;
-};
+  MatrixOfVectorPtr jac;
+  if (!dfdx.is_none())
+    jac.reset(new MatrixFuncFromPy(dfdx));
+  prob.addCost(CostPtr(new CostFromErrFunc(VectorOfVectorPtr(new VectorFuncFromPy(f)),
+                                           jac,
+                                           GetVars(ijs, prob.GetVars()),
+                                           Eigen::VectorXd(),
+                                           GetPenaltyType(typestr),
+                                           name)));
+}
 
-PyCollisionChecker PyGetCollisionChecker(py::object py_env)
+void AddConstraint(TrajOptProb& prob,
+                   py::object f,
+                   py::object dfdx,
+                   const std::vector<std::pair<int, int>>& ijs,
+                   const std::string& typestr,
+                   const std::string& name)
 {
-  CollisionCheckerPtr cc = CollisionChecker::GetOrCreate(*GetCppEnv(py_env));
-  return PyCollisionChecker(cc);
+  MatrixOfVectorPtr jac;
+  if (!dfdx.is_none())
+    jac.reset(new MatrixFuncFromPy(dfdx));
+  prob.addConstraint(ConstraintPtr(new ConstraintFromErrFunc(VectorOfVectorPtr(new VectorFuncFromPy(f)),
+                                                             jac,
+                                                             GetVars(ijs, prob.GetVars()),
+                                                             Eigen::VectorXd(),
+                                                             GetConstraintType(typestr),
+                                                             name)));
 }
 
-class PyOSGViewer
+void AddBatchedErrorCost(TrajOptProb& prob,
+                         py::object f,
+                         py::object dfdx,
+                         int first_step,
+                         int last_step,
+                         const std::string& typestr,
+                         const std::string& name)
 {
-public:
-  PyOSGViewer(OSGViewerPtr viewer) : m_viewer(viewer) {}
-  int Step()
-  {
-    m_viewer->UpdateSceneData();
-    m_viewer->Draw();
-    return 0;
-  }
-  void UpdateSceneData() { m_viewer->UpdateSceneData(); }
-  PyGraphHandle PlotKinBody(py::object py_kb)
-  {
-    return PyGraphHandle(m_viewer->PlotKinBody(GetCppKinBody(py_kb, m_viewer->GetEnv())));
-  }
-  PyGraphHandle PlotLink(py::object py_link)
-  {
-    return PyGraphHandle(m_viewer->PlotLink(GetCppLink(py_link, m_viewer->GetEnv())));
-  }
-  void SetTransparency(py::object py_kb, float alpha)
-  {
-    m_viewer->SetTransparency(GetCppKinBody(py_kb, m_viewer->GetEnv()), alpha);
-  }
-  void SetAllTransparency(float a) { m_viewer->SetAllTransparency(a); }
-  void Idle()
-  {
-    assert(!!m_viewer);
-    m_viewer->Idle();
-  }
-  PyGraphHandle DrawText(std::string text, float x, float y, float fontsize, py::object pycolor)
-  {
-    OpenRAVE::Vector color = OpenRAVE::Vector(py::extract<float>(pycolor[0]),
-                                              py::extract<float>(pycolor[1]),
-                                              py::extract<float>(pycolor[2]),
-                                              py::extract<float>(pycolor[3]));
-    return PyGraphHandle(m_viewer->drawtext(text, x, y, fontsize, color));
-  }
+  VarVector vars = GetStepVars(prob, first_step, last_step);
+  auto func = std::make_shared<BatchedVectorFuncFromPy>(f, last_step - first_step + 1, prob.GetNumDOF());
+  MatrixOfVectorPtr jac(new BatchedMatrixFuncFromPy(func, dfdx));
+  prob.addCost(CostPtr(new CostFromErrFunc(func, jac, vars, Eigen::VectorXd(), GetPenaltyType(typestr), name)));
+}
 
-private:
-  OSGViewerPtr m_viewer;
-  PyOSGViewer() {}
-};
-PyOSGViewer PyGetViewer(py::object py_env)
+void AddBatchedConstraint(TrajOptProb& prob,
+                          py::object f,
+                          py::object dfdx,
+                          int first_step,
+                          int last_step,
+                          const std::string& typestr,
+                          const std::string& name)
 {
-  EnvironmentBasePtr env = GetCppEnv(py_env);
-  OSGViewerPtr viewer = OSGViewer::GetOrCreate(env);
-  ALWAYS_ASSERT(!!viewer);
-  return PyOSGViewer(viewer);
+  VarVector vars = GetStepVars(prob, first_step, last_step);
+  auto func = std::make_shared<BatchedVectorFuncFromPy>(f, last_step - first_step + 1, prob.GetNumDOF());
+  MatrixOfVectorPtr jac(new BatchedMatrixFuncFromPy(func, dfdx));
+  prob.addConstraint(
+      ConstraintPtr(new ConstraintFromErrFunc(func, jac, vars, Eigen::VectorXd(), GetConstraintType(typestr), name)));
 }
+}  // namespace
 
-BOOST_PYTHON_MODULE(ctrajoptpy)
+PYBIND11_MODULE(ctrajoptpy, m)
 {
-  np_mod = py::import("numpy");
+  m.doc() = "Python bindings for trajopt";
 
-  py::object openravepy = py::import("openravepy");
+  py::class_<tesseract::BasicEnv, tesseract::BasicEnvPtr>(m, "Environment");
+  m.def("LoadEnvironment",
+        &LoadEnvironment,
+        py::arg("urdf_xml_string"),
+        py::arg("srdf_xml_string"),
+        "create a collision environment from urdf and srdf strings");
 
-  string pyversion = py::extract<string>(openravepy.attr("__version__"));
-  if (OPENRAVE_VERSION_STRING != pyversion)
-  {
-    PRINT_AND_THROW("the openrave on your pythonpath is different from the "
-                    "openrave version that trajopt links to!");
-  }
+  py::class_<ProblemConstructionInfo>(m, "ProblemConstructionInfo")
+      .def(py::init([](tesseract::BasicEnvPtr env) { return new ProblemConstructionInfo(env); }))
+      .def("fromJson",
+           [](ProblemConstructionInfo& pci, const std::string& json_string) { pci.fromJson(ParseJson(json_string)); });
 
-  py::class_<PyTrajOptProb>("TrajOptProb", py::no_init)
-      .def("GetDOFIndices", &PyTrajOptProb::GetDOFIndices)
-      .def("SetRobotActiveDOFs",
-           &PyTrajOptProb::SetRobotActiveDOFs,
-           "Sets the active DOFs of the robot to the DOFs in the optimization "
-           "problem")
-      .def("AddConstraint",
-           &PyTrajOptProb::AddConstraint1,
-           "Add constraint from python function (using numerical "
-           "differentiation)",
-           (py::arg("f"), "var_ijs", "constraint_type", "name"))
-      .def("AddConstraint",
-           &PyTrajOptProb::AddConstraint2,
-           "Add constraint from python error function and analytic derivative",
-           (py::arg("f"), "dfdx", "var_ijs", "constraint_type", "name"))
-      .def("AddCost",
-           &PyTrajOptProb::AddCost1,
-           "Add cost from python "
-           "scalar-valued function (using "
-           "numerical differentiation)",
-           (py::arg("func"), "var_ijs", "name"))
+  // The problem owns the Python callbacks, so the Python objects are released when the last reference goes away
+  py::class_<TrajOptProb, TrajOptProbPtr>(m, "TrajOptProb")
+      .def("GetNumSteps", &TrajOptProb::GetNumSteps)
+      .def("GetNumDOF", &TrajOptProb::GetNumDOF)
+      .def("GetInitTraj", &TrajOptProb::GetInitTraj)
+      .def("SetInitTraj",
+           [](TrajOptProb& prob, const Eigen::Ref<const TrajArray>& traj) { prob.SetInitTraj(traj); })
+      .def("AddCost", &AddCost, py::arg("f"), py::arg("ijs"), py::arg("name") = "py_cost")
       .def("AddErrorCost",
-           &PyTrajOptProb::AddErrCost1,
-           "Add error cost from python vector-valued error function (using "
-           "numerical differentiation)",
-           (py::arg("f"), "var_ijs", "penalty_type", "name"))
-      .def("AddErrorCost",
-           &PyTrajOptProb::AddErrCost2,
-           "Add error cost from python vector-valued error function and "
-           "analytic derivative",
-           (py::arg("f"), "dfdx", "var_ijs", "penalty_type", "name"));
-  py::def("SetInteractive", &SetInteractive, "if True, pause and plot every iteration");
-  py::def("ConstructProblem", &PyConstructProblem, "create problem from JSON string");
-  py::def("OptimizeProblem", &PyOptimizeProblem);
-
-  py::class_<PyTrajOptResult>("TrajOptResult", py::no_init)
-      .def("GetCosts", &PyTrajOptResult::GetCosts)
-      .def("GetConstraints", &PyTrajOptResult::GetConstraints)
-      .def("GetTraj", &PyTrajOptResult::GetTraj)
-      .def("__str__", &PyTrajOptResult::__str__);
-
-  py::class_<PyCollisionChecker>("CollisionChecker", py::no_init)
-      .def("AllVsAll", &PyCollisionChecker::AllVsAll)
-      .def("BodyVsAll", &PyCollisionChecker::BodyVsAll)
-      .def("PlotCollisionGeometry", &PyCollisionChecker::PlotCollisionGeometry)
-      .def("ExcludeCollisionPair", &PyCollisionChecker::ExcludeCollisionPair)
-      .def("IncludeCollisionPair", &PyCollisionChecker::IncludeCollisionPair);
-  py::def("GetCollisionChecker", &PyGetCollisionChecker);
-  py::class_<PyCollision>("Collision", py::no_init).def("GetDistance", &PyCollision::GetDistance);
-  py::class_<PyGraphHandle>("GraphHandle", py::no_init).def("SetTransparency", &PyGraphHandle::SetTransparency1);
-
-  py::class_<PyOSGViewer>("OSGViewer", py::no_init)
-      .def("UpdateSceneData", &PyOSGViewer::UpdateSceneData)
-      .def("Step", &PyOSGViewer::Step)
-      .def("PlotKinBody", &PyOSGViewer::PlotKinBody)
-      .def("PlotLink", &PyOSGViewer::PlotLink)
-      .def("SetTransparency", &PyOSGViewer::SetTransparency)
-      .def("SetAllTransparency", &PyOSGViewer::SetAllTransparency)
-      .def("Idle", &PyOSGViewer::Idle)
-      .def("DrawText", &PyOSGViewer::DrawText);
-  py::def("GetViewer", &PyGetViewer, "Get OSG viewer for environment or create a new one");
+           &AddErrorCost,
+           py::arg("f"),
+           py::arg("dfdx") = py::none(),
+           py::arg("ijs"),
+           py::arg("type") = "SQUARED",
+           py::arg("name") = "py_cost",
+           "error cost on the variables at (timestep, dof) pairs ijs, f(x) receives a copy of the variables")
+      .def("AddConstraint",
+           &AddConstraint,
+           py::arg("f"),
+           py::arg("dfdx") = py::none(),
+           py::arg("ijs"),
+           py::arg("type") = "EQ",
+           py::arg("name") = "py_cnt")
+      .def("AddBatchedErrorCost",
+           &AddBatchedErrorCost,
+           py::arg("f"),
+           py::arg("dfdx") = py::none(),
+           py::arg("first_step"),
+           py::arg("last_step"),
+           py::arg("type") = "SQUARED",
+           py::arg("name") = "py_batched_cost",
+           "error cost evaluated over all waypoints in [first_step, last_step] with one call, "
+           "f(X) maps an (n, n_dof) array to an (n, n_err) array")
+      .def("AddBatchedConstraint",
+           &AddBatchedConstraint,
+           py::arg("f"),
+           py::arg("dfdx") = py::none(),
+           py::arg("first_step"),
+           py::arg("last_step"),
+           py::arg("type") = "EQ",
+           py::arg("name") = "py_batched_cnt");
+
+  m.def("ConstructProblem",
+        [](const ProblemConstructionInfo& pci) { return ConstructProblem(pci); },
+        "create problem from construction info");
+  m.def("ConstructProblem",
+        [](const std::string& json_string, tesseract::BasicEnvPtr env) {
+          return ConstructProblem(ParseJson(json_string), env);
+        },
+        "create problem from JSON string");
+
+  // Optimization runs without the GIL, Python callbacks reacquire it only while they execute
+  m.def("OptimizeProblem",
+        [](TrajOptProbPtr prob) { return OptimizeProblem(prob); },
+        py::call_guard<py::gil_scoped_release>());
+
+  // Results are exposed as NumPy views that keep the C++ result alive, nothing is copied
+  py::class_<TrajOptResult, TrajOptResultPtr>(m, "TrajOptResult")
+      .def_readonly("cost_names", &TrajOptResult::cost_names)
+      .def_readonly("cnt_names", &TrajOptResult::cnt_names)
+      .def_property_readonly("cost_vals",
+                             [](py::object self) {
+                               const TrajOptResult& r = self.cast<const TrajOptResult&>();
+                               return readOnlyView(
+                                   r.cost_vals.data(), { static_cast<py::ssize_t>(r.cost_vals.size()) }, self);
+                             })
+      .def_property_readonly("cnt_viols",
+                             [](py::object self) {
+                               const TrajOptResult& r = self.cast<const TrajOptResult&>();
+                               return readOnlyView(
+                                   r.cnt_viols.data(), { static_cast<py::ssize_t>(r.cnt_viols.size()) }, self);
+                             })
+      .def_property_readonly("traj",
+                             [](py::object self) {
+                               const TrajOptResult& r = self.cast<const TrajOptResult&>();
+                               return readOnlyView(r.traj.data(), { r.traj.rows(), r.traj.cols() }, self);
+                             })
+      .def("GetCosts",
+           [](const TrajOptResult& r) {
+             std::vector<std::pair<std::string, double>> out;
+             for (size_t i = 0; i < r.cost_names.size(); ++i)
+               out.emplace_back(r.cost_names[i], r.cost_vals[i]);
+             return out;
+           })
+      .def("GetConstraints", [](const TrajOptResult& r) {
+        std::vector<std::pair<std::string, double>> out;
+        for (size_t i = 0; i < r.cnt_names.size(); ++i)
+          out.emplace_back(r.cnt_names[i], r.cnt_viols[i]);
+        return out;
+      });
 }
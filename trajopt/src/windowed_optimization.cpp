@@ -0,0 +1,275 @@
+#include <trajopt_utils/macros.h>
+TRAJOPT_IGNORE_WARNINGS_PUSH
+#include <atomic>
+#include <boost/format.hpp>
+#include <cmath>
+#include <exception>
+#include <mutex>
+#include <thread>
+TRAJOPT_IGNORE_WARNINGS_POP
+
+#include <trajopt/utils.hpp>
+#include <trajopt/windowed_optimization.hpp>
+#include <trajopt_sco/expr_ops.hpp>
+#include <trajopt_sco/modeling_utils.hpp>
+#include <trajopt_utils/logging.hpp>
+
+namespace trajopt
+{
+namespace
+{
+/** @brief Penalty rho / 2 * || x - target ||^2 pulling the shared waypoints of a window towards the consensus */
+class ConsensusCost : public sco::Cost
+{
+public:
+  ConsensusCost(const sco::VarVector& vars)
+    : Cost("consensus"), vars_(vars), targets_(Eigen::VectorXd::Zero(static_cast<long>(vars.size()))), rho_(0)
+  {
+  }
+
+  void setTargets(const Eigen::VectorXd& targets, double rho)
+  {
+    assert(targets.size() == targets_.size());
+    targets_ = targets;
+    rho_ = rho;
+  }
+
+  double value(const DblVec& x) override { return 0.5 * rho_ * (sco::getVec(x, vars_) - targets_).squaredNorm(); }
+
+  sco::ConvexObjectivePtr convex(const DblVec& /*x*/, sco::Model* model) override
+  {
+    sco::ConvexObjectivePtr out(new sco::ConvexObjective(model));
+    if (rho_ <= 0)
+      return out;
+
+    for (size_t i = 0; i < vars_.size(); ++i)
+    {
+      sco::AffExpr err(vars_[i]);
+      sco::exprDec(err, targets_[static_cast<long>(i)]);
+      out->addLeastSquares(err, 0.5 * rho_);
+    }
+    return out;
+  }
+
+  sco::VarVector getVars() override { return vars_; }
+
+private:
+  sco::VarVector vars_;
+  Eigen::VectorXd targets_;
+  double rho_;
+};
+typedef std::shared_ptr<ConsensusCost> ConsensusCostPtr;
+
+struct Window
+{
+  int first_step;
+  int last_step;
+  TrajOptProbPtr prob;
+  /** @brief Local rows of the window shared with another window */
+  std::vector<int> shared_rows;
+  ConsensusCostPtr consensus;
+  /** @brief Current solution of the window */
+  DblVec x;
+  /** @brief Scaled dual variables of the shared rows (n_window_steps x n_dof, unshared rows stay zero) */
+  Eigen::MatrixXd u;
+  TrajOptResultPtr result;
+};
+
+/** @brief Apply f to every window using up to num_threads threads, rethrowing the first exception */
+void forEachWindow(std::vector<Window>& windows, int num_threads, const std::function<void(Window&)>& f)
+{
+  std::atomic<size_t> next(0);
+  std::exception_ptr error;
+  std::mutex error_mutex;
+  auto worker = [&]() {
+    for (size_t i = next++; i < windows.size(); i = next++)
+    {
+      try
+      {
+        f(windows[i]);
+      }
+      catch (...)
+      {
+        std::lock_guard<std::mutex> lock(error_mutex);
+        if (!error)
+          error = std::current_exception();
+      }
+    }
+  };
+
+  size_t n_threads = std::min(windows.size(), static_cast<size_t>(num_threads));
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < n_threads; ++i)
+    threads.emplace_back(worker);
+  worker();
+  for (std::thread& t : threads)
+    t.join();
+
+  if (error)
+    std::rethrow_exception(error);
+}
+
+void solveWindow(Window& w, const sco::BasicTrustRegionSQPParameters& sqp_params)
+{
+  sco::BasicTrustRegionSQP opt(w.prob);
+  opt.setParameters(sqp_params);
+  opt.initialize(w.x);
+  opt.optimize();
+  w.x = opt.results().x;
+  w.result.reset(new TrajOptResult(opt.results(), *w.prob));
+}
+}  // namespace
+
+WindowedOptimizationParameters::WindowedOptimizationParameters()
+  : window_size(20), window_overlap(4), max_admm_iter(20), rho(10), consensus_tol(1e-3), num_threads(1)
+{
+  sqp_params.max_iter = 40;
+  sqp_params.min_approx_improve_frac = .001;
+  sqp_params.improve_ratio_threshold = .2;
+  sqp_params.merit_error_coeff = 20;
+}
+
+WindowedOptimizationResultPtr OptimizeWindowed(int n_steps,
+                                               const WindowProblemFactory& factory,
+                                               const WindowedOptimizationParameters& params)
+{
+  if (params.window_size < 2 || params.window_overlap < 1 || params.window_overlap >= params.window_size)
+    PRINT_AND_THROW("window_overlap must be at least 1 and smaller than window_size");
+
+  int num_threads = params.num_threads;
+  if (num_threads <= 0)
+    num_threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+
+  // Split the trajectory into overlapping windows
+  std::vector<Window> windows;
+  int stride = params.window_size - params.window_overlap;
+  for (int first_step = 0;; first_step += stride)
+  {
+    Window w;
+    w.first_step = first_step;
+    w.last_step = std::min(first_step + params.window_size, n_steps) - 1;
+    windows.push_back(w);
+    if (w.last_step == n_steps - 1)
+      break;
+  }
+
+  std::vector<int> step_count(static_cast<size_t>(n_steps), 0);
+  for (const Window& w : windows)
+    for (int i = w.first_step; i <= w.last_step; ++i)
+      ++step_count[static_cast<size_t>(i)];
+
+  // Create the window problems on this thread, since problems are usually built against a shared environment
+  for (Window& w : windows)
+  {
+    w.prob = factory(w.first_step, w.last_step);
+    if (!w.prob || w.prob->GetNumSteps() != w.last_step - w.first_step + 1)
+      PRINT_AND_THROW(boost::format("window problem for steps [%i, %i] has the wrong number of steps") %
+                      w.first_step % w.last_step);
+  }
+
+  // The windows are solved concurrently, so they must not share the non thread-safe environment or kinematics
+  if (num_threads > 1)
+  {
+    for (size_t i = 0; i < windows.size(); ++i)
+      for (size_t j = i + 1; j < windows.size(); ++j)
+        if (windows[i].prob->GetEnv() == windows[j].prob->GetEnv() ||
+            windows[i].prob->GetKin() == windows[j].prob->GetKin())
+          PRINT_AND_THROW("windows optimized on several threads must not share an environment or kinematics, "
+                          "set num_threads to 1 or build each window against its own environment");
+  }
+
+  int n_dof = static_cast<int>(windows.front().prob->GetKin()->numJoints());
+  for (Window& w : windows)
+  {
+    sco::VarVector shared_vars;
+    for (int i = w.first_step; i <= w.last_step; ++i)
+    {
+      if (step_count[static_cast<size_t>(i)] < 2)
+        continue;
+
+      int row = i - w.first_step;
+      w.shared_rows.push_back(row);
+      sco::VarVector row_vars = w.prob->GetVarRow(row, 0, n_dof);
+      shared_vars.insert(shared_vars.end(), row_vars.begin(), row_vars.end());
+    }
+
+    w.consensus.reset(new ConsensusCost(shared_vars));
+    w.prob->addCost(w.consensus);
+    w.x = trajToDblVec(w.prob->GetInitTraj());
+    w.u = Eigen::MatrixXd::Zero(w.last_step - w.first_step + 1, n_dof);
+  }
+
+  WindowedOptimizationResultPtr result(new WindowedOptimizationResult);
+  result->traj = TrajArray::Zero(n_steps, n_dof);
+  result->admm_iter = 0;
+  result->primal_residual = 0;
+  result->converged = windows.size() == 1;
+
+  TrajArray& z = result->traj;
+  for (int iter = 0; iter <= params.max_admm_iter; ++iter)
+  {
+    // The first round solves the windows independently to seed the consensus
+    forEachWindow(windows, num_threads, [&params](Window& w) { solveWindow(w, params.sqp_params); });
+    if (windows.size() == 1)
+    {
+      z = getTraj(windows.front().x, windows.front().prob->GetVars()).leftCols(n_dof);
+      break;
+    }
+
+    // Consensus update: average of the windows on the shared waypoints
+    TrajArray z_prev = z;
+    z.setZero();
+    std::vector<TrajArray> window_trajs;
+    for (Window& w : windows)
+    {
+      window_trajs.push_back(getTraj(w.x, w.prob->GetVars()).leftCols(n_dof));
+      z.middleRows(w.first_step, window_trajs.back().rows()) += window_trajs.back() + w.u;
+    }
+    for (int i = 0; i < n_steps; ++i)
+      z.row(i) /= step_count[static_cast<size_t>(i)];
+
+    // Dual update and residuals
+    double primal_residual = 0;
+    for (size_t k = 0; k < windows.size(); ++k)
+    {
+      Window& w = windows[k];
+      for (int row : w.shared_rows)
+      {
+        Eigen::VectorXd r = window_trajs[k].row(row) - z.row(w.first_step + row);
+        w.u.row(row) += r.transpose();
+        primal_residual = std::max(primal_residual, r.cwiseAbs().maxCoeff());
+      }
+    }
+    double dual_residual = (iter == 0) ? INFINITY : params.rho * (z - z_prev).cwiseAbs().maxCoeff();
+
+    result->admm_iter = iter;
+    result->primal_residual = primal_residual;
+    LOG_INFO("consensus iteration %i: primal residual %g, dual residual %g", iter, primal_residual, dual_residual);
+    if (primal_residual < params.consensus_tol && dual_residual < params.consensus_tol)
+    {
+      result->converged = true;
+      break;
+    }
+
+    // Pull the shared waypoints of every window towards the consensus
+    for (Window& w : windows)
+    {
+      Eigen::VectorXd targets(static_cast<long>(w.shared_rows.size()) * n_dof);
+      for (size_t j = 0; j < w.shared_rows.size(); ++j)
+      {
+        int row = w.shared_rows[j];
+        targets.segment(static_cast<long>(j) * n_dof, n_dof) = (z.row(w.first_step + row) - w.u.row(row)).transpose();
+      }
+      w.consensus->setTargets(targets, params.rho);
+    }
+  }
+
+  for (const Window& w : windows)
+    result->window_results.push_back(w.result);
+
+  if (!result->converged)
+    LOG_WARN("windowed optimization did not reach consensus, primal residual %g", result->primal_residual);
+
+  return result;
+}
+}  // namespace trajopt
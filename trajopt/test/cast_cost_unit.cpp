@@ -1,6 +1,7 @@
 #include <trajopt_utils/macros.h>
 TRAJOPT_IGNORE_WARNINGS_PUSH
 #include <ctime>
+#include <map>
 #include <gtest/gtest.h>
 #include <ros/package.h>
 #include <ros/ros.h>
@@ -112,6 +113,167 @@ TEST_F(CastTest, boxes)
   ROS_INFO((found) ? ("Final trajectory is in collision") : ("Final trajectory is collision free"));
 }
 
+TEST_F(CastTest, boxes_subdivided)
+{
+  ROS_DEBUG("CastTest, boxes_subdivided");
+
+  std::string package_path = ros::package::getPath("trajopt_test_support");
+  Json::Value root = readJsonFile(package_path + "/config/box_cast_test.json");
+  root["costs"][1]["params"]["max_segment_length"] = 0.5;
+
+  std::unordered_map<std::string, double> ipos;
+  ipos["boxbot_x_joint"] = -1.9;
+  ipos["boxbot_y_joint"] = 0;
+  env_->setState(ipos);
+
+  TrajOptProbPtr prob = ConstructProblem(root, env_);
+  ASSERT_TRUE(!!prob);
+
+  // The initial segments move the box 1.9 in each joint, so they are cast as four sub-segments
+  CastCollisionEvaluator evaluator(prob->GetKin(),
+                                   prob->GetEnv(),
+                                   SafetyMarginDataPtr(new SafetyMarginData(0.2, 10)),
+                                   prob->GetVarRow(0, 0, 2),
+                                   prob->GetVarRow(1, 0, 2),
+                                   0.5);
+  DblVec x = trajToDblVec(prob->GetInitTraj());
+  EXPECT_EQ(evaluator.NumSegments(x), 4);
+
+  tesseract::ContactResultVector dist_results;
+  evaluator.CalcCollisions(x, dist_results);
+  ASSERT_FALSE(dist_results.empty());
+  sco::AffExprVector exprs;
+  evaluator.CalcDistExpressions(x, exprs);
+  EXPECT_EQ(exprs.size(), dist_results.size());
+
+  // Every link pair only keeps the contacts of a single sub-segment
+  std::map<std::pair<std::string, std::string>, std::pair<double, double>> cc_time_range;
+  for (const auto& res : dist_results)
+  {
+    auto key = std::make_pair(res.link_names[0], res.link_names[1]);
+    auto it = cc_time_range.find(key);
+    if (it == cc_time_range.end())
+      cc_time_range[key] = std::make_pair(res.cc_time, res.cc_time);
+    else
+      it->second = std::make_pair(std::min(it->second.first, res.cc_time), std::max(it->second.second, res.cc_time));
+  }
+  for (const auto& range : cc_time_range)
+    EXPECT_LE(range.second.second - range.second.first, 0.25 + 1e-9);
+  for (std::size_t i = 0; i < exprs.size(); ++i)
+  {
+    EXPECT_GE(dist_results[i].cc_time, 0.0);
+    EXPECT_LE(dist_results[i].cc_time, 1.0);
+    // The linearization is exact at the point it was taken
+    EXPECT_NEAR(exprs[i].value(x), dist_results[i].distance, 1e-6);
+  }
+
+  sco::BasicTrustRegionSQP opt(prob);
+  opt.initialize(x);
+  opt.optimize();
+
+  std::vector<tesseract::ContactResultMap> collisions;
+  ContinuousContactManagerBasePtr manager = prob->GetEnv()->getContinuousContactManager();
+  manager->setActiveCollisionObjects(prob->GetKin()->getLinkNames());
+  manager->setContactDistanceThreshold(0);
+
+  bool found = tesseract::continuousCollisionCheckTrajectory(
+      *manager, *prob->GetEnv(), *prob->GetKin(), getTraj(opt.x(), prob->GetVars()), collisions);
+
+  EXPECT_FALSE(found);
+  ROS_INFO((found) ? ("Final trajectory is in collision") : ("Final trajectory is collision free"));
+}
+
+TEST_F(CastTest, exact_penalty_matches_model)
+{
+  ROS_DEBUG("CastTest, exact_penalty_matches_model");
+
+  std::string package_path = ros::package::getPath("trajopt_test_support");
+  Json::Value root = readJsonFile(package_path + "/config/box_cast_test.json");
+
+  std::unordered_map<std::string, double> ipos;
+  ipos["boxbot_x_joint"] = -1.9;
+  ipos["boxbot_y_joint"] = 0;
+  env_->setState(ipos);
+
+  TrajOptProbPtr prob = ConstructProblem(root, env_);
+  ASSERT_TRUE(!!prob);
+
+  SafetyMarginDataPtr margin(new SafetyMarginData(0.2, 10));
+  DblVec x = trajToDblVec(prob->GetInitTraj());
+  std::vector<sco::ConstraintPtr> cnts;
+  for (int i = 0; i < 2; ++i)
+  {
+    // Once with the exact penalty computed first and once with the convexification computed first
+    cnts.push_back(std::make_shared<CollisionConstraint>(prob->GetKin(), prob->GetEnv(), margin, prob->GetVarRow(1)));
+    cnts.push_back(std::make_shared<CollisionConstraint>(
+        prob->GetKin(), prob->GetEnv(), margin, prob->GetVarRow(0), prob->GetVarRow(1)));
+    cnts.push_back(std::make_shared<CollisionConstraint>(
+        prob->GetKin(), prob->GetEnv(), margin, prob->GetVarRow(0), prob->GetVarRow(1), 0.5));
+  }
+
+  // The exact penalty computed first comes from the distance only query, which must find the same contacts
+  for (std::size_t i = 0; i < cnts.size(); ++i)
+  {
+    double exact, model;
+    if (i < 3)
+    {
+      exact = cnts[i]->violation(x);
+      model = cnts[i]->convex(x, prob->getModel().get())->violation(x);
+    }
+    else
+    {
+      model = cnts[i]->convex(x, prob->getModel().get())->violation(x);
+      exact = cnts[i]->violation(x);
+    }
+    EXPECT_NEAR(exact, model, 1e-6);
+  }
+  EXPECT_GT(cnts[1]->violation(x), 0);
+  EXPECT_GT(cnts[2]->violation(x), 0);
+}
+
+TEST_F(CastTest, boxes_pipelined)
+{
+  ROS_DEBUG("CastTest, boxes_pipelined");
+
+  std::string package_path = ros::package::getPath("trajopt_test_support");
+  Json::Value root = readJsonFile(package_path + "/config/box_cast_test.json");
+
+  std::unordered_map<std::string, double> ipos;
+  ipos["boxbot_x_joint"] = -1.9;
+  ipos["boxbot_y_joint"] = 0;
+  env_->setState(ipos);
+
+  // The collision terms are not thread safe, so they are convexified after the trial point is evaluated
+  std::vector<sco::OptResults> results;
+  for (bool pipelined : { false, true })
+  {
+    TrajOptProbPtr prob = ConstructProblem(root, env_);
+    ASSERT_TRUE(!!prob);
+    bool has_collision_term = false;
+    for (const sco::CostPtr& cost : prob->getCosts())
+    {
+      if (std::dynamic_pointer_cast<CollisionCost>(cost))
+      {
+        has_collision_term = true;
+        EXPECT_FALSE(cost->isThreadSafe());
+      }
+    }
+    EXPECT_TRUE(has_collision_term);
+
+    sco::BasicTrustRegionSQP opt(prob);
+    opt.getParameters().pipelined_convexification = pipelined;
+    opt.initialize(trajToDblVec(prob->GetInitTraj()));
+    opt.optimize();
+    results.push_back(opt.results());
+  }
+
+  ASSERT_EQ(results[1].x.size(), results[0].x.size());
+  for (std::size_t i = 0; i < results[0].x.size(); ++i)
+    EXPECT_NEAR(results[1].x[i], results[0].x[i], 1e-6);
+  EXPECT_EQ(results[1].status, results[0].status);
+  EXPECT_EQ(results[1].n_func_evals, results[0].n_func_evals);
+}
+
 int main(int argc, char** argv)
 {
   testing::InitGoogleTest(&argc, argv);
@@ -12,6 +12,7 @@ TRAJOPT_IGNORE_WARNINGS_POP
 #include <tesseract_ros/kdl/kdl_env.h>
 #include <tesseract_ros/ros_basic_plotting.h>
 #include <trajopt/common.hpp>
+#include <trajopt/kinematic_terms.hpp>
 #include <trajopt/plot_callback.hpp>
 #include <trajopt/problem_description.hpp>
 #include <trajopt_sco/optimizers.hpp>
@@ -887,6 +888,179 @@ TEST_F(CostsTest, inequality_jointAcc)
 
 ////////////////////////////////////////////////////////////////////
 
+/**
+ * @brief Compares the analytic jacobian of the cartesian path errors with central differences
+ *
+ * Also checks that a rotation tolerance is an angle: a rotation just inside it about one target axis has no error.
+ */
+TEST_F(CostsTest, cartesianPath_jacobian)
+{
+  ROS_DEBUG("CostsTest, cartesianPath_jacobian");
+
+  std::unordered_map<std::string, double> ipos;
+  ipos["torso_lift_joint"] = 0;
+  ipos["r_shoulder_pan_joint"] = -1.832;
+  ipos["r_shoulder_lift_joint"] = -0.332;
+  ipos["r_upper_arm_roll_joint"] = -1.011;
+  ipos["r_elbow_flex_joint"] = -1.437;
+  ipos["r_forearm_roll_joint"] = -1.1;
+  ipos["r_wrist_flex_joint"] = -1.926;
+  ipos["r_wrist_roll_joint"] = 3.074;
+  env_->setState(ipos);
+
+  ProblemConstructionInfo pci(env_);
+  pci.basic_info.n_steps = 2;
+  pci.basic_info.manip = "right_arm";
+  pci.basic_info.start_fixed = false;
+  pci.kin = pci.env->getManipulator(pci.basic_info.manip);
+  pci.init_info.type = InitInfo::STATIONARY;
+
+  std::shared_ptr<JointVelTermInfo> jv(new JointVelTermInfo);
+  jv->coeffs = std::vector<double>(7, 1.0);
+  jv->targets = std::vector<double>(7, 0.0);
+  jv->first_step = 0;
+  jv->last_step = 1;
+  jv->name = "joint_vel";
+  jv->term_type = TT_COST;
+  pci.cost_infos.push_back(jv);
+
+  TrajOptProbPtr prob = ConstructProblem(pci);
+  ASSERT_TRUE(!!prob);
+
+  const std::string link = "r_gripper_tool_frame";
+  EnvStateConstPtr state = env_->getState();
+  Eigen::Isometry3d change_base = state->transforms.at(pci.kin->getBaseLinkName());
+  Eigen::Isometry3d tcp = Eigen::Isometry3d::Identity();
+  tcp.translate(Eigen::Vector3d(0.02, 0, 0.05));
+  tcp.rotate(Eigen::AngleAxisd(0.3, Eigen::Vector3d::UnitY()));
+
+  Eigen::VectorXd start = env_->getCurrentJointValues(pci.kin->getName());
+  tesseract::VectorIsometry3d poses(2);
+  pci.kin->calcFwdKin(poses[0], change_base, Eigen::VectorXd(start.array() + 0.3), link, *state);
+  pci.kin->calcFwdKin(poses[1], change_base, Eigen::VectorXd(start.array() - 0.2), link, *state);
+
+  std::vector<sco::VarVector> vars = { prob->GetVarRow(0), prob->GetVarRow(1) };
+  CartesianPathEvaluator evaluator(poses,
+                                   vars,
+                                   Eigen::Vector3d(1, 2, 3),
+                                   Eigen::Vector3d(4, 5, 6),
+                                   Eigen::Vector3d::Zero(),
+                                   Eigen::Vector3d::Zero(),
+                                   pci.kin,
+                                   env_,
+                                   link,
+                                   tcp);
+
+  DblVec x = trajToDblVec(prob->GetInitTraj());
+  std::vector<sco::AffExpr> exprs = evaluator.calcLinearizedErrors(x);
+  Eigen::VectorXd errors = evaluator.calcErrors(x);
+  ASSERT_EQ(exprs.size(), 12u);
+
+  const double eps = 1e-6;
+  for (size_t k = 0; k < x.size(); ++k)
+  {
+    DblVec x_plus = x, x_minus = x;
+    x_plus[k] += eps;
+    x_minus[k] -= eps;
+    Eigen::VectorXd numerical = (evaluator.calcErrors(x_plus) - evaluator.calcErrors(x_minus)) / (2 * eps);
+    for (size_t r = 0; r < exprs.size(); ++r)
+    {
+      EXPECT_NEAR(exprs[r].value(x), errors(static_cast<long>(r)), 1e-10);
+      double analytic = (exprs[r].value(x_plus) - exprs[r].value(x_minus)) / (2 * eps);
+      EXPECT_NEAR(analytic, numerical(static_cast<long>(r)), 1e-5);
+    }
+  }
+
+  // A rotation of 0.2 rad about the target x axis is within a 0.21 rad tolerance and outside a 0.19 rad one
+  Eigen::Isometry3d current;
+  pci.kin->calcFwdKin(current, change_base, start, link, *state);
+  tesseract::VectorIsometry3d rotated(1, current * Eigen::AngleAxisd(0.2, Eigen::Vector3d::UnitX()));
+  std::vector<sco::VarVector> first_row = { prob->GetVarRow(0) };
+  for (double tol : { 0.21, 0.19 })
+  {
+    CartesianPathEvaluator tolerant(rotated,
+                                    first_row,
+                                    Eigen::Vector3d::Ones(),
+                                    Eigen::Vector3d::Ones(),
+                                    Eigen::Vector3d::Zero(),
+                                    Eigen::Vector3d::Constant(tol),
+                                    pci.kin,
+                                    env_,
+                                    link);
+    double err = tolerant.calcErrors(x).cwiseAbs().maxCoeff();
+    if (tol > 0.2)
+      EXPECT_NEAR(err, 0, 1e-9);
+    else
+      EXPECT_GT(err, 1e-4);
+  }
+}
+
+/**
+ * @brief Checks the fixed size pose jacobians against the numerical jacobian of CostFromErrFunc
+ *
+ * Also checks that evaluating into existing storage gives the same values as returning new vectors.
+ */
+TEST_F(CostsTest, cartPose_fixedDofJacobian)
+{
+  ROS_DEBUG("CostsTest, cartPose_fixedDofJacobian");
+
+  std::unordered_map<std::string, double> ipos;
+  ipos["torso_lift_joint"] = 0;
+  ipos["r_shoulder_pan_joint"] = -1.832;
+  ipos["r_shoulder_lift_joint"] = -0.332;
+  ipos["r_upper_arm_roll_joint"] = -1.011;
+  ipos["r_elbow_flex_joint"] = -1.437;
+  ipos["r_forearm_roll_joint"] = -1.1;
+  ipos["r_wrist_flex_joint"] = -1.926;
+  ipos["r_wrist_roll_joint"] = 3.074;
+  env_->setState(ipos);
+
+  BasicKinConstPtr kin = env_->getManipulator("right_arm");
+  ASSERT_EQ(kin->numJoints(), 7u);
+  const std::string link = "r_gripper_tool_frame";
+  EnvStateConstPtr state = env_->getState();
+  Eigen::Isometry3d change_base = state->transforms.at(kin->getBaseLinkName());
+  Eigen::Isometry3d tcp = Eigen::Isometry3d::Identity();
+  tcp.translate(Eigen::Vector3d(0.02, 0, 0.05));
+
+  Eigen::VectorXd start = env_->getCurrentJointValues(kin->getName());
+  Eigen::Isometry3d target;
+  kin->calcFwdKin(target, change_base, Eigen::VectorXd(start.array() + 0.3), link, *state);
+
+  std::vector<CartPoseErrCalculatorBaseConstPtr> errs = {
+    std::make_shared<CartPoseErrCalculator>(target, kin, env_, link, tcp),
+    std::make_shared<DynamicCartPoseErrCalculator>("r_elbow_flex_link", kin, env_, link, tcp)
+  };
+  for (const CartPoseErrCalculatorBaseConstPtr& err : errs)
+  {
+    Eigen::VectorXd y;
+    err->evaluate(start, y);
+    Eigen::VectorXd returned = (*err)(start);
+    ASSERT_EQ(y.size(), 6);
+    EXPECT_TRUE(y.isApprox(returned, 0));
+
+    Eigen::MatrixXd numerical = sco::calcForwardNumJac(*err, start, 1e-5);
+    Eigen::MatrixXd fixed, dynamic;
+    CartPoseJacCalculatorT<7>(err).evaluate(start, fixed);
+    CartPoseJacCalculator(err).evaluate(start, dynamic);
+    ASSERT_EQ(fixed.rows(), 6);
+    ASSERT_EQ(fixed.cols(), 7);
+    EXPECT_TRUE(fixed.isApprox(numerical, 1e-12));
+    EXPECT_TRUE(dynamic.isApprox(numerical, 1e-12));
+  }
+
+  Eigen::VectorXd two_steps(14);
+  two_steps << start, Eigen::VectorXd(start.array() + 0.1);
+  CartVelErrCalculatorT<7> vel_err(kin, env_, link, 0.1);
+  CartVelJacCalculatorT<7> vel_jac(kin, env_, link, 0.1);
+  Eigen::VectorXd vel_y;
+  Eigen::MatrixXd vel_j;
+  vel_err.evaluate(two_steps, vel_y);
+  vel_jac.evaluate(two_steps, vel_j);
+  EXPECT_TRUE(vel_y.isApprox(CartVelErrCalculator(kin, env_, link, 0.1)(two_steps), 0));
+  EXPECT_TRUE(vel_j.isApprox(CartVelJacCalculator(kin, env_, link, 0.1)(two_steps), 1e-12));
+}
+
 int main(int argc, char** argv)
 {
   testing::InitGoogleTest(&argc, argv);
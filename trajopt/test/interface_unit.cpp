@@ -163,6 +163,67 @@ TEST_F(InterfaceTest, initial_trajectory_time_cpp_interface)
     }
   }
 }
+/**
+ * @brief Tests InitInfo::CARTESIAN_IK with a rotated target whose position is free along its own z axis
+ */
+TEST_F(InterfaceTest, initial_trajectory_cartesian_ik)
+{
+  ROS_DEBUG("InterfaceTest, initial_trajectory_cartesian_ik");
+
+  std::unordered_map<std::string, double> ipos;
+  ipos["torso_lift_joint"] = 0;
+  ipos["r_shoulder_pan_joint"] = -1.832;
+  ipos["r_shoulder_lift_joint"] = -0.332;
+  ipos["r_upper_arm_roll_joint"] = -1.011;
+  ipos["r_elbow_flex_joint"] = -1.437;
+  ipos["r_forearm_roll_joint"] = -1.1;
+  ipos["r_wrist_flex_joint"] = -1.926;
+  ipos["r_wrist_roll_joint"] = 3.074;
+  env_->setState(ipos);
+
+  ProblemConstructionInfo pci(env_);
+  pci.basic_info.n_steps = 2;
+  pci.basic_info.manip = "right_arm";
+  pci.basic_info.start_fixed = false;
+  pci.kin = pci.env->getManipulator(pci.basic_info.manip);
+  pci.init_info.type = InitInfo::CARTESIAN_IK;
+
+  // The target is a reachable pose, moved along its own z axis which is then left free
+  const std::string link = "r_gripper_tool_frame";
+  EnvStateConstPtr state = env_->getState();
+  Eigen::Isometry3d change_base = state->transforms.at(pci.kin->getBaseLinkName());
+  Eigen::VectorXd goal = env_->getCurrentJointValues(pci.kin->getName()).array() + 0.2;
+  Eigen::Isometry3d goal_pose;
+  pci.kin->calcFwdKin(goal_pose, change_base, goal, link, *state);
+  Eigen::Quaterniond q(goal_pose.linear());
+
+  std::shared_ptr<CartPoseTermInfo> pose(new CartPoseTermInfo);
+  pose->timestep = 1;
+  pose->link = link;
+  pose->xyz = goal_pose * Eigen::Vector3d(0, 0, 0.1);
+  pose->wxyz = Eigen::Vector4d(q.w(), q.x(), q.y(), q.z());
+  pose->pos_coeffs = Eigen::Vector3d(1, 1, 0);
+  pose->name = "pose";
+  pose->term_type = TT_CNT;
+  pci.cnt_infos.push_back(pose);
+
+  TrajOptProbPtr prob = ConstructProblem(pci);
+  ASSERT_TRUE(!!prob);
+
+  Eigen::VectorXd solution = prob->GetInitTraj().row(1).transpose();
+  Eigen::Isometry3d solution_pose;
+  pci.kin->calcFwdKin(solution_pose, change_base, solution, link, *state);
+
+  // Expressed in the target frame only the free z axis may differ
+  Eigen::Isometry3d target_pose;
+  target_pose.linear() = goal_pose.linear();
+  target_pose.translation() = pose->xyz;
+  Eigen::Isometry3d err = target_pose.inverse() * solution_pose;
+  EXPECT_NEAR(err.translation().x(), 0, 1e-4);
+  EXPECT_NEAR(err.translation().y(), 0, 1e-4);
+  EXPECT_NEAR(Eigen::AngleAxisd(err.linear()).angle(), 0, 1e-4);
+}
+
 /**
  * @brief Tests the json interface for correct initial traj generation when not using time
  */
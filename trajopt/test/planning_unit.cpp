@@ -1,5 +1,6 @@
 #include <trajopt_utils/macros.h>
 TRAJOPT_IGNORE_WARNINGS_PUSH
+#include <algorithm>
 #include <ctime>
 #include <gtest/gtest.h>
 #include <ros/package.h>
@@ -11,9 +12,11 @@ TRAJOPT_IGNORE_WARNINGS_POP
 #include <tesseract_ros/kdl/kdl_chain_kin.h>
 #include <tesseract_ros/kdl/kdl_env.h>
 #include <tesseract_ros/ros_basic_plotting.h>
+#include <trajopt/collision_terms.hpp>
 #include <trajopt/common.hpp>
 #include <trajopt/plot_callback.hpp>
 #include <trajopt/problem_description.hpp>
+#include <trajopt/windowed_optimization.hpp>
 #include <trajopt_sco/optimizers.hpp>
 #include <trajopt_test_utils.hpp>
 #include <trajopt_utils/clock.hpp>
@@ -188,6 +191,193 @@ TEST_F(PlanningTest, arm_around_table)
   ROS_INFO((found) ? ("Final trajectory is in collision") : ("Final trajectory is collision free"));
 }
 
+TEST_F(PlanningTest, link_joint_indices)
+{
+  ROS_DEBUG("PlanningTest, link_joint_indices");
+
+  std::string package_path = ros::package::getPath("trajopt_test_support");
+  Json::Value root = readJsonFile(package_path + "/config/arm_around_table.json");
+
+  std::unordered_map<std::string, double> ipos;
+  ipos["torso_lift_joint"] = 0;
+  ipos["r_shoulder_pan_joint"] = -1.832;
+  ipos["r_shoulder_lift_joint"] = -0.332;
+  ipos["r_upper_arm_roll_joint"] = -1.011;
+  ipos["r_elbow_flex_joint"] = -1.437;
+  ipos["r_forearm_roll_joint"] = -1.1;
+  ipos["r_wrist_flex_joint"] = -1.926;
+  ipos["r_wrist_roll_joint"] = 3.074;
+  env_->setState(ipos);
+
+  TrajOptProbPtr prob = ConstructProblem(root, env_);
+  ASSERT_TRUE(!!prob);
+  BasicKinConstPtr manip = prob->GetKin();
+  DblVec x = trajToDblVec(prob->GetInitTraj());
+
+  // The Jacobian columns of the joints left out for a link are zero, at another state than the one they were found at
+  SafetyMarginDataPtr margin(new SafetyMarginData(0.025, 20));
+  int step = prob->GetNumSteps() / 2;
+  CastCollisionEvaluator evaluator(manip, prob->GetEnv(), margin, prob->GetVarRow(step), prob->GetVarRow(step + 1));
+  const LinkJointIndices& link_joints = evaluator.GetLinkJointIndices();
+  Eigen::VectorXd dofvals = toVectorXd(sco::getVec(x, prob->GetVarRow(step)));
+  EnvStatePtr state = prob->GetEnv()->getState(manip->getJointNames(), dofvals);
+  Eigen::Isometry3d change_base = state->transforms.at(manip->getBaseLinkName());
+  bool found_partial = false;
+  for (const std::string& link_name : manip->getLinkNames())
+  {
+    ASSERT_TRUE(link_joints.count(link_name) > 0);
+    const std::vector<int>& joints = link_joints.at(link_name);
+    found_partial |= !joints.empty() && joints.size() < manip->numJoints();
+
+    Eigen::MatrixXd jac(6, manip->numJoints());
+    Eigen::Vector3d link_point = state->transforms.at(link_name) * Eigen::Vector3d(0.05, 0.05, 0.05);
+    ASSERT_TRUE(manip->calcJacobian(jac, change_base, dofvals, link_name, *state, link_point));
+    for (int j = 0; j < static_cast<int>(manip->numJoints()); ++j)
+    {
+      if (std::find(joints.begin(), joints.end(), j) == joints.end())
+        EXPECT_TRUE(jac.col(j).isZero()) << link_name << " joint " << j;
+    }
+  }
+  EXPECT_TRUE(found_partial);
+
+  // The distance expressions only carry the joints moving the links in contact
+  bool found_contact = false;
+  for (int i = 0; i + 1 < prob->GetNumSteps(); ++i)
+  {
+    sco::VarVector vars0 = prob->GetVarRow(i);
+    sco::VarVector vars1 = prob->GetVarRow(i + 1);
+    CastCollisionEvaluator cast(manip, prob->GetEnv(), margin, vars0, vars1);
+    tesseract::ContactResultVector dist_results;
+    cast.CalcCollisions(x, dist_results);
+    sco::AffExprVector exprs;
+    cast.CalcDistExpressions(x, exprs);
+    ASSERT_EQ(exprs.size(), dist_results.size());
+    for (std::size_t k = 0; k < exprs.size(); ++k)
+    {
+      found_contact = true;
+      std::vector<int> joints;
+      for (const std::string& link_name : dist_results[k].link_names)
+      {
+        auto it = link_joints.find(link_name);
+        if (it != link_joints.end())
+          joints.insert(joints.end(), it->second.begin(), it->second.end());
+      }
+      for (const sco::Var& var : exprs[k].vars)
+      {
+        auto same_var = [&var](const sco::Var& v) { return v.var_rep == var.var_rep; };
+        auto it0 = std::find_if(vars0.begin(), vars0.end(), same_var);
+        auto it1 = std::find_if(vars1.begin(), vars1.end(), same_var);
+        int j = static_cast<int>(it0 != vars0.end() ? it0 - vars0.begin() : it1 - vars1.begin());
+        ASSERT_TRUE(it0 != vars0.end() || it1 != vars1.end());
+        EXPECT_TRUE(std::find(joints.begin(), joints.end(), j) != joints.end()) << "joint " << j;
+      }
+    }
+  }
+  EXPECT_TRUE(found_contact);
+}
+
+TEST_F(PlanningTest, windowed_consensus)
+{
+  ROS_DEBUG("PlanningTest, windowed_consensus");
+
+  const int n_steps = 14;
+  std::unordered_map<std::string, double> ipos;
+  ipos["torso_lift_joint"] = 0;
+  ipos["r_shoulder_pan_joint"] = -1.832;
+  ipos["r_shoulder_lift_joint"] = -0.332;
+  ipos["r_upper_arm_roll_joint"] = -1.011;
+  ipos["r_elbow_flex_joint"] = -1.437;
+  ipos["r_forearm_roll_joint"] = -1.1;
+  ipos["r_wrist_flex_joint"] = -1.926;
+  ipos["r_wrist_roll_joint"] = 3.074;
+  env_->setState(ipos);
+
+  Eigen::VectorXd start = env_->getCurrentJointValues(env_->getManipulator("right_arm")->getName());
+  Eigen::VectorXd end = start + Eigen::VectorXd::Constant(start.size(), 0.2);
+
+  // Minimum velocity between two fixed end points, whose optimum is the straight line in joint space
+  bool separate_envs = true;
+  WindowProblemFactory factory = [&](int first_step, int last_step) {
+    tesseract_ros::KDLEnvPtr env = env_;
+    if (separate_envs)
+    {
+      env.reset(new tesseract_ros::KDLEnv);
+      EXPECT_TRUE(env->init(urdf_model_, srdf_model_));
+      env->setState(ipos);
+    }
+
+    ProblemConstructionInfo pci(env);
+    pci.basic_info.n_steps = last_step - first_step + 1;
+    pci.basic_info.manip = "right_arm";
+    pci.basic_info.start_fixed = false;
+    pci.kin = pci.env->getManipulator(pci.basic_info.manip);
+    pci.init_info.type = InitInfo::STATIONARY;
+
+    std::shared_ptr<JointVelTermInfo> jv(new JointVelTermInfo);
+    jv->coeffs = std::vector<double>(7, 1.0);
+    jv->targets = std::vector<double>(7, 0.0);
+    jv->first_step = 0;
+    jv->last_step = pci.basic_info.n_steps - 1;
+    jv->name = "joint_vel";
+    jv->term_type = TT_COST;
+    pci.cost_infos.push_back(jv);
+
+    std::vector<std::pair<int, Eigen::VectorXd> > fixed;
+    if (first_step == 0)
+      fixed.push_back(std::make_pair(0, start));
+    if (last_step == n_steps - 1)
+      fixed.push_back(std::make_pair(pci.basic_info.n_steps - 1, end));
+    for (const auto& f : fixed)
+    {
+      std::shared_ptr<JointPosTermInfo> jp(new JointPosTermInfo);
+      jp->coeffs = std::vector<double>(7, 10.0);
+      jp->targets = std::vector<double>(f.second.data(), f.second.data() + f.second.size());
+      jp->first_step = f.first;
+      jp->last_step = f.first;
+      jp->name = "joint_pos";
+      jp->term_type = TT_CNT;
+      pci.cnt_infos.push_back(jp);
+    }
+    return ConstructProblem(pci);
+  };
+
+  WindowedOptimizationParameters params;
+  params.window_size = 6;
+  params.window_overlap = 2;
+  params.max_admm_iter = 100;
+  params.num_threads = 2;
+
+  WindowedOptimizationResultPtr result = OptimizeWindowed(n_steps, factory, params);
+  ASSERT_TRUE(!!result);
+  EXPECT_TRUE(result->converged);
+  EXPECT_LT(result->primal_residual, params.consensus_tol);
+  ASSERT_EQ(result->window_results.size(), 3u);
+
+  // Every window agrees with the consensus on its waypoints, in particular on the ones it shares
+  int first_step = 0;
+  for (const TrajOptResultPtr& window : result->window_results)
+  {
+    ASSERT_EQ(window->traj.rows(), params.window_size);
+    for (int i = 0; i < window->traj.rows(); ++i)
+      for (int j = 0; j < start.size(); ++j)
+        EXPECT_NEAR(window->traj(i, j), result->traj(first_step + i, j), 10 * params.consensus_tol);
+    first_step += params.window_size - params.window_overlap;
+  }
+
+  for (int i = 0; i < n_steps; ++i)
+  {
+    Eigen::VectorXd expected = start + (end - start) * (static_cast<double>(i) / (n_steps - 1));
+    for (int j = 0; j < start.size(); ++j)
+      EXPECT_NEAR(result->traj(i, j), expected(j), 1e-2);
+  }
+
+  // Windows solved on several threads must not share the environment
+  separate_envs = false;
+  EXPECT_ANY_THROW(OptimizeWindowed(n_steps, factory, params));
+  params.num_threads = 1;
+  EXPECT_TRUE(OptimizeWindowed(n_steps, factory, params)->converged);
+}
+
 int main(int argc, char** argv)
 {
   testing::InitGoogleTest(&argc, argv);
@@ -0,0 +1,63 @@
+#!/usr/bin/env python
+import json
+import unittest
+
+import numpy as np
+import rospy
+import rostest
+
+import ctrajoptpy
+
+PROBLEM = {
+    "basic_info": {"n_steps": 5, "manip": "right_arm", "start_fixed": False},
+    "costs": [{"type": "joint_vel", "params": {"coeffs": [1], "targets": [0, 0, 0, 0, 0, 0, 0]}}],
+    "init_info": {"type": "stationary"},
+}
+
+
+class TrajOptPyTest(unittest.TestCase):
+    def setUp(self):
+        self.env = ctrajoptpy.LoadEnvironment(rospy.get_param("robot_description"),
+                                              rospy.get_param("robot_description_semantic"))
+        self.prob = ctrajoptpy.ConstructProblem(json.dumps(PROBLEM), self.env)
+
+    def test_python_costs(self):
+        # callbacks may keep their arguments, they must not change once the call returned
+        kept = []
+
+        def err(x):
+            kept.append((x, np.array(x)))
+            return x - 0.1
+
+        def batched_err(x):
+            return x[:, 1:2] - 0.2
+
+        self.prob.AddErrorCost(err, ijs=[(i, 0) for i in range(5)], name="py_err")
+        self.prob.AddBatchedErrorCost(batched_err, first_step=0, last_step=4, name="py_batched")
+        result = ctrajoptpy.OptimizeProblem(self.prob)
+
+        self.assertTrue(len(kept) > 1)
+        for x, snapshot in kept:
+            self.assertTrue(np.array_equal(x, snapshot))
+
+        self.assertEqual(result.traj.shape, (5, 7))
+        self.assertTrue(np.allclose(result.traj[:, 0], 0.1, atol=1e-2))
+        self.assertTrue(np.allclose(result.traj[:, 1], 0.2, atol=1e-2))
+        self.assertEqual(len(result.cost_vals), len(result.cost_names))
+        self.assertEqual(len(result.GetCosts()), len(result.cost_names))
+
+    def test_batched_shape_mismatch(self):
+        # the number of errors changes between calls, so the finite differences cannot be taken
+        calls = [0]
+
+        def batched_err(x):
+            calls[0] += 1
+            return np.zeros((x.shape[0], 1 + calls[0] % 2))
+
+        self.prob.AddBatchedErrorCost(batched_err, first_step=0, last_step=4, name="py_batched")
+        with self.assertRaises(ValueError):
+            ctrajoptpy.OptimizeProblem(self.prob)
+
+
+if __name__ == "__main__":
+    rostest.rosrun("trajopt", "trajoptpy_unit", TrajOptPyTest)
@@ -0,0 +1,512 @@
+/**
+ * @file trajopt_server.cpp
+ * @brief Long running planning server keeping pre-built environments and serving requests over a unix socket
+ *
+ * Usage: trajopt_server <socket_path> --env <name>=<urdf_file>,<srdf_file> [--env ...] [--workers <n>]
+ *
+ * Every worker owns its own copy of each environment, built once at startup, since the kinematics and contact
+ * managers are not thread-safe. Clients connect to the socket and send one JSON request per line:
+ *
+ *   { "id": 1, "env": "kuka", "deadline_ms": 500, "joint_state": { "joint_a1": 0.1 }, "problem": { ... } }
+ *
+ * where problem is a trajopt json problem description. Requests are served earliest deadline first and every request
+ * gets one JSON response line on the same connection:
+ *
+ *   { "id": 1, "status": "ok", "opt_status": "CONVERGED", "traj": [[...]], "costs": {...}, "constraints": {...},
+ *     "timing": { "queue_ms": 0.1, "construct_ms": 2.0, "optimize_ms": 40.0 } }
+ *
+ * status is one of ok, deadline_exceeded or error (with a message). Requests still queued when the server is stopped
+ * are answered with an error. No ROS master is required.
+ *
+ * @copyright Copyright (c) 2017, Southwest Research Institute
+ *
+ * @par License
+ * Software License Agreement (Apache License)
+ * @par
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * @par
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <trajopt_utils/macros.h>
+TRAJOPT_IGNORE_WARNINGS_PUSH
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <jsoncpp/json/json.h>
+#include <list>
+#include <map>
+#include <mutex>
+#include <queue>
+#include <srdfdom/model.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <urdf_parser/urdf_parser.h>
+TRAJOPT_IGNORE_WARNINGS_POP
+
+#include <tesseract_ros/kdl/kdl_env.h>
+#include <trajopt/problem_description.hpp>
+#include <trajopt_utils/logging.hpp>
+
+using namespace trajopt;
+
+typedef std::chrono::steady_clock Clock;
+
+struct EnvironmentSource
+{
+  std::string urdf_file;
+  std::string srdf_file;
+};
+
+/** @brief A client connection, responses of concurrent workers are serialized by the write mutex */
+struct Connection
+{
+  int fd;
+  std::mutex write_mutex;
+
+  Connection(int fd) : fd(fd) {}
+  ~Connection() { close(fd); }
+
+  /** @brief Unblocks the reader of the connection, responses can still be sent */
+  void stopReading() { ::shutdown(fd, SHUT_RD); }
+
+  void send(const Json::Value& response)
+  {
+    Json::FastWriter writer;
+    std::string line = writer.write(response);  // terminated by a newline
+    std::lock_guard<std::mutex> lock(write_mutex);
+    size_t sent = 0;
+    while (sent < line.size())
+    {
+      ssize_t n = ::send(fd, line.data() + sent, line.size() - sent, MSG_NOSIGNAL);
+      if (n <= 0)
+        return;  // the client went away, nothing left to do with its results
+      sent += static_cast<size_t>(n);
+    }
+  }
+};
+typedef std::shared_ptr<Connection> ConnectionPtr;
+
+struct Request
+{
+  Json::Value msg;
+  ConnectionPtr connection;
+  Clock::time_point received;
+  Clock::time_point deadline;
+};
+
+/** @brief Earliest deadline first */
+struct LaterDeadline
+{
+  bool operator()(const Request& a, const Request& b) const { return a.deadline > b.deadline; }
+};
+
+class RequestQueue
+{
+public:
+  void push(Request request)
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      queue_.push(std::move(request));
+    }
+    cv_.notify_one();
+  }
+
+  /** @brief Blocks until a request is available, returns false once the queue is shut down, see drain */
+  bool pop(Request& request)
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this]() { return shutdown_ || !queue_.empty(); });
+    if (shutdown_)
+      return false;
+    request = queue_.top();
+    queue_.pop();
+    return true;
+  }
+
+  void shutdown()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      shutdown_ = true;
+    }
+    cv_.notify_all();
+  }
+
+  /** @brief Remove the requests left in the queue */
+  std::vector<Request> drain()
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<Request> requests;
+    while (!queue_.empty())
+    {
+      requests.push_back(queue_.top());
+      queue_.pop();
+    }
+    return requests;
+  }
+
+private:
+  std::priority_queue<Request, std::vector<Request>, LaterDeadline> queue_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool shutdown_ = false;
+};
+
+static double toMilliseconds(Clock::duration d) { return std::chrono::duration<double, std::milli>(d).count(); }
+
+tesseract_ros::KDLEnvPtr loadEnvironment(const EnvironmentSource& source)
+{
+  urdf::ModelInterfaceSharedPtr urdf_model = urdf::parseURDFFile(source.urdf_file);
+  if (urdf_model == nullptr)
+    PRINT_AND_THROW("failed to parse urdf " + source.urdf_file);
+
+  srdf::ModelSharedPtr srdf_model(new srdf::Model);
+  if (!srdf_model->initFile(*urdf_model, source.srdf_file))
+    PRINT_AND_THROW("failed to parse srdf " + source.srdf_file);
+
+  tesseract_ros::KDLEnvPtr env(new tesseract_ros::KDLEnv);
+  if (!env->init(urdf_model, srdf_model))
+    PRINT_AND_THROW("failed to initialize environment from " + source.urdf_file);
+
+  return env;
+}
+
+/** @brief Owns pre-built copies of every environment and solves requests on them */
+class Worker
+{
+public:
+  Worker(const std::map<std::string, EnvironmentSource>& sources)
+  {
+    for (const auto& source : sources)
+    {
+      Environment env;
+      env.env = loadEnvironment(source.second);
+      env.default_state = env.env->getCurrentJointValues();
+      envs_[source.first] = env;
+    }
+  }
+
+  void run(RequestQueue& queue)
+  {
+    Request request;
+    while (queue.pop(request))
+      request.connection->send(solve(request));
+  }
+
+private:
+  struct Environment
+  {
+    tesseract_ros::KDLEnvPtr env;
+    Eigen::VectorXd default_state;
+  };
+  std::map<std::string, Environment> envs_;
+
+  Json::Value solve(const Request& request)
+  {
+    Json::Value response;
+    response["id"] = request.msg["id"];
+
+    Clock::time_point start = Clock::now();
+    response["timing"]["queue_ms"] = toMilliseconds(start - request.received);
+    if (start >= request.deadline)
+    {
+      response["status"] = "deadline_exceeded";
+      return response;
+    }
+
+    auto it = envs_.find(request.msg["env"].asString());
+    if (it == envs_.end())
+    {
+      response["status"] = "error";
+      response["message"] = "unknown environment '" + request.msg["env"].asString() + "'";
+      return response;
+    }
+    const tesseract_ros::KDLEnvPtr& env = it->second.env;
+
+    try
+    {
+      // Every request starts from the default state so earlier requests cannot leak into it
+      env->setState(env->getJointNames(), it->second.default_state);
+      const Json::Value& joint_state = request.msg["joint_state"];
+      if (joint_state.isObject())
+      {
+        std::unordered_map<std::string, double> state;
+        for (const std::string& name : joint_state.getMemberNames())
+          state[name] = joint_state[name].asDouble();
+        env->setState(state);
+      }
+
+      ProblemConstructionInfo pci(env);
+      pci.fromJson(request.msg["problem"]);
+      TrajOptProbPtr prob = ConstructProblem(pci);
+      Clock::time_point constructed = Clock::now();
+      response["timing"]["construct_ms"] = toMilliseconds(constructed - start);
+
+      sco::BasicTrustRegionSQP opt(prob);
+      opt.setParameters(pci.opt_info);
+      if (request.deadline != Clock::time_point::max())
+      {
+        double remaining = std::chrono::duration<double>(request.deadline - constructed).count();
+        opt.getParameters().max_time = std::min(opt.getParameters().max_time, std::max(remaining, 0.0));
+      }
+      opt.initialize(trajToDblVec(prob->GetInitTraj()));
+      sco::OptStatus status = opt.optimize();
+      response["timing"]["optimize_ms"] = toMilliseconds(Clock::now() - constructed);
+
+      TrajOptResult result(opt.results(), *prob);
+      response["status"] = (status == sco::OPT_TIME_LIMIT && Clock::now() >= request.deadline) ? "deadline_exceeded" :
+                                                                                                "ok";
+      response["opt_status"] = sco::statusToString(status);
+      response["traj"] = Json::Value(Json::arrayValue);
+      for (long i = 0; i < result.traj.rows(); ++i)
+      {
+        Json::Value row(Json::arrayValue);
+        for (long j = 0; j < result.traj.cols(); ++j)
+          row.append(result.traj(i, j));
+        response["traj"].append(row);
+      }
+      // The values are only missing if the optimizer stopped before evaluating the initial trajectory
+      response["costs"] = Json::Value(Json::objectValue);
+      for (size_t i = 0; i < std::min(result.cost_names.size(), result.cost_vals.size()); ++i)
+        response["costs"][result.cost_names[i]] = result.cost_vals[i];
+      response["constraints"] = Json::Value(Json::objectValue);
+      for (size_t i = 0; i < std::min(result.cnt_names.size(), result.cnt_viols.size()); ++i)
+        response["constraints"][result.cnt_names[i]] = result.cnt_viols[i];
+    }
+    catch (const std::exception& e)
+    {
+      response["status"] = "error";
+      response["message"] = e.what();
+    }
+    return response;
+  }
+};
+
+/** @brief Reads newline delimited requests from a client and queues them */
+void readRequests(ConnectionPtr connection, RequestQueue& queue)
+{
+  std::string buffer;
+  char chunk[4096];
+  for (;;)
+  {
+    ssize_t n = recv(connection->fd, chunk, sizeof(chunk), 0);
+    if (n <= 0)
+      return;
+    buffer.append(chunk, static_cast<size_t>(n));
+
+    size_t eol;
+    while ((eol = buffer.find('\n')) != std::string::npos)
+    {
+      std::string line = buffer.substr(0, eol);
+      buffer.erase(0, eol + 1);
+      if (line.find_first_not_of(" \t\r") == std::string::npos)
+        continue;
+
+      Request request;
+      request.connection = connection;
+      request.received = Clock::now();
+      Json::Reader reader;
+      if (!reader.parse(line, request.msg) || !request.msg.isObject())
+      {
+        Json::Value response;
+        response["status"] = "error";
+        response["message"] = "failed to parse request: " + reader.getFormattedErrorMessages();
+        connection->send(response);
+        continue;
+      }
+
+      if (request.msg.isMember("deadline_ms"))
+        request.deadline = request.received + std::chrono::duration_cast<Clock::duration>(
+                                                  std::chrono::duration<double, std::milli>(
+                                                      request.msg["deadline_ms"].asDouble()));
+      else
+        request.deadline = Clock::time_point::max();
+
+      queue.push(std::move(request));
+    }
+  }
+}
+
+/** @brief The thread reading the requests of one client, joined when it is done or at shutdown */
+struct ClientReader
+{
+  ConnectionPtr connection;
+  std::atomic<bool> finished;
+  std::thread thread;
+
+  ClientReader(ConnectionPtr connection) : connection(connection), finished(false) {}
+};
+
+static int listen_fd_ = -1;
+
+void handleSignal(int /*signal*/)
+{
+  // Unblocks accept in the main thread
+  if (listen_fd_ >= 0)
+    shutdown(listen_fd_, SHUT_RDWR);
+}
+
+void printUsage()
+{
+  std::cerr << "usage: trajopt_server <socket_path> --env <name>=<urdf_file>,<srdf_file> [--env ...] [--workers <n>]"
+            << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+  if (argc < 2)
+  {
+    printUsage();
+    return 1;
+  }
+
+  std::string socket_path = argv[1];
+  std::map<std::string, EnvironmentSource> sources;
+  int num_workers = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+  for (int i = 2; i < argc; ++i)
+  {
+    std::string arg = argv[i];
+    if (arg == "--env" && i + 1 < argc)
+    {
+      std::string value = argv[++i];
+      size_t eq = value.find('='), comma = value.find(',');
+      if (eq == std::string::npos || comma == std::string::npos || comma < eq)
+      {
+        printUsage();
+        return 1;
+      }
+      sources[value.substr(0, eq)] = { value.substr(eq + 1, comma - eq - 1), value.substr(comma + 1) };
+    }
+    else if (arg == "--workers" && i + 1 < argc)
+    {
+      num_workers = std::max(1, std::atoi(argv[++i]));
+    }
+    else
+    {
+      printUsage();
+      return 1;
+    }
+  }
+
+  if (sources.empty())
+  {
+    printUsage();
+    return 1;
+  }
+
+  // Build all environments up front so requests only pay for planning
+  std::vector<std::unique_ptr<Worker>> workers;
+  try
+  {
+    for (int i = 0; i < num_workers; ++i)
+      workers.emplace_back(new Worker(sources));
+  }
+  catch (const std::exception& e)
+  {
+    LOG_ERROR("%s", e.what());
+    return 1;
+  }
+
+  listen_fd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+  sockaddr_un addr;
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (listen_fd_ < 0 || socket_path.size() >= sizeof(addr.sun_path))
+  {
+    LOG_ERROR("failed to create socket %s", socket_path.c_str());
+    return 1;
+  }
+  std::strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path) - 1);
+  unlink(socket_path.c_str());
+  if (bind(listen_fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(listen_fd_, 16) != 0)
+  {
+    LOG_ERROR("failed to listen on %s: %s", socket_path.c_str(), std::strerror(errno));
+    return 1;
+  }
+
+  std::signal(SIGINT, handleSignal);
+  std::signal(SIGTERM, handleSignal);
+
+  RequestQueue queue;
+  std::vector<std::thread> worker_threads;
+  for (std::unique_ptr<Worker>& worker : workers)
+    worker_threads.emplace_back([&worker, &queue]() { worker->run(queue); });
+
+  LOG_INFO("trajopt_server listening on %s with %i workers", socket_path.c_str(), num_workers);
+
+  std::list<std::unique_ptr<ClientReader>> readers;
+  for (;;)
+  {
+    int fd = accept(listen_fd_, nullptr, nullptr);
+    if (fd < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+
+    // Join the readers of clients which went away
+    for (auto it = readers.begin(); it != readers.end();)
+    {
+      if ((*it)->finished)
+      {
+        (*it)->thread.join();
+        it = readers.erase(it);
+      }
+      else
+      {
+        ++it;
+      }
+    }
+
+    readers.emplace_back(new ClientReader(ConnectionPtr(new Connection(fd))));
+    ClientReader* reader = readers.back().get();
+    reader->thread = std::thread([reader, &queue]() {
+      readRequests(reader->connection, queue);
+      reader->finished = true;
+    });
+  }
+
+  LOG_INFO("shutting down");
+  // Nothing is queued once every reader has stopped
+  for (std::unique_ptr<ClientReader>& reader : readers)
+    reader->connection->stopReading();
+  for (std::unique_ptr<ClientReader>& reader : readers)
+    reader->thread.join();
+
+  // The workers finish the requests they are solving, the ones nobody got to are answered rather than dropped
+  queue.shutdown();
+  for (std::thread& t : worker_threads)
+    t.join();
+  for (const Request& request : queue.drain())
+  {
+    Json::Value response;
+    response["id"] = request.msg["id"];
+    response["status"] = "error";
+    response["message"] = "server shutting down";
+    request.connection->send(response);
+  }
+
+  // The last references to the connections close the client sockets
+  readers.clear();
+  close(listen_fd_);
+  unlink(socket_path.c_str());
+  return 0;
+}
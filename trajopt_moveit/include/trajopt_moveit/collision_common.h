@@ -40,10 +40,23 @@
 #include <moveit/collision_detection/world.h>
 #include <moveit/collision_detection/collision_world.h>
 #include <moveit/macros/class_forward.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <set>
+#include <unordered_map>
 #include <moveit/macros/deprecation.h>
 #include <btBulletCollisionCommon.h>
+#include <LinearMath/btAabbUtil2.h>
+#include <BulletCollision/CollisionDispatch/btActivatingCollisionAlgorithm.h>
+#include <BulletCollision/NarrowPhaseCollision/btGjkEpaPenetrationDepthSolver.h>
+#include <BulletCollision/NarrowPhaseCollision/btGjkPairDetector.h>
+#include <BulletCollision/NarrowPhaseCollision/btPointCollector.h>
+#include <BulletCollision/NarrowPhaseCollision/btVoronoiSimplexSolver.h>
 
 namespace collision_detection
 {
@@ -54,6 +67,8 @@ const float BULLET_SUPPORT_FUNC_TOLERANCE = .01 METERS;
 const float BULLET_LENGTH_TOLERANCE = .001 METERS;
 const float BULLET_EPSILON = 1e-3;
 const double BULLET_DEFAULT_CONTACT_DISTANCE = 0.05;
+const bool BULLET_DEFAULT_ALLOWED_COLLISION_TABLE = true;
+const bool BULLET_DEFAULT_REFRESH_CONVEX_DECOMPOSITIONS = false;
 
 inline btVector3 convertEigenToBt(const Eigen::Vector3d& v) { return btVector3(v[0], v[1], v[2]); }
 inline Eigen::Vector3d convertBtToEigen(const btVector3& v) { return Eigen::Vector3d(v.x(), v.y(), v.z()); }
@@ -64,6 +79,8 @@ inline btTransform convertEigenToBt(const Eigen::Isometry3d& t)
   return btTransform(convertEigenToBt(q), convertEigenToBt(t.translation()));
 }
 
+class AllowedCollisionTable;
+
 struct BulletDistanceData
 {
   BulletDistanceData(const DistanceRequest* req, DistanceResult* res) : req(req), res(res), done(false) {}
@@ -75,6 +92,9 @@ struct BulletDistanceData
 
   /// Indicate if search is finished
   bool done;
+
+  /// Allowed collisions of the request compiled for the objects of this query, see compileAllowedCollisions
+  std::shared_ptr<const AllowedCollisionTable> acm_table;
 };
 
 inline void convertBulletCollisions(collision_detection::CollisionResult& moveit_cr,
@@ -144,7 +164,10 @@ public:
   short int m_collisionFilterGroup;
   short int m_collisionFilterMask;
 
-  int m_index;  // index into collision matrix
+  int m_index;      // index into collision matrix
+  int m_acm_index;  // index into the allowed collision table of the current query, -1 if it has none
+  int m_pending_decompositions;             // meshes approximated by their convex hull until decomposed
+  unsigned long m_decomposition_generation;  // ConvexDecompositionCache::generation() when the shapes were created
   BodyType m_type;
   union
   {
@@ -200,7 +223,7 @@ public:
     return ptr.m_obj->id_;
   }
 
-  std::shared_ptr<CollisionObjectWrapper> clone()
+  std::shared_ptr<CollisionObjectWrapper> clone() const
   {
     switch (m_type)
     {
@@ -209,6 +232,7 @@ public:
         std::shared_ptr<CollisionObjectWrapper> cow(new CollisionObjectWrapper(ptr.m_link));
         cow->m_collisionFilterGroup = m_collisionFilterGroup;
         cow->m_collisionFilterMask = m_collisionFilterMask;
+        cow->m_acm_index = m_acm_index;
         return cow;
       }
       case BodyTypes::ROBOT_ATTACHED:
@@ -216,6 +240,7 @@ public:
         std::shared_ptr<CollisionObjectWrapper> cow(new CollisionObjectWrapper(ptr.m_ab));
         cow->m_collisionFilterGroup = m_collisionFilterGroup;
         cow->m_collisionFilterMask = m_collisionFilterMask;
+        cow->m_acm_index = m_acm_index;
         return cow;
       }
       default:
@@ -223,6 +248,7 @@ public:
         std::shared_ptr<CollisionObjectWrapper> cow(new CollisionObjectWrapper(ptr.m_obj));
         cow->m_collisionFilterGroup = m_collisionFilterGroup;
         cow->m_collisionFilterMask = m_collisionFilterMask;
+        cow->m_acm_index = m_acm_index;
         return cow;
       }
     }
@@ -255,6 +281,186 @@ typedef std::shared_ptr<const CollisionObjectWrapper> COWConstPtr;
 typedef std::map<std::string, COWPtr> Link2Cow;
 typedef std::map<std::string, COWConstPtr> Link2ConstCow;
 
+/**
+ * @brief Point cloud checked as spheres of a fixed radius, without the conversion to an octree
+ *
+ * The points are bucketed in a uniform grid and stored contiguously per cell, so indexing a new cloud is a sort of
+ * the points by cell. The shape has no triangles: pairs with convex shapes are handled by ConvexPointCloudAlgorithm,
+ * which only tests the points in the cells overlapping the convex shape, and sweeps by BulletManager::convexSweepTest.
+ */
+class PointCloudShape : public btConcaveShape
+{
+public:
+  PointCloudShape(const std::vector<Eigen::Vector3d>& points, double point_radius, double cell_size)
+    : m_point_radius(static_cast<btScalar>(point_radius)), m_cell_size(static_cast<btScalar>(cell_size))
+  {
+    m_shapeType = CUSTOM_CONCAVE_SHAPE_TYPE;
+    assert(m_cell_size > 0);
+
+    std::vector<std::pair<CellKey, int>> keys;
+    keys.reserve(points.size());
+    m_aabb_min.setValue(BT_LARGE_FLOAT, BT_LARGE_FLOAT, BT_LARGE_FLOAT);
+    m_aabb_max = -m_aabb_min;
+    for (std::size_t i = 0; i < points.size(); ++i)
+    {
+      btVector3 p = convertEigenToBt(points[i]);
+      keys.emplace_back(cellKey(p), static_cast<int>(i));
+      m_aabb_min.setMin(p);
+      m_aabb_max.setMax(p);
+    }
+    std::sort(keys.begin(), keys.end());
+
+    m_points.resize(static_cast<int>(points.size()));
+    for (std::size_t i = 0; i < keys.size(); ++i)
+    {
+      m_points[static_cast<int>(i)] = convertEigenToBt(points[static_cast<std::size_t>(keys[i].second)]);
+      if (i == 0 || keys[i].first != keys[i - 1].first)
+        m_cells[keys[i].first] = std::make_pair(static_cast<int>(i), static_cast<int>(i));
+      ++m_cells[keys[i].first].second;
+    }
+  }
+
+  btScalar getPointRadius() const { return m_point_radius; }
+  int getNumPoints() const { return m_points.size(); }
+
+  /** @brief Call f for every point whose cell overlaps the box given in the shape frame */
+  template <typename F>
+  void forEachPoint(const btVector3& aabb_min, const btVector3& aabb_max, F f) const
+  {
+    btVector3 lo = aabb_min;
+    btVector3 hi = aabb_max;
+    lo.setMax(m_aabb_min);
+    hi.setMin(m_aabb_max);
+    if (lo.x() > hi.x() || lo.y() > hi.y() || lo.z() > hi.z())
+      return;
+
+    double n_cells = 1;
+    for (int k = 0; k < 3; ++k)
+      n_cells *= std::floor(hi[k] / m_cell_size) - std::floor(lo[k] / m_cell_size) + 1;
+
+    // Walking the cells only pays off while there are fewer of them than occupied cells
+    if (n_cells > static_cast<double>(m_cells.size()))
+    {
+      for (int i = 0; i < m_points.size(); ++i)
+      {
+        const btVector3& p = m_points[i];
+        if (p.x() >= lo.x() && p.y() >= lo.y() && p.z() >= lo.z() && p.x() <= hi.x() && p.y() <= hi.y() &&
+            p.z() <= hi.z())
+          f(p);
+      }
+      return;
+    }
+
+    int x0 = cellIndex(lo.x()), y0 = cellIndex(lo.y()), z0 = cellIndex(lo.z());
+    int x1 = cellIndex(hi.x()), y1 = cellIndex(hi.y()), z1 = cellIndex(hi.z());
+    for (int x = x0; x <= x1; ++x)
+      for (int y = y0; y <= y1; ++y)
+        for (int z = z0; z <= z1; ++z)
+        {
+          auto it = m_cells.find(cellKey(x, y, z));
+          if (it == m_cells.end())
+            continue;
+
+          for (int i = it->second.first; i < it->second.second; ++i)
+            f(m_points[i]);
+        }
+  }
+
+  void getAabb(const btTransform& t, btVector3& aabbMin, btVector3& aabbMax) const override
+  {
+    if (m_points.size() == 0)
+    {
+      aabbMin = aabbMax = t.getOrigin();
+      return;
+    }
+    btTransformAabb(m_aabb_min, m_aabb_max, m_point_radius + getMargin(), t, aabbMin, aabbMax);
+  }
+
+  void processAllTriangles(btTriangleCallback* /*callback*/,
+                           const btVector3& /*aabbMin*/,
+                           const btVector3& /*aabbMax*/) const override
+  {
+  }
+
+  void setLocalScaling(const btVector3& /*scaling*/) override {}
+  const btVector3& getLocalScaling() const override
+  {
+    static btVector3 out(1, 1, 1);
+    return out;
+  }
+
+  void calculateLocalInertia(btScalar /*mass*/, btVector3& inertia) const override { inertia.setValue(0, 0, 0); }
+  const char* getName() const override { return "PointCloud"; }
+
+private:
+  typedef uint64_t CellKey;
+
+  int cellIndex(btScalar v) const { return static_cast<int>(std::floor(v / m_cell_size)); }
+
+  /** @brief 21 bits per axis, which covers +-10 km with 1 cm cells */
+  static CellKey cellKey(int x, int y, int z)
+  {
+    const uint64_t mask = (1 << 21) - 1;
+    return ((static_cast<uint64_t>(x) & mask) << 42) | ((static_cast<uint64_t>(y) & mask) << 21) |
+           (static_cast<uint64_t>(z) & mask);
+  }
+
+  CellKey cellKey(const btVector3& p) const { return cellKey(cellIndex(p.x()), cellIndex(p.y()), cellIndex(p.z())); }
+
+  btScalar m_point_radius;
+  btScalar m_cell_size;
+  btVector3 m_aabb_min, m_aabb_max;
+  btAlignedObjectArray<btVector3> m_points;                 // sorted by cell
+  std::unordered_map<CellKey, std::pair<int, int>> m_cells;  // [begin, end) of the points of every cell
+};
+
+/**
+ * @brief Collision shape with coarse bounding levels checked before the full resolution shape
+ *
+ * Every coarse level is a compound of convex pieces enclosing the shape. ConvexLodAlgorithm only goes down to the
+ * next level when a piece of the current one is within the contact distance of the other shape, so far away objects
+ * never reach the full resolution narrowphase. Since every level encloses the shape, the contacts are the same as with
+ * the full resolution shape alone.
+ */
+class LodShape : public btConcaveShape
+{
+public:
+  /** @param levels Coarse levels, coarsest first. The shapes are owned by the caller */
+  LodShape(const std::vector<const btCompoundShape*>& levels, btCollisionShape* shape)
+    : m_levels(levels), m_shape(shape)
+  {
+    m_shapeType = CUSTOM_CONCAVE_SHAPE_TYPE;
+  }
+
+  const std::vector<const btCompoundShape*>& getLevels() const { return m_levels; }
+  btCollisionShape* getFullShape() const { return m_shape; }
+
+  void getAabb(const btTransform& t, btVector3& aabbMin, btVector3& aabbMax) const override
+  {
+    m_shape->getAabb(t, aabbMin, aabbMax);
+  }
+
+  void processAllTriangles(btTriangleCallback* /*callback*/,
+                           const btVector3& /*aabbMin*/,
+                           const btVector3& /*aabbMax*/) const override
+  {
+  }
+
+  void setLocalScaling(const btVector3& /*scaling*/) override {}
+  const btVector3& getLocalScaling() const override
+  {
+    static btVector3 out(1, 1, 1);
+    return out;
+  }
+
+  void calculateLocalInertia(btScalar /*mass*/, btVector3& inertia) const override { inertia.setValue(0, 0, 0); }
+  const char* getName() const override { return "Lod"; }
+
+private:
+  std::vector<const btCompoundShape*> m_levels;
+  btCollisionShape* m_shape;
+};
+
 inline void nearCallback(btBroadphasePair& collisionPair,
                          btCollisionDispatcher& dispatcher,
                          const btDispatcherInfo& dispatchInfo)
@@ -340,6 +546,165 @@ isCollisionAllowed(const COW* cow0, const COW* cow1, const AllowedCollisionMatri
   return !always_in_collision;
 }
 
+/**
+ * @brief Result of isCollisionAllowed for every pair of a set of collision objects, indexed by COW::m_acm_index
+ *
+ * The broadphase filter of the collectors runs for every overlapping pair, and the allowed collision matrix lookup
+ * is keyed by the object names. Each pair is evaluated once and then read back, so a table can be shared by the
+ * queries and threads which index the same objects, see AllowedCollisionTableCache.
+ */
+class AllowedCollisionTable
+{
+public:
+  AllowedCollisionTable(const AllowedCollisionMatrix* acm, std::size_t n_objects)
+    : acm_(acm), n_(n_objects), pairs_(new std::atomic<unsigned char>[n_ * n_]())
+  {
+  }
+
+  bool isCollisionAllowed(const COW* cow0, const COW* cow1, bool verbose = false) const
+  {
+    // Objects added after the table was compiled and verbose queries use the matrix itself
+    if (verbose || cow0->m_acm_index < 0 || cow1->m_acm_index < 0)
+      return collision_detection::isCollisionAllowed(cow0, cow1, acm_, verbose);
+
+    size_t i = static_cast<size_t>(std::min(cow0->m_acm_index, cow1->m_acm_index));
+    size_t j = static_cast<size_t>(std::max(cow0->m_acm_index, cow1->m_acm_index));
+    assert(j < n_);
+
+    // Threads evaluating the same pair store the same result, so relaxed ordering is enough
+    std::atomic<unsigned char>& pair = pairs_[i * n_ + j];
+    unsigned char state = pair.load(std::memory_order_relaxed);
+    if (state == UNKNOWN)
+    {
+      state = collision_detection::isCollisionAllowed(cow0, cow1, acm_) ? ALLOWED : SKIPPED;
+      pair.store(state, std::memory_order_relaxed);
+    }
+    return state == ALLOWED;
+  }
+
+private:
+  enum : unsigned char
+  {
+    UNKNOWN = 0,
+    ALLOWED,
+    SKIPPED
+  };
+
+  const AllowedCollisionMatrix* acm_;
+  size_t n_;
+  std::unique_ptr<std::atomic<unsigned char>[]> pairs_;
+};
+typedef std::shared_ptr<const AllowedCollisionTable> AllowedCollisionTableConstPtr;
+
+/**
+ * @brief The allowed collision tables of the recent queries of a collision robot or world
+ *
+ * A query over the same objects with the same allowed collision matrix reuses the table of the earlier ones, so the
+ * pairs evaluated in one query or SQP iteration are read back in the next. Comparing the contents of the matrix
+ * costs as much as evaluating the pairs, so it is identified by its address and a matrix modified in place after
+ * it was queried needs clear().
+ */
+class AllowedCollisionTableCache
+{
+public:
+  /**
+   * @brief Get the table for the objects, creating it if no recent query used them with acm
+   * @param objects The objects in the order of their COW::m_acm_index
+   */
+  AllowedCollisionTableConstPtr get(const AllowedCollisionMatrix* acm, const std::vector<const COW*>& objects)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto it = entries_.begin(); it != entries_.end(); ++it)
+    {
+      if (it->matches(acm, objects))
+      {
+        entries_.splice(entries_.begin(), entries_, it);
+        return entries_.front().table;
+      }
+    }
+
+    Entry entry;
+    entry.acm = acm;
+    entry.sources.reserve(objects.size());
+    entry.ids.reserve(objects.size());
+    for (const COW* cow : objects)
+    {
+      entry.sources.push_back(cow->ptr.raw);
+      entry.ids.push_back(cow->getID());
+    }
+    entry.table = std::make_shared<AllowedCollisionTable>(acm, objects.size());
+    entries_.push_front(std::move(entry));
+    if (entries_.size() > MAX_ENTRIES)
+      entries_.pop_back();
+    return entries_.front().table;
+  }
+
+  /** @brief Drop all tables, needed when an allowed collision matrix which was queried is modified in place */
+  void clear()
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.clear();
+  }
+
+private:
+  /** Self, world, other robot and trajectory queries each use their own object set */
+  static const std::size_t MAX_ENTRIES = 8;
+
+  struct Entry
+  {
+    const AllowedCollisionMatrix* acm;
+    std::vector<const void*> sources; /**< COW::ptr of the objects, in index order */
+    std::vector<std::string> ids;     /**< COW::getID() of the objects, in index order */
+    AllowedCollisionTableConstPtr table;
+
+    bool matches(const AllowedCollisionMatrix* other_acm, const std::vector<const COW*>& objects) const
+    {
+      if (acm != other_acm || sources.size() != objects.size())
+        return false;
+
+      for (std::size_t i = 0; i < objects.size(); ++i)
+        if (sources[i] != objects[i]->ptr.raw || ids[i] != objects[i]->getID())
+          return false;
+
+      return true;
+    }
+  };
+
+  std::mutex mutex_;
+  std::list<Entry> entries_; /**< Most recently used first */
+};
+typedef std::shared_ptr<AllowedCollisionTableCache> AllowedCollisionTableCachePtr;
+
+/**
+ * @brief Index the collision objects of a query and attach the allowed collision table for them to collisions
+ * @param object_sets All the objects that can be reported as a pair by the query
+ * @param cache The tables of earlier queries, the one for these objects is reused if present
+ */
+inline void compileAllowedCollisions(BulletDistanceData& collisions,
+                                     const std::vector<const Link2Cow*>& object_sets,
+                                     AllowedCollisionTableCache& cache)
+{
+  std::vector<const COW*> objects;
+  for (const Link2Cow* set : object_sets)
+  {
+    for (const auto& element : *set)
+    {
+      element.second->m_acm_index = static_cast<int>(objects.size());
+      objects.push_back(element.second.get());
+    }
+  }
+
+  collisions.acm_table = cache.get(collisions.req->acm, objects);
+}
+
+inline bool isCollisionAllowed(const COW* cow0, const COW* cow1, BulletDistanceData& collisions, bool verbose = false)
+{
+  if (collisions.acm_table)
+    return collisions.acm_table->isCollisionAllowed(cow0, cow1, verbose);
+
+  return isCollisionAllowed(cow0, cow1, collisions.req->acm, verbose);
+}
+
 inline collision_detection::DistanceResultsData* processResult(BulletDistanceData& cdata,
                                                                collision_detection::DistanceResultsData& contact,
                                                                const std::pair<std::string, std::string>& key,
@@ -475,7 +840,7 @@ struct CollisionCollector : public btCollisionWorld::ContactResultCallback
            (m_collisionFilterGroup & proxy0->m_collisionFilterMask) &&
            isCollisionAllowed(m_cow.get(),
                               static_cast<CollisionObjectWrapper*>(proxy0->m_clientObject),
-                              m_collisions.req->acm,
+                              m_collisions,
                               m_verbose);
   }
 };
@@ -542,7 +907,7 @@ struct SweepCollisionCollector : public btCollisionWorld::ClosestConvexResultCal
            (m_collisionFilterGroup & proxy0->m_collisionFilterMask) &&
            isCollisionAllowed(m_cow.get(),
                               static_cast<CollisionObjectWrapper*>(proxy0->m_clientObject),
-                              m_collisions.req->acm,
+                              m_collisions,
                               m_verbose);
   }
 };
@@ -814,7 +1179,7 @@ struct CastCollisionCollector : public btCollisionWorld::ContactResultCallback
            (m_collisionFilterGroup & proxy0->m_collisionFilterMask) &&
            isCollisionAllowed(m_cow.get(),
                               static_cast<CollisionObjectWrapper*>(proxy0->m_clientObject),
-                              m_collisions.req->acm,
+                              m_collisions,
                               m_verbose);
   }
 };
@@ -951,11 +1316,339 @@ struct CastCollisionCollectorOriginal : public btCollisionWorld::ContactResultCa
            (m_collisionFilterGroup & proxy0->m_collisionFilterMask) &&
            isCollisionAllowed(m_cow.get(),
                               static_cast<CollisionObjectWrapper*>(proxy0->m_clientObject),
-                              m_collisions.req->acm,
+                              m_collisions,
                               m_verbose);
   }
 };
 
+/**
+ * @brief Narrowphase between a convex shape and a PointCloudShape
+ *
+ * Every point near the convex shape is checked as a sphere with GJK/EPA, and only the closest point is reported, so the
+ * pair produces a single contact with a normal like any other pair.
+ */
+class ConvexPointCloudAlgorithm : public btActivatingCollisionAlgorithm
+{
+public:
+  ConvexPointCloudAlgorithm(const btCollisionAlgorithmConstructionInfo& ci,
+                            const btCollisionObjectWrapper* body0Wrap,
+                            const btCollisionObjectWrapper* body1Wrap,
+                            bool swapped)
+    : btActivatingCollisionAlgorithm(ci, body0Wrap, body1Wrap), m_manifoldPtr(nullptr), m_swapped(swapped)
+  {
+  }
+
+  ~ConvexPointCloudAlgorithm() override
+  {
+    if (m_manifoldPtr)
+      m_dispatcher->releaseManifold(m_manifoldPtr);
+  }
+
+  void processCollision(const btCollisionObjectWrapper* body0Wrap,
+                        const btCollisionObjectWrapper* body1Wrap,
+                        const btDispatcherInfo& dispatchInfo,
+                        btManifoldResult* resultOut) override
+  {
+    const btCollisionObjectWrapper* convex_wrap = m_swapped ? body1Wrap : body0Wrap;
+    const btCollisionObjectWrapper* cloud_wrap = m_swapped ? body0Wrap : body1Wrap;
+
+    // The manifold is always created convex first, btManifoldResult swaps the contacts back if needed
+    if (!m_manifoldPtr)
+      m_manifoldPtr =
+          m_dispatcher->getNewManifold(convex_wrap->getCollisionObject(), cloud_wrap->getCollisionObject());
+    resultOut->setPersistentManifold(m_manifoldPtr);
+
+    const btConvexShape* convex = static_cast<const btConvexShape*>(convex_wrap->getCollisionShape());
+    const PointCloudShape* cloud = static_cast<const PointCloudShape*>(cloud_wrap->getCollisionShape());
+    btSphereShape sphere(cloud->getPointRadius());
+
+    btScalar max_distance = convex->getMargin() + sphere.getMargin() + m_manifoldPtr->getContactBreakingThreshold();
+#if BT_BULLET_VERSION >= 285
+    max_distance += resultOut->m_closestPointDistanceThreshold;
+#endif
+    btGjkPairDetector::ClosestPointInput input;
+    input.m_maximumDistanceSquared = max_distance * max_distance;
+    input.m_transformA = convex_wrap->getWorldTransform();
+    input.m_transformB = cloud_wrap->getWorldTransform();
+
+    // Candidate points: the box of the convex shape in the cloud frame, grown by the query distance
+    btVector3 aabb_min, aabb_max;
+    convex->getAabb(cloud_wrap->getWorldTransform().inverse() * convex_wrap->getWorldTransform(), aabb_min, aabb_max);
+    btVector3 grow(max_distance, max_distance, max_distance);
+
+    btPointCollector closest;
+    cloud->forEachPoint(aabb_min - grow, aabb_max + grow, [&](const btVector3& p) {
+      btGjkPairDetector gjk(convex, &sphere, &m_simplexSolver, &m_pdSolver);
+      input.m_transformB.setOrigin(cloud_wrap->getWorldTransform() * p);
+
+      btPointCollector result;
+      gjk.getClosestPoints(input, result, dispatchInfo.m_debugDraw);
+      if (result.m_hasResult && (!closest.m_hasResult || result.m_distance < closest.m_distance))
+        closest = result;
+    });
+
+    if (closest.m_hasResult)
+      resultOut->addContactPoint(closest.m_normalOnBInWorld, closest.m_pointInWorld, closest.m_distance);
+
+    resultOut->refreshContactPoints();
+  }
+
+  btScalar calculateTimeOfImpact(btCollisionObject* /*body0*/,
+                                 btCollisionObject* /*body1*/,
+                                 const btDispatcherInfo& /*dispatchInfo*/,
+                                 btManifoldResult* /*resultOut*/) override
+  {
+    return btScalar(1.);
+  }
+
+  void getAllContactManifolds(btManifoldArray& manifoldArray) override
+  {
+    if (m_manifoldPtr)
+      manifoldArray.push_back(m_manifoldPtr);
+  }
+
+private:
+  btPersistentManifold* m_manifoldPtr;
+  bool m_swapped;
+  btVoronoiSimplexSolver m_simplexSolver;
+  btGjkEpaPenetrationDepthSolver m_pdSolver;
+};
+
+/**
+ * @brief Narrowphase between a convex shape and a LodShape
+ *
+ * The coarse levels are checked with GJK, coarsest first. Once all of them are within the contact distance the pair
+ * is handed to the algorithm of the full resolution shape, which is kept for the rest of the query.
+ */
+class ConvexLodAlgorithm : public btActivatingCollisionAlgorithm
+{
+public:
+  ConvexLodAlgorithm(const btCollisionAlgorithmConstructionInfo& ci,
+                     const btCollisionObjectWrapper* body0Wrap,
+                     const btCollisionObjectWrapper* body1Wrap,
+                     bool swapped)
+    : btActivatingCollisionAlgorithm(ci, body0Wrap, body1Wrap), m_full_algorithm(nullptr), m_swapped(swapped)
+  {
+  }
+
+  ~ConvexLodAlgorithm() override
+  {
+    if (m_full_algorithm)
+    {
+      m_full_algorithm->~btCollisionAlgorithm();
+      m_dispatcher->freeCollisionAlgorithm(m_full_algorithm);
+    }
+  }
+
+  void processCollision(const btCollisionObjectWrapper* body0Wrap,
+                        const btCollisionObjectWrapper* body1Wrap,
+                        const btDispatcherInfo& dispatchInfo,
+                        btManifoldResult* resultOut) override
+  {
+    const btCollisionObjectWrapper* convex_wrap = m_swapped ? body1Wrap : body0Wrap;
+    const btCollisionObjectWrapper* lod_wrap = m_swapped ? body0Wrap : body1Wrap;
+    const btConvexShape* convex = static_cast<const btConvexShape*>(convex_wrap->getCollisionShape());
+    const LodShape* lod = static_cast<const LodShape*>(lod_wrap->getCollisionShape());
+
+    btScalar max_distance = convex->getMargin() + gContactBreakingThreshold;
+#if BT_BULLET_VERSION >= 285
+    max_distance += resultOut->m_closestPointDistanceThreshold;
+#endif
+    for (const btCompoundShape* level : lod->getLevels())
+      if (!isWithin(convex, convex_wrap->getWorldTransform(), level, lod_wrap->getWorldTransform(), max_distance))
+        return;
+
+    btCollisionObjectWrapper full_wrap(lod_wrap,
+                                       lod->getFullShape(),
+                                       lod_wrap->getCollisionObject(),
+                                       lod_wrap->getWorldTransform(),
+                                       -1,
+                                       -1);
+    const btCollisionObjectWrapper* wrap0 = m_swapped ? &full_wrap : body0Wrap;
+    const btCollisionObjectWrapper* wrap1 = m_swapped ? body1Wrap : &full_wrap;
+    if (!m_full_algorithm)
+#if BT_BULLET_VERSION >= 285
+      m_full_algorithm = m_dispatcher->findAlgorithm(wrap0, wrap1, nullptr, BT_CLOSEST_POINT_ALGORITHMS);
+#else
+      m_full_algorithm = m_dispatcher->findAlgorithm(wrap0, wrap1);
+#endif
+
+    // The contacts must be reported against the full resolution shape, like the compound algorithm does for children
+    const btCollisionObjectWrapper* saved0 = resultOut->getBody0Wrap();
+    const btCollisionObjectWrapper* saved1 = resultOut->getBody1Wrap();
+    resultOut->setBody0Wrap(wrap0);
+    resultOut->setBody1Wrap(wrap1);
+    m_full_algorithm->processCollision(wrap0, wrap1, dispatchInfo, resultOut);
+    resultOut->setBody0Wrap(saved0);
+    resultOut->setBody1Wrap(saved1);
+  }
+
+  btScalar calculateTimeOfImpact(btCollisionObject* /*body0*/,
+                                 btCollisionObject* /*body1*/,
+                                 const btDispatcherInfo& /*dispatchInfo*/,
+                                 btManifoldResult* /*resultOut*/) override
+  {
+    return btScalar(1.);
+  }
+
+  void getAllContactManifolds(btManifoldArray& manifoldArray) override
+  {
+    if (m_full_algorithm)
+      m_full_algorithm->getAllContactManifolds(manifoldArray);
+  }
+
+private:
+  /** @brief True if a piece of the level is within max_distance of the convex shape */
+  bool isWithin(const btConvexShape* convex,
+                const btTransform& convex_tf,
+                const btCompoundShape* level,
+                const btTransform& level_tf,
+                btScalar max_distance)
+  {
+    for (int i = 0; i < level->getNumChildShapes(); ++i)
+    {
+      const btConvexShape* piece = static_cast<const btConvexShape*>(level->getChildShape(i));
+      btScalar piece_distance = max_distance + piece->getMargin();
+
+      btGjkPairDetector::ClosestPointInput input;
+      input.m_maximumDistanceSquared = piece_distance * piece_distance;
+      input.m_transformA = convex_tf;
+      input.m_transformB = level_tf * level->getChildTransform(i);
+
+      btGjkPairDetector gjk(convex, piece, &m_simplexSolver, &m_pdSolver);
+      btPointCollector result;
+      gjk.getClosestPoints(input, result, nullptr);
+      if (result.m_hasResult)
+      {
+        if (result.m_distance <= max_distance)
+          return true;
+        continue;
+      }
+
+      // No result is also what a failed penetration depth query gives, so only trust it for disjoint boxes
+      btVector3 convex_min, convex_max, piece_min, piece_max;
+      convex->getAabb(convex_tf, convex_min, convex_max);
+      piece->getAabb(input.m_transformB, piece_min, piece_max);
+      btVector3 grow(max_distance, max_distance, max_distance);
+      if (TestAabbAgainstAabb2(convex_min - grow, convex_max + grow, piece_min, piece_max))
+        return true;
+    }
+    return false;
+  }
+
+  btCollisionAlgorithm* m_full_algorithm;
+  bool m_swapped;
+  btVoronoiSimplexSolver m_simplexSolver;
+  btGjkEpaPenetrationDepthSolver m_pdSolver;
+};
+
+/**
+ * @brief Narrowphase between two shapes of CUSTOM_CONCAVE_SHAPE_TYPE, as found by world to world queries
+ *
+ * The LodShapes are replaced by their full resolution shapes and the pair is handed to the algorithm of the result, so
+ * a LodShape is checked against another LodShape or a PointCloudShape like its full shape. Two point clouds are not
+ * checked against each other.
+ */
+class CustomConcavePairAlgorithm : public btActivatingCollisionAlgorithm
+{
+public:
+  CustomConcavePairAlgorithm(const btCollisionAlgorithmConstructionInfo& ci,
+                             const btCollisionObjectWrapper* body0Wrap,
+                             const btCollisionObjectWrapper* body1Wrap)
+    : btActivatingCollisionAlgorithm(ci, body0Wrap, body1Wrap), m_algorithm(nullptr)
+  {
+  }
+
+  ~CustomConcavePairAlgorithm() override
+  {
+    if (m_algorithm)
+    {
+      m_algorithm->~btCollisionAlgorithm();
+      m_dispatcher->freeCollisionAlgorithm(m_algorithm);
+    }
+  }
+
+  void processCollision(const btCollisionObjectWrapper* body0Wrap,
+                        const btCollisionObjectWrapper* body1Wrap,
+                        const btDispatcherInfo& dispatchInfo,
+                        btManifoldResult* resultOut) override
+  {
+    const btCollisionShape* shape0 = getFullShape(body0Wrap->getCollisionShape());
+    const btCollisionShape* shape1 = getFullShape(body1Wrap->getCollisionShape());
+    if (shape0 == body0Wrap->getCollisionShape() && shape1 == body1Wrap->getCollisionShape())
+      return;
+
+    btCollisionObjectWrapper wrap0(
+        body0Wrap, shape0, body0Wrap->getCollisionObject(), body0Wrap->getWorldTransform(), -1, -1);
+    btCollisionObjectWrapper wrap1(
+        body1Wrap, shape1, body1Wrap->getCollisionObject(), body1Wrap->getWorldTransform(), -1, -1);
+    if (!m_algorithm)
+#if BT_BULLET_VERSION >= 285
+      m_algorithm = m_dispatcher->findAlgorithm(&wrap0, &wrap1, nullptr, BT_CLOSEST_POINT_ALGORITHMS);
+#else
+      m_algorithm = m_dispatcher->findAlgorithm(&wrap0, &wrap1);
+#endif
+
+    // The contacts are reported against the full resolution shapes, as in ConvexLodAlgorithm
+    const btCollisionObjectWrapper* saved0 = resultOut->getBody0Wrap();
+    const btCollisionObjectWrapper* saved1 = resultOut->getBody1Wrap();
+    resultOut->setBody0Wrap(&wrap0);
+    resultOut->setBody1Wrap(&wrap1);
+    m_algorithm->processCollision(&wrap0, &wrap1, dispatchInfo, resultOut);
+    resultOut->setBody0Wrap(saved0);
+    resultOut->setBody1Wrap(saved1);
+  }
+
+  btScalar calculateTimeOfImpact(btCollisionObject* /*body0*/,
+                                 btCollisionObject* /*body1*/,
+                                 const btDispatcherInfo& /*dispatchInfo*/,
+                                 btManifoldResult* /*resultOut*/) override
+  {
+    return btScalar(1.);
+  }
+
+  void getAllContactManifolds(btManifoldArray& manifoldArray) override
+  {
+    if (m_algorithm)
+      m_algorithm->getAllContactManifolds(manifoldArray);
+  }
+
+private:
+  static const btCollisionShape* getFullShape(const btCollisionShape* shape)
+  {
+    const LodShape* lod = dynamic_cast<const LodShape*>(shape);
+    return lod ? lod->getFullShape() : shape;
+  }
+
+  btCollisionAlgorithm* m_algorithm;
+};
+
+/** @brief Create function for the pairs of a PointCloudShape or a LodShape with a convex shape or with each other */
+struct CustomConcaveCreateFunc : public btCollisionAlgorithmCreateFunc
+{
+  btCollisionAlgorithm* CreateCollisionAlgorithm(btCollisionAlgorithmConstructionInfo& ci,
+                                                 const btCollisionObjectWrapper* body0Wrap,
+                                                 const btCollisionObjectWrapper* body1Wrap) override
+  {
+    if (body0Wrap->getCollisionShape()->getShapeType() == CUSTOM_CONCAVE_SHAPE_TYPE &&
+        body1Wrap->getCollisionShape()->getShapeType() == CUSTOM_CONCAVE_SHAPE_TYPE)
+    {
+      void* mem = ci.m_dispatcher1->allocateCollisionAlgorithm(sizeof(CustomConcavePairAlgorithm));
+      return new (mem) CustomConcavePairAlgorithm(ci, body0Wrap, body1Wrap);
+    }
+
+    const btCollisionShape* shape = (m_swapped ? body0Wrap : body1Wrap)->getCollisionShape();
+    if (dynamic_cast<const LodShape*>(shape))
+    {
+      void* mem = ci.m_dispatcher1->allocateCollisionAlgorithm(sizeof(ConvexLodAlgorithm));
+      return new (mem) ConvexLodAlgorithm(ci, body0Wrap, body1Wrap, m_swapped);
+    }
+
+    void* mem = ci.m_dispatcher1->allocateCollisionAlgorithm(sizeof(ConvexPointCloudAlgorithm));
+    return new (mem) ConvexPointCloudAlgorithm(ci, body0Wrap, body1Wrap, m_swapped);
+  }
+};
+
 struct BulletManager
 {
   btCollisionWorld* m_world;
@@ -979,6 +1672,8 @@ struct BulletManager
     btCollisionDispatcher* dispatcher = static_cast<btCollisionDispatcher*>(m_world->getDispatcher());
     dispatcher->setDispatcherFlags(dispatcher->getDispatcherFlags() &
                                    ~btCollisionDispatcher::CD_USE_RELATIVE_CONTACT_BREAKING_THRESHOLD);
+
+    registerCustomConcaveShapes();
   }
 
   ~BulletManager()
@@ -1021,6 +1716,11 @@ struct BulletManager
 
   void convexSweepTest(const COWPtr cow, const btTransform& tf1, const btTransform& tf2, BulletDistanceData& collisions)
   {
+    // Sweeps do not go through the collision algorithms, so they need the full resolution shapes
+    for (auto& element : m_link2cow)
+      if (LodShape* lod = dynamic_cast<LodShape*>(element.second->getCollisionShape()))
+        element.second->setCollisionShape(lod->getFullShape());
+
     SweepCollisionCollector cc(collisions, cow);
     convexSweepTestHelper(cow->getCollisionShape(), tf1, tf2, cc);
   }
@@ -1064,6 +1764,57 @@ private:
     }
   }
 
+  /** @brief Register the algorithms of the shapes sharing CUSTOM_CONCAVE_SHAPE_TYPE, PointCloudShape and LodShape */
+  void registerCustomConcaveShapes()
+  {
+    m_custom_concave_cf.reset(new CustomConcaveCreateFunc);
+    m_custom_concave_swapped_cf.reset(new CustomConcaveCreateFunc);
+    m_custom_concave_swapped_cf->m_swapped = true;
+    for (int i = 0; i < CONCAVE_SHAPES_START_HERE; ++i)
+    {
+      m_dispatcher->registerCollisionCreateFunc(i, CUSTOM_CONCAVE_SHAPE_TYPE, m_custom_concave_cf.get());
+      m_dispatcher->registerCollisionCreateFunc(CUSTOM_CONCAVE_SHAPE_TYPE, i, m_custom_concave_swapped_cf.get());
+#if BT_BULLET_VERSION >= 285
+      m_dispatcher->registerClosestPointsCreateFunc(i, CUSTOM_CONCAVE_SHAPE_TYPE, m_custom_concave_cf.get());
+      m_dispatcher->registerClosestPointsCreateFunc(CUSTOM_CONCAVE_SHAPE_TYPE, i, m_custom_concave_swapped_cf.get());
+#endif
+    }
+    m_dispatcher->registerCollisionCreateFunc(
+        CUSTOM_CONCAVE_SHAPE_TYPE, CUSTOM_CONCAVE_SHAPE_TYPE, m_custom_concave_cf.get());
+#if BT_BULLET_VERSION >= 285
+    m_dispatcher->registerClosestPointsCreateFunc(
+        CUSTOM_CONCAVE_SHAPE_TYPE, CUSTOM_CONCAVE_SHAPE_TYPE, m_custom_concave_cf.get());
+#endif
+  }
+
+  std::unique_ptr<CustomConcaveCreateFunc> m_custom_concave_cf;
+  std::unique_ptr<CustomConcaveCreateFunc> m_custom_concave_swapped_cf;
+
+  /** @brief Sweep a convex shape against the points of a cloud in the box swept by the shape */
+  static void pointCloudSweepTest(const btConvexShape* convex,
+                                  const btTransform& tf1,
+                                  const btTransform& tf2,
+                                  const btCollisionObject* cloud_object,
+                                  const PointCloudShape* cloud,
+                                  btCollisionWorld::ConvexResultCallback& cc)
+  {
+    const btTransform& cloud_tf = cloud_object->getWorldTransform();
+    btVector3 aabb_min, aabb_max, aabb_min2, aabb_max2;
+    convex->getAabb(cloud_tf.inverse() * tf1, aabb_min, aabb_max);
+    convex->getAabb(cloud_tf.inverse() * tf2, aabb_min2, aabb_max2);
+    aabb_min.setMin(aabb_min2);
+    aabb_max.setMax(aabb_max2);
+    btVector3 grow(cloud->getPointRadius(), cloud->getPointRadius(), cloud->getPointRadius());
+
+    btSphereShape sphere(cloud->getPointRadius());
+    btTransform point_tf;
+    point_tf.setIdentity();
+    cloud->forEachPoint(aabb_min - grow, aabb_max + grow, [&](const btVector3& p) {
+      point_tf.setOrigin(cloud_tf * p);
+      btCollisionWorld::objectQuerySingle(convex, tf1, tf2, cloud_object, &sphere, point_tf, cc, 0);
+    });
+  }
+
   void convexSweepTestHelper(const btCollisionShape* shape,
                              const btTransform& tf1,
                              const btTransform& tf2,
@@ -1073,6 +1824,15 @@ private:
     {
       const btConvexShape* convex = static_cast<const btConvexShape*>(shape);
       m_world->convexSweepTest(convex, tf1, tf2, cc, 0);
+
+      // Point clouds have no triangles for the sweep, their points are swept against as spheres
+      for (auto& element : m_link2cow)
+      {
+        const PointCloudShape* cloud = dynamic_cast<const PointCloudShape*>(element.second->getCollisionShape());
+        btBroadphaseProxy* proxy = element.second->getBroadphaseHandle();
+        if (cloud && proxy && cc.needsCollision(proxy))
+          pointCloudSweepTest(convex, tf1, tf2, element.second.get(), cloud, cc);
+      }
     }
     else if (btBroadphaseProxy::isCompound(shape->getShapeType()))
     {
@@ -1080,7 +1840,7 @@ private:
       for (int i = 0; i < compound->getNumChildShapes(); ++i)
       {
         convexSweepTestHelper(
-            compound->getChildShape(i), tf1 * compound->getChildTransform(i), tf1 * compound->getChildTransform(i), cc);
+            compound->getChildShape(i), tf1 * compound->getChildTransform(i), tf2 * compound->getChildTransform(i), cc);
       }
     }
     else
@@ -1095,6 +1855,24 @@ typedef std::shared_ptr<BulletManager> BulletManagerPtr;
 btCollisionShape* createShapePrimitive(const shapes::ShapeConstPtr& geom, bool useTrimesh, CollisionObjectWrapper* cow);
 COWPtr CollisionObjectFromLink(const robot_model::LinkModel* link, bool useTrimesh);
 
+/**
+ * @brief Rebuild the objects created while the convex decomposition of one of their meshes was pending
+ * @return True if any object was rebuilt
+ */
+bool refreshConvexDecompositions(Link2ConstCow& objects);
+
+/**
+ * @brief Create a world collision object for a point cloud, see PointCloudShape
+ * @param id Name of the object, used by the allowed collision matrix like the name of any world object
+ * @param points Points in the world frame
+ * @param point_radius The points are checked as spheres of this radius
+ * @param cell_size Size of the grid cells the points are bucketed in
+ */
+COWPtr createPointCloudObject(const std::string& id,
+                              const std::vector<Eigen::Vector3d>& points,
+                              double point_radius,
+                              double cell_size);
+
 inline void setContactDistance(COWPtr cow, double contact_distance)
 {
   SHAPE_EXPANSION = btVector3(1, 1, 1) * contact_distance;
@@ -130,6 +130,23 @@ public:
                              const CollisionRobot& other_robot,
                              const robot_state::RobotState& other_state) const override;
 
+  /**
+   * @brief Swap in the convex decompositions of the link meshes that finished since the links were created
+   *
+   * Queries keep the shapes the links were created with, unless the bullet/refresh_convex_decompositions parameter
+   * is set, so the geometry cannot change in the middle of a solve. Call this between requests, while no query runs.
+   * @return True if any link was rebuilt
+   */
+  bool updateConvexDecompositions() const;
+
+  /**
+   * @brief Drop the allowed collision tables kept from earlier queries
+   *
+   * The tables are looked up by the address of the allowed collision matrix, so call this after modifying a matrix in
+   * place which was already used for a query.
+   */
+  void clearAllowedCollisionTables() const;
+
 protected:
   virtual void updatedPaddingOrScaling(const std::vector<std::string>& links);
 
@@ -184,8 +201,18 @@ protected:
                            const CollisionRobot& other_robot,
                            const robot_state::RobotState& other_state) const;
 
-  Link2ConstCow m_link2cow;
+  /** @brief The link collision objects, see updateConvexDecompositions */
+  Link2ConstCow getCollisionObjects() const;
+
+  mutable Link2ConstCow m_link2cow;
+  mutable std::mutex m_link2cow_mutex;
   bool m_use_original_cast;
+  /** @brief Compile the allowed collision matrix into a pair table per query (param bullet/allowed_collision_table) */
+  bool m_use_acm_table = true;
+  /** @brief The pair tables of recent queries, reused by later queries over the same objects, not shared with copies */
+  AllowedCollisionTableCachePtr m_acm_tables = std::make_shared<AllowedCollisionTableCache>();
+  /** @brief Swap in finished convex decompositions at every query (param bullet/refresh_convex_decompositions) */
+  bool m_refresh_convex_decompositions = BULLET_DEFAULT_REFRESH_CONVEX_DECOMPOSITIONS;
 };
 }
 
@@ -40,6 +40,7 @@
 #include "trajopt_moveit/collision_robot_bullet.h"
 #include <memory>
 #include <moveit/macros/deprecation.h>
+#include <moveit/robot_trajectory/robot_trajectory.h>
 
 namespace collision_detection
 {
@@ -115,6 +116,62 @@ public:
 
   virtual void setWorld(const WorldPtr& world);
 
+  /**
+   * @brief Add or replace a point cloud collision object, checked against the robot like a world object
+   *
+   * The points are indexed directly instead of going through an octree, so the cloud can be replaced at the sensor
+   * rate. Point clouds are not part of the MoveIt world, which has no point cloud shape. They are checked by the
+   * discrete, cast and swept queries.
+   * @param points Points in the world frame
+   * @param point_radius The points are checked as spheres of this radius
+   * @param cell_size Size of the grid cells the points are bucketed in, defaults to the size of a contact query
+   */
+  void setPointCloud(const std::string& id,
+                     const std::vector<Eigen::Vector3d>& points,
+                     double point_radius,
+                     double cell_size = 0);
+
+  void removePointCloud(const std::string& id);
+
+  /**
+   * @brief Check a whole trajectory against the world, stopping at the first collision
+   *
+   * The collision objects are built once per thread and only moved from waypoint to waypoint, and the waypoints are
+   * spread over the threads. Waypoint k is checked against the world (and the robot itself if self is set) and, if
+   * continuous is set, the motion from waypoint k - 1 to k is swept against the world. The attached bodies are taken
+   * from the first waypoint.
+   * @param res The contacts of the first invalid waypoint
+   * @param acm Allowed collision matrix, may be nullptr
+   * @param num_threads Number of threads, 0 for one per core
+   * @return The index of the first invalid waypoint, -1 if the whole trajectory is collision free
+   */
+  int checkTrajectoryCollision(const CollisionRequest& req,
+                               CollisionResult& res,
+                               const CollisionRobot& robot,
+                               const robot_trajectory::RobotTrajectory& trajectory,
+                               const AllowedCollisionMatrix* acm = nullptr,
+                               bool continuous = false,
+                               bool self = true,
+                               int num_threads = 0) const;
+
+  /**
+   * @brief Swap in the convex decompositions of the object meshes that finished since the objects were created
+   *
+   * Queries keep the shapes the objects were created with, unless the bullet/refresh_convex_decompositions parameter
+   * is set, so the geometry cannot change in the middle of a solve. Call this between requests, while no query runs.
+   * VersionedPlanningScene calls it on every new version before publishing it.
+   * @return True if any object was rebuilt
+   */
+  bool updateConvexDecompositions() const;
+
+  /**
+   * @brief Drop the allowed collision tables kept from earlier queries
+   *
+   * The tables are looked up by the address of the allowed collision matrix, so call this after modifying a matrix in
+   * place which was already used for a query.
+   */
+  void clearAllowedCollisionTables() const;
+
 protected:
   void checkWorldCollisionHelper(const CollisionRequest& req,
                                  CollisionResult& res,
@@ -150,9 +207,21 @@ protected:
                              bool allow_static2static = false) const;
   void updateBulletObject(const std::string& id);
 
-  Link2ConstCow m_link2cow;
+  /** @brief The world collision objects, see updateConvexDecompositions */
+  Link2ConstCow getCollisionObjects() const;
+
+  mutable Link2ConstCow m_link2cow;
+  mutable std::mutex m_link2cow_mutex;
+  Link2ConstCow m_point_clouds;
+  /** @brief Compile the allowed collision matrix into a pair table per query (param bullet/allowed_collision_table) */
+  bool m_use_acm_table = true;
+  /** @brief The pair tables of recent queries, reused by later queries over the same objects, not shared with copies */
+  AllowedCollisionTableCachePtr m_acm_tables = std::make_shared<AllowedCollisionTableCache>();
+  /** @brief Swap in finished convex decompositions at every query (param bullet/refresh_convex_decompositions) */
+  bool m_refresh_convex_decompositions = BULLET_DEFAULT_REFRESH_CONVEX_DECOMPOSITIONS;
 
 private:
+  /** @brief Read the bullet parameters from the private namespace */
   void initialize();
   void notifyObjectChange(const ObjectConstPtr& obj, World::Action action);
   World::ObserverHandle observer_handle_;
@@ -0,0 +1,82 @@
+#ifndef TRAJOPT_MOVEIT_CONVEX_DECOMPOSITION_CACHE_H
+#define TRAJOPT_MOVEIT_CONVEX_DECOMPOSITION_CACHE_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <Eigen/Core>
+#include <geometric_shapes/shapes.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+namespace collision_detection
+{
+/** @brief Convex pieces of a mesh, given by the vertices of their convex hull */
+struct ConvexDecomposition
+{
+  std::vector<std::vector<Eigen::Vector3d>> hulls;
+};
+typedef std::shared_ptr<const ConvexDecomposition> ConvexDecompositionConstPtr;
+
+/**
+ * @brief Convex decompositions of meshes, computed with V-HACD in a background thread
+ *
+ * Meshes are identified by a hash of their vertices and triangles. The first lookup of a mesh queues it and returns
+ * nullptr, so the caller approximates it by its convex hull until generation() changes and a later lookup returns the
+ * decomposition. Results are written to the directory given by the TRAJOPT_CONVEX_DECOMPOSITION_DIR environment
+ * variable (default ~/.ros/trajopt_convex_decomposition), so every mesh is decomposed only once.
+ */
+class ConvexDecompositionCache
+{
+public:
+  static ConvexDecompositionCache& instance();
+  ~ConvexDecompositionCache();
+
+  /** @brief Decomposition of the mesh if it is ready, otherwise queue the mesh and return nullptr */
+  ConvexDecompositionConstPtr get(const shapes::Mesh& mesh);
+
+  /** @brief Incremented every time a decomposition becomes ready */
+  unsigned long generation() const;
+
+  /** @brief When disabled, lookups return nullptr without queuing the mesh */
+  void setEnabled(bool enabled);
+  bool isEnabled() const;
+
+  /** @brief Block until all the queued meshes are decomposed */
+  void wait();
+
+private:
+  struct Job
+  {
+    uint64_t hash;
+    std::vector<double> points;
+    std::vector<uint32_t> triangles;
+  };
+
+  ConvexDecompositionCache();
+
+  void run();
+  ConvexDecompositionConstPtr decompose(const Job& job);
+  std::string fileName(uint64_t hash) const;
+  ConvexDecompositionConstPtr load(uint64_t hash) const;
+  void save(uint64_t hash, const ConvexDecomposition& decomposition) const;
+
+  std::map<uint64_t, ConvexDecompositionConstPtr> decompositions_;
+  std::set<uint64_t> pending_;  // queued or running
+  std::deque<Job> jobs_;
+  std::string dir_;
+  bool enabled_;
+  bool stop_;
+  unsigned long generation_;
+  std::thread worker_;
+  mutable std::mutex mutex_;
+  std::condition_variable job_cv_;
+  std::condition_variable done_cv_;
+};
+}
+
+#endif
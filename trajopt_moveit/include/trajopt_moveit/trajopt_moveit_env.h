@@ -14,8 +14,21 @@ public:
   EIGEN_MAKE_ALIGNED_OPERATOR_NEW
 
   TrajOptMoveItEnv() : BasicEnv(), initialized_(false) {}
+
+  /**
+   * @brief Bind to a live planning scene, changes made to the scene are seen by the queries
+   *
+   * The scene must not be modified while a planner is using this environment. Use init with a snapshot of a
+   * VersionedPlanningScene to plan concurrently with scene updates.
+   */
   bool init(planning_scene::PlanningScenePtr planning_scene);
 
+  /** @brief Bind to a scene which is not modified for the lifetime of this environment, e.g. a snapshot */
+  bool init(planning_scene::PlanningSceneConstPtr planning_scene);
+
+  /** @brief The planning scene used by the queries */
+  planning_scene::PlanningSceneConstPtr getPlanningScene() const { return env_; }
+
   /**
    * @brief Checks if BasicKin is initialized (init() has been run: urdf model loaded, etc.)
    * @return True if init() has completed successfully
@@ -65,7 +78,7 @@ public:
 
 private:
   bool initialized_; /**< Identifies if the object has been initialized */
-  planning_scene::PlanningScenePtr env_;
+  planning_scene::PlanningSceneConstPtr env_;
   std::vector<std::string> urdf_active_link_names_;             /**< A vector of active link names */
   collision_detection::CollisionRobotConstPtr collision_robot_; /**< Pointer to the collision robot, some constraints
                                                                    require it */
@@ -75,6 +88,12 @@ private:
   std::set<const robot_model::LinkModel*> getLinkModels(const std::vector<std::string>& link_names) const;
 
   std::string getManipulatorName(const std::vector<std::string>& joint_names) const;
+
+  /** @brief Get the transforms of all links from a state whose transforms are up to date */
+  tesseract::VectorIsometry3d getLinkTransforms(const moveit::core::RobotState& state) const;
+
+  /** @brief Check if the link or attached body transforms of a state need an update before they are read */
+  static bool hasDirtyTransforms(const moveit::core::RobotState& state);
 };
 typedef std::shared_ptr<TrajOptMoveItEnv> TrajOptMoveItEnvPtr;
 typedef std::shared_ptr<const TrajOptMoveItEnv> TrajOptMoveItEnvConstPtr;
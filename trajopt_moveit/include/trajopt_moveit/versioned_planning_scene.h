@@ -0,0 +1,65 @@
+#ifndef TRAJOPT_MOVEIT_VERSIONED_PLANNING_SCENE_H
+#define TRAJOPT_MOVEIT_VERSIONED_PLANNING_SCENE_H
+
+#include <functional>
+#include <mutex>
+#include <moveit/planning_scene/planning_scene.h>
+#include <moveit_msgs/PlanningScene.h>
+#include <trajopt_moveit/trajopt_moveit_env.h>
+
+namespace trajopt_moveit
+{
+/**
+ * @brief Publishes immutable versions of a planning scene so planners can run concurrently with scene updates
+ *
+ * Every update is applied to a child of the current version (PlanningScene::diff) which is then decoupled from its
+ * parent and published as the new version. Versions are never modified once published, so a planning request pins
+ * the version returned by snapshot() for its lifetime without holding any lock. Unchanged world objects and their
+ * collision objects are shared between versions, only the changed ones are copied. The convex decompositions of the
+ * world meshes that finished in the background are swapped in when a version is published, never in a published one.
+ */
+class VersionedPlanningScene
+{
+public:
+  /** @brief The scene is copied, later changes to it are not seen by the versions */
+  VersionedPlanningScene(const planning_scene::PlanningSceneConstPtr& scene);
+
+  /** @brief The current version of the scene */
+  planning_scene::PlanningSceneConstPtr snapshot() const;
+
+  /** @brief Number of updates published so far */
+  unsigned long version() const;
+
+  /**
+   * @brief Apply modify to a copy of the current version and publish the result
+   *
+   * Updates are serialized, so concurrent updates are all applied in turn.
+   * @return The new version
+   */
+  planning_scene::PlanningSceneConstPtr update(const std::function<void(planning_scene::PlanningScene&)>& modify);
+
+  /**
+   * @brief Apply a planning scene message (full or diff) and publish the result
+   * @return The new version, or nullptr if the message could not be applied in which case nothing is published
+   */
+  planning_scene::PlanningSceneConstPtr update(const moveit_msgs::PlanningScene& msg);
+
+  /** @brief Create an environment bound to the current version */
+  TrajOptMoveItEnvPtr createEnv() const;
+
+private:
+  mutable std::mutex mutex_; /**< Guards current_ and version_, only held to copy the pointer */
+  std::mutex update_mutex_;  /**< Serializes the writers */
+  planning_scene::PlanningSceneConstPtr current_;
+  unsigned long version_;
+
+  /** @brief Copy of the scene which shares the unchanged data and no longer depends on its parent */
+  static planning_scene::PlanningScenePtr copy(const planning_scene::PlanningSceneConstPtr& scene);
+  planning_scene::PlanningSceneConstPtr publish(planning_scene::PlanningScenePtr next);
+  /** @brief Swap in the finished convex decompositions of a version which is not published yet */
+  static void updateConvexDecompositions(const planning_scene::PlanningScene& scene);
+};
+typedef std::shared_ptr<VersionedPlanningScene> VersionedPlanningScenePtr;
+}
+
+#endif  // TRAJOPT_MOVEIT_VERSIONED_PLANNING_SCENE_H
@@ -37,11 +37,13 @@
 #include <BulletCollision/CollisionDispatch/btConvexConvexAlgorithm.h>
 #include <BulletCollision/CollisionShapes/btShapeHull.h>
 #include <BulletCollision/Gimpact/btGImpactShape.h>
+#include <LinearMath/btConvexHullComputer.h>
 #include <boost/thread/mutex.hpp>
 #include <geometric_shapes/shapes.h>
 #include <memory>
 #include <octomap/octomap.h>
 #include <trajopt_moveit/collision_common.h>
+#include <trajopt_moveit/convex_decomposition_cache.h>
 
 namespace collision_detection
 {
@@ -79,6 +81,31 @@ btCollisionShape* createShapePrimitive(const shapes::ShapeConstPtr& geom, bool u
     case shapes::MESH:
     {
       const shapes::Mesh* mesh = static_cast<const shapes::Mesh*>(geom.get());
+
+      // Non-convex meshes are replaced by their convex decomposition once it is ready
+      ConvexDecompositionCache& decompositions = ConvexDecompositionCache::instance();
+      ConvexDecompositionConstPtr decomposition = decompositions.get(*mesh);
+      if (decomposition && decomposition->hulls.size() > 1)
+      {
+        btCompoundShape* compound = new btCompoundShape(/*dynamicAABBtree=*/false);
+        btTransform identity;
+        identity.setIdentity();
+        for (const std::vector<Eigen::Vector3d>& hull : decomposition->hulls)
+        {
+          btConvexHullShape* piece = new btConvexHullShape();
+          for (const Eigen::Vector3d& p : hull)
+            piece->addPoint(convertEigenToBt(p));
+          piece->setMargin(BULLET_MARGIN);
+          cow->manage(piece);
+          compound->addChildShape(identity, piece);
+        }
+        return compound;
+      }
+      else if (!decomposition && decompositions.isEnabled())
+      {
+        ++cow->m_pending_decompositions;
+      }
+
       std::shared_ptr<btTriangleMesh> ptrimesh(new btTriangleMesh());
       if (mesh->vertex_count > 0 && mesh->triangle_count > 0)
       {
@@ -176,8 +203,122 @@ btCollisionShape* createShapePrimitive(const shapes::ShapeConstPtr& geom, bool u
   }
 }
 
+namespace
+{
+/** @brief Add points whose convex hull encloses the shape: hull vertices for convex hulls, bounding box corners else */
+void addEnclosingPoints(const btCollisionShape* shape, const btTransform& tf, std::vector<double>& points)
+{
+  auto add = [&points](const btVector3& p) {
+    points.push_back(p.x());
+    points.push_back(p.y());
+    points.push_back(p.z());
+  };
+
+  if (const btCompoundShape* compound = dynamic_cast<const btCompoundShape*>(shape))
+  {
+    for (int i = 0; i < compound->getNumChildShapes(); ++i)
+      addEnclosingPoints(compound->getChildShape(i), tf * compound->getChildTransform(i), points);
+  }
+  else if (const btConvexHullShape* hull = dynamic_cast<const btConvexHullShape*>(shape))
+  {
+    for (int i = 0; i < hull->getNumPoints(); ++i)
+      add(tf * hull->getUnscaledPoints()[i]);
+  }
+  else
+  {
+    btVector3 lo, hi;
+    shape->getAabb(tf, lo, hi);
+    for (int i = 0; i < 8; ++i)
+      add(btVector3((i & 1) ? hi.x() : lo.x(), (i & 2) ? hi.y() : lo.y(), (i & 4) ? hi.z() : lo.z()));
+  }
+}
+
+/**
+ * @brief Wrap the shape of the object in a LodShape whose coarse levels are its bounding box and its convex hull
+ *
+ * Both levels enclose the shape, so they only cull pairs that would not produce contacts anyway.
+ */
+void addLevelsOfDetail(CollisionObjectWrapper* cow)
+{
+  btCollisionShape* shape = cow->getCollisionShape();
+  btTransform identity;
+  identity.setIdentity();
+
+  btVector3 lo, hi;
+  shape->getAabb(identity, lo, hi);
+  btBoxShape* box = new btBoxShape((hi - lo) / 2);
+  box->setMargin(BULLET_MARGIN);
+  btCompoundShape* box_level = new btCompoundShape(/*dynamicAABBtree=*/false);
+  box_level->addChildShape(btTransform(btQuaternion::getIdentity(), (hi + lo) / 2), box);
+
+  cow->manage(box);
+  cow->manage(box_level);
+  std::vector<const btCompoundShape*> levels = { box_level };
+
+  std::vector<double> points;
+  addEnclosingPoints(shape, identity, points);
+  btConvexHullComputer computer;
+  computer.compute(points.data(), 3 * sizeof(double), static_cast<int>(points.size() / 3), 0, 0);
+  if (computer.vertices.size() > 0)
+  {
+    btConvexHullShape* hull = new btConvexHullShape();
+    for (int i = 0; i < computer.vertices.size(); ++i)
+      hull->addPoint(computer.vertices[i]);
+    hull->setMargin(BULLET_MARGIN);
+    btCompoundShape* hull_level = new btCompoundShape(/*dynamicAABBtree=*/false);
+    hull_level->addChildShape(identity, hull);
+    cow->manage(hull);
+    cow->manage(hull_level);
+    levels.push_back(hull_level);
+  }
+
+  LodShape* lod = new LodShape(levels, shape);
+  lod->setMargin(BULLET_MARGIN);
+  cow->manage(lod);
+  cow->setCollisionShape(lod);
+}
+}
+
+bool refreshConvexDecompositions(Link2ConstCow& objects)
+{
+  unsigned long generation = ConvexDecompositionCache::instance().generation();
+  bool refreshed = false;
+  for (auto& element : objects)
+  {
+    const COWConstPtr& cow = element.second;
+    if (cow->m_pending_decompositions == 0 || cow->m_decomposition_generation == generation)
+      continue;
+
+    element.second = cow->clone();
+    refreshed = true;
+  }
+  return refreshed;
+}
+
+COWPtr createPointCloudObject(const std::string& id,
+                              const std::vector<Eigen::Vector3d>& points,
+                              double point_radius,
+                              double cell_size)
+{
+  // The object is not part of the world, the wrapper owns it to provide the ID
+  std::shared_ptr<World::Object> obj(new World::Object(id));
+  COWPtr cow(new COW(obj.get()));
+  cow->manage(obj);
+  cow->m_index = -1000;
+
+  PointCloudShape* shape = new PointCloudShape(points, point_radius, cell_size);
+  shape->setMargin(BULLET_MARGIN);
+  cow->manage(shape);
+  cow->setCollisionShape(shape);
+  return cow;
+}
+
 CollisionObjectWrapper::CollisionObjectWrapper(const robot_model::LinkModel* link)
-  : m_type(BodyTypes::ROBOT_LINK), m_index(-1)
+  : m_type(BodyTypes::ROBOT_LINK)
+  , m_index(-1)
+  , m_acm_index(-1)
+  , m_pending_decompositions(0)
+  , m_decomposition_generation(0)
 {
   ptr.m_link = link;
 
@@ -189,7 +330,11 @@ CollisionObjectWrapper::CollisionObjectWrapper(const robot_model::LinkModel* lin
 }
 
 CollisionObjectWrapper::CollisionObjectWrapper(const robot_state::AttachedBody* ab)
-  : m_type(BodyTypes::ROBOT_ATTACHED), m_index(-1)
+  : m_type(BodyTypes::ROBOT_ATTACHED)
+  , m_index(-1)
+  , m_acm_index(-1)
+  , m_pending_decompositions(0)
+  , m_decomposition_generation(0)
 {
   ptr.m_ab = ab;
 
@@ -200,7 +345,12 @@ CollisionObjectWrapper::CollisionObjectWrapper(const robot_state::AttachedBody*
   initialize(ab->getShapes(), ab->getFixedTransforms());
 }
 
-CollisionObjectWrapper::CollisionObjectWrapper(const World::Object* obj) : m_type(BodyTypes::WORLD_OBJECT), m_index(-1)
+CollisionObjectWrapper::CollisionObjectWrapper(const World::Object* obj)
+  : m_type(BodyTypes::WORLD_OBJECT)
+  , m_index(-1)
+  , m_acm_index(-1)
+  , m_pending_decompositions(0)
+  , m_decomposition_generation(0)
 {
   ptr.m_obj = obj;
 
@@ -214,6 +364,9 @@ CollisionObjectWrapper::CollisionObjectWrapper(const World::Object* obj) : m_typ
 void CollisionObjectWrapper::initialize(const std::vector<shapes::ShapeConstPtr>& shapes,
                                         const tesseract::VectorIsometry3d& transforms)
 {
+  // Taken before the meshes are looked up, so a decomposition finishing meanwhile still triggers a refresh
+  m_decomposition_generation = ConvexDecompositionCache::instance().generation();
+
   bool useTrimesh = false;
   if (shapes.size() == 1 && transforms[0].matrix().isIdentity())
   {
@@ -244,6 +397,11 @@ void CollisionObjectWrapper::initialize(const std::vector<shapes::ShapeConstPtr>
     }
   }
 
+  // Meshes, octrees and objects made of several shapes get coarse levels, checked first by the narrowphase
+  bool detailed = shapes.size() > 1 || shapes[0]->type == shapes::MESH || shapes[0]->type == shapes::OCTREE;
+  if (m_type == BodyTypes::WORLD_OBJECT && detailed && getCollisionShape())
+    addLevelsOfDetail(this);
+
   btTransform trans;
   trans.setIdentity();
   setWorldTransform(trans);
@@ -35,8 +35,10 @@
 /* Author: Ioan Sucan */
 
 #include <trajopt_moveit/collision_robot_bullet.h>
+#include <trajopt_moveit/convex_decomposition_cache.h>
 
 const bool BULLET_DEFAULT_USE_ORIGINAL_CAST = false;
+const bool BULLET_DEFAULT_CONVEX_DECOMPOSITION = true;
 
 collision_detection::CollisionRobotBullet::CollisionRobotBullet(const robot_model::RobotModelConstPtr& model,
                                                                 double padding,
@@ -47,6 +49,15 @@ collision_detection::CollisionRobotBullet::CollisionRobotBullet(const robot_mode
 
   nh.param<bool>("bullet/use_original_cast", m_use_original_cast, BULLET_DEFAULT_USE_ORIGINAL_CAST);
 
+  bool convex_decomposition;
+  nh.param<bool>("bullet/convex_decomposition", convex_decomposition, BULLET_DEFAULT_CONVEX_DECOMPOSITION);
+  ConvexDecompositionCache::instance().setEnabled(convex_decomposition);
+
+  nh.param<bool>("bullet/allowed_collision_table", m_use_acm_table, BULLET_DEFAULT_ALLOWED_COLLISION_TABLE);
+  nh.param<bool>("bullet/refresh_convex_decompositions",
+                 m_refresh_convex_decompositions,
+                 BULLET_DEFAULT_REFRESH_CONVEX_DECOMPOSITIONS);
+
   const std::vector<const robot_model::LinkModel*>& links = robot_model_->getLinkModelsWithCollisionGeometry();
   // we keep the same order of objects as what RobotState *::getLinkState()
   // returns
@@ -74,6 +85,22 @@ collision_detection::CollisionRobotBullet::CollisionRobotBullet(const CollisionR
 {
   m_link2cow = other.m_link2cow;
   m_use_original_cast = other.m_use_original_cast;
+  m_use_acm_table = other.m_use_acm_table;
+  m_refresh_convex_decompositions = other.m_refresh_convex_decompositions;
+}
+
+collision_detection::Link2ConstCow collision_detection::CollisionRobotBullet::getCollisionObjects() const
+{
+  std::lock_guard<std::mutex> lock(m_link2cow_mutex);
+  if (m_refresh_convex_decompositions)
+    refreshConvexDecompositions(m_link2cow);
+  return m_link2cow;
+}
+
+bool collision_detection::CollisionRobotBullet::updateConvexDecompositions() const
+{
+  std::lock_guard<std::mutex> lock(m_link2cow_mutex);
+  return refreshConvexDecompositions(m_link2cow);
 }
 
 void collision_detection::CollisionRobotBullet::constructBulletObject(
@@ -84,7 +111,7 @@ void collision_detection::CollisionRobotBullet::constructBulletObject(
     const std::set<const robot_model::LinkModel*>* active_links,
     bool continuous) const
 {
-  for (std::pair<std::string, COWConstPtr> element : m_link2cow)
+  for (std::pair<std::string, COWConstPtr> element : getCollisionObjects())
   {
     COWPtr new_cow(new COW(*(element.second.get())));
     assert(new_cow->getCollisionShape());
@@ -163,7 +190,7 @@ void collision_detection::CollisionRobotBullet::constructBulletObject(
     const robot_state::RobotState& state2,
     const std::set<const robot_model::LinkModel*>* active_links) const
 {
-  for (std::pair<std::string, COWConstPtr> element : m_link2cow)
+  for (std::pair<std::string, COWConstPtr> element : getCollisionObjects())
   {
     COWPtr new_cow(new COW(*(element.second.get())));
 
@@ -403,6 +430,9 @@ void collision_detection::CollisionRobotBullet::checkSelfCollisionHelper(const C
   manager.processCollisionObjects();
 
   BulletDistanceData collisions(&dreq, &dres);
+  if (m_use_acm_table)
+    compileAllowedCollisions(collisions, { &manager.m_link2cow }, *m_acm_tables);
+
   for (auto& obj : active_objects)
   {
     COWPtr cow = manager.m_link2cow[obj];
@@ -447,6 +477,9 @@ void collision_detection::CollisionRobotBullet::checkSelfCollisionHelper(const C
   manager.processCollisionObjects();
 
   BulletDistanceData collisions(&dreq, &dres);
+  if (m_use_acm_table)
+    compileAllowedCollisions(collisions, { &manager.m_link2cow }, *m_acm_tables);
+
   for (auto& obj : active_objects)
   {
     COWPtr cow = manager.m_link2cow[obj];
@@ -542,6 +575,9 @@ void collision_detection::CollisionRobotBullet::checkOtherCollisionHelper(const
   constructBulletObject(robot_objects, active_objects, contact_distance, state, dreq.active_components_only);
 
   BulletDistanceData collisions(&dreq, &dres);
+  if (m_use_acm_table)
+    compileAllowedCollisions(collisions, { &other_robot_manager.m_link2cow, &robot_objects }, *m_acm_tables);
+
   for (auto& obj : active_objects)
   {
     COWPtr cow = robot_objects[obj];
@@ -556,6 +592,8 @@ void collision_detection::CollisionRobotBullet::checkOtherCollisionHelper(const
   convertBulletCollisions(res, collisions);
 }
 
+void collision_detection::CollisionRobotBullet::clearAllowedCollisionTables() const { m_acm_tables->clear(); }
+
 void collision_detection::CollisionRobotBullet::updatedPaddingOrScaling(const std::vector<std::string>& links)
 {
   CONSOLE_BRIDGE_logError("Bullet updatedPaddingOrScaling not implemented");
@@ -613,6 +651,9 @@ void collision_detection::CollisionRobotBullet::distanceSelfHelper(const Distanc
   constructBulletObject(manager.m_link2cow, active_objects, req.distance_threshold, state, req.active_components_only);
   manager.processCollisionObjects();
 
+  if (m_use_acm_table)
+    compileAllowedCollisions(collisions, { &manager.m_link2cow }, *m_acm_tables);
+
   for (auto& obj : active_objects)
   {
     COWPtr cow = manager.m_link2cow[obj];
@@ -638,6 +679,9 @@ void collision_detection::CollisionRobotBullet::distanceSelfHelper(const Distanc
       manager.m_link2cow, active_objects, req.distance_threshold, state1, state2, req.active_components_only);
   manager.processCollisionObjects();
 
+  if (m_use_acm_table)
+    compileAllowedCollisions(collisions, { &manager.m_link2cow }, *m_acm_tables);
+
   for (auto& obj : active_objects)
   {
     COWPtr cow = manager.m_link2cow[obj];
@@ -663,6 +707,9 @@ void collision_detection::CollisionRobotBullet::distanceSelfHelperOriginal(const
       manager.m_link2cow, active_objects, req.distance_threshold, state1, req.active_components_only, true);
   manager.processCollisionObjects();
 
+  if (m_use_acm_table)
+    compileAllowedCollisions(collisions, { &manager.m_link2cow }, *m_acm_tables);
+
   for (auto& obj : active_objects)
   {
     COWPtr cow = manager.m_link2cow[obj];
@@ -734,6 +781,9 @@ void collision_detection::CollisionRobotBullet::distanceOtherHelper(const Distan
 
   constructBulletObject(robot_objects, active_objects, req.distance_threshold, state, req.active_components_only);
 
+  if (m_use_acm_table)
+    compileAllowedCollisions(collisions, { &other_robot_manager.m_link2cow, &robot_objects }, *m_acm_tables);
+
   for (auto& obj : active_objects)
   {
     COWPtr cow = robot_objects[obj];
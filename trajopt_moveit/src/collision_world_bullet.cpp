@@ -34,38 +34,83 @@
 
 /* Author: Ioan Sucan */
 
+#include <algorithm>
+#include <atomic>
 #include <boost/bind.hpp>
+#include <exception>
+#include <functional>
+#include <thread>
 #include <trajopt_moveit/collision_world_bullet.h>
 
+namespace
+{
+/** @brief Collision objects of one thread of a trajectory check, built once and moved along the trajectory */
+struct TrajectoryCheckObjects
+{
+  collision_detection::BulletManager world_manager;
+  collision_detection::BulletManager self_manager;
+  collision_detection::Link2Cow robot_objects;
+  std::vector<std::string> active_objects;
+  collision_detection::AllowedCollisionTableConstPtr acm_table;
+};
+}
+
 void collision_detection::CollisionWorldBullet::constructBulletObject(Link2Cow& collision_objects,
                                                                       double contact_distance,
                                                                       bool allow_static2static) const
 {
-  for (std::pair<std::string, COWConstPtr> element : m_link2cow)
+  Link2ConstCow world_objects = getCollisionObjects();
+  Link2ConstCow point_clouds;
+  {
+    std::lock_guard<std::mutex> lock(m_link2cow_mutex);
+    point_clouds = m_point_clouds;
+  }
+  for (const Link2ConstCow* objects : { &world_objects, &point_clouds })
   {
-    COWPtr new_cow(new COW(*(element.second.get())));
-    assert(new_cow->getCollisionShape());
+    for (std::pair<std::string, COWConstPtr> element : *objects)
+    {
+      COWPtr new_cow(new COW(*(element.second.get())));
+      assert(new_cow->getCollisionShape());
 
-    new_cow->setWorldTransform(element.second->getWorldTransform());
+      new_cow->setWorldTransform(element.second->getWorldTransform());
 
-    new_cow->m_collisionFilterGroup = btBroadphaseProxy::StaticFilter;
-    (allow_static2static) ?
-        new_cow->m_collisionFilterMask = btBroadphaseProxy::KinematicFilter | btBroadphaseProxy::StaticFilter :
-        new_cow->m_collisionFilterMask = btBroadphaseProxy::KinematicFilter;
+      new_cow->m_collisionFilterGroup = btBroadphaseProxy::StaticFilter;
+      (allow_static2static) ?
+          new_cow->m_collisionFilterMask = btBroadphaseProxy::KinematicFilter | btBroadphaseProxy::StaticFilter :
+          new_cow->m_collisionFilterMask = btBroadphaseProxy::KinematicFilter;
 
-    setContactDistance(new_cow, contact_distance);
-    collision_objects[element.first] = new_cow;
+      setContactDistance(new_cow, contact_distance);
+      collision_objects[element.first] = new_cow;
+    }
   }
 }
 
+collision_detection::Link2ConstCow collision_detection::CollisionWorldBullet::getCollisionObjects() const
+{
+  std::lock_guard<std::mutex> lock(m_link2cow_mutex);
+  if (m_refresh_convex_decompositions)
+    refreshConvexDecompositions(m_link2cow);
+  return m_link2cow;
+}
+
+bool collision_detection::CollisionWorldBullet::updateConvexDecompositions() const
+{
+  std::lock_guard<std::mutex> lock(m_link2cow_mutex);
+  return refreshConvexDecompositions(m_link2cow);
+}
+
 collision_detection::CollisionWorldBullet::CollisionWorldBullet() : CollisionWorld()
 {
+  initialize();
+
   // request notifications about changes to new world
   observer_handle_ = getWorld()->addObserver(boost::bind(&CollisionWorldBullet::notifyObjectChange, this, _1, _2));
 }
 
 collision_detection::CollisionWorldBullet::CollisionWorldBullet(const WorldPtr& world) : CollisionWorld(world)
 {
+  initialize();
+
   // TODO: Need to loop through objects and add them
   m_link2cow.clear();
 
@@ -78,12 +123,28 @@ collision_detection::CollisionWorldBullet::CollisionWorldBullet(const CollisionW
                                                                 const WorldPtr& world)
   : CollisionWorld(other, world)
 {
-  m_link2cow = other.m_link2cow;
+  {
+    std::lock_guard<std::mutex> lock(other.m_link2cow_mutex);
+    m_link2cow = other.m_link2cow;
+    m_point_clouds = other.m_point_clouds;
+  }
+  m_use_acm_table = other.m_use_acm_table;
+  m_refresh_convex_decompositions = other.m_refresh_convex_decompositions;
 
   // request notifications about changes to new world
   observer_handle_ = getWorld()->addObserver(boost::bind(&CollisionWorldBullet::notifyObjectChange, this, _1, _2));
 }
 
+void collision_detection::CollisionWorldBullet::initialize()
+{
+  ros::NodeHandle nh("~");
+
+  nh.param<bool>("bullet/allowed_collision_table", m_use_acm_table, BULLET_DEFAULT_ALLOWED_COLLISION_TABLE);
+  nh.param<bool>("bullet/refresh_convex_decompositions",
+                 m_refresh_convex_decompositions,
+                 BULLET_DEFAULT_REFRESH_CONVEX_DECOMPOSITIONS);
+}
+
 collision_detection::CollisionWorldBullet::~CollisionWorldBullet() { getWorld()->removeObserver(observer_handle_); }
 void collision_detection::CollisionWorldBullet::checkRobotCollision(const CollisionRequest& req,
                                                                     CollisionResult& res,
@@ -155,6 +216,9 @@ void collision_detection::CollisionWorldBullet::checkRobotCollisionHelper(const
   manager.processCollisionObjects();
 
   BulletDistanceData collisions(&dreq, &dres);
+  if (m_use_acm_table)
+    compileAllowedCollisions(collisions, { &robot_collision_objects, &manager.m_link2cow }, *m_acm_tables);
+
   for (auto& obj : robot_active_objects)
   {
     COWPtr cow = robot_collision_objects[obj];
@@ -204,6 +268,9 @@ void collision_detection::CollisionWorldBullet::checkRobotCollisionHelper(const
   manager.processCollisionObjects();
 
   BulletDistanceData collisions(&dreq, &dres);
+  if (m_use_acm_table)
+    compileAllowedCollisions(collisions, { &robot_collision_objects, &manager.m_link2cow }, *m_acm_tables);
+
   for (auto& obj : robot_active_objects)
   {
     COWPtr cow = robot_collision_objects[obj];
@@ -221,6 +288,160 @@ void collision_detection::CollisionWorldBullet::checkRobotCollisionHelper(const
   convertBulletCollisions(res, collisions);
 }
 
+int collision_detection::CollisionWorldBullet::checkTrajectoryCollision(
+    const CollisionRequest& req,
+    CollisionResult& res,
+    const CollisionRobot& robot,
+    const robot_trajectory::RobotTrajectory& trajectory,
+    const AllowedCollisionMatrix* acm,
+    bool continuous,
+    bool self,
+    int num_threads) const
+{
+  const CollisionRobotBullet& robot_bullet = dynamic_cast<const CollisionRobotBullet&>(robot);
+  std::size_t n_waypoints = trajectory.getWayPointCount();
+  if (n_waypoints == 0)
+    return -1;
+
+  DistanceRequest dreq;
+  dreq.group_name = req.group_name;
+  dreq.acm = acm;
+  dreq.enableGroup(robot_bullet.getRobotModel());
+  dreq.enable_signed_distance = false;
+
+  double contact_distance = 0.0;
+  if (req.distance)
+  {
+    contact_distance = BULLET_DEFAULT_CONTACT_DISTANCE;
+  }
+
+  if (num_threads <= 0)
+    num_threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+  std::size_t n_threads = std::min(n_waypoints, static_cast<std::size_t>(num_threads));
+
+  // Built up front since setContactDistance writes globals, so the threads only move and query the objects
+  robot_state::RobotState start(trajectory.getWayPoint(0));
+  start.updateLinkTransforms();
+  std::vector<std::unique_ptr<TrajectoryCheckObjects>> objects;
+  for (std::size_t t = 0; t < n_threads; ++t)
+  {
+    objects.emplace_back(new TrajectoryCheckObjects());
+    TrajectoryCheckObjects& o = *objects.back();
+
+    robot_bullet.constructBulletObject(
+        o.robot_objects, o.active_objects, contact_distance, start, dreq.active_components_only, false);
+    constructBulletObject(o.world_manager.m_link2cow, contact_distance, false);
+    o.world_manager.processCollisionObjects();
+    if (self)
+    {
+      o.self_manager.m_link2cow = o.robot_objects;
+      o.self_manager.processCollisionObjects();
+    }
+
+    BulletDistanceData collisions(&dreq, nullptr);
+    if (m_use_acm_table)
+      compileAllowedCollisions(collisions, { &o.robot_objects, &o.world_manager.m_link2cow }, *m_acm_tables);
+    o.acm_table = collisions.acm_table;
+  }
+
+  // Waypoints are taken in order and skipped once an earlier one is known to be invalid
+  std::atomic<std::size_t> next(0);
+  std::atomic<std::size_t> first_invalid(n_waypoints);
+  DistanceResult first_invalid_dres;
+  std::exception_ptr error;
+  std::mutex mutex;
+
+  auto checkWaypoint = [&](TrajectoryCheckObjects& o,
+                           robot_state::RobotState& state,
+                           robot_state::RobotState& prev_state,
+                           std::size_t k) {
+    state = trajectory.getWayPoint(k);
+    state.updateLinkTransforms();
+    for (auto& element : o.robot_objects)
+    {
+      element.second->setWorldTransform(convertEigenToBt(state.getGlobalLinkTransform(element.second->getLinkName())));
+      if (self)
+        o.self_manager.m_world->updateSingleAabb(element.second.get());
+    }
+
+    DistanceResult dres;
+    BulletDistanceData collisions(&dreq, &dres);
+    collisions.acm_table = o.acm_table;
+    for (auto& obj : o.active_objects)
+    {
+      COWPtr cow = o.robot_objects[obj];
+      o.world_manager.contactDiscreteTest(cow, collisions);
+      if (!collisions.done && self)
+        o.self_manager.contactDiscreteTest(cow, collisions);
+
+      if (collisions.done)
+        break;
+    }
+
+    if (continuous && k > 0 && !collisions.done)
+    {
+      prev_state = trajectory.getWayPoint(k - 1);
+      prev_state.updateLinkTransforms();
+      for (auto& obj : o.active_objects)
+      {
+        COWPtr cow = o.robot_objects[obj];
+        btTransform tf1 = convertEigenToBt(prev_state.getGlobalLinkTransform(cow->getLinkName()));
+        btTransform tf2 = convertEigenToBt(state.getGlobalLinkTransform(cow->getLinkName()));
+        o.world_manager.convexSweepTest(cow, tf1, tf2, collisions);
+
+        if (collisions.done)
+          break;
+      }
+    }
+
+    if (!dres.collision)
+      return;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (k < first_invalid)
+    {
+      first_invalid = k;
+      first_invalid_dres = dres;
+    }
+  };
+
+  auto worker = [&](TrajectoryCheckObjects& o) {
+    robot_state::RobotState state(start);
+    robot_state::RobotState prev_state(start);
+    for (std::size_t k = next++; k < n_waypoints && k < first_invalid; k = next++)
+    {
+      try
+      {
+        checkWaypoint(o, state, prev_state, k);
+      }
+      catch (...)
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!error)
+          error = std::current_exception();
+        first_invalid = 0;
+      }
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (std::size_t t = 1; t < n_threads; ++t)
+    threads.emplace_back(worker, std::ref(*objects[t]));
+  worker(*objects[0]);
+  for (std::thread& t : threads)
+    t.join();
+
+  if (error)
+    std::rethrow_exception(error);
+
+  if (first_invalid == n_waypoints)
+    return -1;
+
+  BulletDistanceData collisions(&dreq, &first_invalid_dres);
+  convertBulletCollisions(res, collisions);
+  return static_cast<int>(first_invalid);
+}
+
 void collision_detection::CollisionWorldBullet::checkWorldCollision(const CollisionRequest& req,
                                                                     CollisionResult& res,
                                                                     const CollisionWorld& other_world) const
@@ -266,6 +487,9 @@ void collision_detection::CollisionWorldBullet::checkWorldCollisionHelper(const
   manager.processCollisionObjects();
 
   BulletDistanceData collisions(&dreq, &dres);
+  if (m_use_acm_table)
+    compileAllowedCollisions(collisions, { &other_world_objects, &manager.m_link2cow }, *m_acm_tables);
+
   for (auto element : other_world_objects)
   {
     manager.contactDiscreteTest(element.second, collisions);
@@ -278,6 +502,8 @@ void collision_detection::CollisionWorldBullet::checkWorldCollisionHelper(const
 
 void collision_detection::CollisionWorldBullet::updateBulletObject(const std::string& id)
 {
+  std::lock_guard<std::mutex> lock(m_link2cow_mutex);
+
   // check to see if we have this object
   auto it = getWorld()->find(id);
   if (it != getWorld()->end())
@@ -301,7 +527,10 @@ void collision_detection::CollisionWorldBullet::setWorld(const WorldPtr& world)
   getWorld()->removeObserver(observer_handle_);
 
   // clear out objects from old world
-  m_link2cow.clear();
+  {
+    std::lock_guard<std::mutex> lock(m_link2cow_mutex);
+    m_link2cow.clear();
+  }
 
   CollisionWorld::setWorld(world);
 
@@ -312,10 +541,33 @@ void collision_detection::CollisionWorldBullet::setWorld(const WorldPtr& world)
   getWorld()->notifyObserverAllObjects(observer_handle_, World::CREATE);
 }
 
+void collision_detection::CollisionWorldBullet::clearAllowedCollisionTables() const { m_acm_tables->clear(); }
+
+void collision_detection::CollisionWorldBullet::setPointCloud(const std::string& id,
+                                                              const std::vector<Eigen::Vector3d>& points,
+                                                              double point_radius,
+                                                              double cell_size)
+{
+  if (cell_size <= 0)
+    cell_size = 2 * (point_radius + BULLET_DEFAULT_CONTACT_DISTANCE);
+
+  COWConstPtr cloud = createPointCloudObject(id, points, point_radius, cell_size);
+
+  std::lock_guard<std::mutex> lock(m_link2cow_mutex);
+  m_point_clouds[id] = cloud;
+}
+
+void collision_detection::CollisionWorldBullet::removePointCloud(const std::string& id)
+{
+  std::lock_guard<std::mutex> lock(m_link2cow_mutex);
+  m_point_clouds.erase(id);
+}
+
 void collision_detection::CollisionWorldBullet::notifyObjectChange(const ObjectConstPtr& obj, World::Action action)
 {
   if (action == World::DESTROY)
   {
+    std::lock_guard<std::mutex> lock(m_link2cow_mutex);
     auto it = m_link2cow.find(obj->id_);
     if (it != m_link2cow.end())
     {
@@ -345,6 +597,9 @@ void collision_detection::CollisionWorldBullet::distanceRobotHelper(const Distan
   constructBulletObject(manager.m_link2cow, req.distance_threshold, false);
   manager.processCollisionObjects();
 
+  if (m_use_acm_table)
+    compileAllowedCollisions(collisions, { &robot_collision_objects, &manager.m_link2cow }, *m_acm_tables);
+
   for (auto& obj : robot_active_objects)
   {
     COWPtr cow = robot_collision_objects[obj];
@@ -379,6 +634,9 @@ void collision_detection::CollisionWorldBullet::distanceRobotHelper(const Distan
   constructBulletObject(manager.m_link2cow, req.distance_threshold, false);
   manager.processCollisionObjects();
 
+  if (m_use_acm_table)
+    compileAllowedCollisions(collisions, { &robot_collision_objects, &manager.m_link2cow }, *m_acm_tables);
+
   for (auto& obj : robot_active_objects)
   {
     COWPtr cow = robot_collision_objects[obj];
@@ -492,6 +750,9 @@ void collision_detection::CollisionWorldBullet::distanceWorldHelper(const Distan
   constructBulletObject(manager.m_link2cow, req.distance_threshold, true);
   manager.processCollisionObjects();
 
+  if (m_use_acm_table)
+    compileAllowedCollisions(collisions, { &other_world_objects, &manager.m_link2cow }, *m_acm_tables);
+
   for (auto element : other_world_objects)
   {
     manager.contactDiscreteTest(element.second, collisions);
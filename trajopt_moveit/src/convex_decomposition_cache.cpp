@@ -0,0 +1,261 @@
+#include <cerrno>
+#include <console_bridge/console.h>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <sys/stat.h>
+#include <trajopt_moveit/convex_decomposition_cache.h>
+#include <unistd.h>
+#include <vhacd_ros/VHACD.h>
+
+namespace collision_detection
+{
+namespace
+{
+/** @brief FNV-1a over the raw bytes of the mesh */
+uint64_t hashMesh(const std::vector<double>& points, const std::vector<uint32_t>& triangles)
+{
+  uint64_t hash = 14695981039346656037ULL;
+  auto add = [&hash](const void* data, std::size_t size) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (std::size_t i = 0; i < size; ++i)
+    {
+      hash ^= bytes[i];
+      hash *= 1099511628211ULL;
+    }
+  };
+  add(points.data(), points.size() * sizeof(double));
+  add(triangles.data(), triangles.size() * sizeof(uint32_t));
+  return hash;
+}
+
+/** @brief Create the directory and its parents, like mkdir -p */
+bool createDirectories(const std::string& dir)
+{
+  for (std::size_t pos = dir.find('/', 1); pos != std::string::npos; pos = dir.find('/', pos + 1))
+    mkdir(dir.substr(0, pos).c_str(), 0755);
+
+  return mkdir(dir.c_str(), 0755) == 0 || errno == EEXIST;
+}
+}
+
+ConvexDecompositionCache& ConvexDecompositionCache::instance()
+{
+  static ConvexDecompositionCache cache;
+  return cache;
+}
+
+ConvexDecompositionCache::ConvexDecompositionCache() : enabled_(true), stop_(false), generation_(0)
+{
+  const char* dir = std::getenv("TRAJOPT_CONVEX_DECOMPOSITION_DIR");
+  const char* home = std::getenv("HOME");
+  if (dir)
+    dir_ = dir;
+  else if (home)
+    dir_ = std::string(home) + "/.ros/trajopt_convex_decomposition";
+
+  if (!dir_.empty() && !createDirectories(dir_))
+  {
+    CONSOLE_BRIDGE_logWarn("Could not create %s, convex decompositions will not be saved", dir_.c_str());
+    dir_.clear();
+  }
+}
+
+ConvexDecompositionCache::~ConvexDecompositionCache()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  job_cv_.notify_all();
+  if (worker_.joinable())
+    worker_.join();
+}
+
+ConvexDecompositionConstPtr ConvexDecompositionCache::get(const shapes::Mesh& mesh)
+{
+  if (!isEnabled() || mesh.vertex_count == 0 || mesh.triangle_count == 0)
+    return nullptr;
+
+  Job job;
+  job.points.assign(mesh.vertices, mesh.vertices + 3 * mesh.vertex_count);
+  job.triangles.assign(mesh.triangles, mesh.triangles + 3 * mesh.triangle_count);
+  job.hash = hashMesh(job.points, job.triangles);
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = decompositions_.find(job.hash);
+    if (it != decompositions_.end())
+      return it->second;
+    if (pending_.count(job.hash))
+      return nullptr;
+  }
+
+  // Decompositions saved by earlier runs are used right away
+  ConvexDecompositionConstPtr saved = load(job.hash);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (saved)
+  {
+    decompositions_[job.hash] = saved;
+    return saved;
+  }
+
+  pending_.insert(job.hash);
+  jobs_.push_back(std::move(job));
+  if (!worker_.joinable())
+    worker_ = std::thread(&ConvexDecompositionCache::run, this);
+  job_cv_.notify_one();
+  return nullptr;
+}
+
+unsigned long ConvexDecompositionCache::generation() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return generation_;
+}
+
+void ConvexDecompositionCache::setEnabled(bool enabled)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  enabled_ = enabled;
+}
+
+bool ConvexDecompositionCache::isEnabled() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return enabled_;
+}
+
+void ConvexDecompositionCache::wait()
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  done_cv_.wait(lock, [this]() { return pending_.empty(); });
+}
+
+void ConvexDecompositionCache::run()
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true)
+  {
+    job_cv_.wait(lock, [this]() { return stop_ || !jobs_.empty(); });
+    if (stop_)
+      return;
+
+    Job job = std::move(jobs_.front());
+    jobs_.pop_front();
+
+    lock.unlock();
+    ConvexDecompositionConstPtr decomposition = decompose(job);
+    if (decomposition)
+      save(job.hash, *decomposition);
+    lock.lock();
+
+    // A failed decomposition is stored as an empty one so the mesh is not queued again
+    decompositions_[job.hash] = decomposition ? decomposition : std::make_shared<ConvexDecomposition>();
+    pending_.erase(job.hash);
+    ++generation_;
+    done_cv_.notify_all();
+  }
+}
+
+ConvexDecompositionConstPtr ConvexDecompositionCache::decompose(const Job& job)
+{
+  VHACD::IVHACD::Parameters params;
+  params.m_oclAcceleration = false;
+  params.m_maxConvexHulls = 32;
+
+  VHACD::IVHACD* vhacd = VHACD::CreateVHACD();
+  bool success = vhacd->Compute(job.points.data(),
+                                static_cast<uint32_t>(job.points.size() / 3),
+                                job.triangles.data(),
+                                static_cast<uint32_t>(job.triangles.size() / 3),
+                                params);
+
+  std::shared_ptr<ConvexDecomposition> decomposition;
+  if (success)
+  {
+    decomposition = std::make_shared<ConvexDecomposition>();
+    for (uint32_t i = 0; i < vhacd->GetNConvexHulls(); ++i)
+    {
+      VHACD::IVHACD::ConvexHull ch;
+      vhacd->GetConvexHull(i, ch);
+
+      std::vector<Eigen::Vector3d> hull;
+      for (uint32_t j = 0; j < ch.m_nPoints; ++j)
+        hull.emplace_back(ch.m_points[3 * j], ch.m_points[3 * j + 1], ch.m_points[3 * j + 2]);
+      decomposition->hulls.push_back(hull);
+    }
+  }
+  else
+  {
+    CONSOLE_BRIDGE_logWarn("Convex decomposition of mesh %016llx failed", static_cast<unsigned long long>(job.hash));
+  }
+
+  vhacd->Clean();
+  vhacd->Release();
+  return decomposition;
+}
+
+std::string ConvexDecompositionCache::fileName(uint64_t hash) const
+{
+  std::ostringstream name;
+  name << dir_ << "/" << std::hex << std::setw(16) << std::setfill('0') << hash << ".hulls";
+  return name.str();
+}
+
+ConvexDecompositionConstPtr ConvexDecompositionCache::load(uint64_t hash) const
+{
+  if (dir_.empty())
+    return nullptr;
+
+  std::ifstream file(fileName(hash).c_str());
+  std::size_t n_hulls;
+  if (!(file >> n_hulls))
+    return nullptr;
+
+  std::shared_ptr<ConvexDecomposition> decomposition = std::make_shared<ConvexDecomposition>();
+  decomposition->hulls.resize(n_hulls);
+  for (std::vector<Eigen::Vector3d>& hull : decomposition->hulls)
+  {
+    std::size_t n_points;
+    if (!(file >> n_points))
+      return nullptr;
+
+    hull.resize(n_points);
+    for (Eigen::Vector3d& p : hull)
+      if (!(file >> p.x() >> p.y() >> p.z()))
+        return nullptr;
+  }
+  return decomposition;
+}
+
+void ConvexDecompositionCache::save(uint64_t hash, const ConvexDecomposition& decomposition) const
+{
+  if (dir_.empty())
+    return;
+
+  // Written to a temporary file first so concurrent processes never read a partial file
+  std::string name = fileName(hash);
+  std::string tmp_name = name + ".tmp" + std::to_string(getpid());
+  {
+    std::ofstream file(tmp_name.c_str());
+    file << std::setprecision(17) << decomposition.hulls.size() << "\n";
+    for (const std::vector<Eigen::Vector3d>& hull : decomposition.hulls)
+    {
+      file << hull.size() << "\n";
+      for (const Eigen::Vector3d& p : hull)
+        file << p.x() << " " << p.y() << " " << p.z() << "\n";
+    }
+    if (!file)
+    {
+      CONSOLE_BRIDGE_logWarn("Could not write %s", tmp_name.c_str());
+      std::remove(tmp_name.c_str());
+      return;
+    }
+  }
+  std::rename(tmp_name.c_str(), name.c_str());
+}
+}
@@ -11,6 +11,11 @@ using Eigen::MatrixXd;
 using Eigen::VectorXd;
 
 bool TrajOptMoveItEnv::init(planning_scene::PlanningScenePtr planning_scene)
+{
+  return init(planning_scene::PlanningSceneConstPtr(planning_scene));
+}
+
+bool TrajOptMoveItEnv::init(planning_scene::PlanningSceneConstPtr planning_scene)
 {
   env_ = planning_scene;
   initialized_ = planning_scene ? true : false;
@@ -420,20 +425,43 @@ std::vector<std::string> TrajOptMoveItEnv::getActiveLinkNames() const
 }
 
 tesseract::VectorIsometry3d TrajOptMoveItEnv::getLinkTransforms() const
+{
+  const moveit::core::RobotState& current = env_->getCurrentState();
+  if (!hasDirtyTransforms(current))
+    return getLinkTransforms(current);
+
+  // The const scene does not refresh dirty transforms, so they are computed on a copy of the state
+  moveit::core::RobotState state(current);
+  state.update();
+  return getLinkTransforms(state);
+}
+
+Eigen::Isometry3d TrajOptMoveItEnv::getLinkTransform(const std::string& link_name) const
+{
+  const moveit::core::RobotState& current = env_->getCurrentState();
+  if (!hasDirtyTransforms(current))
+    return env_->getFrameTransform(current, link_name);
+
+  moveit::core::RobotState state(current);
+  state.update();
+  return env_->getFrameTransform(state, link_name);
+}
+
+tesseract::VectorIsometry3d TrajOptMoveItEnv::getLinkTransforms(const moveit::core::RobotState& state) const
 {
   std::vector<std::string> link_names = getLinkNames();
   tesseract::VectorIsometry3d link_tfs;
-  link_tfs.resize(link_names.size());
+  link_tfs.reserve(link_names.size());
   for (const auto& link_name : link_names)
   {
-    link_tfs.push_back(env_->getFrameTransform(link_name));
+    link_tfs.push_back(env_->getFrameTransform(state, link_name));
   }
   return link_tfs;
 }
 
-Eigen::Isometry3d TrajOptMoveItEnv::getLinkTransform(const std::string& link_name) const
+bool TrajOptMoveItEnv::hasDirtyTransforms(const moveit::core::RobotState& state)
 {
-  return env_->getFrameTransform(link_name);
+  return state.dirtyLinkTransforms() || state.dirtyCollisionBodyTransforms();
 }
 
 bool TrajOptMoveItEnv::hasManipulator(const std::string& manipulator_name) const
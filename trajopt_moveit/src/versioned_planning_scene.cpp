@@ -0,0 +1,81 @@
+#include "trajopt_moveit/versioned_planning_scene.h"
+#include "trajopt_moveit/collision_world_bullet.h"
+
+namespace trajopt_moveit
+{
+VersionedPlanningScene::VersionedPlanningScene(const planning_scene::PlanningSceneConstPtr& scene)
+  : current_(copy(scene)), version_(0)
+{
+}
+
+planning_scene::PlanningSceneConstPtr VersionedPlanningScene::snapshot() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return current_;
+}
+
+unsigned long VersionedPlanningScene::version() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return version_;
+}
+
+planning_scene::PlanningSceneConstPtr
+VersionedPlanningScene::update(const std::function<void(planning_scene::PlanningScene&)>& modify)
+{
+  std::lock_guard<std::mutex> lock(update_mutex_);
+  planning_scene::PlanningScenePtr next = snapshot()->diff();
+  modify(*next);
+  return publish(next);
+}
+
+planning_scene::PlanningSceneConstPtr VersionedPlanningScene::update(const moveit_msgs::PlanningScene& msg)
+{
+  std::lock_guard<std::mutex> lock(update_mutex_);
+  planning_scene::PlanningScenePtr next = snapshot()->diff();
+  if (!next->usePlanningSceneMsg(msg))
+  {
+    ROS_WARN("Failed to apply planning scene message, keeping version %lu", version());
+    return nullptr;
+  }
+  return publish(next);
+}
+
+TrajOptMoveItEnvPtr VersionedPlanningScene::createEnv() const
+{
+  TrajOptMoveItEnvPtr env(new TrajOptMoveItEnv);
+  env->init(snapshot());
+  return env;
+}
+
+planning_scene::PlanningScenePtr VersionedPlanningScene::copy(const planning_scene::PlanningSceneConstPtr& scene)
+{
+  planning_scene::PlanningScenePtr next = scene->diff();
+  next->decoupleParent();
+  next->getCurrentStateNonConst().update();
+  updateConvexDecompositions(*next);
+  return next;
+}
+
+void VersionedPlanningScene::updateConvexDecompositions(const planning_scene::PlanningScene& scene)
+{
+  // The collision robot is shared with the previous versions and keeps its shapes
+  auto bullet_world =
+      std::dynamic_pointer_cast<const collision_detection::CollisionWorldBullet>(scene.getCollisionWorld());
+  if (bullet_world)
+    bullet_world->updateConvexDecompositions();
+}
+
+planning_scene::PlanningSceneConstPtr VersionedPlanningScene::publish(planning_scene::PlanningScenePtr next)
+{
+  // The new version must not reference the previous one, which may be released while the new one is in use
+  next->decoupleParent();
+  next->getCurrentStateNonConst().update();
+  updateConvexDecompositions(*next);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  current_ = next;
+  ++version_;
+  return current_;
+}
+}
@@ -13,8 +13,11 @@
 #include <trajopt_utils/stl_to_string.hpp>
 
 #include <tesseract_ros/kdl/kdl_chain_kin.h>
+#include <trajopt_moveit/collision_world_bullet.h>
+#include <trajopt_moveit/convex_decomposition_cache.h>
 #include <trajopt_moveit/trajopt_moveit_env.h>
 #include <trajopt_moveit/trajopt_moveit_plotting.h>
+#include <trajopt_moveit/versioned_planning_scene.h>
 
 #include <moveit/collision_plugin_loader/collision_plugin_loader.h>
 #include <moveit/robot_model/joint_model_group.h>
@@ -32,6 +35,69 @@ using namespace util;
 const std::string ROBOT_DESCRIPTION_PARAM = "robot_description"; /**< Default ROS parameter for robot description */
 bool plotting = false;
 
+/** @brief Add a 1m box world object to the scene */
+void addBox(planning_scene::PlanningScene& scene, const std::string& id, double x, double y)
+{
+  moveit_msgs::CollisionObject box_world;
+  shape_msgs::SolidPrimitive box;
+  geometry_msgs::Pose box_pose;
+
+  box.type = shape_msgs::SolidPrimitive::BOX;
+  box.dimensions.assign(3, 1.0);
+  box_pose.position.x = x;
+  box_pose.position.y = y;
+  box_pose.orientation.w = 1;
+
+  box_world.header.frame_id = "base_link";
+  box_world.id = id;
+  box_world.operation = moveit_msgs::CollisionObject::ADD;
+  box_world.primitives.push_back(box);
+  box_world.primitive_poses.push_back(box_pose);
+  scene.processCollisionObjectMsg(box_world);
+}
+
+/** @brief Mesh of the boxes given by their min and max corners, as one object */
+shapes::Mesh* createBoxesMesh(const std::vector<std::pair<Eigen::Vector3d, Eigen::Vector3d>>& boxes)
+{
+  // Corner v has bit 2 for x, bit 1 for y and bit 0 for z set at the max corner, the faces point outwards
+  static const unsigned int faces[12][3] = { { 0, 1, 2 }, { 1, 3, 2 }, { 4, 6, 5 }, { 5, 6, 7 },
+                                             { 0, 4, 1 }, { 1, 4, 5 }, { 2, 3, 6 }, { 3, 7, 6 },
+                                             { 0, 2, 4 }, { 2, 6, 4 }, { 1, 5, 3 }, { 3, 5, 7 } };
+  shapes::Mesh* mesh = new shapes::Mesh(8 * static_cast<unsigned int>(boxes.size()),
+                                        12 * static_cast<unsigned int>(boxes.size()));
+  for (std::size_t b = 0; b < boxes.size(); ++b)
+  {
+    for (unsigned int v = 0; v < 8; ++v)
+    {
+      for (unsigned int k = 0; k < 3; ++k)
+        mesh->vertices[3 * (8 * b + v) + k] = ((v >> (2 - k)) & 1) ? boxes[b].second[k] : boxes[b].first[k];
+    }
+    for (unsigned int f = 0; f < 12; ++f)
+    {
+      for (unsigned int k = 0; k < 3; ++k)
+        mesh->triangles[3 * (12 * b + f) + k] = static_cast<unsigned int>(8 * b) + faces[f][k];
+    }
+  }
+  mesh->computeTriangleNormals();
+  mesh->computeVertexNormals();
+  return mesh;
+}
+
+/** @brief Compare two distance results pair by pair */
+void expectSameDistances(const collision_detection::DistanceResult& a, const collision_detection::DistanceResult& b)
+{
+  EXPECT_NEAR(a.minimum_distance.distance, b.minimum_distance.distance, 1e-5);
+  ASSERT_EQ(a.distances.size(), b.distances.size());
+  for (const auto& pair : a.distances)
+  {
+    auto it = b.distances.find(pair.first);
+    ASSERT_TRUE(it != b.distances.end()) << pair.first.first << " " << pair.first.second;
+    ASSERT_EQ(pair.second.size(), it->second.size());
+    for (std::size_t i = 0; i < pair.second.size(); ++i)
+      EXPECT_NEAR(pair.second[i].distance, it->second[i].distance, 1e-5);
+  }
+}
+
 class CastWorldTest : public testing::TestWithParam<const char*>
 {
 public:
@@ -138,6 +204,360 @@ TEST_F(CastWorldTest, boxes)
   ASSERT_EQ(collisions.size(), 0);
 }
 
+TEST_F(CastWorldTest, snapshots)
+{
+  ROS_DEBUG("CastTest, snapshots");
+
+  std::string package_path = ros::package::getPath("trajopt_test_support");
+  Json::Value root = readJsonFile(package_path + "/config/box_cast_test.json");
+
+  robot_state::RobotState& rs = planning_scene_->getCurrentStateNonConst();
+  std::map<std::string, double> ipos;
+  ipos["boxbot_x_joint"] = -1.9;
+  ipos["boxbot_y_joint"] = 0;
+  rs.setVariablePositions(ipos);
+
+  trajopt_moveit::VersionedPlanningScene scene(planning_scene_);
+  trajopt_moveit::TrajOptMoveItEnvPtr pinned = scene.createEnv();
+
+  // Removing the box publishes a new version, the pinned snapshot keeps it
+  scene.update([](planning_scene::PlanningScene& next) { next.getWorldNonConst()->removeObject("box_world"); });
+  EXPECT_EQ(scene.version(), 1);
+  EXPECT_TRUE(pinned->getPlanningScene()->getWorld()->hasObject("box_world"));
+  EXPECT_FALSE(scene.snapshot()->getWorld()->hasObject("box_world"));
+
+  TrajOptProbPtr prob = ConstructProblem(root, pinned);
+  ASSERT_TRUE(!!prob);
+
+  const std::vector<std::string>& joint_names = prob->GetKin()->getJointNames();
+  const std::vector<std::string>& link_names = prob->GetKin()->getLinkNames();
+
+  tesseract::ContactResultVector collisions;
+  pinned->continuousCollisionCheckTrajectory(joint_names, link_names, prob->GetInitTraj(), collisions);
+  EXPECT_NE(collisions.size(), 0);
+
+  collisions.clear();
+  trajopt_moveit::TrajOptMoveItEnvPtr latest = scene.createEnv();
+  latest->continuousCollisionCheckTrajectory(joint_names, link_names, prob->GetInitTraj(), collisions);
+  EXPECT_EQ(collisions.size(), 0);
+}
+
+TEST_F(CastWorldTest, allowed_collision_table_unchanged)
+{
+  ROS_DEBUG("CastTest, allowed_collision_table_unchanged");
+
+  // One scene per setting of the bullet parameters, which are read when the plugin is activated
+  std::vector<planning_scene::PlanningScenePtr> scenes;
+  for (bool enabled : { true, false })
+  {
+    ros::param::set("~bullet/allowed_collision_table", enabled);
+
+    planning_scene::PlanningScenePtr scene(new planning_scene::PlanningScene(robot_model_));
+    collision_detection::CollisionPluginLoader cd_loader;
+    ASSERT_TRUE(cd_loader.activate("BULLET", scene, true));
+
+    // box_world_2 overlaps box_world and box_world_3 is allowed to collide with the robot
+    addBox(*scene, "box_world", 0, 0);
+    addBox(*scene, "box_world_2", 0.8, 0);
+    addBox(*scene, "box_world_3", 0, -1.6);
+    scene->getAllowedCollisionMatrixNonConst().setEntry("box_world_3", "boxbot_link", true);
+    scenes.push_back(scene);
+  }
+  ros::param::del("~bullet/allowed_collision_table");
+
+  collision_detection::DistanceRequest dreq;
+  dreq.type = collision_detection::DistanceRequestType::ALL;
+  dreq.enable_nearest_points = true;
+  dreq.enable_signed_distance = true;
+  dreq.distance_threshold = 0.5;
+  dreq.max_contacts_per_body = 50;
+
+  collision_detection::CollisionRequest creq;
+  creq.contacts = true;
+  creq.max_contacts = 100;
+
+  // Every state is queried twice so the second query reuses the allowed collision tables of the first
+  bool found_contact = false;
+  for (double x : { -1.9, -1.2, -0.6, 0.3 })
+  {
+    for (double y : { 0.0, 0.5, -0.9 })
+    {
+      for (int repeat = 0; repeat < 2; ++repeat)
+      {
+        std::vector<collision_detection::DistanceResult> robot_dists(2), world_dists(2);
+        std::vector<collision_detection::CollisionResult> robot_contacts(2);
+        for (std::size_t i = 0; i < scenes.size(); ++i)
+        {
+          robot_state::RobotState state = scenes[i]->getCurrentState();
+          state.setVariablePosition("boxbot_x_joint", x);
+          state.setVariablePosition("boxbot_y_joint", y);
+          state.update();
+
+          const collision_detection::CollisionWorldConstPtr& world = scenes[i]->getCollisionWorld();
+          const collision_detection::CollisionRobotConstPtr& robot = scenes[i]->getCollisionRobot();
+          dreq.acm = &scenes[i]->getAllowedCollisionMatrix();
+          world->distanceRobot(dreq, robot_dists[i], *robot, state);
+          world->distanceWorld(dreq, world_dists[i], *world);
+          world->checkRobotCollision(creq, robot_contacts[i], *robot, state, scenes[i]->getAllowedCollisionMatrix());
+        }
+
+        expectSameDistances(robot_dists[0], robot_dists[1]);
+        expectSameDistances(world_dists[0], world_dists[1]);
+        EXPECT_EQ(robot_contacts[0].collision, robot_contacts[1].collision);
+        ASSERT_EQ(robot_contacts[0].contacts.size(), robot_contacts[1].contacts.size());
+        for (const auto& pair : robot_contacts[0].contacts)
+        {
+          EXPECT_TRUE(robot_contacts[1].contacts.count(pair.first) != 0);
+          EXPECT_NE(pair.first.first, "box_world_3");
+          EXPECT_NE(pair.first.second, "box_world_3");
+        }
+        EXPECT_FALSE(world_dists[0].distances.empty());
+        found_contact |= robot_contacts[0].collision;
+      }
+    }
+  }
+  EXPECT_TRUE(found_contact);
+}
+
+TEST_F(CastWorldTest, allowed_collision_tables_reused)
+{
+  ROS_DEBUG("CastTest, allowed_collision_tables_reused");
+
+  planning_scene::PlanningScenePtr scene(new planning_scene::PlanningScene(robot_model_));
+  collision_detection::CollisionPluginLoader cd_loader;
+  ASSERT_TRUE(cd_loader.activate("BULLET", scene, true));
+  addBox(*scene, "box_world", 0, 0);
+
+  auto world = std::dynamic_pointer_cast<const collision_detection::CollisionWorldBullet>(scene->getCollisionWorld());
+  ASSERT_TRUE(world != nullptr);
+  const collision_detection::CollisionRobotConstPtr& robot = scene->getCollisionRobot();
+
+  robot_state::RobotState state = scene->getCurrentState();
+  state.setVariablePosition("boxbot_x_joint", 0);
+  state.setVariablePosition("boxbot_y_joint", 0);
+  state.update();
+
+  collision_detection::CollisionRequest creq;
+  collision_detection::AllowedCollisionMatrix acm = scene->getAllowedCollisionMatrix();
+  for (int repeat = 0; repeat < 2; ++repeat)
+  {
+    collision_detection::CollisionResult res;
+    world->checkRobotCollision(creq, res, *robot, state, acm);
+    EXPECT_TRUE(res.collision);
+  }
+
+  // The table of the earlier queries is found by the address of the matrix, so the change is only seen once cleared
+  acm.setEntry("box_world", "boxbot_link", true);
+  collision_detection::CollisionResult stale;
+  world->checkRobotCollision(creq, stale, *robot, state, acm);
+  EXPECT_TRUE(stale.collision);
+
+  world->clearAllowedCollisionTables();
+  collision_detection::CollisionResult res;
+  world->checkRobotCollision(creq, res, *robot, state, acm);
+  EXPECT_FALSE(res.collision);
+}
+
+TEST_F(CastWorldTest, point_cloud_sweep)
+{
+  ROS_DEBUG("CastTest, point_cloud_sweep");
+
+  collision_detection::CollisionWorldBullet world;
+  collision_detection::CollisionRobotBullet robot(robot_model_);
+
+  // A wall of points crossed by the robot between the two states, which are both clear of it
+  std::vector<Eigen::Vector3d> points;
+  for (double y = 1.2; y <= 2.8; y += 0.05)
+    for (double z = -0.4; z <= 0.4; z += 0.1)
+      points.push_back(Eigen::Vector3d(0, y, z));
+  world.setPointCloud("cloud", points, 0.01);
+
+  robot_state::RobotState state1 = planning_scene_->getCurrentState();
+  state1.setVariablePosition("boxbot_x_joint", -1.9);
+  state1.setVariablePosition("boxbot_y_joint", 2.0);
+  state1.update();
+  robot_state::RobotState state2 = state1;
+  state2.setVariablePosition("boxbot_x_joint", 1.9);
+  state2.update();
+
+  collision_detection::CollisionRequest creq;
+  creq.contacts = true;
+  creq.max_contacts = 100;
+
+  collision_detection::CollisionResult res;
+  world.checkRobotCollision(creq, res, robot, state1);
+  EXPECT_FALSE(res.collision);
+  res.clear();
+  world.checkRobotCollision(creq, res, robot, state2);
+  EXPECT_FALSE(res.collision);
+
+  res.clear();
+  world.checkRobotCollision(creq, res, robot, state1, state2);
+  EXPECT_TRUE(res.collision);
+  ASSERT_EQ(res.contacts.size(), 1);
+  EXPECT_TRUE(res.contacts.begin()->first.first == "cloud" || res.contacts.begin()->first.second == "cloud");
+
+  world.removePointCloud("cloud");
+  res.clear();
+  world.checkRobotCollision(creq, res, robot, state1, state2);
+  EXPECT_FALSE(res.collision);
+}
+
+TEST_F(CastWorldTest, convex_decomposition_swap)
+{
+  ROS_DEBUG("CastTest, convex_decomposition_swap");
+
+  collision_detection::ConvexDecompositionCache& cache = collision_detection::ConvexDecompositionCache::instance();
+  ASSERT_TRUE(cache.isEnabled());
+
+  collision_detection::CollisionWorldBullet world;
+  collision_detection::CollisionRobotBullet robot(robot_model_);
+
+  // A U around the robot, whose convex hull contains the robot. The offset makes the mesh new to the decomposition
+  // cache, which keeps the decompositions of earlier runs on disk.
+  double offset = 1e-6 * static_cast<double>(ros::WallTime::now().toNSec() % 1000);
+  std::vector<std::pair<Eigen::Vector3d, Eigen::Vector3d>> boxes;
+  boxes.emplace_back(Eigen::Vector3d(-1.5 + offset, -1.5, -0.5), Eigen::Vector3d(1.5, -0.9, 0.5));
+  boxes.emplace_back(Eigen::Vector3d(-1.5 + offset, -0.9, -0.5), Eigen::Vector3d(-0.9, 1.5, 0.5));
+  boxes.emplace_back(Eigen::Vector3d(0.9, -0.9, -0.5), Eigen::Vector3d(1.5, 1.5, 0.5));
+  world.getWorld()->addToObject("u_mesh", shapes::ShapeConstPtr(createBoxesMesh(boxes)), Eigen::Isometry3d::Identity());
+
+  robot_state::RobotState state = planning_scene_->getCurrentState();
+  state.setVariablePosition("boxbot_x_joint", 0);
+  state.setVariablePosition("boxbot_y_joint", 0);
+  state.update();
+
+  collision_detection::DistanceRequest dreq;
+  dreq.enable_signed_distance = true;
+  dreq.distance_threshold = 1.0;
+
+  collision_detection::DistanceResult hull_res;
+  world.distanceRobot(dreq, hull_res, robot, state);
+  EXPECT_LT(hull_res.minimum_distance.distance, 0);
+
+  // A decomposition finishing in the background is not used by the queries
+  cache.wait();
+  collision_detection::DistanceResult res;
+  world.distanceRobot(dreq, res, robot, state);
+  EXPECT_NEAR(res.minimum_distance.distance, hull_res.minimum_distance.distance, 1e-6);
+
+  // It is swapped in on request
+  EXPECT_TRUE(world.updateConvexDecompositions());
+  EXPECT_FALSE(world.updateConvexDecompositions());
+  res.clear();
+  world.distanceRobot(dreq, res, robot, state);
+  EXPECT_GT(res.minimum_distance.distance, 0);
+}
+
+TEST_F(CastWorldTest, world_meshes)
+{
+  ROS_DEBUG("CastTest, world_meshes");
+
+  collision_detection::CollisionWorldBullet world;
+
+  // Meshes get levels of detail, which must be unwrapped when checked against each other
+  std::vector<std::pair<Eigen::Vector3d, Eigen::Vector3d>> box_a, box_b;
+  box_a.emplace_back(Eigen::Vector3d(-0.5, -0.5, -0.5), Eigen::Vector3d(0.5, 0.5, 0.5));
+  box_b.emplace_back(Eigen::Vector3d(0.3, -0.5, -0.5), Eigen::Vector3d(1.3, 0.5, 0.5));
+  world.getWorld()->addToObject("mesh_a", shapes::ShapeConstPtr(createBoxesMesh(box_a)), Eigen::Isometry3d::Identity());
+  world.getWorld()->addToObject("mesh_b", shapes::ShapeConstPtr(createBoxesMesh(box_b)), Eigen::Isometry3d::Identity());
+
+  auto hasPair = [](const collision_detection::CollisionResult& res, const std::string& a, const std::string& b) {
+    return res.contacts.count(std::make_pair(a, b)) != 0 || res.contacts.count(std::make_pair(b, a)) != 0;
+  };
+
+  collision_detection::CollisionRequest creq;
+  creq.contacts = true;
+  creq.max_contacts = 100;
+
+  collision_detection::CollisionResult res;
+  world.checkWorldCollision(creq, res, world);
+  EXPECT_TRUE(res.collision);
+  EXPECT_TRUE(hasPair(res, "mesh_a", "mesh_b"));
+
+  collision_detection::DistanceRequest dreq;
+  dreq.type = collision_detection::DistanceRequestType::ALL;
+  dreq.enable_signed_distance = true;
+  dreq.distance_threshold = 0.5;
+  collision_detection::DistanceResult dres;
+  world.distanceWorld(dreq, dres, world);
+  auto it = dres.distances.find(std::make_pair(std::string("mesh_a"), std::string("mesh_b")));
+  ASSERT_TRUE(it != dres.distances.end());
+  ASSERT_FALSE(it->second.empty());
+  EXPECT_NEAR(it->second[0].distance, -0.2, 1e-2);
+
+  // A point cloud inside the second mesh only
+  std::vector<Eigen::Vector3d> points = { Eigen::Vector3d(1.0, 0, 0), Eigen::Vector3d(1.1, 0.1, 0) };
+  world.setPointCloud("cloud", points, 0.01);
+  res.clear();
+  world.checkWorldCollision(creq, res, world);
+  EXPECT_TRUE(hasPair(res, "cloud", "mesh_b"));
+  EXPECT_FALSE(hasPair(res, "cloud", "mesh_a"));
+}
+
+TEST_F(CastWorldTest, attached_sweep)
+{
+  ROS_DEBUG("CastTest, attached_sweep");
+
+  // A box attached away from the link origin, so the link is swept as a compound shape
+  moveit_msgs::AttachedCollisionObject box_attached;
+  shape_msgs::SolidPrimitive box;
+  geometry_msgs::Pose box_pose;
+
+  box.type = shape_msgs::SolidPrimitive::BOX;
+  box.dimensions.assign(3, 0.2);
+  box_pose.position.y = -1.2;
+  box_pose.orientation.w = 1;
+
+  box_attached.link_name = "boxbot_link";
+  box_attached.touch_links.push_back("boxbot_link");
+  box_attached.object.header.frame_id = "boxbot_link";
+  box_attached.object.id = "box_attached";
+  box_attached.object.operation = moveit_msgs::CollisionObject::ADD;
+  box_attached.object.primitives.push_back(box);
+  box_attached.object.primitive_poses.push_back(box_pose);
+  planning_scene_->processAttachedCollisionObjectMsg(box_attached);
+
+  // Only the attached box crosses box_world, and only between the two waypoints
+  robot_state::RobotState state1 = planning_scene_->getCurrentState();
+  state1.setVariablePosition("boxbot_x_joint", -1.9);
+  state1.setVariablePosition("boxbot_y_joint", 1.2);
+  state1.update();
+  robot_state::RobotState state2 = state1;
+  state2.setVariablePosition("boxbot_x_joint", 1.9);
+  state2.update();
+
+  const collision_detection::CollisionWorldBullet& world =
+      dynamic_cast<const collision_detection::CollisionWorldBullet&>(*planning_scene_->getCollisionWorld());
+  const collision_detection::CollisionRobot& robot = *planning_scene_->getCollisionRobot();
+  const collision_detection::AllowedCollisionMatrix& acm = planning_scene_->getAllowedCollisionMatrix();
+
+  collision_detection::CollisionRequest creq;
+  creq.contacts = true;
+  creq.max_contacts = 100;
+
+  collision_detection::CollisionResult res;
+  world.checkRobotCollision(creq, res, robot, state1, acm);
+  EXPECT_FALSE(res.collision);
+  res.clear();
+  world.checkRobotCollision(creq, res, robot, state2, acm);
+  EXPECT_FALSE(res.collision);
+
+  res.clear();
+  world.checkRobotCollision(creq, res, robot, state1, state2, acm);
+  EXPECT_TRUE(res.collision);
+  EXPECT_TRUE(res.contacts.count(std::make_pair(std::string("box_attached"), std::string("box_world"))) != 0 ||
+              res.contacts.count(std::make_pair(std::string("box_world"), std::string("box_attached"))) != 0);
+
+  robot_trajectory::RobotTrajectory trajectory(robot_model_, "manipulator");
+  trajectory.addSuffixWayPoint(state1, 0);
+  trajectory.addSuffixWayPoint(state2, 1);
+  res.clear();
+  EXPECT_EQ(world.checkTrajectoryCollision(creq, res, robot, trajectory, &acm, false, false, 1), -1);
+  res.clear();
+  EXPECT_EQ(world.checkTrajectoryCollision(creq, res, robot, trajectory, &acm, true, false, 1), 1);
+}
+
 int main(int argc, char** argv)
 {
   testing::InitGoogleTest(&argc, argv);
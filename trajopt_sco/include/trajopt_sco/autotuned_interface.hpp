@@ -0,0 +1,141 @@
+#pragma once
+#include <trajopt_utils/macros.h>
+TRAJOPT_IGNORE_WARNINGS_PUSH
+#include <map>
+#include <mutex>
+#include <random>
+TRAJOPT_IGNORE_WARNINGS_POP
+
+#include <trajopt_sco/solver_interface.hpp>
+
+namespace sco
+{
+/**
+ * @brief Statistics of the convex solver backends, grouped by problem signature
+ *
+ * The signature buckets the number of variables, constraints, nonzeros and the bandwidth of the problem on a log2
+ * scale. Every backend is tried a few times per signature, after which the fastest backend whose success rate is above
+ * reliability_threshold is used, with an occasional random backend to keep the statistics current.
+ *
+ * If the TRAJOPT_AUTOTUNE_FILE environment variable is set, the statistics are loaded from and saved to that file so
+ * they carry over between runs. The tuner is shared by all models of the process and is thread-safe.
+ */
+class SolverAutotuner
+{
+public:
+  struct BackendStats
+  {
+    int trials = 0;
+    int successes = 0;
+    double success_rate = 0;  // running mean, turns into a moving average after max_history trials
+    double mean_time = 0;     // same for the solve time of the successful solves in seconds
+  };
+  typedef std::map<int, BackendStats> SignatureStats;
+
+  int min_trials = 2;                  // trials of every backend before the statistics are trusted
+  int max_history = 50;                // window of the moving averages, so the statistics follow changes
+  double explore_rate = 0.05;          // probability of trying a random backend
+  double reliability_threshold = 0.9;  // minimum success rate for a backend to be chosen for speed
+
+  static SolverAutotuner& instance();
+  ~SolverAutotuner();
+
+  /** @brief Backend to use for the next solve of a problem with this signature */
+  ModelType select(const std::string& signature, const std::vector<ModelType>& candidates);
+
+  /** @brief Best backend for the signature, ignoring the ones in exclude. Returns AUTO_SOLVER if none is left */
+  ModelType best(const std::string& signature,
+                 const std::vector<ModelType>& candidates,
+                 const std::vector<ModelType>& exclude = std::vector<ModelType>());
+
+  /** @brief Record the outcome of a solve */
+  void record(const std::string& signature, ModelType backend, double seconds, bool success);
+
+  SignatureStats stats(const std::string& signature) const;
+
+  /** @brief Write the statistics to the file given by TRAJOPT_AUTOTUNE_FILE, if any */
+  void save() const;
+
+private:
+  SolverAutotuner();
+
+  void load();
+
+  std::map<std::string, SignatureStats> stats_;
+  std::string file_;
+  int unsaved_records_;
+  std::mt19937 rng_;
+  mutable std::mutex mutex_;
+};
+
+/**
+ * @brief Model forwarding to the backend chosen by SolverAutotuner
+ *
+ * The model keeps its own copy of the variables, constraints and objective, mirrored into the current backend as they
+ * are added. When the tuner switches backend the new backend is built from this copy before solving. If a backend
+ * fails to solve, the remaining backends are tried in order of preference.
+ */
+class AutoTunedModel : public Model
+{
+public:
+  AutoTunedModel(const std::vector<ModelType>& candidates);
+  virtual ~AutoTunedModel();
+
+  Var addVar(const std::string& name) override;
+  Cnt addEqCnt(const AffExpr&, const std::string& name) override;
+  Cnt addIneqCnt(const AffExpr&, const std::string& name) override;
+  Cnt addIneqCnt(const QuadExpr&, const std::string& name) override;
+  void removeVars(const VarVector& vars) override;
+  void removeCnts(const CntVector& cnts) override;
+
+  void update() override;
+  void setVarBounds(const VarVector& vars, const DblVec& lower, const DblVec& upper) override;
+  DblVec getVarValues(const VarVector& vars) const override;
+  CvxOptStatus optimize() override;
+  void setTolerance(double tolerance, bool polish) override;
+  void setObjective(const AffExpr&) override;
+  void setObjective(const QuadExpr&) override;
+  void setLeastSquaresObjective(const QuadExpr& quad, const LeastSquaresExpr& lsq) override;
+  void writeToFile(const std::string& fname) override;
+  VarVector getVars() const override;
+  ModelPtr clone() const override;
+
+  /** @brief Signature of the current problem used to look up the backend statistics */
+  std::string signature() const;
+
+  /** @brief Backend used by the last call to optimize() */
+  ModelType backend() const { return backend_type_; }
+
+private:
+  struct CntData
+  {
+    ConstraintType type;
+    bool quadratic;
+    AffExpr aff;
+    QuadExpr quad;
+  };
+
+  AffExpr toBackend(const AffExpr& expr) const;
+  QuadExpr toBackend(const QuadExpr& expr) const;
+  void addBackendCnt(const CntData& data);
+  void setBackendObjective();
+  /** @brief Replace the backend by a new one of the given type holding the current problem */
+  void rebuild(ModelType type);
+
+  std::vector<ModelType> candidates_;
+  ModelType backend_type_;
+  ModelPtr backend_;
+
+  VarVector vars_;
+  VarVector backend_vars_;
+  DblVec lbs_, ubs_;
+  CntVector cnts_;
+  CntVector backend_cnts_;
+  std::vector<CntData> cnt_data_;
+
+  QuadExpr objective_;
+  LeastSquaresExpr lsq_objective_;
+  double tolerance_;
+  bool polish_;
+};
+}
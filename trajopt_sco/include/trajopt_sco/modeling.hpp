@@ -9,6 +9,8 @@
  */
 #include <trajopt_utils/macros.h>
 TRAJOPT_IGNORE_WARNINGS_PUSH
+#include <Eigen/Core>
+#include <Eigen/SparseCore>
 #include <vector>
 TRAJOPT_IGNORE_WARNINGS_POP
 
@@ -30,6 +32,8 @@ public:
   ConvexObjective(Model* model) : model_(model) {}
   void addAffExpr(const AffExpr&);
   void addQuadExpr(const QuadExpr&);
+  /** Add coeff * affexpr^2 without expanding it into quadratic terms */
+  void addLeastSquares(const AffExpr&, double coeff);
   void addHinge(const AffExpr&, double coeff);
   void addAbs(const AffExpr&, double coeff);
   void addHinges(const AffExprVector&);
@@ -46,6 +50,7 @@ public:
 
   Model* model_;
   QuadExpr quad_;
+  LeastSquaresExpr lsq_;
   VarVector vars_;
   AffExprVector eqs_;
   AffExprVector ineqs_;
@@ -91,6 +96,44 @@ private:
   ConvexConstraints(ConvexConstraints&) {}
 };
 
+/**
+ * @brief Convex objectives and constraints assembled in sparse form for evaluation at the subproblem solutions
+ *
+ * Every affine part, least squares row and constraint row becomes a row of one CSC matrix, so the model costs and
+ * constraint violations at x come from a single product Ax + b instead of a walk over each expression. The variable
+ * indices are read when the evaluator is built, so it has to be rebuilt whenever the model is updated.
+ */
+class ConvexModelEvaluator
+{
+public:
+  ConvexModelEvaluator(const std::vector<ConvexObjectivePtr>& costs, const std::vector<ConvexConstraintsPtr>& cnts);
+
+  /** @brief Value of each convex objective and violation of each convex constraint set at x */
+  void evaluate(const DblVec& x, DblVec& cost_vals, DblVec& cnt_viols) const;
+
+private:
+  enum RowType
+  {
+    AFFINE,
+    LEAST_SQUARES,
+    EQ_ROW,
+    INEQ_ROW
+  };
+
+  size_t n_costs_;
+  size_t n_cnts_;
+  Eigen::SparseMatrix<double> A_;
+  Eigen::VectorXd b_;
+  /** @brief Cost or constraint index of each row, what it contributes and its least squares weight */
+  std::vector<size_t> row_terms_;
+  std::vector<RowType> row_types_;
+  DblVec row_weights_;
+  /** @brief Quadratic terms of the objectives, cost index, variable indices and coefficient */
+  std::vector<size_t> quad_terms_;
+  IntVec quad_vars1_, quad_vars2_;
+  DblVec quad_coeffs_;
+};
+
 /**
 Non-convex cost function, which knows how to calculate its convex approximation
 (convexify() method)
@@ -104,6 +147,8 @@ public:
   virtual ConvexObjectivePtr convex(const DblVec& x, Model* model) = 0;
   /** Get problem variables associated with this cost */
   virtual VarVector getVars() = 0;
+  /** True if value and convex can run at the same time on different threads, see pipelined_convexification */
+  virtual bool isThreadSafe() const { return false; }
   std::string name() { return name_; }
   void setName(const std::string& name) { name_ = name; }
   Cost() : name_("unnamed") {}
@@ -134,6 +179,8 @@ public:
   double violation(const DblVec& x);
   /** Get problem variables associated with this constraint */
   virtual VarVector getVars() = 0;
+  /** True if value and convex can run at the same time on different threads, see pipelined_convexification */
+  virtual bool isThreadSafe() const { return false; }
   std::string name() { return name_; }
   void setName(const std::string& name) { name_ = name; }
   Constraint() : name_("unnamed") {}
@@ -195,6 +242,9 @@ public:
    * constraints */
   DblVec getCentralFeasiblePoint(const DblVec& x);
   DblVec getClosestFeasiblePoint(const DblVec& x);
+  /** Assign each variable to a trust region block (numbered from 0), for optimizers which size the
+   * trust region of each block separately. Empty means a single block */
+  void setTrustRegionBlocks(const IntVec& blocks);
 
   std::vector<ConstraintPtr> getConstraints() const;
   const std::vector<CostPtr>& getCosts() { return costs_; }
@@ -204,6 +254,7 @@ public:
   const DblVec& getUpperBounds() { return upper_bounds_; }
   ModelPtr getModel() { return model_; }
   const VarVector& getVars() { return vars_; }
+  const IntVec& getTrustRegionBlocks() { return trust_region_blocks_; }
   int getNumCosts() { return static_cast<int>(costs_.size()); }
   int getNumConstraints() { return static_cast<int>(eqcnts_.size() + ineqcnts_.size()); }
   int getNumVars() { return static_cast<int>(vars_.size()); }
@@ -215,6 +266,7 @@ protected:
   std::vector<CostPtr> costs_;
   std::vector<ConstraintPtr> eqcnts_;
   std::vector<ConstraintPtr> ineqcnts_;
+  IntVec trust_region_blocks_;
 
   OptProb(OptProb&);
 };
@@ -35,6 +35,8 @@ class VectorOfVector
 public:
   virtual Eigen::VectorXd operator()(const Eigen::VectorXd& x) const = 0;
   Eigen::VectorXd call(const Eigen::VectorXd& x) const { return operator()(x); }
+  /** @brief Write f(x) into out. Override to reuse the storage of out instead of returning a new vector. */
+  virtual void evaluate(const Eigen::VectorXd& x, Eigen::VectorXd& out) const { out = operator()(x); }
   virtual ~VectorOfVector() {}
   typedef std::function<Eigen::VectorXd(Eigen::VectorXd)> func;
   static VectorOfVectorPtr construct(const func&);
@@ -46,6 +48,8 @@ class MatrixOfVector
 public:
   virtual Eigen::MatrixXd operator()(const Eigen::VectorXd& x) const = 0;
   Eigen::MatrixXd call(const Eigen::VectorXd& x) const { return operator()(x); }
+  /** @brief Write f(x) into out. Override to reuse the storage of out instead of returning a new matrix. */
+  virtual void evaluate(const Eigen::VectorXd& x, Eigen::MatrixXd& out) const { out = operator()(x); }
   virtual ~MatrixOfVector() {}
   typedef std::function<Eigen::MatrixXd(Eigen::VectorXd)> func;
   static MatrixOfVectorPtr construct(const func&);
@@ -18,13 +18,15 @@ enum OptStatus
   OPT_SCO_ITERATION_LIMIT,  // hit iteration limit before convergence
   OPT_PENALTY_ITERATION_LIMIT,
   OPT_FAILED,
-  INVALID
+  INVALID,
+  OPT_TIME_LIMIT  // hit max_time before convergence
 };
 static const char* OptStatus_strings[] = { "CONVERGED",
                                            "SCO_ITERATION_LIMIT",
                                            "PENALTY_ITERATION_LIMIT",
                                            "FAILED",
-                                           "INVALID" };
+                                           "INVALID",
+                                           "TIME_LIMIT" };
 inline std::string statusToString(OptStatus status) { return OptStatus_strings[status]; }
 struct OptResults
 {
@@ -47,6 +49,11 @@ struct OptResults
 };
 std::ostream& operator<<(std::ostream& o, const OptResults& r);
 
+/** @brief Turn convexified constraints into l1 penalties weighted by err_coeff, adding their variables to the model */
+std::vector<ConvexObjectivePtr> cntsToCosts(const std::vector<ConvexConstraintsPtr>& cnts,
+                                            double err_coeff,
+                                            Model* model);
+
 class Optimizer
 {
   /*
@@ -90,9 +97,32 @@ struct BasicTrustRegionSQPParameters
   double max_merit_coeff_increases;   // number of times that we jack up penalty
                                       // coefficient
   double merit_coeff_increase_ratio;  // ratio that we increate coeff each time
-  double max_time;                    // not yet implemented
+  double max_time;                    // wall time limit in seconds, checked at the start of every iteration
   double merit_error_coeff;           // initial penalty coefficient
   double trust_box_size;              // current size of trust region (component-wise)
+  bool lazy_merit_evaluation;         // evaluate trial costs largest first and stop once
+                                      // the step is certain to be rejected. Only valid
+                                      // if all costs are nonnegative
+  bool inexact_qp_solves;             // loosen the convex subproblem tolerance far from
+                                      // convergence, tightening it as the trust region
+                                      // and the approximate improvement shrink
+  double max_qp_tolerance;            // subproblem tolerance used far from convergence
+  double min_qp_tolerance;            // subproblem tolerance used near convergence,
+                                      // polishing is only requested at this tolerance
+  bool per_block_trust_region;        // size the trust region of each block set with
+                                      // OptProb::setTrustRegionBlocks separately, based
+                                      // on the improvement ratio of the terms touching it
+  int speculative_trials;             // after a rejected step, solve the subproblem for this many
+                                      // trust region sizes at once (shrunk 0, 1, 2... times) on
+                                      // copies of the model, so further rejections do not wait
+                                      // for a new solve. 1 disables it, as do backends without
+                                      // Model::clone and per-block trust regions
+  bool pipelined_convexification;     // convexify at the trial point on another thread while
+                                      // its exact merit is evaluated, and start the next
+                                      // iteration from it if the step is accepted. Only the
+                                      // terms whose isThreadSafe() is true are convexified
+                                      // on the other thread, the others only once the step
+                                      // is accepted
 
   BasicTrustRegionSQPParameters();
 };
@@ -121,8 +151,37 @@ public:
 
 protected:
   void adjustTrustRegion(double ratio);
+  /**
+   * @brief Grow or shrink the trust region of each block from the agreement between the approximate and
+   * exact improvement of the merit terms touching it. Unknown exact values are passed as NAN.
+   */
+  void adjustBlockTrustRegions(const std::vector<IntVec>& term_blocks,
+                               const DblVec& old_merit_terms,
+                               const DblVec& model_merit_terms,
+                               const DblVec& new_merit_terms,
+                               bool accepted);
   void setTrustBoxConstraints(const DblVec& x);
+  void setTrustBoxConstraints(const DblVec& x, Model& model, double trust_box_size);
+  /** @brief A subproblem solved ahead of time for a smaller trust region */
+  struct SpeculativeTrial
+  {
+    double trust_box_size;
+    double qp_tolerance;
+    CvxOptStatus status;
+    DblVec model_var_vals;
+  };
+  /**
+   * @brief Solve the subproblem for the current trust region and the next n_trials - 1 shrunk ones concurrently
+   * @return The solutions ordered from the largest trust region, empty if the model cannot be copied, in which case
+   * model_clonable_ is cleared
+   */
+  std::vector<SpeculativeTrial> solveSpeculativeTrials(const DblVec& x, int n_trials, double last_approx_merit_improve);
+  /** @brief Tolerance of the subproblem for the given trust region size, 0 unless inexact_qp_solves is set */
+  double subproblemTolerance(double trust_box_size, double last_approx_merit_improve) const;
   ModelPtr model_;
+  bool model_clonable_ = true;  // false once model_->clone() failed, which disables the speculative trials
   BasicTrustRegionSQPParameters param_;
+  IntVec var_blocks_;       // trust region block of each variable
+  DblVec trust_box_sizes_;  // trust region size of each block, param_.trust_box_size is their max
 };
 }
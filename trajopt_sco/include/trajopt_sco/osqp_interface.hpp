@@ -59,7 +59,8 @@ class OSQPModel : public Model
   DblVec A_csc_data_;                    /**< constraint matrix values in CSC format */
   DblVec l_, u_;                         /**< linear constraints upper and lower limits */
 
-  QuadExpr objective_; /**< objective QuadExpr expression */
+  QuadExpr objective_;             /**< objective QuadExpr expression */
+  LeastSquaresExpr lsq_objective_; /**< least squares part of the objective */
 
 public:
   OSQPModel();
@@ -76,9 +77,13 @@ public:
   void setVarBounds(const VarVector& vars, const DblVec& lower, const DblVec& upper) override;
   DblVec getVarValues(const VarVector& vars) const override;
   virtual CvxOptStatus optimize() override;
+  /** Sets eps_abs to tolerance, scaling eps_rel along with it, and toggles polishing */
+  virtual void setTolerance(double tolerance, bool polish) override;
   virtual void setObjective(const AffExpr&) override;
   virtual void setObjective(const QuadExpr&) override;
+  virtual void setLeastSquaresObjective(const QuadExpr& quad, const LeastSquaresExpr& lsq) override;
   virtual void writeToFile(const std::string& fname) override;
   virtual VarVector getVars() const override;
+  virtual ModelPtr clone() const override;
 };
 }
@@ -27,6 +27,8 @@ class qpOASESModel : public Model
   /** pointer to a qpOASES Sequential Quadratic Problem*/
   std::shared_ptr<qpOASES::SQProblem> qpoases_problem_;
   qpOASES::Options qpoases_options_; /**< qpOASES solver options */
+  /** termination tolerance set by the MPC options, used as the tightest tolerance */
+  qpOASES::real_t default_termination_tolerance_;
 
   qpOASES::SymSparseMat H_; /**< Quadratic cost matrix */
   qpOASES::SparseMatrix A_; /**< Constraints matrix */
@@ -70,7 +72,8 @@ class qpOASESModel : public Model
   DblVec A_csc_data_;        /**< constraint matrix values in CSC format */
   DblVec lbA_, ubA_;         /**< linear constraints upper and lower limits */
 
-  QuadExpr objective_; /**< objective QuadExpr expression */
+  QuadExpr objective_;             /**< objective QuadExpr expression */
+  LeastSquaresExpr lsq_objective_; /**< least squares part of the objective */
 
 public:
   qpOASESModel();
@@ -87,8 +90,11 @@ public:
   void setVarBounds(const VarVector& vars, const DblVec& lower, const DblVec& upper) override;
   DblVec getVarValues(const VarVector& vars) const override;
   virtual CvxOptStatus optimize() override;
+  /** Scales the termination tolerance of the homotopy, polish is ignored */
+  virtual void setTolerance(double tolerance, bool polish) override;
   virtual void setObjective(const AffExpr&) override;
   virtual void setObjective(const QuadExpr&) override;
+  virtual void setLeastSquaresObjective(const QuadExpr& quad, const LeastSquaresExpr& lsq) override;
   virtual void writeToFile(const std::string& fname) override;
   virtual VarVector getVars() const override;
 };
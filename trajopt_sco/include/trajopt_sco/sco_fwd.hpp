@@ -45,4 +45,6 @@ struct AffExpr;
 typedef std::shared_ptr<AffExpr> AffExprPtr;
 struct QuadExpr;
 typedef std::shared_ptr<QuadExpr> QuadExprPtr;
+struct LeastSquaresExpr;
+typedef std::shared_ptr<LeastSquaresExpr> LeastSquaresExprPtr;
 }
@@ -65,13 +65,38 @@ public:
   virtual double getVarValue(const Var& var) const;
   virtual DblVec getVarValues(const VarVector& vars) const = 0;
   virtual CvxOptStatus optimize() = 0;
+  /**
+   * @brief Request the accuracy to which the following calls to optimize() should solve the problem
+   *
+   * Backends map it onto their own termination criteria, or ignore it if they have none.
+   *
+   * @param tolerance absolute tolerance on the primal and dual residuals. A value <= 0 restores the
+   * backend defaults
+   * @param polish whether to run a solution polishing step, if the backend has one
+   */
+  virtual void setTolerance(double tolerance, bool polish);
 
   virtual void setObjective(const AffExpr&) = 0;
   virtual void setObjective(const QuadExpr&) = 0;
+  /**
+   * @brief Set the objective to quad + lsq
+   *
+   * The default implementation expands lsq into quadratic terms. Backends which can assemble J'WJ
+   * directly should override it.
+   */
+  virtual void setLeastSquaresObjective(const QuadExpr& quad, const LeastSquaresExpr& lsq);
   virtual void writeToFile(const std::string& fname) = 0;
 
   virtual VarVector getVars() const = 0;
 
+  /**
+   * @brief Independent copy of the model, or nullptr if the backend cannot copy itself
+   *
+   * The copy has its own variables and constraints, with the same indices as the ones of this model, so the variables
+   * of this model can be passed to it. Copies can be solved on other threads as long as this model is not changed.
+   */
+  virtual ModelPtr clone() const;
+
   virtual ~Model() {}
 };
 
@@ -148,6 +173,20 @@ struct QuadExpr
   double value(const DblVec& x) const;
 };
 
+/**
+ * @brief Weighted sum of squared affine expressions, sum_i weights[i] * exprs[i]^2
+ *
+ * This is (Jx + r)'W(Jx + r) with one row of J and r per expression and a diagonal W. Keeping the
+ * rows avoids the quadratic number of terms exprSquare creates for each of them.
+ */
+struct LeastSquaresExpr
+{
+  AffExprVector exprs;
+  DblVec weights;
+  size_t size() const { return exprs.size(); }
+  double value(const DblVec& x) const;
+};
+
 std::ostream& operator<<(std::ostream&, const Var&);
 std::ostream& operator<<(std::ostream&, const Cnt&);
 std::ostream& operator<<(std::ostream&, const AffExpr&);
@@ -162,7 +201,8 @@ public:
     BPMPD,
     OSQP,
     QPOASES,
-    AUTO_SOLVER
+    AUTO_SOLVER,
+    AUTO_TUNED  // picks the fastest reliable backend per problem signature, see SolverAutotuner
   };
 
   static const std::vector<std::string> MODEL_NAMES_;
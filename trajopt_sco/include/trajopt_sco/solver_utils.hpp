@@ -44,6 +44,24 @@ void exprToEigen(const QuadExpr& expr,
                  const bool& matrix_is_halved = false,
                  const bool& force_diagonal = false);
 
+/**
+ * @brief transform a `LeastSquaresExpr` to the Hessian and gradient of its
+ *        quadratic form, `2 * J'WJ` and `2 * J'Wr`.
+ *        J is assembled from triplets, so the cost is linear in the number
+ *        of coefficients of each row instead of quadratic.
+ *
+ * @param [in] expr a `LeastSquaresExpr` expression
+ * @param [out] sparse_matrix the Hessian, full and symmetric. It will be
+ *                            resized to the correct size.
+ * @param [out] vector the gradient at zero. It will be resized to the correct
+ *                     size.
+ * @param [in] n_vars the number of variables in the model.
+ */
+void exprToEigen(const LeastSquaresExpr& expr,
+                 Eigen::SparseMatrix<double>& sparse_matrix,
+                 Eigen::VectorXd& vector,
+                 const int& n_vars);
+
 /**
  * @brief transform a vector of `AffExpr` to an `Eigen::SparseMatrix` plus an
  *        `Eigen::VectorXd`.
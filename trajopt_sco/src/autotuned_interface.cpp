@@ -0,0 +1,548 @@
+#include <trajopt_utils/macros.h>
+TRAJOPT_IGNORE_WARNINGS_PUSH
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <jsoncpp/json/json.h>
+#include <sstream>
+TRAJOPT_IGNORE_WARNINGS_POP
+
+#include <trajopt_sco/autotuned_interface.hpp>
+#include <trajopt_utils/logging.hpp>
+
+namespace sco
+{
+namespace
+{
+/** @brief Save the statistics every that many solves, on top of saving at exit */
+const int AUTOTUNE_SAVE_INTERVAL = 100;
+
+const std::string& modelName(ModelType type) { return ModelType::MODEL_NAMES_[static_cast<size_t>(int(type))]; }
+
+int log2Bucket(size_t x) { return (x == 0) ? 0 : static_cast<int>(std::floor(std::log2(static_cast<double>(x)))) + 1; }
+
+/** @brief Largest index distance between the variables of an expression */
+size_t spread(const VarVector& vars)
+{
+  if (vars.empty())
+    return 0;
+  int lo = vars[0].var_rep->index, hi = lo;
+  for (const Var& var : vars)
+  {
+    lo = std::min(lo, var.var_rep->index);
+    hi = std::max(hi, var.var_rep->index);
+  }
+  return static_cast<size_t>(hi - lo);
+}
+}  // namespace
+
+SolverAutotuner& SolverAutotuner::instance()
+{
+  static SolverAutotuner tuner;
+  return tuner;
+}
+
+SolverAutotuner::SolverAutotuner() : unsaved_records_(0), rng_(std::random_device()())
+{
+  const char* file = getenv("TRAJOPT_AUTOTUNE_FILE");
+  if (file)
+  {
+    file_ = file;
+    load();
+  }
+}
+
+SolverAutotuner::~SolverAutotuner() { save(); }
+
+ModelType SolverAutotuner::select(const std::string& signature, const std::vector<ModelType>& candidates)
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    SignatureStats& s = stats_[signature];
+    for (const ModelType& candidate : candidates)
+      if (s[candidate].trials < min_trials)
+        return candidate;
+
+    if (std::uniform_real_distribution<double>(0, 1)(rng_) < explore_rate)
+      return candidates[std::uniform_int_distribution<size_t>(0, candidates.size() - 1)(rng_)];
+  }
+  return best(signature, candidates);
+}
+
+ModelType SolverAutotuner::best(const std::string& signature,
+                                const std::vector<ModelType>& candidates,
+                                const std::vector<ModelType>& exclude)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  SignatureStats& s = stats_[signature];
+
+  ModelType fastest = ModelType::AUTO_SOLVER, most_reliable = ModelType::AUTO_SOLVER;
+  for (const ModelType& candidate : candidates)
+  {
+    if (std::find(exclude.begin(), exclude.end(), candidate) != exclude.end())
+      continue;
+
+    const BackendStats& c = s[candidate];
+    if (c.success_rate >= reliability_threshold &&
+        (fastest == ModelType::AUTO_SOLVER || c.mean_time < s[fastest].mean_time))
+      fastest = candidate;
+    if (most_reliable == ModelType::AUTO_SOLVER || c.success_rate > s[most_reliable].success_rate)
+      most_reliable = candidate;
+  }
+  return (fastest == ModelType::AUTO_SOLVER) ? most_reliable : fastest;
+}
+
+void SolverAutotuner::record(const std::string& signature, ModelType backend, double seconds, bool success)
+{
+  bool save_now = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    BackendStats& c = stats_[signature][backend];
+    ++c.trials;
+    c.success_rate += ((success ? 1.0 : 0.0) - c.success_rate) / std::min(c.trials, max_history);
+    if (success)
+    {
+      // Only successful solves count towards the time, failures are accounted for by the success rate
+      ++c.successes;
+      c.mean_time += (seconds - c.mean_time) / std::min(c.successes, max_history);
+    }
+
+    if (!file_.empty() && ++unsaved_records_ >= AUTOTUNE_SAVE_INTERVAL)
+    {
+      unsaved_records_ = 0;
+      save_now = true;
+    }
+  }
+
+  if (save_now)
+    save();
+}
+
+SolverAutotuner::SignatureStats SolverAutotuner::stats(const std::string& signature) const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = stats_.find(signature);
+  return (it == stats_.end()) ? SignatureStats() : it->second;
+}
+
+void SolverAutotuner::save() const
+{
+  if (file_.empty())
+    return;
+
+  Json::Value root(Json::objectValue);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& signature : stats_)
+    {
+      for (const auto& backend : signature.second)
+      {
+        if (backend.second.trials == 0)
+          continue;
+        Json::Value& v = root[signature.first][modelName(backend.first)];
+        v["trials"] = backend.second.trials;
+        v["successes"] = backend.second.successes;
+        v["success_rate"] = backend.second.success_rate;
+        v["mean_time"] = backend.second.mean_time;
+      }
+    }
+  }
+
+  std::ofstream out(file_);
+  if (!out)
+  {
+    LOG_WARN("failed to write solver statistics to %s", file_.c_str());
+    return;
+  }
+  out << Json::StyledWriter().write(root);
+}
+
+void SolverAutotuner::load()
+{
+  std::ifstream in(file_);
+  if (!in)
+    return;
+
+  Json::Value root;
+  Json::Reader reader;
+  if (!reader.parse(in, root) || !root.isObject())
+  {
+    LOG_WARN("ignoring invalid solver statistics in %s", file_.c_str());
+    return;
+  }
+
+  std::vector<ModelType> available = availableSolvers();
+  for (const std::string& signature : root.getMemberNames())
+  {
+    for (const std::string& name : root[signature].getMemberNames())
+    {
+      // Skip backends which are unknown or not part of this build
+      auto backend = std::find_if(
+          available.begin(), available.end(), [&name](const ModelType& type) { return modelName(type) == name; });
+      if (backend == available.end())
+        continue;
+
+      const Json::Value& v = root[signature][name];
+      BackendStats& c = stats_[signature][*backend];
+      c.trials = v["trials"].asInt();
+      c.successes = v["successes"].asInt();
+      c.success_rate = v["success_rate"].asDouble();
+      c.mean_time = v["mean_time"].asDouble();
+    }
+  }
+}
+
+AutoTunedModel::AutoTunedModel(const std::vector<ModelType>& candidates)
+  : candidates_(candidates), backend_type_(ModelType::AUTO_SOLVER), tolerance_(0), polish_(true)
+{
+  if (candidates_.empty())
+    PRINT_AND_THROW("AutoTunedModel needs at least one solver");
+}
+
+AutoTunedModel::~AutoTunedModel()
+{
+  for (const Var& var : vars_)
+    delete var.var_rep;
+  for (const Cnt& cnt : cnts_)
+    delete cnt.cnt_rep;
+}
+
+Var AutoTunedModel::addVar(const std::string& name)
+{
+  vars_.push_back(new VarRep(static_cast<int>(vars_.size()), name, this));
+  lbs_.push_back(-INFINITY);
+  ubs_.push_back(INFINITY);
+  if (backend_)
+    backend_vars_.push_back(backend_->addVar(name));
+  return vars_.back();
+}
+
+Cnt AutoTunedModel::addEqCnt(const AffExpr& expr, const std::string& /*name*/)
+{
+  cnts_.push_back(new CntRep(static_cast<int>(cnts_.size()), this));
+  cnt_data_.push_back({ EQ, false, expr, QuadExpr() });
+  if (backend_)
+    addBackendCnt(cnt_data_.back());
+  return cnts_.back();
+}
+
+Cnt AutoTunedModel::addIneqCnt(const AffExpr& expr, const std::string& /*name*/)
+{
+  cnts_.push_back(new CntRep(static_cast<int>(cnts_.size()), this));
+  cnt_data_.push_back({ INEQ, false, expr, QuadExpr() });
+  if (backend_)
+    addBackendCnt(cnt_data_.back());
+  return cnts_.back();
+}
+
+Cnt AutoTunedModel::addIneqCnt(const QuadExpr& expr, const std::string& /*name*/)
+{
+  cnts_.push_back(new CntRep(static_cast<int>(cnts_.size()), this));
+  cnt_data_.push_back({ INEQ, true, AffExpr(), expr });
+  if (backend_)
+    addBackendCnt(cnt_data_.back());
+  return cnts_.back();
+}
+
+void AutoTunedModel::removeVars(const VarVector& vars)
+{
+  VarVector backend_vars;
+  for (const Var& var : vars)
+  {
+    var.var_rep->removed = true;
+    if (backend_)
+      backend_vars.push_back(backend_vars_[static_cast<size_t>(var.var_rep->index)]);
+  }
+  if (backend_)
+    backend_->removeVars(backend_vars);
+}
+
+void AutoTunedModel::removeCnts(const CntVector& cnts)
+{
+  CntVector backend_cnts;
+  for (const Cnt& cnt : cnts)
+  {
+    cnt.cnt_rep->removed = true;
+    if (backend_)
+      backend_cnts.push_back(backend_cnts_[static_cast<size_t>(cnt.cnt_rep->index)]);
+  }
+  if (backend_)
+    backend_->removeCnts(backend_cnts);
+}
+
+void AutoTunedModel::update()
+{
+  // The backend compacts its variables and constraints the same way, keeping the two in lockstep
+  size_t inew = 0;
+  for (size_t iold = 0; iold < vars_.size(); ++iold)
+  {
+    const Var& var = vars_[iold];
+    if (!var.var_rep->removed)
+    {
+      vars_[inew] = var;
+      if (backend_)
+        backend_vars_[inew] = backend_vars_[iold];
+      lbs_[inew] = lbs_[iold];
+      ubs_[inew] = ubs_[iold];
+      var.var_rep->index = static_cast<int>(inew);
+      ++inew;
+    }
+    else
+      delete var.var_rep;
+  }
+  vars_.resize(inew);
+  if (backend_)
+    backend_vars_.resize(inew);
+  lbs_.resize(inew);
+  ubs_.resize(inew);
+
+  inew = 0;
+  for (size_t iold = 0; iold < cnts_.size(); ++iold)
+  {
+    const Cnt& cnt = cnts_[iold];
+    if (!cnt.cnt_rep->removed)
+    {
+      cnts_[inew] = cnt;
+      if (backend_)
+        backend_cnts_[inew] = backend_cnts_[iold];
+      cnt_data_[inew] = cnt_data_[iold];
+      cnt.cnt_rep->index = static_cast<int>(inew);
+      ++inew;
+    }
+    else
+      delete cnt.cnt_rep;
+  }
+  cnts_.resize(inew);
+  if (backend_)
+    backend_cnts_.resize(inew);
+  cnt_data_.resize(inew);
+
+  if (backend_)
+    backend_->update();
+}
+
+void AutoTunedModel::setVarBounds(const VarVector& vars, const DblVec& lower, const DblVec& upper)
+{
+  VarVector backend_vars;
+  for (size_t i = 0; i < vars.size(); ++i)
+  {
+    size_t index = static_cast<size_t>(vars[i].var_rep->index);
+    lbs_[index] = lower[i];
+    ubs_[index] = upper[i];
+    if (backend_)
+      backend_vars.push_back(backend_vars_[index]);
+  }
+  if (backend_)
+    backend_->setVarBounds(backend_vars, lower, upper);
+}
+
+DblVec AutoTunedModel::getVarValues(const VarVector& vars) const
+{
+  if (!backend_)
+    PRINT_AND_THROW("getVarValues called before optimize");
+
+  VarVector backend_vars;
+  backend_vars.reserve(vars.size());
+  for (const Var& var : vars)
+    backend_vars.push_back(backend_vars_[static_cast<size_t>(var.var_rep->index)]);
+  return backend_->getVarValues(backend_vars);
+}
+
+CvxOptStatus AutoTunedModel::optimize()
+{
+  update();
+
+  SolverAutotuner& tuner = SolverAutotuner::instance();
+  std::string sig = signature();
+  ModelType type = tuner.select(sig, candidates_);
+  std::vector<ModelType> tried;
+  for (;;)
+  {
+    if (!backend_ || type != backend_type_)
+      rebuild(type);
+
+    auto start = std::chrono::steady_clock::now();
+    CvxOptStatus status = backend_->optimize();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // An infeasible subproblem is a valid answer, only solver failures count against a backend
+    tuner.record(sig, type, seconds, status != CVX_FAILED);
+    if (status != CVX_FAILED)
+      return status;
+
+    tried.push_back(type);
+    ModelType next = tuner.best(sig, candidates_, tried);
+    if (next == ModelType::AUTO_SOLVER)
+      return status;
+
+    LOG_WARN("%s failed to solve the convex subproblem, retrying with %s", modelName(type).c_str(),
+             modelName(next).c_str());
+    type = next;
+  }
+}
+
+void AutoTunedModel::setTolerance(double tolerance, bool polish)
+{
+  tolerance_ = tolerance;
+  polish_ = polish;
+  if (backend_)
+    backend_->setTolerance(tolerance, polish);
+}
+
+void AutoTunedModel::setObjective(const AffExpr& expr)
+{
+  objective_ = QuadExpr(expr);
+  lsq_objective_ = LeastSquaresExpr();
+  if (backend_)
+    backend_->setObjective(toBackend(expr));
+}
+
+void AutoTunedModel::setObjective(const QuadExpr& expr)
+{
+  objective_ = expr;
+  lsq_objective_ = LeastSquaresExpr();
+  if (backend_)
+    backend_->setObjective(toBackend(expr));
+}
+
+void AutoTunedModel::setLeastSquaresObjective(const QuadExpr& quad, const LeastSquaresExpr& lsq)
+{
+  objective_ = quad;
+  lsq_objective_ = lsq;
+  if (backend_)
+    setBackendObjective();
+}
+
+void AutoTunedModel::writeToFile(const std::string& fname)
+{
+  if (!backend_)
+  {
+    update();
+    rebuild(SolverAutotuner::instance().best(signature(), candidates_));
+  }
+  backend_->writeToFile(fname);
+}
+
+VarVector AutoTunedModel::getVars() const { return vars_; }
+
+ModelPtr AutoTunedModel::clone() const
+{
+  std::shared_ptr<AutoTunedModel> out(new AutoTunedModel(candidates_));
+  for (const Var& var : vars_)
+    out->vars_.push_back(new VarRep(var.var_rep->index, var.var_rep->name, out.get()));
+  for (const Cnt& cnt : cnts_)
+    out->cnts_.push_back(new CntRep(cnt.cnt_rep->index, out.get()));
+  out->lbs_ = lbs_;
+  out->ubs_ = ubs_;
+  out->cnt_data_ = cnt_data_;
+  out->objective_ = objective_;
+  out->lsq_objective_ = lsq_objective_;
+  out->tolerance_ = tolerance_;
+  out->polish_ = polish_;
+
+  // The backend is built from the copied problem on the first solve, since toBackend only uses variable indices the
+  // expressions can keep referring to the variables of this model
+  return out;
+}
+
+std::string AutoTunedModel::signature() const
+{
+  size_t nnz = objective_.size() + objective_.affexpr.size();
+  size_t bandwidth = 0;
+  for (size_t i = 0; i < objective_.size(); ++i)
+  {
+    int d = objective_.vars1[i].var_rep->index - objective_.vars2[i].var_rep->index;
+    bandwidth = std::max(bandwidth, static_cast<size_t>(std::abs(d)));
+  }
+  for (const AffExpr& expr : lsq_objective_.exprs)
+  {
+    nnz += expr.size();
+    bandwidth = std::max(bandwidth, spread(expr.vars));
+  }
+  for (const CntData& data : cnt_data_)
+  {
+    const AffExpr& aff = data.quadratic ? data.quad.affexpr : data.aff;
+    nnz += aff.size() + (data.quadratic ? data.quad.size() : 0);
+    bandwidth = std::max(bandwidth, spread(aff.vars));
+  }
+
+  std::stringstream ss;
+  ss << "v" << log2Bucket(vars_.size()) << "_c" << log2Bucket(cnts_.size()) << "_nnz" << log2Bucket(nnz) << "_bw"
+     << log2Bucket(bandwidth);
+  return ss.str();
+}
+
+AffExpr AutoTunedModel::toBackend(const AffExpr& expr) const
+{
+  AffExpr out(expr);
+  for (Var& var : out.vars)
+    var = backend_vars_[static_cast<size_t>(var.var_rep->index)];
+  return out;
+}
+
+QuadExpr AutoTunedModel::toBackend(const QuadExpr& expr) const
+{
+  QuadExpr out(toBackend(expr.affexpr));
+  out.coeffs = expr.coeffs;
+  out.vars1.reserve(expr.vars1.size());
+  out.vars2.reserve(expr.vars2.size());
+  for (size_t i = 0; i < expr.size(); ++i)
+  {
+    out.vars1.push_back(backend_vars_[static_cast<size_t>(expr.vars1[i].var_rep->index)]);
+    out.vars2.push_back(backend_vars_[static_cast<size_t>(expr.vars2[i].var_rep->index)]);
+  }
+  return out;
+}
+
+void AutoTunedModel::addBackendCnt(const CntData& data)
+{
+  if (data.quadratic)
+    backend_cnts_.push_back(backend_->addIneqCnt(toBackend(data.quad), ""));
+  else if (data.type == EQ)
+    backend_cnts_.push_back(backend_->addEqCnt(toBackend(data.aff), ""));
+  else
+    backend_cnts_.push_back(backend_->addIneqCnt(toBackend(data.aff), ""));
+}
+
+void AutoTunedModel::setBackendObjective()
+{
+  if (lsq_objective_.size() == 0)
+  {
+    backend_->setObjective(toBackend(objective_));
+    return;
+  }
+
+  LeastSquaresExpr lsq;
+  lsq.weights = lsq_objective_.weights;
+  lsq.exprs.reserve(lsq_objective_.size());
+  for (const AffExpr& expr : lsq_objective_.exprs)
+    lsq.exprs.push_back(toBackend(expr));
+  backend_->setLeastSquaresObjective(toBackend(objective_), lsq);
+}
+
+void AutoTunedModel::rebuild(ModelType type)
+{
+  // Only called right after update(), so there are no pending removals to carry over
+  backend_ = createModel(type);
+  backend_type_ = type;
+
+  backend_vars_.clear();
+  backend_vars_.reserve(vars_.size());
+  for (const Var& var : vars_)
+    backend_vars_.push_back(backend_->addVar(var.var_rep->name));
+  backend_->update();
+  backend_->setVarBounds(backend_vars_, lbs_, ubs_);
+
+  backend_cnts_.clear();
+  backend_cnts_.reserve(cnt_data_.size());
+  for (const CntData& data : cnt_data_)
+    addBackendCnt(data);
+  backend_->update();
+
+  setBackendObjective();
+  if (tolerance_ > 0)
+    backend_->setTolerance(tolerance_, polish_);
+}
+}
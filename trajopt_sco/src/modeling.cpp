@@ -16,6 +16,11 @@ namespace sco
 {
 void ConvexObjective::addAffExpr(const AffExpr& affexpr) { exprInc(quad_, affexpr); }
 void ConvexObjective::addQuadExpr(const QuadExpr& quadexpr) { exprInc(quad_, quadexpr); }
+void ConvexObjective::addLeastSquares(const AffExpr& affexpr, double coeff)
+{
+  lsq_.exprs.push_back(affexpr);
+  lsq_.weights.push_back(coeff);
+}
 void ConvexObjective::addHinge(const AffExpr& affexpr, double coeff)
 {
   Var hinge = model_->addVar("hinge", 0, INFINITY);
@@ -136,7 +141,91 @@ ConvexConstraints::~ConvexConstraints()
     removeFromModel();
 }
 
-double ConvexObjective::value(const DblVec& x) { return quad_.value(x); }
+double ConvexObjective::value(const DblVec& x) { return quad_.value(x) + lsq_.value(x); }
+
+ConvexModelEvaluator::ConvexModelEvaluator(const std::vector<ConvexObjectivePtr>& costs,
+                                           const std::vector<ConvexConstraintsPtr>& cnts)
+  : n_costs_(costs.size()), n_cnts_(cnts.size())
+{
+  std::vector<Eigen::Triplet<double>> triplets;
+  DblVec constants;
+  int n_cols = 0;
+  auto addRow = [&](const AffExpr& aff, size_t term, RowType type, double weight) {
+    int row = static_cast<int>(constants.size());
+    for (size_t i = 0; i < aff.size(); ++i)
+    {
+      triplets.push_back(Eigen::Triplet<double>(row, aff.vars[i].var_rep->index, aff.coeffs[i]));
+      n_cols = std::max(n_cols, aff.vars[i].var_rep->index + 1);
+    }
+    constants.push_back(aff.constant);
+    row_terms_.push_back(term);
+    row_types_.push_back(type);
+    row_weights_.push_back(weight);
+  };
+
+  for (size_t k = 0; k < costs.size(); ++k)
+  {
+    const ConvexObjective& cost = *costs[k];
+    addRow(cost.quad_.affexpr, k, AFFINE, 1);
+    for (size_t i = 0; i < cost.lsq_.size(); ++i)
+      addRow(cost.lsq_.exprs[i], k, LEAST_SQUARES, cost.lsq_.weights[i]);
+
+    for (size_t i = 0; i < cost.quad_.size(); ++i)
+    {
+      quad_terms_.push_back(k);
+      quad_vars1_.push_back(cost.quad_.vars1[i].var_rep->index);
+      quad_vars2_.push_back(cost.quad_.vars2[i].var_rep->index);
+      quad_coeffs_.push_back(cost.quad_.coeffs[i]);
+    }
+  }
+
+  for (size_t k = 0; k < cnts.size(); ++k)
+  {
+    for (const AffExpr& aff : cnts[k]->eqs_)
+      addRow(aff, k, EQ_ROW, 1);
+    for (const AffExpr& aff : cnts[k]->ineqs_)
+      addRow(aff, k, INEQ_ROW, 1);
+  }
+
+  A_.resize(static_cast<long>(constants.size()), n_cols);
+  A_.setFromTriplets(triplets.begin(), triplets.end());
+  A_.makeCompressed();
+  b_ = Eigen::Map<const Eigen::VectorXd>(constants.data(), static_cast<long>(constants.size()));
+}
+
+void ConvexModelEvaluator::evaluate(const DblVec& x, DblVec& cost_vals, DblVec& cnt_viols) const
+{
+  assert(static_cast<long>(x.size()) >= A_.cols());
+  Eigen::Map<const Eigen::VectorXd> x_vec(x.data(), A_.cols());
+  Eigen::VectorXd r = A_ * x_vec + b_;
+
+  cost_vals.assign(n_costs_, 0);
+  cnt_viols.assign(n_cnts_, 0);
+  for (size_t i = 0; i < row_types_.size(); ++i)
+  {
+    double val = r[static_cast<long>(i)];
+    switch (row_types_[i])
+    {
+      case AFFINE:
+        cost_vals[row_terms_[i]] += val;
+        break;
+      case LEAST_SQUARES:
+        cost_vals[row_terms_[i]] += row_weights_[i] * val * val;
+        break;
+      case EQ_ROW:
+        cnt_viols[row_terms_[i]] += fabs(val);
+        break;
+      case INEQ_ROW:
+        cnt_viols[row_terms_[i]] += pospart(val);
+        break;
+    }
+  }
+
+  for (size_t i = 0; i < quad_coeffs_.size(); ++i)
+    cost_vals[quad_terms_[i]] += quad_coeffs_[i] * x[static_cast<size_t>(quad_vars1_[i])] *
+                                 x[static_cast<size_t>(quad_vars2_[i])];
+}
+
 DblVec Constraint::violations(const DblVec& x)
 {
   DblVec val = value(x);
@@ -195,6 +284,11 @@ void OptProb::setUpperBounds(const DblVec& ub)
 
 void OptProb::setLowerBounds(const DblVec& lb, const VarVector& vars) { setVec(lower_bounds_, vars, lb); }
 void OptProb::setUpperBounds(const DblVec& ub, const VarVector& vars) { setVec(upper_bounds_, vars, ub); }
+void OptProb::setTrustRegionBlocks(const IntVec& blocks)
+{
+  assert(blocks.empty() || blocks.size() == vars_.size());
+  trust_region_blocks_ = blocks;
+}
 void OptProb::addCost(CostPtr cost) { costs_.push_back(cost); }
 void OptProb::addConstraint(ConstraintPtr cnt)
 {
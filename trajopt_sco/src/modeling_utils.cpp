@@ -175,9 +175,7 @@ ConvexObjectivePtr CostFromErrFunc::convex(const DblVec& xin, Model* model)
     {
       case SQUARED:
       {
-        QuadExpr quad = exprSquare(aff);
-        exprScale(quad, weight);
-        out->addQuadExpr(quad);
+        out->addLeastSquares(aff, weight);
         break;
       }
       case ABS:
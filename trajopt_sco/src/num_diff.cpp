@@ -41,13 +41,14 @@ Eigen::VectorXd calcForwardNumGrad(const ScalarOfVector& f, const Eigen::VectorX
 }
 Eigen::MatrixXd calcForwardNumJac(const VectorOfVector& f, const Eigen::VectorXd& x, double epsilon)
 {
-  Eigen::VectorXd y = f(x);
+  Eigen::VectorXd y, ypert;
+  f.evaluate(x, y);
   Eigen::MatrixXd out(y.size(), x.size());
   Eigen::VectorXd xpert = x;
   for (int i = 0; i < x.size(); ++i)
   {
     xpert(i) = x(i) + epsilon;
-    Eigen::VectorXd ypert = f(xpert);
+    f.evaluate(xpert, ypert);
     out.col(i) = (ypert - y) / epsilon;
     xpert(i) = x(i);
   }
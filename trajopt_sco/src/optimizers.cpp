@@ -1,8 +1,15 @@
 #include <trajopt_utils/macros.h>
 TRAJOPT_IGNORE_WARNINGS_PUSH
+#include <algorithm>
 #include <boost/format.hpp>
 #include <cmath>
 #include <cstdio>
+#include <deque>
+#include <exception>
+#include <future>
+#include <mutex>
+#include <numeric>
+#include <thread>
 TRAJOPT_IGNORE_WARNINGS_POP
 
 #include <trajopt_sco/expr_ops.hpp>
@@ -10,6 +17,7 @@ TRAJOPT_IGNORE_WARNINGS_POP
 #include <trajopt_sco/optimizers.hpp>
 #include <trajopt_sco/sco_common.hpp>
 #include <trajopt_sco/solver_interface.hpp>
+#include <trajopt_utils/clock.hpp>
 #include <trajopt_utils/logging.hpp>
 #include <trajopt_utils/macros.h>
 #include <trajopt_utils/stl_to_string.hpp>
@@ -49,6 +57,98 @@ static DblVec evaluateConstraintViols(const std::vector<ConstraintPtr>& constrai
   }
   return out;
 }
+/** @brief The contribution of each cost and then each constraint to the merit */
+static DblVec meritTerms(const DblVec& cost_vals, const DblVec& cnt_viols, double merit_coeff)
+{
+  DblVec out(cost_vals);
+  out.reserve(cost_vals.size() + cnt_viols.size());
+  for (double viol : cnt_viols)
+    out.push_back(merit_coeff * viol);
+  return out;
+}
+
+/** @brief The trust region blocks touched by each cost and then each constraint */
+static std::vector<IntVec> getTermBlocks(const std::vector<CostPtr>& costs,
+                                         const std::vector<ConstraintPtr>& constraints,
+                                         const IntVec& var_blocks)
+{
+  std::vector<VarVector> term_vars;
+  for (const CostPtr& cost : costs)
+    term_vars.push_back(cost->getVars());
+  for (const ConstraintPtr& cnt : constraints)
+    term_vars.push_back(cnt->getVars());
+
+  std::vector<IntVec> out(term_vars.size());
+  for (size_t i = 0; i < term_vars.size(); ++i)
+  {
+    for (const Var& var : term_vars[i])
+    {
+      // auxiliary variables are not part of any block
+      if (var.var_rep->index < static_cast<int>(var_blocks.size()))
+        out[i].push_back(var_blocks[static_cast<size_t>(var.var_rep->index)]);
+    }
+    std::sort(out[i].begin(), out[i].end());
+    out[i].erase(std::unique(out[i].begin(), out[i].end()), out[i].end());
+  }
+  return out;
+}
+
+/**
+ * @brief Evaluate the exact merit at x one term at a time, stopping once it exceeds reject_merit
+ *
+ * Terms are visited in decreasing order of their previous contribution to the merit, so a
+ * step which is going to be rejected usually is after only a few evaluations. Since all terms
+ * are nonnegative the partial sum is a lower bound on the merit. Terms which were not
+ * evaluated are set to NAN.
+ *
+ * @return The merit if all terms were evaluated, otherwise the partial merit which exceeded reject_merit
+ */
+static double evaluateMeritLazily(const std::vector<CostPtr>& costs,
+                                  const std::vector<ConstraintPtr>& constraints,
+                                  const DblVec& x,
+                                  const DblVec& old_cost_vals,
+                                  const DblVec& old_cnt_viols,
+                                  double merit_coeff,
+                                  double reject_merit,
+                                  DblVec& cost_vals,
+                                  DblVec& cnt_viols)
+{
+  DblVec old_merit_terms = meritTerms(old_cost_vals, old_cnt_viols, merit_coeff);
+
+  std::vector<size_t> order(old_merit_terms.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&old_merit_terms](size_t a, size_t b) {
+    return old_merit_terms[a] > old_merit_terms[b];
+  });
+
+  cost_vals.assign(costs.size(), NAN);
+  cnt_viols.assign(constraints.size(), NAN);
+  double merit = 0;
+  for (size_t k = 0; k < order.size(); ++k)
+  {
+    if (merit > reject_merit)
+    {
+      LOG_DEBUG(
+          "step rejected after evaluating %i of %i merit terms", static_cast<int>(k), static_cast<int>(order.size()));
+      break;
+    }
+
+    size_t i = order[k];
+    if (i < costs.size())
+    {
+      cost_vals[i] = costs[i]->value(x);
+      merit += cost_vals[i];
+    }
+    else
+    {
+      size_t j = i - costs.size();
+      cnt_viols[j] = constraints[j]->violation(x);
+      merit += merit_coeff * cnt_viols[j];
+    }
+  }
+  return merit;
+}
+
 static std::vector<ConvexObjectivePtr> convexifyCosts(const std::vector<CostPtr>& costs, const DblVec& x, Model* model)
 {
   std::vector<ConvexObjectivePtr> out(costs.size());
@@ -70,23 +170,20 @@ static std::vector<ConvexConstraintsPtr> convexifyConstraints(const std::vector<
   return out;
 }
 
-DblVec evaluateModelCosts(const std::vector<ConvexObjectivePtr>& costs, const DblVec& x)
+/** @brief Convexify the terms whose isThreadSafe() is thread_safe into their entries of out */
+template <typename TermPtr, typename ConvexPtr>
+static void convexifyTerms(const std::vector<TermPtr>& terms,
+                           const DblVec& x,
+                           Model* model,
+                           bool thread_safe,
+                           std::vector<ConvexPtr>& out)
 {
-  DblVec out(costs.size());
-  for (size_t i = 0; i < costs.size(); ++i)
+  out.resize(terms.size());
+  for (size_t i = 0; i < terms.size(); ++i)
   {
-    out[i] = costs[i]->value(x);
-  }
-  return out;
-}
-DblVec evaluateModelCntViols(const std::vector<ConvexConstraintsPtr>& cnts, const DblVec& x)
-{
-  DblVec out(cnts.size());
-  for (size_t i = 0; i < cnts.size(); ++i)
-  {
-    out[i] = cnts[i]->violation(x);
+    if (terms[i]->isThreadSafe() == thread_safe)
+      out[i] = terms[i]->convex(x, model);
   }
-  return out;
 }
 
 static std::vector<std::string> getCostNames(const std::vector<CostPtr>& costs)
@@ -222,6 +319,13 @@ BasicTrustRegionSQPParameters::BasicTrustRegionSQPParameters()
   max_time = INFINITY;
   merit_error_coeff = 10;
   trust_box_size = 1e-1;
+  lazy_merit_evaluation = false;
+  per_block_trust_region = false;
+  inexact_qp_solves = false;
+  max_qp_tolerance = 1e-2;
+  min_qp_tolerance = 1e-4;
+  speculative_trials = 1;
+  pipelined_convexification = false;
 }
 
 BasicTrustRegionSQP::BasicTrustRegionSQP() {}
@@ -230,9 +334,59 @@ void BasicTrustRegionSQP::setProblem(OptProbPtr prob)
 {
   Optimizer::setProblem(prob);
   model_ = prob->getModel();
+  model_clonable_ = true;
+}
+
+void BasicTrustRegionSQP::adjustTrustRegion(double ratio)
+{
+  param_.trust_box_size *= ratio;
+  for (double& size : trust_box_sizes_)
+    size *= ratio;
+}
+
+void BasicTrustRegionSQP::adjustBlockTrustRegions(const std::vector<IntVec>& term_blocks,
+                                                  const DblVec& old_merit_terms,
+                                                  const DblVec& model_merit_terms,
+                                                  const DblVec& new_merit_terms,
+                                                  bool accepted)
+{
+  DblVec approx_improve(trust_box_sizes_.size(), 0), exact_improve(trust_box_sizes_.size(), 0);
+  for (size_t i = 0; i < term_blocks.size(); ++i)
+  {
+    for (int block : term_blocks[i])
+    {
+      approx_improve[static_cast<size_t>(block)] += old_merit_terms[i] - model_merit_terms[i];
+      exact_improve[static_cast<size_t>(block)] += old_merit_terms[i] - new_merit_terms[i];
+    }
+  }
+
+  bool shrunk = false;
+  for (size_t b = 0; b < trust_box_sizes_.size(); ++b)
+  {
+    bool informative = approx_improve[b] > 1e-8 && !std::isnan(exact_improve[b]);
+    if (informative && exact_improve[b] / approx_improve[b] < param_.improve_ratio_threshold)
+    {
+      // this block's terms were poorly predicted
+      if (trust_box_sizes_[b] >= param_.min_trust_box_size)
+        shrunk = true;
+      trust_box_sizes_[b] *= param_.trust_shrink_ratio;
+    }
+    else if (accepted)
+    {
+      trust_box_sizes_[b] *= param_.trust_expand_ratio;
+    }
+  }
+
+  // if no block can be blamed for a rejected step, shrink all of them
+  if (!accepted && !shrunk)
+  {
+    for (double& size : trust_box_sizes_)
+      size *= param_.trust_shrink_ratio;
+  }
+
+  param_.trust_box_size = vecMax(trust_box_sizes_);
 }
 
-void BasicTrustRegionSQP::adjustTrustRegion(double ratio) { param_.trust_box_size *= ratio; }
 void BasicTrustRegionSQP::setTrustBoxConstraints(const DblVec& x)
 {
   const VarVector& vars = prob_->getVars();
@@ -241,12 +395,99 @@ void BasicTrustRegionSQP::setTrustBoxConstraints(const DblVec& x)
   DblVec lbtrust(x.size()), ubtrust(x.size());
   for (size_t i = 0; i < x.size(); ++i)
   {
-    lbtrust[i] = fmax(x[i] - param_.trust_box_size, lb[i]);
-    ubtrust[i] = fmin(x[i] + param_.trust_box_size, ub[i]);
+    double trust_box_size =
+        var_blocks_.empty() ? param_.trust_box_size : trust_box_sizes_[static_cast<size_t>(var_blocks_[i])];
+    lbtrust[i] = fmax(x[i] - trust_box_size, lb[i]);
+    ubtrust[i] = fmin(x[i] + trust_box_size, ub[i]);
   }
   model_->setVarBounds(vars, lbtrust, ubtrust);
 }
 
+void BasicTrustRegionSQP::setTrustBoxConstraints(const DblVec& x, Model& model, double trust_box_size)
+{
+  const VarVector& vars = prob_->getVars();
+  const DblVec &lb = prob_->getLowerBounds(), ub = prob_->getUpperBounds();
+  DblVec lbtrust(x.size()), ubtrust(x.size());
+  for (size_t i = 0; i < x.size(); ++i)
+  {
+    lbtrust[i] = fmax(x[i] - trust_box_size, lb[i]);
+    ubtrust[i] = fmin(x[i] + trust_box_size, ub[i]);
+  }
+  model.setVarBounds(vars, lbtrust, ubtrust);
+}
+
+double BasicTrustRegionSQP::subproblemTolerance(double trust_box_size, double last_approx_merit_improve) const
+{
+  if (!param_.inexact_qp_solves)
+    return 0;
+
+  // the subproblem only needs to be solved a fraction more accurately than the step it
+  // is allowed to take and the improvement it is expected to make
+  double qp_tolerance = 0.1 * fmin(trust_box_size, last_approx_merit_improve);
+  return fmin(fmax(qp_tolerance, param_.min_qp_tolerance), param_.max_qp_tolerance);
+}
+
+std::vector<BasicTrustRegionSQP::SpeculativeTrial>
+BasicTrustRegionSQP::solveSpeculativeTrials(const DblVec& x, int n_trials, double last_approx_merit_improve)
+{
+  // drop the variables of discarded convexifications, so the copies have the same variables as model_
+  model_->update();
+
+  std::vector<SpeculativeTrial> trials;
+  std::vector<ModelPtr> models;
+  double trust_box_size = param_.trust_box_size;
+  for (int i = 0; i < n_trials && trust_box_size >= param_.min_trust_box_size; ++i)
+  {
+    ModelPtr model = model_->clone();
+    if (!model)
+    {
+      LOG_WARN("the convex solver cannot copy its model, speculative trials are disabled");
+      model_clonable_ = false;
+      return std::vector<SpeculativeTrial>();
+    }
+
+    double qp_tolerance = subproblemTolerance(trust_box_size, last_approx_merit_improve);
+    if (param_.inexact_qp_solves)
+      model->setTolerance(qp_tolerance, qp_tolerance <= param_.min_qp_tolerance);
+    setTrustBoxConstraints(x, *model, trust_box_size);
+    models.push_back(model);
+    trials.push_back({ trust_box_size, qp_tolerance, CVX_FAILED, DblVec() });
+    trust_box_size *= param_.trust_shrink_ratio;
+  }
+
+  // model_ is left untouched while the copies are solved, they only read its variables
+  std::exception_ptr error;
+  std::mutex error_mutex;
+  auto solve = [&](size_t i) {
+    try
+    {
+      trials[i].status = models[i]->optimize();
+      if (trials[i].status == CVX_SOLVED)
+        trials[i].model_var_vals = models[i]->getVarValues(model_->getVars());
+    }
+    catch (...)
+    {
+      std::lock_guard<std::mutex> lock(error_mutex);
+      if (!error)
+        error = std::current_exception();
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < trials.size(); ++i)
+    threads.emplace_back(solve, i);
+  if (!trials.empty())
+    solve(0);
+  for (std::thread& t : threads)
+    t.join();
+
+  if (error)
+    std::rethrow_exception(error);
+
+  results_.n_qp_solves += static_cast<int>(trials.size());
+  return trials;
+}
+
 #if 0
 struct MultiCritFilter {
   /**
@@ -286,6 +527,32 @@ OptStatus BasicTrustRegionSQP::optimize()
   assert(prob_->getCosts().size() > 0 || constraints.size() > 0);
 
   OptStatus retval = INVALID;
+  double last_approx_merit_improve = INFINITY;
+  double start_time = util::GetClock();
+
+  // Convexification of the last iteration. After a penalty increase the next iteration starts from the same point,
+  // so it is kept instead of convexifying every term again.
+  DblVec convexified_x;
+  double convexified_merit_coeff = param_.merit_error_coeff;
+  std::vector<ConvexObjectivePtr> cost_models;
+  std::vector<ConvexConstraintsPtr> cnt_models;
+  std::vector<ConvexObjectivePtr> cnt_cost_models;
+
+  // convexification at the last accepted point, made while its exact merit was evaluated
+  DblVec pipelined_x;
+  std::vector<ConvexObjectivePtr> pipelined_cost_models;
+  std::vector<ConvexConstraintsPtr> pipelined_cnt_models;
+
+  var_blocks_.clear();
+  trust_box_sizes_.clear();
+  std::vector<IntVec> term_blocks;
+  if (param_.per_block_trust_region && !prob_->getTrustRegionBlocks().empty())
+  {
+    var_blocks_ = prob_->getTrustRegionBlocks();
+    trust_box_sizes_.assign(static_cast<size_t>(*std::max_element(var_blocks_.begin(), var_blocks_.end()) + 1),
+                            param_.trust_box_size);
+    term_blocks = getTermBlocks(prob_->getCosts(), constraints, var_blocks_);
+  }
 
   for (int merit_increases = 0; merit_increases < param_.max_merit_coeff_increases; ++merit_increases)
   { /* merit adjustment loop */
@@ -306,6 +573,14 @@ OptStatus BasicTrustRegionSQP::optimize()
         ++results_.n_func_evals;
       }
 
+      // checked after the first evaluation so the results always hold the values of the returned point
+      if (util::GetClock() - start_time > param_.max_time)
+      {
+        LOG_INFO("time limit");
+        retval = OPT_TIME_LIMIT;
+        goto cleanup;
+      }
+
       // DblVec new_cnt_viols = evaluateConstraintViols(constraints, results_.x);
       // DblVec new_cost_vals = evaluateCosts(prob_->getCosts(), results_.x);
       // cout << "costs" << endl;
@@ -318,23 +593,63 @@ OptStatus BasicTrustRegionSQP::optimize()
       //   results_.cost_vals[i] << endl;
       // }
 
-      std::vector<ConvexObjectivePtr> cost_models = convexifyCosts(prob_->getCosts(), results_.x, model_.get());
-      std::vector<ConvexConstraintsPtr> cnt_models = convexifyConstraints(constraints, results_.x, model_.get());
-      std::vector<ConvexObjectivePtr> cnt_cost_models = cntsToCosts(cnt_models, param_.merit_error_coeff, model_.get());
-      model_->update();
-      for (ConvexObjectivePtr& cost : cost_models)
-        cost->addConstraintsToModel();
-      for (ConvexObjectivePtr& cost : cnt_cost_models)
-        cost->addConstraintsToModel();
-      model_->update();
+      if (!convexified_x.empty() && convexified_x == results_.x)
+      {
+        // Only the penalty coefficient changed since the last iteration, and the penalties are linear in it
+        double ratio = param_.merit_error_coeff / convexified_merit_coeff;
+        for (ConvexObjectivePtr& co : cnt_cost_models)
+          exprScale(co->quad_, ratio);
+        model_->update();
+        LOG_DEBUG("reusing the convexification at the current iterate, penalties scaled by %.3e", ratio);
+      }
+      else
+      {
+        cost_models.clear();
+        cnt_models.clear();
+        cnt_cost_models.clear();
+        if (!pipelined_x.empty() && pipelined_x == results_.x)
+        {
+          cost_models.swap(pipelined_cost_models);
+          cnt_models.swap(pipelined_cnt_models);
+        }
+        else
+        {
+          cost_models = convexifyCosts(prob_->getCosts(), results_.x, model_.get());
+          cnt_models = convexifyConstraints(constraints, results_.x, model_.get());
+        }
+        cnt_cost_models = cntsToCosts(cnt_models, param_.merit_error_coeff, model_.get());
+        model_->update();
+        for (ConvexObjectivePtr& cost : cost_models)
+          cost->addConstraintsToModel();
+        for (ConvexObjectivePtr& cost : cnt_cost_models)
+          cost->addConstraintsToModel();
+        model_->update();
+      }
+      pipelined_x.clear();
+      pipelined_cost_models.clear();
+      pipelined_cnt_models.clear();
+      convexified_x = results_.x;
+      convexified_merit_coeff = param_.merit_error_coeff;
+
       QuadExpr objective;
+      LeastSquaresExpr lsq_objective;
       for (ConvexObjectivePtr& co : cost_models)
+      {
         exprInc(objective, co->quad_);
+        lsq_objective.exprs.insert(lsq_objective.exprs.end(), co->lsq_.exprs.begin(), co->lsq_.exprs.end());
+        lsq_objective.weights.insert(lsq_objective.weights.end(), co->lsq_.weights.begin(), co->lsq_.weights.end());
+      }
       for (ConvexObjectivePtr& co : cnt_cost_models)
         exprInc(objective, co->quad_);
 
       //    objective = cleanupExpr(objective);
-      model_->setObjective(objective);
+      if (lsq_objective.size() > 0)
+        model_->setLeastSquaresObjective(objective, lsq_objective);
+      else
+        model_->setObjective(objective);
+
+      // The model is not updated again until the next convexification, so the variable indices stay valid
+      ConvexModelEvaluator model_evaluator(cost_models, cnt_models);
 
       //    if (logging::filter() >= IPI_LEVEL_DEBUG) {
       //      DblVec model_cost_vals;
@@ -345,11 +660,57 @@ OptStatus BasicTrustRegionSQP::optimize()
       //      printer(model_cost_vals), printer(cost_vals));
       //    }
 
+      std::deque<SpeculativeTrial> speculative_trials;  // solved ahead for the next shrunk trust regions
+      bool rejected = false;
       while (param_.trust_box_size >= param_.min_trust_box_size)
       {
-        setTrustBoxConstraints(results_.x);
-        CvxOptStatus status = model_->optimize();
-        ++results_.n_qp_solves;
+        if (rejected && util::GetClock() - start_time > param_.max_time)
+        {
+          LOG_INFO("time limit while shrinking the trust region");
+          retval = OPT_TIME_LIMIT;
+          goto cleanup;
+        }
+
+        if (!speculative_trials.empty() &&
+            fabs(speculative_trials.front().trust_box_size - param_.trust_box_size) > 1e-9 * param_.trust_box_size)
+          speculative_trials.clear();
+
+        if (speculative_trials.empty() && rejected && param_.speculative_trials > 1 && trust_box_sizes_.empty() &&
+            model_clonable_)
+        {
+          std::vector<SpeculativeTrial> trials =
+              solveSpeculativeTrials(results_.x, param_.speculative_trials, last_approx_merit_improve);
+          speculative_trials.assign(trials.begin(), trials.end());
+        }
+
+        double qp_tolerance;
+        CvxOptStatus status;
+        DblVec model_var_vals;
+        if (!speculative_trials.empty())
+        {
+          LOG_DEBUG("using the speculative solve for trust region size %.4f", param_.trust_box_size);
+          qp_tolerance = speculative_trials.front().qp_tolerance;
+          status = speculative_trials.front().status;
+          model_var_vals = speculative_trials.front().model_var_vals;
+          speculative_trials.pop_front();
+        }
+        else
+        {
+          setTrustBoxConstraints(results_.x);
+
+          qp_tolerance = subproblemTolerance(param_.trust_box_size, last_approx_merit_improve);
+          if (param_.inexact_qp_solves)
+          {
+            model_->setTolerance(qp_tolerance, qp_tolerance <= param_.min_qp_tolerance);
+            LOG_DEBUG("convex subproblem tolerance: %.2e", qp_tolerance);
+          }
+
+          status = model_->optimize();
+          ++results_.n_qp_solves;
+          if (status == CVX_SOLVED)
+            model_var_vals = model_->getVarValues(model_->getVars());
+        }
+
         if (status != CVX_SOLVED)
         {
           LOG_ERROR("convex solver failed! set TRAJOPT_LOG_THRESH=DEBUG to see "
@@ -360,34 +721,80 @@ OptStatus BasicTrustRegionSQP::optimize()
           retval = OPT_FAILED;
           goto cleanup;
         }
-        DblVec model_var_vals = model_->getVarValues(model_->getVars());
 
-        DblVec model_cost_vals = evaluateModelCosts(cost_models, model_var_vals);
-        DblVec model_cnt_viols = evaluateModelCntViols(cnt_models, model_var_vals);
+        DblVec model_cost_vals, model_cnt_viols;
+        model_evaluator.evaluate(model_var_vals, model_cost_vals, model_cnt_viols);
 
         // the n variables of the OptProb happen to be the first n variables in
         // the Model
         DblVec new_x(model_var_vals.begin(), model_var_vals.begin() + static_cast<long int>(results_.x.size()));
 
-        if (util::GetLogLevel() >= util::LevelDebug)
+        double old_merit = vecSum(results_.cost_vals) + param_.merit_error_coeff * vecSum(results_.cnt_viols);
+        double model_merit = vecSum(model_cost_vals) + param_.merit_error_coeff * vecSum(model_cnt_viols);
+        double approx_merit_improve = old_merit - model_merit;
+        last_approx_merit_improve = approx_merit_improve;
+
+        if (qp_tolerance > param_.min_qp_tolerance &&
+            (approx_merit_improve < param_.min_approx_improve ||
+             approx_merit_improve / old_merit < param_.min_approx_improve_frac))
+        {
+          // don't report convergence based on an inexact subproblem solution
+          LOG_INFO("small improvement with inexact subproblem, solving again to tolerance %.2e",
+                   param_.min_qp_tolerance);
+          last_approx_merit_improve = 0;
+          speculative_trials.clear();
+          continue;
+        }
+
+        // The convexification only adds variables to the model, which is not used again until the step is decided.
+        // Steps which are going to be reported as converged are never accepted, so they are not convexified. Only the
+        // thread safe terms are convexified while the trial point is evaluated, the others once the step is accepted,
+        // so a rejection only discards work which overlapped the evaluation.
+        bool pipelining = param_.pipelined_convexification && approx_merit_improve >= param_.min_approx_improve &&
+                          approx_merit_improve / old_merit >= param_.min_approx_improve_frac;
+        std::future<void> pipelined;
+        if (pipelining)
         {
-          DblVec cnt_costs1 = evaluateModelCosts(cnt_cost_models, model_var_vals);
-          DblVec cnt_costs2 = model_cnt_viols;
-          for (unsigned i = 0; i < cnt_costs2.size(); ++i)
-            cnt_costs2[i] *= param_.merit_error_coeff;
-          LOG_DEBUG("SHOULD BE ALMOST THE SAME: %s ?= %s", CSTR(cnt_costs1), CSTR(cnt_costs2));
-          // not exactly the same because cnt_costs1 is based on aux variables,
-          // but they might not be at EXACTLY the right value
+          pipelined = std::async(std::launch::async, [&]() {
+            convexifyTerms(prob_->getCosts(), new_x, model_.get(), true, pipelined_cost_models);
+            convexifyTerms(constraints, new_x, model_.get(), true, pipelined_cnt_models);
+          });
         }
 
-        DblVec new_cost_vals = evaluateCosts(prob_->getCosts(), new_x);
-        DblVec new_cnt_viols = evaluateConstraintViols(constraints, new_x);
+        DblVec new_cost_vals, new_cnt_viols;
+        double new_merit;
+        if (param_.lazy_merit_evaluation)
+        {
+          // Any merit above this is rejected below. If the step is going to be reported as
+          // converged it is never accepted, so nothing needs to be evaluated.
+          double reject_merit = old_merit - fmax(param_.improve_ratio_threshold, 0.0) * approx_merit_improve;
+          if (approx_merit_improve < param_.min_approx_improve ||
+              approx_merit_improve / old_merit < param_.min_approx_improve_frac)
+            reject_merit = -INFINITY;
+
+          new_merit = evaluateMeritLazily(prob_->getCosts(),
+                                          constraints,
+                                          new_x,
+                                          results_.cost_vals,
+                                          results_.cnt_viols,
+                                          param_.merit_error_coeff,
+                                          reject_merit,
+                                          new_cost_vals,
+                                          new_cnt_viols);
+        }
+        else
+        {
+          new_cost_vals = evaluateCosts(prob_->getCosts(), new_x);
+          new_cnt_viols = evaluateConstraintViols(constraints, new_x);
+          new_merit = vecSum(new_cost_vals) + param_.merit_error_coeff * vecSum(new_cnt_viols);
+        }
         ++results_.n_func_evals;
 
-        double old_merit = vecSum(results_.cost_vals) + param_.merit_error_coeff * vecSum(results_.cnt_viols);
-        double model_merit = vecSum(model_cost_vals) + param_.merit_error_coeff * vecSum(model_cnt_viols);
-        double new_merit = vecSum(new_cost_vals) + param_.merit_error_coeff * vecSum(new_cnt_viols);
-        double approx_merit_improve = old_merit - model_merit;
+        if (pipelining)
+        {
+          pipelined.get();
+        }
+
         double exact_merit_improve = old_merit - new_merit;
         double merit_improve_ratio = exact_merit_improve / approx_merit_improve;
 
@@ -434,15 +841,41 @@ OptStatus BasicTrustRegionSQP::optimize()
         }
         else if (exact_merit_improve < 0 || merit_improve_ratio < param_.improve_ratio_threshold)
         {
-          adjustTrustRegion(param_.trust_shrink_ratio);
+          if (trust_box_sizes_.empty())
+            adjustTrustRegion(param_.trust_shrink_ratio);
+          else
+            adjustBlockTrustRegions(term_blocks,
+                                    meritTerms(results_.cost_vals, results_.cnt_viols, param_.merit_error_coeff),
+                                    meritTerms(model_cost_vals, model_cnt_viols, param_.merit_error_coeff),
+                                    meritTerms(new_cost_vals, new_cnt_viols, param_.merit_error_coeff),
+                                    false);
           LOG_INFO("shrunk trust region. new box size: %.4f", param_.trust_box_size);
+          rejected = true;
+
+          // the speculative convexification is removed from the model again
+          pipelined_x.clear();
+          pipelined_cost_models.clear();
+          pipelined_cnt_models.clear();
         }
         else
         {
+          if (trust_box_sizes_.empty())
+            adjustTrustRegion(param_.trust_expand_ratio);
+          else
+            adjustBlockTrustRegions(term_blocks,
+                                    meritTerms(results_.cost_vals, results_.cnt_viols, param_.merit_error_coeff),
+                                    meritTerms(model_cost_vals, model_cnt_viols, param_.merit_error_coeff),
+                                    meritTerms(new_cost_vals, new_cnt_viols, param_.merit_error_coeff),
+                                    true);
+          if (pipelining)
+          {
+            convexifyTerms(prob_->getCosts(), new_x, model_.get(), false, pipelined_cost_models);
+            convexifyTerms(constraints, new_x, model_.get(), false, pipelined_cnt_models);
+            pipelined_x = new_x;
+          }
           results_.x = new_x;
           results_.cost_vals = new_cost_vals;
           results_.cnt_viols = new_cnt_viols;
-          adjustTrustRegion(param_.trust_expand_ratio);
           LOG_INFO("expanded trust region. new box size: %.4f", param_.trust_box_size);
           break;
         }
@@ -474,6 +907,8 @@ OptStatus BasicTrustRegionSQP::optimize()
       LOG_INFO("not all constraints are satisfied. increasing penalties");
       param_.merit_error_coeff *= param_.merit_coeff_increase_ratio;
       param_.trust_box_size = fmax(param_.trust_box_size, param_.min_trust_box_size / param_.trust_shrink_ratio * 1.5);
+      for (double& size : trust_box_sizes_)
+        size = fmax(size, param_.min_trust_box_size / param_.trust_shrink_ratio * 1.5);
     }
   }
   retval = OPT_PENALTY_ITERATION_LIMIT;
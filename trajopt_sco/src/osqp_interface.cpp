@@ -15,6 +15,8 @@ TRAJOPT_IGNORE_WARNINGS_POP
 namespace sco
 {
 double OSQP_INFINITY = std::numeric_limits<double>::infinity();
+const double OSQP_EPS_ABS = 1e-4;
+const double OSQP_EPS_REL = 1e-6;
 
 ModelPtr createOSQPModel()
 {
@@ -28,8 +30,8 @@ OSQPModel::OSQPModel()
   // see https://osqp.org/docs/interfaces/solver_settings.html#solver-settings
   osqp_set_default_settings(&osqp_settings_);
   // tuning parameters to be less accurate, but add a polishing step
-  osqp_settings_.eps_abs = 1e-4;
-  osqp_settings_.eps_rel = 1e-6;
+  osqp_settings_.eps_abs = OSQP_EPS_ABS;
+  osqp_settings_.eps_rel = OSQP_EPS_REL;
   osqp_settings_.max_iter = 8192;
   osqp_settings_.polish = 1;
 
@@ -101,6 +103,14 @@ void OSQPModel::updateObjective()
 
   Eigen::SparseMatrix<double> sm;
   exprToEigen(objective_, sm, q_, n, true);
+  if (lsq_objective_.size() > 0)
+  {
+    Eigen::SparseMatrix<double> lsq_sm;
+    Eigen::VectorXd lsq_q;
+    exprToEigen(lsq_objective_, lsq_sm, lsq_q, n);
+    sm += lsq_sm;
+    q_ += lsq_q;
+  }
   eigenToCSC(sm, P_row_indices_, P_column_pointers_, P_csc_data_);
 
   if (osqp_data_.P != nullptr)
@@ -259,11 +269,59 @@ CvxOptStatus OSQPModel::optimize()
   }
   return CVX_FAILED;
 }
-void OSQPModel::setObjective(const AffExpr& expr) { objective_.affexpr = expr; }
-void OSQPModel::setObjective(const QuadExpr& expr) { objective_ = expr; }
+void OSQPModel::setTolerance(double tolerance, bool polish)
+{
+  // The workspace is set up again on each call to optimize, so updating the settings is enough
+  if (tolerance > 0)
+  {
+    osqp_settings_.eps_abs = tolerance;
+    osqp_settings_.eps_rel = tolerance * OSQP_EPS_REL / OSQP_EPS_ABS;
+    osqp_settings_.polish = polish;
+  }
+  else
+  {
+    osqp_settings_.eps_abs = OSQP_EPS_ABS;
+    osqp_settings_.eps_rel = OSQP_EPS_REL;
+    osqp_settings_.polish = 1;
+  }
+}
+
+void OSQPModel::setObjective(const AffExpr& expr)
+{
+  objective_.affexpr = expr;
+  lsq_objective_ = LeastSquaresExpr();
+}
+void OSQPModel::setObjective(const QuadExpr& expr)
+{
+  objective_ = expr;
+  lsq_objective_ = LeastSquaresExpr();
+}
+void OSQPModel::setLeastSquaresObjective(const QuadExpr& quad, const LeastSquaresExpr& lsq)
+{
+  objective_ = quad;
+  lsq_objective_ = lsq;
+}
 void OSQPModel::writeToFile(const std::string& /*fname*/)
 {
   return;  // NOT IMPLEMENTED
 }
 VarVector OSQPModel::getVars() const { return vars_; }
+
+ModelPtr OSQPModel::clone() const
+{
+  std::shared_ptr<OSQPModel> out(new OSQPModel(*this));
+
+  // The copy sets up its own OSQP data and workspace on its first solve
+  out->osqp_data_.A = nullptr;
+  out->osqp_data_.P = nullptr;
+  out->osqp_workspace_ = nullptr;
+  out->solution_.clear();
+
+  // The expressions keep referring to the variables of this model, they are only used through their indices
+  for (Var& var : out->vars_)
+    var = Var(new VarRep(var.var_rep->index, var.var_rep->name, out.get()));
+  for (Cnt& cnt : out->cnts_)
+    cnt = Cnt(new CntRep(cnt.cnt_rep->index, out.get()));
+  return out;
+}
 }
@@ -33,6 +33,7 @@ qpOASESModel::qpOASESModel()
   // enable regularisation to deal with degenerate Hessians
   qpoases_options_.enableRegularisation = qpOASES::BT_TRUE;
   qpoases_options_.ensureConsistency();
+  default_termination_tolerance_ = qpoases_options_.terminationTolerance;
 }
 
 qpOASESModel::~qpOASESModel() {}
@@ -86,6 +87,14 @@ void qpOASESModel::updateObjective()
 
   Eigen::SparseMatrix<double> sm;
   exprToEigen(objective_, sm, g_, n, true, true);
+  if (lsq_objective_.size() > 0)
+  {
+    Eigen::SparseMatrix<double> lsq_sm;
+    Eigen::VectorXd lsq_g;
+    exprToEigen(lsq_objective_, lsq_sm, lsq_g, n);
+    sm += lsq_sm;
+    g_ += lsq_g;
+  }
   eigenToCSC(sm, H_row_indices_, H_column_pointers_, H_csc_data_);
 
   H_ = SymSparseMat(vars_.size(), vars_.size(), H_row_indices_.data(), H_column_pointers_.data(), H_csc_data_.data());
@@ -241,8 +250,34 @@ CvxOptStatus qpOASESModel::optimize()
     return CVX_FAILED;
   }
 }
-void qpOASESModel::setObjective(const AffExpr& expr) { objective_.affexpr = expr; }
-void qpOASESModel::setObjective(const QuadExpr& expr) { objective_ = expr; }
+void qpOASESModel::setTolerance(double tolerance, bool /*polish*/)
+{
+  // The homotopy termination tolerance is much tighter than the residual tolerance of first
+  // order methods, so the request is scaled down, but never below the MPC default
+  if (tolerance > 0)
+    qpoases_options_.terminationTolerance = std::fmax(default_termination_tolerance_, 1e-3 * tolerance);
+  else
+    qpoases_options_.terminationTolerance = default_termination_tolerance_;
+
+  if (qpoases_problem_)
+    qpoases_problem_->setOptions(qpoases_options_);
+}
+
+void qpOASESModel::setObjective(const AffExpr& expr)
+{
+  objective_.affexpr = expr;
+  lsq_objective_ = LeastSquaresExpr();
+}
+void qpOASESModel::setObjective(const QuadExpr& expr)
+{
+  objective_ = expr;
+  lsq_objective_ = LeastSquaresExpr();
+}
+void qpOASESModel::setLeastSquaresObjective(const QuadExpr& quad, const LeastSquaresExpr& lsq)
+{
+  objective_ = quad;
+  lsq_objective_ = lsq;
+}
 void qpOASESModel::writeToFile(const std::string& /*fname*/)
 {
   return;  // NOT IMPLEMENTED
@@ -6,12 +6,16 @@ TRAJOPT_IGNORE_WARNINGS_PUSH
 #include <sstream>
 TRAJOPT_IGNORE_WARNINGS_POP
 
+#include <trajopt_sco/autotuned_interface.hpp>
+#include <trajopt_sco/expr_ops.hpp>
 #include <trajopt_sco/solver_interface.hpp>
 #include <trajopt_utils/macros.h>
 
 namespace sco
 {
-const std::vector<std::string> ModelType::MODEL_NAMES_ = { "GUROBI", "BPMPD", "OSQP", "QPOASES", "AUTO_SOLVER" };
+const std::vector<std::string> ModelType::MODEL_NAMES_ = {
+  "GUROBI", "BPMPD", "OSQP", "QPOASES", "AUTO_SOLVER", "AUTO_TUNED"
+};
 
 IntVec vars2inds(const VarVector& vars)
 {
@@ -85,6 +89,17 @@ double QuadExpr::value(const double* x) const
   return out;
 }
 
+double LeastSquaresExpr::value(const DblVec& x) const
+{
+  double out = 0;
+  for (size_t i = 0; i < size(); ++i)
+  {
+    double val = exprs[i].value(x);
+    out += weights[i] * val * val;
+  }
+  return out;
+}
+
 Var Model::addVar(const std::string& name, double lb, double ub)
 {
   Var v = addVar(name);
@@ -115,6 +130,20 @@ void Model::setVarBounds(const Var& var, double lower, double upper)
   setVarBounds(vars, lowers, uppers);
 }
 
+void Model::setTolerance(double /*tolerance*/, bool /*polish*/) {}
+ModelPtr Model::clone() const { return nullptr; }
+void Model::setLeastSquaresObjective(const QuadExpr& quad, const LeastSquaresExpr& lsq)
+{
+  QuadExpr objective = quad;
+  for (size_t i = 0; i < lsq.size(); ++i)
+  {
+    QuadExpr square = exprSquare(lsq.exprs[i]);
+    exprScale(square, lsq.weights[i]);
+    exprInc(objective, square);
+  }
+  setObjective(objective);
+}
+
 std::ostream& operator<<(std::ostream& o, const Var& v)
 {
   if (v.var_rep != nullptr)
@@ -264,6 +293,14 @@ ModelPtr createModel(ModelType model_type)
     }
   }
 
+  if (solver == ModelType::AUTO_TUNED)
+  {
+    std::vector<ModelType> available_solvers = availableSolvers();
+    if (available_solvers.size() > 1)
+      return ModelPtr(new AutoTunedModel(available_solvers));
+    solver = available_solvers[0];
+  }
+
 #ifndef HAVE_GUROBI
   if (solver == ModelType::GUROBI)
     PRINT_AND_THROW("you didn't build with GUROBI support");
@@ -79,6 +79,45 @@ void exprToEigen(const QuadExpr& expr,
       sparse_matrix.coeffRef(k, k) += 0.0;
 }
 
+void exprToEigen(const LeastSquaresExpr& expr,
+                 Eigen::SparseMatrix<double>& sparse_matrix,
+                 Eigen::VectorXd& vector,
+                 const int& n_vars)
+{
+  const long int n_rows = static_cast<long int>(expr.size());
+  typedef Eigen::Triplet<double> T;
+  std::vector<T, Eigen::aligned_allocator<T>> triplets;
+  Eigen::VectorXd weighted_residual(n_rows);
+  Eigen::VectorXd weights(n_rows);
+  for (long int i = 0; i < n_rows; ++i)
+  {
+    const AffExpr& row = expr.exprs[static_cast<size_t>(i)];
+    for (size_t j = 0; j < row.size(); ++j)
+    {
+      int j_var_index = row.vars[j].var_rep->index;
+      if (j_var_index >= n_vars)
+      {
+        std::stringstream msg;
+        msg << "Coefficient " << j << " of row " << i << " has index " << j_var_index << " but n_vars is " << n_vars;
+        throw std::runtime_error(msg.str());
+      }
+      if (row.coeffs[j] != 0.)
+        triplets.push_back(T(static_cast<int>(i), j_var_index, row.coeffs[j]));
+    }
+    weights[i] = expr.weights[static_cast<size_t>(i)];
+    weighted_residual[i] = weights[i] * row.constant;
+  }
+
+  // duplicate triplets are summed
+  Eigen::SparseMatrix<double> jac(n_rows, n_vars);
+  jac.setFromTriplets(triplets.begin(), triplets.end());
+  Eigen::SparseMatrix<double> jac_t = jac.transpose();
+  Eigen::SparseMatrix<double> weighted_jac = weights.asDiagonal() * jac;
+
+  sparse_matrix = 2 * jac_t * weighted_jac;
+  vector = 2 * jac_t * weighted_residual;
+}
+
 void exprToEigen(const AffExprVector& expr_vec,
                  Eigen::SparseMatrix<double>& sparse_matrix,
                  Eigen::VectorXd& vector,
@@ -2,10 +2,12 @@
 TRAJOPT_IGNORE_WARNINGS_PUSH
 #include <Eigen/Dense>
 #include <boost/format.hpp>
+#include <chrono>
 #include <cmath>
 #include <gtest/gtest.h>
 #include <iostream>
 #include <sstream>
+#include <thread>
 TRAJOPT_IGNORE_WARNINGS_POP
 
 #include <trajopt_sco/expr_op_overloads.hpp>
@@ -47,6 +49,28 @@ void expectAllNear(const DblVec& x, const DblVec& y, double abstol)
     EXPECT_NEAR(x[i], y[i], abstol);
 }
 
+/** @brief Cost from a function which counts how often it is evaluated and convexified */
+class CountingCost : public CostFromFunc
+{
+public:
+  CountingCost(ScalarOfVectorPtr f, const VarVector& vars, const std::string& name)
+    : CostFromFunc(f, vars, name, true), n_values(0), n_convex(0)
+  {
+  }
+  double value(const DblVec& x) override
+  {
+    ++n_values;
+    return CostFromFunc::value(x);
+  }
+  ConvexObjectivePtr convex(const DblVec& x, Model* model) override
+  {
+    ++n_convex;
+    return CostFromFunc::convex(x, model);
+  }
+  int n_values;
+  int n_convex;
+};
+
 double f_QuadraticSeparable(const VectorXd& x) { return x(0) * x(0) + sq(x(1) - 1) + sq(x(2) - 2); }
 TEST_P(SQP, QuadraticSeparable)
 {
@@ -83,6 +107,331 @@ TEST_P(SQP, QuadraticNonseparable)
   expectAllNear(solver.x(), { 1, 7, 2 }, .01);
   // todo: checks on number of iterations and function evaluates
 }
+TEST_P(SQP, QuadraticNonseparableLazyMerit)
+{
+  // rejected steps may skip cost evaluations, but the solution should not change
+  OptProbPtr prob;
+  setupProblem(prob, 3, GetParam());
+  prob->addCost(
+      CostPtr(new CostFromFunc(ScalarOfVector::construct(&f_QuadraticNonseparable), prob->getVars(), "f", true)));
+  prob->addCost(
+      CostPtr(new CostFromFunc(ScalarOfVector::construct(&f_QuadraticSeparable), prob->getVars(), "g", true)));
+  BasicTrustRegionSQP solver(prob);
+  BasicTrustRegionSQPParameters& params = solver.getParameters();
+  params.trust_box_size = 100;
+  params.min_trust_box_size = 1e-5;
+  params.min_approx_improve = 1e-6;
+  params.lazy_merit_evaluation = true;
+  DblVec x = { 3, 4, 5 };
+  solver.initialize(x);
+  OptStatus status = solver.optimize();
+  ASSERT_EQ(status, OPT_CONVERGED);
+  expectAllNear(solver.x(), { 0.107, 1.786, 0.821 }, .01);
+}
+double f_DoubleWell(const VectorXd& x) { return sq(sq(x(0)) - 4); }
+double f_SmallQuadratic(const VectorXd& x) { return sq(x(1)); }
+TEST_P(SQP, LazyMeritSkipsTermsOfRejectedSteps)
+{
+  // the double well is concave at the start, so the first steps go to the edge of the trust region and the
+  // double well alone is enough to reject them
+  OptProbPtr prob;
+  setupProblem(prob, 2, GetParam());
+  CountingCost* well = new CountingCost(ScalarOfVector::construct(&f_DoubleWell), prob->getVars(), "well");
+  CountingCost* small = new CountingCost(ScalarOfVector::construct(&f_SmallQuadratic), prob->getVars(), "small");
+  prob->addCost(CostPtr(well));
+  prob->addCost(CostPtr(small));
+  BasicTrustRegionSQP solver(prob);
+  BasicTrustRegionSQPParameters& params = solver.getParameters();
+  params.trust_box_size = 100;
+  params.min_trust_box_size = 1e-5;
+  params.min_approx_improve = 1e-6;
+  params.lazy_merit_evaluation = true;
+  DblVec x = { 0.5, 0.01 };
+  solver.initialize(x);
+  OptStatus status = solver.optimize();
+  ASSERT_EQ(status, OPT_CONVERGED);
+  expectAllNear(solver.x(), { 2, 0 }, .01);
+  EXPECT_LE(well->n_values, solver.results().n_func_evals);
+  EXPECT_LT(small->n_values, well->n_values);
+}
+TEST_P(SQP, SpeculativeTrialsMatchSerialShrinking)
+{
+  // without copies of the model the trials are disabled and the serial shrinking is all that runs
+  if (!createModel(GetParam())->clone())
+    return;
+
+  // the first steps are rejected, so the shrunk trust regions are solved ahead on copies of the model
+  std::vector<OptResults> results;
+  for (int speculative_trials : { 1, 3 })
+  {
+    OptProbPtr prob;
+    setupProblem(prob, 2, GetParam());
+    prob->addCost(CostPtr(new CostFromFunc(ScalarOfVector::construct(&f_DoubleWell), prob->getVars(), "well", true)));
+    prob->addCost(
+        CostPtr(new CostFromFunc(ScalarOfVector::construct(&f_SmallQuadratic), prob->getVars(), "small", true)));
+    BasicTrustRegionSQP solver(prob);
+    BasicTrustRegionSQPParameters& params = solver.getParameters();
+    params.trust_box_size = 100;
+    params.min_trust_box_size = 1e-5;
+    params.min_approx_improve = 1e-6;
+    params.speculative_trials = speculative_trials;
+    solver.initialize({ 0.5, 0.01 });
+    ASSERT_EQ(solver.optimize(), OPT_CONVERGED);
+    results.push_back(solver.results());
+  }
+
+  // the accepted steps are the ones the serial shrinking finds, only more subproblems are solved
+  expectAllNear(results[1].x, results[0].x, 1e-6);
+  expectAllNear(results[1].cost_vals, results[0].cost_vals, 1e-6);
+  EXPECT_EQ(results[1].n_func_evals, results[0].n_func_evals);
+  EXPECT_GT(results[1].n_qp_solves, results[0].n_qp_solves);
+}
+VectorXd g_FirstIsOne(const VectorXd& x)
+{
+  VectorXd out(1);
+  out(0) = x(0) - 1;
+  return out;
+}
+VectorXd g_SecondAtMostZero(const VectorXd& x)
+{
+  VectorXd out(1);
+  out(0) = x(1);
+  return out;
+}
+TEST_P(SQP, MeritIncreaseReusesConvexification)
+{
+  // the constraint is ignored at the low initial penalty, so the penalty is increased several times at the same point
+  OptProbPtr prob;
+  setupProblem(prob, 3, GetParam());
+  CountingCost* f = new CountingCost(ScalarOfVector::construct(&f_QuadraticSeparable), prob->getVars(), "f");
+  prob->addCost(CostPtr(f));
+  prob->addConstraint(ConstraintPtr(
+      new ConstraintFromErrFunc(VectorOfVector::construct(&g_FirstIsOne), prob->getVars(), VectorXd(), EQ, "g")));
+  BasicTrustRegionSQP solver(prob);
+  BasicTrustRegionSQPParameters& params = solver.getParameters();
+  params.min_trust_box_size = 1e-5;
+  params.min_approx_improve = 1e-10;
+  params.merit_error_coeff = 1e-2;
+
+  // an iteration starting from the same point as the last one follows a penalty increase
+  int n_iterations = 0;
+  int n_new_points = 0;
+  DblVec last_x;
+  solver.addCallback([&](OptProb*, OptResults& results) {
+    ++n_iterations;
+    if (results.x != last_x)
+      ++n_new_points;
+    last_x = results.x;
+  });
+  solver.initialize({ 3, 4, 5 });
+  ASSERT_EQ(solver.optimize(), OPT_CONVERGED);
+  expectAllNear(solver.x(), { 1, 1, 2 }, .01);
+  EXPECT_GT(params.merit_error_coeff, 1e-2);
+  EXPECT_LT(n_new_points, n_iterations);
+  EXPECT_EQ(f->n_convex, n_new_points);
+}
+TEST_P(SQP, ScaledPenaltiesMatchFreshConvexification)
+{
+  // the penalties are linear in the coefficient, so scaling them is the same as convexifying at the new coefficient
+  OptProbPtr prob;
+  setupProblem(prob, 3, GetParam());
+  ConstraintFromErrFunc eq(VectorOfVector::construct(&g_FirstIsOne), prob->getVars(), VectorXd(), EQ, "g");
+  ConstraintFromErrFunc ineq(VectorOfVector::construct(&g_SecondAtMostZero), prob->getVars(), VectorXd(), INEQ, "h");
+  Model* model = prob->getModel().get();
+  DblVec x = { 3, 4, 5 };
+  std::vector<ConvexConstraintsPtr> cnts = { eq.convex(x, model), ineq.convex(x, model) };
+  std::vector<ConvexObjectivePtr> scaled = cntsToCosts(cnts, 10, model);
+  for (ConvexObjectivePtr& co : scaled)
+    exprScale(co->quad_, 100.0 / 10);
+  std::vector<ConvexObjectivePtr> fresh = cntsToCosts(cnts, 100, model);
+
+  ASSERT_EQ(scaled.size(), fresh.size());
+  for (size_t i = 0; i < fresh.size(); ++i)
+  {
+    EXPECT_EQ(scaled[i]->quad_.size(), fresh[i]->quad_.size());
+    expectAllNear(scaled[i]->quad_.affexpr.coeffs, fresh[i]->quad_.affexpr.coeffs, 1e-12);
+    EXPECT_NEAR(scaled[i]->quad_.affexpr.constant, fresh[i]->quad_.affexpr.constant, 1e-12);
+    ASSERT_EQ(scaled[i]->eqs_.size(), fresh[i]->eqs_.size());
+    for (size_t j = 0; j < fresh[i]->eqs_.size(); ++j)
+    {
+      expectAllNear(scaled[i]->eqs_[j].coeffs, fresh[i]->eqs_[j].coeffs, 1e-12);
+      EXPECT_NEAR(scaled[i]->eqs_[j].constant, fresh[i]->eqs_[j].constant, 1e-12);
+    }
+    ASSERT_EQ(scaled[i]->ineqs_.size(), fresh[i]->ineqs_.size());
+    for (size_t j = 0; j < fresh[i]->ineqs_.size(); ++j)
+    {
+      expectAllNear(scaled[i]->ineqs_[j].coeffs, fresh[i]->ineqs_[j].coeffs, 1e-12);
+      EXPECT_NEAR(scaled[i]->ineqs_[j].constant, fresh[i]->ineqs_[j].constant, 1e-12);
+    }
+  }
+  // every penalty weight is the new coefficient
+  for (double coeff : fresh[0]->quad_.affexpr.coeffs)
+    EXPECT_DOUBLE_EQ(coeff, 100);
+}
+/** @brief Cost from a function which takes a fixed time to evaluate */
+class SlowCost : public CostFromFunc
+{
+public:
+  SlowCost(ScalarOfVectorPtr f, const VarVector& vars, const std::string& name, double seconds)
+    : CostFromFunc(f, vars, name, true), seconds_(seconds)
+  {
+  }
+  double value(const DblVec& x) override
+  {
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds_));
+    return CostFromFunc::value(x);
+  }
+
+private:
+  double seconds_;
+};
+TEST_P(SQP, TimeLimit)
+{
+  OptProbPtr prob;
+  setupProblem(prob, 2, GetParam());
+  prob->addCost(CostPtr(new SlowCost(ScalarOfVector::construct(&f_DoubleWell), prob->getVars(), "well", 0.05)));
+  BasicTrustRegionSQP solver(prob);
+  BasicTrustRegionSQPParameters& params = solver.getParameters();
+  params.trust_box_size = 100;
+
+  // out of time before the first iteration, the costs of the initial point are still reported
+  params.max_time = -1;
+  DblVec x = { 0.5, 0.01 };
+  solver.initialize(x);
+  EXPECT_EQ(solver.optimize(), OPT_TIME_LIMIT);
+  EXPECT_EQ(statusToString(solver.results().status), "TIME_LIMIT");
+  EXPECT_EQ(solver.results().cost_vals.size(), 1u);
+  EXPECT_EQ(solver.results().n_qp_solves, 0);
+  expectAllNear(solver.x(), x, 1e-6);
+
+  // the first step is rejected, and the time runs out before the shrunk trust region is solved
+  params.max_time = 0.075;
+  solver.initialize(x);
+  EXPECT_EQ(solver.optimize(), OPT_TIME_LIMIT);
+  EXPECT_EQ(solver.results().n_qp_solves, 1);
+  expectAllNear(solver.x(), x, 1e-6);
+}
+/** @brief Exposes the subproblem tolerance of the optimizer */
+class InexactSQP : public BasicTrustRegionSQP
+{
+public:
+  InexactSQP(OptProbPtr prob) : BasicTrustRegionSQP(prob) {}
+  using BasicTrustRegionSQP::subproblemTolerance;
+};
+TEST_P(SQP, QuadraticNonseparableInexact)
+{
+  OptProbPtr prob;
+  setupProblem(prob, 3, GetParam());
+  prob->addCost(
+      CostPtr(new CostFromFunc(ScalarOfVector::construct(&f_QuadraticNonseparable), prob->getVars(), "f", true)));
+  InexactSQP solver(prob);
+  BasicTrustRegionSQPParameters& params = solver.getParameters();
+  EXPECT_EQ(solver.subproblemTolerance(1, 1), 0);
+
+  // loose far from convergence, tightening with the trust region and the approximate improvement
+  params.inexact_qp_solves = true;
+  EXPECT_DOUBLE_EQ(solver.subproblemTolerance(1, INFINITY), params.max_qp_tolerance);
+  EXPECT_DOUBLE_EQ(solver.subproblemTolerance(1e-2, INFINITY), 1e-3);
+  EXPECT_DOUBLE_EQ(solver.subproblemTolerance(1, 1e-2), 1e-3);
+  EXPECT_DOUBLE_EQ(solver.subproblemTolerance(1e-5, INFINITY), params.min_qp_tolerance);
+  EXPECT_DOUBLE_EQ(solver.subproblemTolerance(1, 1e-5), params.min_qp_tolerance);
+
+  params.trust_box_size = 100;
+  params.min_trust_box_size = 1e-5;
+  params.min_approx_improve = 1e-6;
+  DblVec x = { 3, 4, 5 };
+  solver.initialize(x);
+  OptStatus status = solver.optimize();
+  ASSERT_EQ(status, OPT_CONVERGED);
+  expectAllNear(solver.x(), { 1, 7, 2 }, .01);
+}
+/** @brief Cost from a function which may be convexified while it is evaluated */
+class ThreadSafeCost : public CostFromFunc
+{
+public:
+  ThreadSafeCost(ScalarOfVectorPtr f, const VarVector& vars, const std::string& name)
+    : CostFromFunc(f, vars, name, true)
+  {
+  }
+  bool isThreadSafe() const override { return true; }
+};
+TEST_P(SQP, QuadraticNonseparablePipelined)
+{
+  // accepted steps start from the convexification made during their evaluation, which should not change the solution.
+  // Only the thread safe cost is convexified on the other thread, the other one once the step is accepted.
+  std::vector<OptResults> results;
+  for (bool pipelined : { false, true })
+  {
+    OptProbPtr prob;
+    setupProblem(prob, 3, GetParam());
+    prob->addCost(
+        CostPtr(new ThreadSafeCost(ScalarOfVector::construct(&f_QuadraticNonseparable), prob->getVars(), "f")));
+    prob->addCost(
+        CostPtr(new CostFromFunc(ScalarOfVector::construct(&f_QuadraticSeparable), prob->getVars(), "g", true)));
+    EXPECT_TRUE(prob->getCosts()[0]->isThreadSafe());
+    EXPECT_FALSE(prob->getCosts()[1]->isThreadSafe());
+    BasicTrustRegionSQP solver(prob);
+    BasicTrustRegionSQPParameters& params = solver.getParameters();
+    params.trust_box_size = 100;
+    params.min_trust_box_size = 1e-5;
+    params.min_approx_improve = 1e-6;
+    params.pipelined_convexification = pipelined;
+    solver.initialize({ 3, 4, 5 });
+    ASSERT_EQ(solver.optimize(), OPT_CONVERGED);
+    results.push_back(solver.results());
+  }
+
+  expectAllNear(results[1].x, results[0].x, 1e-6);
+  expectAllNear(results[1].cost_vals, results[0].cost_vals, 1e-6);
+  EXPECT_EQ(results[1].n_func_evals, results[0].n_func_evals);
+}
+TEST_P(SQP, PipelinedRejectionsSkipSerialConvexification)
+{
+  // the first steps are rejected, which must not cost a convexification of the terms that are not thread safe
+  std::vector<OptResults> results;
+  std::vector<int> n_convex;
+  for (bool pipelined : { false, true })
+  {
+    OptProbPtr prob;
+    setupProblem(prob, 2, GetParam());
+    CountingCost* well = new CountingCost(ScalarOfVector::construct(&f_DoubleWell), prob->getVars(), "well");
+    prob->addCost(CostPtr(well));
+    prob->addCost(CostPtr(new ThreadSafeCost(ScalarOfVector::construct(&f_SmallQuadratic), prob->getVars(), "small")));
+    BasicTrustRegionSQP solver(prob);
+    BasicTrustRegionSQPParameters& params = solver.getParameters();
+    params.trust_box_size = 100;
+    params.min_trust_box_size = 1e-5;
+    params.min_approx_improve = 1e-6;
+    params.pipelined_convexification = pipelined;
+    solver.initialize({ 0.5, 0.01 });
+    ASSERT_EQ(solver.optimize(), OPT_CONVERGED);
+    results.push_back(solver.results());
+    n_convex.push_back(well->n_convex);
+  }
+
+  expectAllNear(results[1].x, results[0].x, 1e-6);
+  EXPECT_EQ(results[1].n_func_evals, results[0].n_func_evals);
+  EXPECT_GT(results[0].n_func_evals, n_convex[0]);
+  EXPECT_EQ(n_convex[1], n_convex[0]);
+}
+TEST_P(SQP, QuadraticNonseparablePerBlockTrustRegion)
+{
+  OptProbPtr prob;
+  setupProblem(prob, 3, GetParam());
+  prob->setTrustRegionBlocks({ 0, 1, 1 });
+  prob->addCost(
+      CostPtr(new CostFromFunc(ScalarOfVector::construct(&f_QuadraticNonseparable), prob->getVars(), "f", true)));
+  BasicTrustRegionSQP solver(prob);
+  BasicTrustRegionSQPParameters& params = solver.getParameters();
+  params.min_trust_box_size = 1e-5;
+  params.min_approx_improve = 1e-6;
+  params.per_block_trust_region = true;
+  DblVec x = { 3, 4, 5 };
+  solver.initialize(x);
+  OptStatus status = solver.optimize();
+  ASSERT_EQ(status, OPT_CONVERGED);
+  expectAllNear(solver.x(), { 1, 7, 2 }, .01);
+}
 
 void testProblem(ScalarOfVectorPtr f,
                  VectorOfVectorPtr g,
@@ -1,11 +1,14 @@
 #include <trajopt_utils/macros.h>
 TRAJOPT_IGNORE_WARNINGS_PUSH
+#include <algorithm>
 #include <cstdio>
 #include <gtest/gtest.h>
 #include <iostream>
 TRAJOPT_IGNORE_WARNINGS_POP
 
+#include <trajopt_sco/autotuned_interface.hpp>
 #include <trajopt_sco/expr_ops.hpp>
+#include <trajopt_sco/modeling.hpp>
 #include <trajopt_sco/solver_interface.hpp>
 #include <trajopt_utils/logging.hpp>
 #include <trajopt_utils/stl_to_string.hpp>
@@ -241,4 +244,171 @@ TEST_P(SolverInterface, ExprMult_test3)
   EXPECT_NEAR(aff12.value(soln), answer, 1e-6);
 }
 
+/**
+ * Solves the same problem repeatedly through AUTO_TUNED. With several backends built the model tries every backend
+ * and then settles, with a single backend AUTO_TUNED is that backend.
+ */
+TEST(SolverInterface, auto_tuned)
+{
+  for (int trial = 0; trial < 10; ++trial)
+  {
+    ModelPtr solver = createModel(ModelType::AUTO_TUNED);
+    VarVector vars;
+    for (int i = 0; i < 3; ++i)
+      vars.push_back(solver->addVar("v" + std::to_string(i), 0, 10));
+    solver->update();
+
+    AffExpr aff;
+    for (const Var& var : vars)
+      exprInc(aff, var);
+    aff.constant -= 3;
+    solver->setObjective(exprSquare(aff));
+    Cnt cnt = solver->addEqCnt(AffExpr(vars[0]), "");
+    solver->update();
+
+    EXPECT_EQ(solver->optimize(), CVX_SOLVED);
+    DblVec soln = solver->getVarValues(vars);
+    EXPECT_NEAR(aff.value(soln), 0, 1e-6);
+    EXPECT_NEAR(soln[0], 0, 1e-6);
+
+    // Changes after a solve are carried over to the backend
+    solver->removeCnt(cnt);
+    solver->addEqCnt(exprSub(AffExpr(vars[1]), 1), "");
+    solver->update();
+    EXPECT_EQ(solver->optimize(), CVX_SOLVED);
+    EXPECT_NEAR(solver->getVarValue(vars[1]), 1, 1e-6);
+  }
+}
+
+/** The tuner tries every candidate, then prefers the fastest reliable one and falls back to the most reliable */
+TEST(SolverInterface, autotuner_statistics)
+{
+  SolverAutotuner& tuner = SolverAutotuner::instance();
+  double explore_rate = tuner.explore_rate;
+  tuner.explore_rate = 0;
+
+  // The statistics only depend on the backend types, so this does not need both backends to be built
+  const std::string signature = "autotuner_statistics_test";
+  std::vector<ModelType> candidates = { ModelType::OSQP, ModelType::QPOASES };
+  for (int i = 0; i < tuner.min_trials; ++i)
+  {
+    EXPECT_EQ(tuner.select(signature, candidates), ModelType::OSQP);
+    tuner.record(signature, ModelType::OSQP, 2.0, true);
+  }
+  for (int i = 0; i < tuner.min_trials; ++i)
+  {
+    EXPECT_EQ(tuner.select(signature, candidates), ModelType::QPOASES);
+    tuner.record(signature, ModelType::QPOASES, 1.0, true);
+  }
+  EXPECT_EQ(tuner.select(signature, candidates), ModelType::QPOASES);
+  EXPECT_EQ(tuner.best(signature, candidates, { ModelType::QPOASES }), ModelType::OSQP);
+  EXPECT_EQ(tuner.best(signature, candidates, candidates), ModelType::AUTO_SOLVER);
+
+  // Failures lower the success rate but not the mean time, an unreliable backend is not chosen for its speed
+  tuner.record(signature, ModelType::QPOASES, 0.5, false);
+  SolverAutotuner::SignatureStats stats = tuner.stats(signature);
+  EXPECT_EQ(stats[ModelType::QPOASES].trials, tuner.min_trials + 1);
+  EXPECT_EQ(stats[ModelType::QPOASES].successes, tuner.min_trials);
+  EXPECT_DOUBLE_EQ(stats[ModelType::QPOASES].mean_time, 1.0);
+  EXPECT_NEAR(stats[ModelType::QPOASES].success_rate, 2.0 / 3.0, 1e-12);
+  EXPECT_EQ(tuner.select(signature, candidates), ModelType::OSQP);
+
+  // Without a reliable backend the most reliable one is used
+  tuner.record(signature, ModelType::OSQP, 2.0, false);
+  tuner.record(signature, ModelType::OSQP, 2.0, false);
+  EXPECT_LT(tuner.stats(signature)[ModelType::OSQP].success_rate, 2.0 / 3.0);
+  EXPECT_EQ(tuner.best(signature, candidates), ModelType::QPOASES);
+
+  tuner.explore_rate = explore_rate;
+}
+
+/** AutoTunedModel with an explicit candidate list, which exercises it even when only one backend is built */
+TEST(SolverInterface, auto_tuned_model)
+{
+  std::vector<ModelType> candidates = availableSolvers();
+  std::shared_ptr<AutoTunedModel> tuned(new AutoTunedModel(candidates));
+  ModelPtr model = tuned;
+  VarVector vars;
+  for (int i = 0; i < 3; ++i)
+    vars.push_back(model->addVar("v" + std::to_string(i), 0, 10));
+  model->update();
+
+  AffExpr aff;
+  for (const Var& var : vars)
+    exprInc(aff, var);
+  aff.constant -= 3;
+  model->setObjective(exprSquare(aff));
+  Cnt cnt = model->addEqCnt(AffExpr(vars[0]), "");
+  model->update();
+
+  std::string signature = tuned->signature();
+  SolverAutotuner::SignatureStats before = SolverAutotuner::instance().stats(signature);
+  ASSERT_EQ(model->optimize(), CVX_SOLVED);
+  EXPECT_NE(std::find(candidates.begin(), candidates.end(), tuned->backend()), candidates.end());
+  EXPECT_EQ(SolverAutotuner::instance().stats(signature)[tuned->backend()].trials,
+            before[tuned->backend()].trials + 1);
+  DblVec soln = model->getVarValues(vars);
+  EXPECT_NEAR(aff.value(soln), 0, 1e-6);
+  EXPECT_NEAR(soln[0], 0, 1e-6);
+
+  // A clone is built from the mirrored problem on its first solve
+  ModelPtr copy = model->clone();
+  ASSERT_EQ(copy->optimize(), CVX_SOLVED);
+  VarVector copy_vars = copy->getVars();
+  ASSERT_EQ(copy_vars.size(), vars.size());
+  for (size_t i = 0; i < vars.size(); ++i)
+    EXPECT_NEAR(copy->getVarValue(copy_vars[i]), soln[i], 1e-6);
+
+  // Changes after a solve are carried over to the backend
+  model->removeCnt(cnt);
+  model->addEqCnt(exprSub(AffExpr(vars[1]), 1), "");
+  model->setVarBounds(VarVector{ vars[2] }, DblVec{ 0 }, DblVec{ 0.5 });
+  model->update();
+  ASSERT_EQ(model->optimize(), CVX_SOLVED);
+  soln = model->getVarValues(vars);
+  EXPECT_NEAR(soln[1], 1, 1e-6);
+  EXPECT_LE(soln[2], 0.5 + 1e-6);
+  EXPECT_NEAR(aff.value(soln), 0, 1e-6);
+}
+
+/** The assembled evaluation must match evaluating every convex term on its own */
+TEST_P(SolverInterface, convex_model_evaluator)
+{
+  ModelPtr solver = createModel(GetParam());
+  VarVector vars;
+  for (int i = 0; i < 4; ++i)
+    vars.push_back(solver->addVar("v" + std::to_string(i)));
+  solver->update();
+
+  std::vector<ConvexObjectivePtr> costs;
+  costs.push_back(ConvexObjectivePtr(new ConvexObjective(solver.get())));
+  costs.back()->addQuadExpr(exprSquare(exprAdd(AffExpr(vars[0]), -1)));
+  costs.back()->addLeastSquares(exprSub(AffExpr(vars[1]), AffExpr(vars[2])), 2);
+  costs.push_back(ConvexObjectivePtr(new ConvexObjective(solver.get())));
+  costs.back()->addHinge(exprAdd(AffExpr(vars[3]), 0.5), 3);
+  costs.back()->addAbs(AffExpr(vars[2]), 0.5);
+  costs.back()->addAffExpr(exprMult(AffExpr(vars[1]), 4));
+
+  std::vector<ConvexConstraintsPtr> cnts;
+  cnts.push_back(ConvexConstraintsPtr(new ConvexConstraints(solver.get())));
+  cnts.back()->addEqCnt(exprSub(AffExpr(vars[0]), AffExpr(vars[3])));
+  cnts.back()->addIneqCnt(exprAdd(AffExpr(vars[1]), -0.25));
+  cnts.push_back(ConvexConstraintsPtr(new ConvexConstraints(solver.get())));
+  solver->update();
+
+  ConvexModelEvaluator evaluator(costs, cnts);
+  DblVec x(solver->getVars().size());
+  for (size_t i = 0; i < x.size(); ++i)
+    x[i] = 0.3 * static_cast<double>(i) - 0.7;
+
+  DblVec cost_vals, cnt_viols;
+  evaluator.evaluate(x, cost_vals, cnt_viols);
+  ASSERT_EQ(cost_vals.size(), costs.size());
+  ASSERT_EQ(cnt_viols.size(), cnts.size());
+  for (size_t i = 0; i < costs.size(); ++i)
+    EXPECT_NEAR(cost_vals[i], costs[i]->value(x), 1e-12);
+  for (size_t i = 0; i < cnts.size(); ++i)
+    EXPECT_NEAR(cnt_viols[i], cnts[i]->violation(x), 1e-12);
+}
+
 INSTANTIATE_TEST_CASE_P(AllSolvers, SolverInterface, testing::ValuesIn(availableSolvers()));
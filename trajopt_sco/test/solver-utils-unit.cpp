@@ -135,6 +135,54 @@ TEST(solver_utils, exprToEigen)
   EXPECT_EQ(m_Q.nonZeros(), 2) << "m_Q.nonZeros() != 2" << std::endl;
 }
 
+TEST(solver_utils, leastSquaresToEigen)
+{
+  int n_vars = 3;
+  std::vector<VarRepPtr> x_info;
+  VarVector x;
+  for (int i = 0; i < n_vars; ++i)
+  {
+    std::stringstream var_name;
+    var_name << "x_" << i;
+    VarRepPtr x_el(new VarRep(i, var_name.str(), nullptr));
+    x_info.push_back(x_el);
+    x.push_back(Var(x_el.get()));
+  }
+
+  // lsq = 2 * ([3, 2, 0]*x + 1)^2 + 1 * ([0, 1, 1]*x - 2)^2
+  AffExpr row0;
+  row0.vars = VarVector{ x[0], x[1] };
+  row0.coeffs = DblVec{ 3, 2 };
+  row0.constant = 1;
+  AffExpr row1;
+  row1.vars = VarVector{ x[1], x[2] };
+  row1.coeffs = DblVec{ 1, 1 };
+  row1.constant = -2;
+  LeastSquaresExpr lsq;
+  lsq.exprs = AffExprVector{ row0, row1 };
+  lsq.weights = DblVec{ 2, 1 };
+
+  // the result should match squaring each row
+  QuadExpr expanded = exprMult(exprSquare(row0), 2);
+  exprInc(expanded, exprSquare(row1));
+  Eigen::SparseMatrix<double> m_Q_expected;
+  Eigen::VectorXd v_q_expected;
+  exprToEigen(expanded, m_Q_expected, v_q_expected, n_vars, true);
+
+  Eigen::SparseMatrix<double> m_Q;
+  Eigen::VectorXd v_q;
+  exprToEigen(lsq, m_Q, v_q, n_vars);
+  EXPECT_TRUE(m_Q.isApprox(m_Q_expected)) << "error converting lsq to "
+                                          << "Eigen::SparseMatrix. m_Q :" << std::endl
+                                          << m_Q << std::endl;
+  EXPECT_TRUE(v_q.isApprox(v_q_expected)) << "v_q_expected != v_q" << std::endl
+                                          << "v_q:" << std::endl
+                                          << v_q << std::endl;
+
+  DblVec x_val{ 1, -1, 0.5 };
+  EXPECT_NEAR(lsq.value(x_val), expanded.value(x_val), 1e-12);
+}
+
 TEST(solver_utils, eigenToTriplets)
 {
   Eigen::MatrixXd m_Q(2, 2);